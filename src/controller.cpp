@@ -230,6 +230,18 @@ SIPConfig uvgCommController::createSIPConfig()
 }
 
 
+SIPConnectionType uvgCommController::sipConnectionType()
+{
+  // TLS has not been implemented for outgoing connections
+  if (settingString(SettingsKey::sipSIPProtocol) == "UDP")
+  {
+    return SIP_UDP;
+  }
+
+  return SIP_TCP;
+}
+
+
 void uvgCommController::quit()
 {
   uninit();
@@ -247,7 +259,7 @@ uint32_t uvgCommController::startINVITETransaction(QString name, QString usernam
   waitingToStart_[qIP.toString()] = {name, username, sessionID};
 
   // try connecting, if returns immediately or we already have a connection, create Dialog
-  if (sip_.connect(SIP_TCP, ip, 5060))
+  if (sip_.connect(sipConnectionType(), ip, 5060))
   {
     waitingToStart_.erase(ip);
     createSIPDialog(name, username, ip, sessionID);
@@ -418,7 +430,7 @@ void uvgCommController::updateCallSettings()
     QString serverAddress = config.sipServerAddress;
     waitingToBind_.push_back(serverAddress);
 
-    if(sip_.connect(SIP_TCP, serverAddress, config.sipServerPort))
+    if(sip_.connect(sipConnectionType(), serverAddress, config.sipServerPort))
     {
       waitingToBind_.removeAll(serverAddress);
       sip_.bindingAtRegistrar(serverAddress);
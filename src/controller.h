@@ -91,6 +91,9 @@ private:
 
   SIPConfig createSIPConfig();
 
+  // the protocol used to reach peers and our SIP server
+  SIPConnectionType sipConnectionType();
+
   void createCall(uint32_t sessionID);
 
   void updateSDPAudioStatus(std::shared_ptr<SDPMessageInfo> sdp);
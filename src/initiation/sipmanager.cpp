@@ -9,9 +9,11 @@
 #include "initiation/transaction/sipclient.h"
 #include "initiation/transaction/sipdialogstate.h"
 #include "initiation/transaction/sipallow.h"
+#include "initiation/transaction/sipretransmissions.h"
 
 #include "initiation/transport/siprouting.h"
 #include "initiation/transport/tcpconnection.h"
+#include "initiation/transport/udpconnection.h"
 #include "initiation/transport/sipauthentication.h"
 #include "initiation/transport/siptransport.h"
 
@@ -38,10 +40,15 @@ const int REGISTER_SEND_PERIOD = (REGISTER_INTERVAL - 5)*1000;
 const int MIN_RANDOM_DELAY_MS = 25;
 const int MAX_RANDOM_DELAY_MS = 75;
 
+// 64*T1, so the transactions of a transport have ended before it is checked
+const int TRANSPORT_CHECK_INTERVAL_MS = 32000;
+
 
 SIPManager::SIPManager():
   tcpServer_(),
+  udpServer_(),
   transports_(),
+  transportTimer_(),
   nextSessionID_(FIRSTSESSIONID),
   dialogs_(),
   ourSDP_(nullptr),
@@ -53,6 +60,9 @@ SIPManager::SIPManager():
   QObject::connect(&delayTimer_, &QTimer::timeout,
                    this, &SIPManager::delayedMessage);
 
+  QObject::connect(&transportTimer_, &QTimer::timeout,
+                   this,             &SIPManager::removeEndedTransports);
+
   cname_ = CName::cname();
 }
 
@@ -135,27 +145,19 @@ void SIPManager::uninit()
 
   registrations_.clear();
 
+  transportTimer_.stop();
+
   for(auto& transport : transports_)
   {
     if(transport.second != nullptr)
     {
-      if (transport.second->connection != nullptr)
-      {
-
-        transport.second->connection->exit(0); // stops qthread
-        transport.second->connection->stopConnection(); // exits run loop
-        while(transport.second->connection->isRunning())
-        {
-          std::this_thread::sleep_for(std::chrono::milliseconds(5));
-        }
-        transport.second->connection.reset();
-      }
-      transport.second->pipe.uninit();
+      destroyTransport(transport.second);
       transport.second.reset();
     }
   }
 
   transports_.clear();
+  udpServer_.close();
 
   for(auto& dialog : dialogs_)
   {
@@ -163,6 +165,8 @@ void SIPManager::uninit()
   }
 
   dialogs_.clear();
+  callIDIndex_.clear();
+  inviteIndex_.clear();
   sdpConf_->uninit();
   nextSessionID_ = FIRSTSESSIONID;
 }
@@ -255,6 +259,16 @@ bool SIPManager::listenToAny(SIPConnectionType type, uint16_t port)
 
     return tcpServer_.listen(QHostAddress::Any, port);
   }
+  else if (type == SIP_UDP)
+  {
+    QObject::connect(&udpServer_, &UDPServer::newConnection,
+                     this, &SIPManager::receiveUDPConnection, Qt::UniqueConnection);
+
+    Logger::getLogger()->printNormal(this, "Listening to SIP UDP messages",
+                                     "Port", QString::number(port));
+
+    return udpServer_.listen(port);
+  }
   else
   {
     Logger::getLogger()->printUnimplemented(this, "Unimplemented SIP connection type");
@@ -268,16 +282,21 @@ bool SIPManager::connect(SIPConnectionType type, QString address, uint16_t port)
 {
   if (transports_.find(address) == transports_.end())
   {
-    std::shared_ptr<TCPConnection> connection =
-        std::shared_ptr<TCPConnection>(new TCPConnection());
-    createSIPTransport(address, createConnection(type, address, port));
-  }
-  else
-  {
-    return true;
+    std::shared_ptr<SIPConnection> connection = createConnection(type, address, port);
+
+    if (connection == nullptr)
+    {
+      return false;
+    }
+
+    createSIPTransport(address, connection);
+
+    // UDP has no handshake, so the transport can be used right away unless
+    // the host name is still being resolved
+    return type == SIP_UDP && connection->waitUntilConnected();
   }
 
-  return false;
+  return true;
 }
 
 
@@ -475,6 +494,33 @@ void SIPManager::receiveTCPConnection(std::shared_ptr<TCPConnection> con)
 }
 
 
+void SIPManager::receiveUDPConnection(std::shared_ptr<UDPConnection> con)
+{
+  Logger::getLogger()->printNormal(this, "Received a SIP message from a new UDP peer.");
+  Q_ASSERT(con);
+
+  // Transports are per address, so a peer sending from another port shares
+  // the transport we already have with it. The connection is kept with the
+  // transport so its messages keep arriving.
+  auto existing = transports_.find(con->remoteAddress());
+  if (existing != transports_.end() && existing->second->connection != con)
+  {
+    Logger::getLogger()->printNormal(this, "Peer sends from another port, using its existing transport",
+                                     {"Peer"}, {con->remoteAddress() + ":" +
+                                                QString::number(con->remotePort())});
+
+    QObject::connect(con.get(),                         &UDPConnection::messageAvailable,
+                     existing->second->transport.get(), &SIPTransport::networkPackage);
+
+    existing->second->otherConnections.push_back(con);
+    con->allowReceiving();
+    return;
+  }
+
+  createSIPTransport(con->remoteAddress(), con);
+}
+
+
 void SIPManager::transportRequest(SIPRequest &request, QVariant& content)
 {
   Logger::getLogger()->printNormal(this, "Initiate sending of a dialog request");
@@ -565,6 +611,7 @@ void SIPManager::processSIPRequest(SIPRequest& request, QVariant& content,
                                  localAddress);
 
       createDialog(sessionID, local, request.message->from.address, localAddress, false);
+      indexDialog(sessionID, request.message->callID);
     }
     else if (request.method == SIP_CANCEL && identifyCANCELSession(request, sessionID))
     {
@@ -585,6 +632,11 @@ void SIPManager::processSIPRequest(SIPRequest& request, QVariant& content,
   // find the dialog which corresponds to the callID and tags received in request
   std::shared_ptr<DialogInstance> foundDialog = getDialog(sessionID);
 
+  if (request.method == SIP_INVITE)
+  {
+    indexINVITE(sessionID, request);
+  }
+
   foundDialog->pipe.processIncomingRequest(request, content, generatedResponse);
 
   if(foundDialog->server->shouldBeDestroyed())
@@ -659,15 +711,18 @@ bool SIPManager::identifySession(SIPRequest& request,
 
   out_sessionID = 0;
 
-  for (auto i = dialogs_.begin(); i != dialogs_.end(); ++i)
+  auto candidates = callIDIndex_.equal_range(request.message->callID);
+  for (auto i = candidates.first; i != candidates.second; ++i)
   {
-    if (i->second != nullptr &&
-        i->second->state->correctRequestDialog(request.message->callID,
-                                               request.message->to.tagParameter,
-                                               request.message->from.tagParameter))
+    std::shared_ptr<DialogInstance> dialog = getDialog(i->second);
+
+    if (dialog != nullptr &&
+        dialog->state->correctRequestDialog(request.message->callID,
+                                            request.message->to.tagParameter,
+                                            request.message->from.tagParameter))
     {
       Logger::getLogger()->printNormal(this, "Found matching dialog for incoming request.");
-      out_sessionID = i->first;
+      out_sessionID = i->second;
       return true;
     }
   }
@@ -682,15 +737,18 @@ bool SIPManager::identifySession(SIPResponse &response, uint32_t& out_sessionID)
 
   out_sessionID = 0;
   // find the dialog which corresponds to the callID and tags received in response
-  for (auto i = dialogs_.begin(); i != dialogs_.end(); ++i)
+  auto candidates = callIDIndex_.equal_range(response.message->callID);
+  for (auto i = candidates.first; i != candidates.second; ++i)
   {
-    if (i->second != nullptr &&
-        i->second->state->correctResponseDialog(response.message->callID,
-                                                response.message->to.tagParameter,
-                                                response.message->from.tagParameter))
+    std::shared_ptr<DialogInstance> dialog = getDialog(i->second);
+
+    if (dialog != nullptr &&
+        dialog->state->correctResponseDialog(response.message->callID,
+                                             response.message->to.tagParameter,
+                                             response.message->from.tagParameter))
     {
       Logger::getLogger()->printNormal(this, "Found matching dialog for incoming response");
-      out_sessionID = i->first;
+      out_sessionID = i->second;
       return true;
     }
   }
@@ -702,14 +760,18 @@ bool SIPManager::identifySession(SIPResponse &response, uint32_t& out_sessionID)
 bool SIPManager::identifyCANCELSession(SIPRequest &request, uint32_t& out_sessionID)
 {
   out_sessionID = 0;
+
   // find the request which is being cancelled
-  for (auto i = dialogs_.begin(); i != dialogs_.end(); ++i)
+  auto invite = inviteIndex_.find(transactionKey(request));
+  if (invite != inviteIndex_.end())
   {
-    if (i->second != nullptr &&
-        i->second->server->doesCANCELMatchRequest(request))
+    std::shared_ptr<DialogInstance> dialog = getDialog(invite->second);
+
+    if (dialog != nullptr &&
+        dialog->server->doesCANCELMatchRequest(request))
     {
       Logger::getLogger()->printNormal(this, "Found matching request for cancellation");
-      out_sessionID = i->first;
+      out_sessionID = invite->second;
       return true;
     }
   }
@@ -797,7 +859,7 @@ std::shared_ptr<TransportInstance> SIPManager::getTransport(QString& address) co
 }
 
 
-void SIPManager::createSIPTransport(QString remoteAddress, std::shared_ptr<TCPConnection> connection)
+void SIPManager::createSIPTransport(QString remoteAddress, std::shared_ptr<SIPConnection> connection)
 {
   /* SIP is divided to transport and transaction layers. Here we construct the transport
    * layer for one connection (either to proxy or to peer) which is used by one or more
@@ -818,7 +880,8 @@ void SIPManager::createSIPTransport(QString remoteAddress, std::shared_ptr<TCPCo
     instance->connection = connection;
 
     std::shared_ptr<SIPTransport> transport =
-        std::shared_ptr<SIPTransport>(new SIPTransport(stats_));
+        std::shared_ptr<SIPTransport>(new SIPTransport(stats_, connection->transportProtocol()));
+    instance->transport = transport;
 
     std::shared_ptr<SIPRouting> routing =
         std::shared_ptr<SIPRouting> (new SIPRouting(instance->connection));
@@ -826,16 +889,38 @@ void SIPManager::createSIPTransport(QString remoteAddress, std::shared_ptr<TCPCo
     std::shared_ptr<SIPAuthentication> authentication =
         std::shared_ptr<SIPAuthentication> (new SIPAuthentication());
 
-    // get those network messages to transport
-    QObject::connect(connection.get(), &TCPConnection::messageAvailable,
-                     transport.get(),  &SIPTransport::networkPackage);
+    std::shared_ptr<TCPConnection> tcp = std::dynamic_pointer_cast<TCPConnection>(connection);
+    std::shared_ptr<UDPConnection> udp = std::dynamic_pointer_cast<UDPConnection>(connection);
+
+    if (tcp != nullptr)
+    {
+      // get those network messages to transport
+      QObject::connect(tcp.get(),       &TCPConnection::messageAvailable,
+                       transport.get(), &SIPTransport::networkPackage);
 
-    // get those network messages to transport
-    QObject::connect(transport.get(),             &SIPTransport::sendMessage,
-                     instance->connection.get(),  &TCPConnection::sendPacket);
+      // get those network messages to transport
+      QObject::connect(transport.get(), &SIPTransport::sendMessage,
+                       tcp.get(),       &TCPConnection::sendPacket);
+    }
+    else if (udp != nullptr)
+    {
+      QObject::connect(udp.get(),       &UDPConnection::messageAvailable,
+                       transport.get(), &SIPTransport::networkPackage);
+
+      QObject::connect(transport.get(), &SIPTransport::sendMessage,
+                       udp.get(),       &UDPConnection::sendPacket);
+    }
 
     // remember that the processors are always added from outgoing to incoming
     instance->pipe.addProcessor(transport);
+
+    // datagrams may be lost, so they are sent again until answered
+    if (udp != nullptr)
+    {
+      instance->retransmissions = std::shared_ptr<SIPRetransmissions>(new SIPRetransmissions);
+      instance->pipe.addProcessor(instance->retransmissions);
+    }
+
     instance->pipe.addProcessor(authentication);
     instance->pipe.addProcessor(routing);
 
@@ -844,6 +929,11 @@ void SIPManager::createSIPTransport(QString remoteAddress, std::shared_ptr<TCPCo
 
     QObject::connect(&instance->pipe, &SIPMessageFlow::incomingResponse,
                      this,            &SIPManager::processSIPResponse);
+
+    if (!transportTimer_.isActive())
+    {
+      transportTimer_.start(TRANSPORT_CHECK_INTERVAL_MS);
+    }
   }
   else
   {
@@ -856,7 +946,99 @@ void SIPManager::createSIPTransport(QString remoteAddress, std::shared_ptr<TCPCo
 }
 
 
-std::shared_ptr<TCPConnection> SIPManager::createConnection(SIPConnectionType type, QString address, uint16_t port)
+void SIPManager::removeEndedTransports()
+{
+  for (auto it = transports_.begin(); it != transports_.end();)
+  {
+    if (it->second != nullptr && !transportEnded(it->first, it->second))
+    {
+      ++it;
+      continue;
+    }
+
+    Logger::getLogger()->printNormal(this, "Removing SIP transport that is no longer used",
+                                     {"Address"}, {it->first});
+
+    if (it->second != nullptr)
+    {
+      destroyTransport(it->second);
+    }
+
+    it = transports_.erase(it);
+  }
+
+  if (transports_.empty())
+  {
+    transportTimer_.stop();
+  }
+}
+
+
+bool SIPManager::transportEnded(const QString& remoteAddress,
+                                std::shared_ptr<TransportInstance> transport) const
+{
+  if (registrations_.find(remoteAddress) != registrations_.end())
+  {
+    return false;
+  }
+
+  // the requests and responses of a dialog are sent to the host of its remote URI
+  QHostAddress transportHost(remoteAddress);
+  for (auto& dialog : dialogs_)
+  {
+    if (dialog.second == nullptr)
+    {
+      continue;
+    }
+
+    QString dialogHost = dialog.second->state->getRemoteHost();
+    if (dialogHost == remoteAddress ||
+        (!transportHost.isNull() &&
+         transportHost.isEqual(QHostAddress(dialogHost), QHostAddress::TolerantConversion)))
+    {
+      return false;
+    }
+  }
+
+  if (transport->retransmissions != nullptr && transport->retransmissions->hasTransactions())
+  {
+    return false;
+  }
+
+  if (!transport->connection->hasEnded())
+  {
+    return false;
+  }
+
+  for (auto& connection : transport->otherConnections)
+  {
+    if (!connection->hasEnded())
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+void SIPManager::destroyTransport(std::shared_ptr<TransportInstance> transport)
+{
+  std::shared_ptr<TCPConnection> tcp =
+      std::dynamic_pointer_cast<TCPConnection>(transport->connection);
+
+  if (tcp != nullptr)
+  {
+    tcp->stopConnection();
+  }
+
+  transport->connection.reset();
+  transport->otherConnections.clear();
+  transport->pipe.uninit();
+}
+
+
+std::shared_ptr<SIPConnection> SIPManager::createConnection(SIPConnectionType type, QString address, uint16_t port)
 {
   if (type == SIP_TCP)
   {
@@ -870,9 +1052,21 @@ std::shared_ptr<TCPConnection> SIPManager::createConnection(SIPConnectionType ty
     connection->establishConnection(address, port);
     return connection;
   }
+  else if (type == SIP_UDP)
+  {
+    std::shared_ptr<UDPConnection> connection = udpServer_.getConnection(address, port);
+
+    // informs us when a host name has been resolved
+    if (connection != nullptr)
+    {
+      QObject::connect(connection.get(), &UDPConnection::socketConnected,
+                       this,             &SIPManager::connectionEstablished);
+    }
+    return connection;
+  }
   else
   {
-    Logger::getLogger()->printUnimplemented(this, "Non-TCP connection in transport creation");
+    Logger::getLogger()->printUnimplemented(this, "Unimplemented connection type in transport creation");
   }
   return nullptr;
 }
@@ -1002,6 +1196,12 @@ void SIPManager::createDialog(uint32_t sessionID, NameAddr &local,
   dialog->state = std::shared_ptr<SIPDialogState> (new SIPDialogState);
   dialog->state->init(local, remote, ourDialog);
 
+  // the Call-ID of their dialog is known once their INVITE is processed
+  if (ourDialog)
+  {
+    indexDialog(sessionID, dialog->state->getCallID());
+  }
+
   // Add all components to the pipe.
   dialog->pipe.addProcessor(std::shared_ptr<SIPAllow>(new SIPAllow));
   dialog->pipe.addProcessor(dialog->state);
@@ -1024,12 +1224,17 @@ void SIPManager::createDialog(uint32_t sessionID, NameAddr &local,
 
 void SIPManager::removeDialog(uint32_t sessionID)
 {
-  if (dialogs_.find(sessionID) != dialogs_.end())
+  if (dialogs_.find(sessionID) == dialogs_.end())
   {
-    getDialog(sessionID)->pipe.uninit();
+    Logger::getLogger()->printProgramError(this, "Tried to remove a non-existing dialog",
+                                           "SessionID", QString::number(sessionID));
+    return;
   }
 
-  dialogs_.erase(dialogs_.find(sessionID));
+  unindexDialog(sessionID);
+  getDialog(sessionID)->pipe.uninit();
+
+  dialogs_.erase(sessionID);
   if (dialogs_.empty())
   {
     nextSessionID_ = FIRSTSESSIONID;
@@ -1039,6 +1244,79 @@ void SIPManager::removeDialog(uint32_t sessionID)
 }
 
 
+void SIPManager::indexDialog(uint32_t sessionID, QString callID)
+{
+  std::shared_ptr<DialogInstance> dialog = getDialog(sessionID);
+
+  if (dialog == nullptr || callID.isEmpty())
+  {
+    Logger::getLogger()->printProgramError(this, "Could not index dialog",
+                                           "SessionID", QString::number(sessionID));
+    return;
+  }
+
+  dialog->indexedCallID = callID;
+  callIDIndex_.insert({callID, sessionID});
+}
+
+
+void SIPManager::indexINVITE(uint32_t sessionID, SIPRequest& request)
+{
+  std::shared_ptr<DialogInstance> dialog = getDialog(sessionID);
+  QString key = transactionKey(request);
+
+  if (dialog == nullptr || key.isEmpty())
+  {
+    return;
+  }
+
+  // only the latest INVITE of the dialog can be cancelled
+  if (!dialog->indexedInvite.isEmpty())
+  {
+    inviteIndex_.erase(dialog->indexedInvite);
+  }
+
+  dialog->indexedInvite = key;
+  inviteIndex_[key] = sessionID;
+}
+
+
+QString SIPManager::transactionKey(SIPRequest& request) const
+{
+  // see section 17.2.3 of RFC 3261
+  if (request.message->vias.empty() ||
+      request.message->vias.first().branch.isEmpty())
+  {
+    return "";
+  }
+
+  const ViaField& via = request.message->vias.first();
+  return via.branch + ";" + via.sentBy + ":" + QString::number(via.port);
+}
+
+
+void SIPManager::unindexDialog(uint32_t sessionID)
+{
+  std::shared_ptr<DialogInstance> dialog = getDialog(sessionID);
+
+  auto candidates = callIDIndex_.equal_range(dialog->indexedCallID);
+  for (auto i = candidates.first; i != candidates.second; ++i)
+  {
+    if (i->second == sessionID)
+    {
+      callIDIndex_.erase(i);
+      break;
+    }
+  }
+
+  auto invite = inviteIndex_.find(dialog->indexedInvite);
+  if (invite != inviteIndex_.end() && invite->second == sessionID)
+  {
+    inviteIndex_.erase(invite);
+  }
+}
+
+
 void SIPManager::installSIPRequestCallback(std::function<void(uint32_t sessionID,
                                                               SIPRequest& request,
                                                               QVariant& content)> callback)
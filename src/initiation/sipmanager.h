@@ -1,6 +1,7 @@
 #pragma once
 
 #include "initiation/transport/connectionserver.h"
+#include "initiation/transport/udpserver.h"
 
 #include "initiation/transaction/sipcallbacks.h"
 
@@ -11,6 +12,7 @@
 #include <QHostAddress>
 #include <QList>
 #include <map>
+#include <unordered_map>
 
 #include <functional>
 #include <queue>
@@ -18,6 +20,9 @@
 class SIPServer;
 class SIPClient;
 class SDPNegotiation;
+class SIPConnection;
+class SIPTransport;
+class SIPRetransmissions;
 
 // The components specific to one dialog
 struct DialogInstance
@@ -30,6 +35,10 @@ struct DialogInstance
   std::shared_ptr<SDPNegotiation> sdp; // for sending requests
 
   std::shared_ptr<SIPCallbacks> callbacks;
+
+  // the keys this dialog has in the lookup indexes of SIPManager
+  QString indexedCallID;
+  QString indexedInvite;
 };
 
 // Components specific to one registration
@@ -48,8 +57,14 @@ struct RegistrationInstance
 // Components specific to one transport connection
 struct TransportInstance
 {
-  std::shared_ptr<TCPConnection> connection;
+  std::shared_ptr<SIPConnection> connection;
   SIPMessageFlow pipe;
+
+  std::shared_ptr<SIPTransport> transport;
+  std::shared_ptr<SIPRetransmissions> retransmissions; // only with UDP
+
+  // UDP connections of the same peer sending from other ports
+  std::vector<std::shared_ptr<SIPConnection>> otherConnections;
 };
 
 class StatisticsInterface;
@@ -197,6 +212,10 @@ private slots:
 
   // somebody established a TCP connection with us
   void receiveTCPConnection(std::shared_ptr<TCPConnection> con);
+
+  // a new peer sent us a SIP message over UDP
+  void receiveUDPConnection(std::shared_ptr<UDPConnection> con);
+
   // our outbound TCP connection was established.
 
   // send the SIP message to a SIP User agent with transport layer. Attaches SDP message if needed.
@@ -211,6 +230,9 @@ private slots:
 
   void delayedMessage();
 
+  // removes the transports no registration, dialog or connection needs
+  void removeEndedTransports();
+
 private:
 
   std::shared_ptr<DialogInstance> getDialog(uint32_t sessionID) const;
@@ -233,7 +255,11 @@ private:
 
   // helper function which handles all steps related to creation of new transport
   void createSIPTransport(QString remoteAddress,
-                          std::shared_ptr<TCPConnection> connection);
+                          std::shared_ptr<SIPConnection> connection);
+
+  bool transportEnded(const QString& remoteAddress,
+                      std::shared_ptr<TransportInstance> transport) const;
+  void destroyTransport(std::shared_ptr<TransportInstance> transport);
 
   void createRegistration(NameAddr &addressRecord);
 
@@ -241,6 +267,16 @@ private:
                     NameAddr &remote, QString localAddress, bool ourDialog);
   void removeDialog(uint32_t sessionID);
 
+  // Dialogs are indexed by Call-ID, because the tags are learned during the
+  // dialog. The few dialogs sharing a Call-ID are then checked for the tags.
+  void indexDialog(uint32_t sessionID, QString callID);
+
+  // CANCEL is matched to the INVITE transaction with the topmost Via
+  void indexINVITE(uint32_t sessionID, SIPRequest& request);
+  QString transactionKey(SIPRequest& request) const;
+
+  void unindexDialog(uint32_t sessionID);
+
   // Goes through our current connections and returns if we are already connected
   // to this address.
   bool isConnected(QString remoteAddress);
@@ -256,16 +292,22 @@ private:
 
   void re_INVITE_all();
 
-  std::shared_ptr<TCPConnection> createConnection(SIPConnectionType type, QString address, uint16_t port);
+  std::shared_ptr<SIPConnection> createConnection(SIPConnectionType type, QString address, uint16_t port);
 
   // Helper functions for SDP management.
 
   ConnectionServer tcpServer_;
 
+  // one socket for all SIP peers using UDP
+  UDPServer udpServer_;
+
   // SIP Transport layer
   // Key is remote address
   std::map<QString, std::shared_ptr<TransportInstance>> transports_;
 
+  // checks periodically for transports which are no longer needed
+  QTimer transportTimer_;
+
   std::shared_ptr<NetworkCandidates> nCandidates_;
 
   StatisticsInterface *stats_;
@@ -281,6 +323,12 @@ private:
   // key is sessionID
   std::map<uint32_t, std::shared_ptr<DialogInstance>> dialogs_;
 
+  // key is Call-ID, the same Call-ID can be used by many dialogs when calling ourselves
+  std::unordered_multimap<QString, uint32_t> callIDIndex_;
+
+  // key is the branch and sent-by of the latest INVITE received in the dialog
+  std::unordered_map<QString, uint32_t> inviteIndex_;
+
   // key is the server address
   std::map<QString, std::shared_ptr<RegistrationInstance>> registrations_;
 
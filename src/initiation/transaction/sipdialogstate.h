@@ -47,6 +47,18 @@ public:
     return callActive_;
   }
 
+  // empty until set by init or the first INVITE
+  QString getCallID() const
+  {
+    return callID_;
+  }
+
+  // the host of the remote address-of-record, which our transport is keyed with
+  QString getRemoteHost() const
+  {
+    return remoteURI_.uri.hostport.host;
+  }
+
 public slots:
 
   // Adds dialog info to request
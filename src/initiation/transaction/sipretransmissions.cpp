@@ -0,0 +1,483 @@
+#include "sipretransmissions.h"
+
+#include "initiation/transport/sipconversions.h"
+
+#include "common.h"
+#include "logger.h"
+
+#include <algorithm>
+
+// see section 17.1.1.1 of RFC 3261
+const int T1_MS = 500;
+const int T2_MS = 4000;
+const int T4_MS = 5000;
+
+// timers B, D, F, H and J
+const int TRANSACTION_TIMEOUT_MS = 64*T1_MS;
+
+// how long an INVITE may ring, same as timer C of proxies
+const int PROCEEDING_TIMEOUT_MS = 180*1000;
+
+// The number of transactions kept for the originator of the transactions. A
+// proxy relays the transactions of many peers, so they are not limited together.
+const size_t MAX_PEER_TRANSACTIONS = 256;
+
+
+SIPRetransmissions::SIPRetransmissions():
+  clients_(),
+  servers_(),
+  clientInvites_(),
+  serverInvites_(),
+  deadlines_(),
+  timer_(),
+  peerTransactions_(),
+  untracked_(0)
+{
+  timer_.setSingleShot(true);
+  QObject::connect(&timer_, &QTimer::timeout,
+                   this,    &SIPRetransmissions::timerExpired);
+}
+
+
+void SIPRetransmissions::uninit()
+{
+  timer_.stop();
+
+  clients_.clear();
+  servers_.clear();
+  clientInvites_.clear();
+  serverInvites_.clear();
+  deadlines_.clear();
+  peerTransactions_.clear();
+}
+
+
+bool SIPRetransmissions::hasTransactions() const
+{
+  return !clients_.empty() || !servers_.empty();
+}
+
+
+void SIPRetransmissions::processOutgoingRequest(SIPRequest& request, QVariant& content)
+{
+  if (request.method == SIP_ACK)
+  {
+    // the ACK is sent again if the peer repeats its response
+    auto invite = clientInvites_.find(acknowledgeKey(request.message));
+    if (invite != clientInvites_.end())
+    {
+      ClientTransaction& transaction = clients_[invite->second];
+      transaction.ack = request;
+      transaction.ack.message =
+          std::shared_ptr<SIPMessageHeader> (new SIPMessageHeader(*request.message));
+    }
+  }
+  else
+  {
+    QString key = transactionKey(request.message);
+
+    if (!key.isEmpty() && (clients_.find(key) != clients_.end() ||
+                           addTransaction(request.message, requestMethodToString(request.method))))
+    {
+      int64_t now = clockNowMs();
+
+      ClientTransaction& transaction = clients_[key];
+      transaction.peer = transactionPeer(request.message);
+      transaction.request = request;
+      transaction.request.message =
+          std::shared_ptr<SIPMessageHeader> (new SIPMessageHeader(*request.message));
+      transaction.content = content;
+      transaction.intervalMs = T1_MS;
+      transaction.nextSendMs = now + T1_MS;
+      transaction.endMs = now + TRANSACTION_TIMEOUT_MS;
+
+      if (request.method == SIP_INVITE)
+      {
+        clientInvites_[acknowledgeKey(request.message)] = key;
+      }
+
+      schedule(key, transaction.nextSendMs);
+      schedule(key, transaction.endMs);
+    }
+  }
+
+  emit outgoingRequest(request, content);
+}
+
+
+void SIPRetransmissions::processOutgoingResponse(SIPResponse& response, QVariant& content)
+{
+  QString key = transactionKey(response.message);
+
+  if (!key.isEmpty() && (servers_.find(key) != servers_.end() ||
+                         addTransaction(response.message, responseTypeToPhrase(response.type))))
+  {
+    int64_t now = clockNowMs();
+
+    ServerTransaction& transaction = servers_[key];
+    transaction.peer = transactionPeer(response.message);
+    transaction.response = response;
+    transaction.response.message =
+        std::shared_ptr<SIPMessageHeader> (new SIPMessageHeader(*response.message));
+    transaction.content = content;
+    transaction.endMs = now + TRANSACTION_TIMEOUT_MS;
+
+    // final responses to INVITE are repeated until the ACK arrives
+    if (response.message->cSeq.method == SIP_INVITE && response.type >= 200)
+    {
+      transaction.retransmit = true;
+      transaction.intervalMs = T1_MS;
+      transaction.nextSendMs = now + T1_MS;
+
+      serverInvites_[acknowledgeKey(response.message)] = key;
+      schedule(key, transaction.nextSendMs);
+    }
+
+    schedule(key, transaction.endMs);
+  }
+
+  emit outgoingResponse(response, content);
+}
+
+
+void SIPRetransmissions::processIncomingRequest(SIPRequest& request, QVariant& content,
+                                                SIPResponseStatus generatedResponse)
+{
+  if (request.method == SIP_ACK)
+  {
+    auto invite = serverInvites_.find(acknowledgeKey(request.message));
+    if (invite != serverInvites_.end() && servers_.find(invite->second) != servers_.end())
+    {
+      ServerTransaction& transaction = servers_[invite->second];
+
+      if (transaction.acknowledged)
+      {
+        // they repeated the ACK because we repeated our response
+        return;
+      }
+
+      // timer I
+      transaction.acknowledged = true;
+      transaction.retransmit = false;
+      transaction.endMs = clockNowMs() + T4_MS;
+      schedule(invite->second, transaction.endMs);
+    }
+  }
+  else
+  {
+    QString key = transactionKey(request.message);
+    auto existing = servers_.find(key);
+
+    if (existing != servers_.end())
+    {
+      Logger::getLogger()->printNormal(this, "Absorbing a retransmitted request",
+                                       {"Type"}, {requestMethodToString(request.method)});
+
+      // the original is still being processed if we have not responded
+      if (existing->second.response.message != nullptr)
+      {
+        sendAgain(existing->second, clockNowMs());
+      }
+      return;
+    }
+
+    if (!key.isEmpty() && addTransaction(request.message, requestMethodToString(request.method)))
+    {
+      ServerTransaction& transaction = servers_[key];
+      transaction.peer = transactionPeer(request.message);
+      transaction.endMs = clockNowMs() + TRANSACTION_TIMEOUT_MS;
+      schedule(key, transaction.endMs);
+    }
+  }
+
+  emit incomingRequest(request, content, generatedResponse);
+}
+
+
+void SIPRetransmissions::processIncomingResponse(SIPResponse& response, QVariant& content,
+                                                 bool retryRequest)
+{
+  QString key = transactionKey(response.message);
+  auto existing = clients_.find(key);
+
+  if (existing == clients_.end())
+  {
+    // the client decides what to do with responses we have not tracked
+    emit incomingResponse(response, content, retryRequest);
+    return;
+  }
+
+  ClientTransaction& transaction = existing->second;
+
+  if (transaction.completed)
+  {
+    // they repeat their final response to INVITE if our ACK was lost
+    if (transaction.ack.message != nullptr && response.type >= 200)
+    {
+      SIPRequest ack = transaction.ack;
+      QVariant noContent;
+      emit outgoingRequest(ack, noContent);
+    }
+    return;
+  }
+
+  int64_t now = clockNowMs();
+
+  if (response.type < 200)
+  {
+    if (response.message->cSeq.method == SIP_INVITE)
+    {
+      // timer A stops and the call may now ring
+      transaction.retransmit = false;
+      transaction.endMs = now + PROCEEDING_TIMEOUT_MS;
+      schedule(key, transaction.endMs);
+    }
+    else
+    {
+      // timer E continues at T2, see section 17.1.2.2 of RFC 3261
+      transaction.intervalMs = T2_MS;
+      transaction.nextSendMs = now + T2_MS;
+      schedule(key, transaction.nextSendMs);
+    }
+  }
+  else
+  {
+    // timer D for INVITE and timer K for others
+    transaction.completed = true;
+    transaction.retransmit = false;
+    transaction.endMs = now + (response.message->cSeq.method == SIP_INVITE ?
+                                 TRANSACTION_TIMEOUT_MS : T4_MS);
+    schedule(key, transaction.endMs);
+  }
+
+  emit incomingResponse(response, content, retryRequest);
+}
+
+
+void SIPRetransmissions::timerExpired()
+{
+  processDeadlines(clockNowMs());
+}
+
+
+void SIPRetransmissions::processDeadlines(int64_t now)
+{
+  while (!deadlines_.empty() && deadlines_.begin()->first <= now)
+  {
+    QString key = deadlines_.begin()->second;
+    deadlines_.erase(deadlines_.begin());
+
+    auto client = clients_.find(key);
+    if (client != clients_.end())
+    {
+      if (client->second.endMs <= now)
+      {
+        if (!client->second.completed)
+        {
+          // timers B and F
+          Logger::getLogger()->printWarning(this, "No response to request before transaction timeout",
+                                            {"Type"},
+                                            {requestMethodToString(client->second.request.method)});
+        }
+        removeClient(key);
+      }
+      else if (client->second.retransmit && client->second.nextSendMs <= now)
+      {
+        sendAgain(client->second, now);
+        schedule(key, client->second.nextSendMs);
+      }
+    }
+
+    auto server = servers_.find(key);
+    if (server != servers_.end())
+    {
+      if (server->second.endMs <= now)
+      {
+        if (server->second.retransmit)
+        {
+          // timer H
+          Logger::getLogger()->printWarning(this, "No ACK to our response before transaction timeout");
+        }
+        removeServer(key);
+      }
+      else if (server->second.retransmit && server->second.nextSendMs <= now)
+      {
+        sendAgain(server->second, now);
+        schedule(key, server->second.nextSendMs);
+      }
+    }
+  }
+
+  if (!deadlines_.empty())
+  {
+    timer_.start(std::max<int64_t>(0, deadlines_.begin()->first - now));
+  }
+}
+
+
+QString SIPRetransmissions::transactionKey(const std::shared_ptr<SIPMessageHeader>& message) const
+{
+  // messages without a branch come from old RFC 2543 implementations
+  if (message == nullptr ||
+      message->vias.empty() ||
+      message->vias.first().branch.isEmpty())
+  {
+    return "";
+  }
+
+  const ViaField& via = message->vias.first();
+  return via.branch + ";" + via.sentBy + ":" + QString::number(via.port) + ";" +
+      QString::number(message->cSeq.method);
+}
+
+
+QString SIPRetransmissions::acknowledgeKey(const std::shared_ptr<SIPMessageHeader>& message) const
+{
+  return message->callID + ";" + QString::number(message->cSeq.cSeq);
+}
+
+
+QString SIPRetransmissions::transactionPeer(const std::shared_ptr<SIPMessageHeader>& message) const
+{
+  const ViaField& via = message->vias.first();
+  return via.sentBy + ":" + QString::number(via.port);
+}
+
+
+bool SIPRetransmissions::addTransaction(const std::shared_ptr<SIPMessageHeader>& message,
+                                        const QString& type)
+{
+  QString peer = transactionPeer(message);
+  PeerTransactions& transactions = peerTransactions_[peer];
+
+  if (transactions.count < MAX_PEER_TRANSACTIONS)
+  {
+    ++transactions.count;
+    transactions.limitReported = false;
+    return true;
+  }
+
+  ++untracked_;
+
+  // a flooding peer is named once, after that the drops are only counted
+  if (!transactions.limitReported)
+  {
+    transactions.limitReported = true;
+    Logger::getLogger()->printWarning(this, "Too many SIP transactions from one peer, "
+                                            "not retransmitting the new ones",
+                                      {"Peer", "Type", "Untracked"},
+                                      {peer, type, QString::number(untracked_)});
+  }
+  else
+  {
+    LOG_FAST_WARNING(this, "Too many SIP transactions from one peer, not retransmitting",
+                     {"Untracked"}, {untracked_});
+  }
+  return false;
+}
+
+
+void SIPRetransmissions::removeTransaction(const QString& peer)
+{
+  auto transactions = peerTransactions_.find(peer);
+  if (transactions != peerTransactions_.end() && --transactions->second.count == 0)
+  {
+    peerTransactions_.erase(transactions);
+  }
+}
+
+
+void SIPRetransmissions::schedule(const QString& key, int64_t deadlineMs)
+{
+  deadlines_.insert({deadlineMs, key});
+
+  // the timer is always set for the earliest deadline
+  if (deadlines_.begin()->first == deadlineMs)
+  {
+    timer_.start(std::max<int64_t>(0, deadlineMs - clockNowMs()));
+  }
+}
+
+
+void SIPRetransmissions::sendAgain(ClientTransaction& transaction, int64_t nowMs)
+{
+  Logger::getLogger()->printNormal(this, "Retransmitting request",
+                                   {"Type", "Interval"},
+                                   {requestMethodToString(transaction.request.method),
+                                    QString::number(transaction.intervalMs) + " ms"});
+
+  SIPRequest request = transaction.request;
+  QVariant content = transaction.content;
+  emit outgoingRequest(request, content);
+
+  // timer A keeps doubling, timer E stops at T2
+  transaction.intervalMs *= 2;
+  if (transaction.request.method != SIP_INVITE)
+  {
+    transaction.intervalMs = std::min(transaction.intervalMs, T2_MS);
+  }
+  transaction.nextSendMs = nowMs + transaction.intervalMs;
+}
+
+
+void SIPRetransmissions::sendAgain(ServerTransaction& transaction, int64_t nowMs)
+{
+  Logger::getLogger()->printNormal(this, "Retransmitting response",
+                                   {"Type"}, {responseTypeToPhrase(transaction.response.type)});
+
+  SIPResponse response = transaction.response;
+  QVariant content = transaction.content;
+  emit outgoingResponse(response, content);
+
+  // timer G
+  if (transaction.retransmit)
+  {
+    transaction.intervalMs = std::min(transaction.intervalMs*2, T2_MS);
+    transaction.nextSendMs = nowMs + transaction.intervalMs;
+  }
+}
+
+
+void SIPRetransmissions::removeClient(const QString& key)
+{
+  auto client = clients_.find(key);
+  if (client == clients_.end())
+  {
+    return;
+  }
+
+  if (client->second.request.method == SIP_INVITE)
+  {
+    auto invite = clientInvites_.find(acknowledgeKey(client->second.request.message));
+    if (invite != clientInvites_.end() && invite->second == key)
+    {
+      clientInvites_.erase(invite);
+    }
+  }
+
+  removeTransaction(client->second.peer);
+  clients_.erase(client);
+}
+
+
+void SIPRetransmissions::removeServer(const QString& key)
+{
+  auto server = servers_.find(key);
+  if (server == servers_.end())
+  {
+    return;
+  }
+
+  if (server->second.response.message != nullptr &&
+      server->second.response.message->cSeq.method == SIP_INVITE)
+  {
+    auto invite = serverInvites_.find(acknowledgeKey(server->second.response.message));
+    if (invite != serverInvites_.end() && invite->second == key)
+    {
+      serverInvites_.erase(invite);
+    }
+  }
+
+  removeTransaction(server->second.peer);
+  servers_.erase(server);
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "initiation/sipmessageprocessor.h"
+#include "initiation/siptypes.h"
+
+#include <QTimer>
+#include <QVariant>
+
+#include <map>
+#include <unordered_map>
+
+/* Reliability for SIP over an unreliable transport, following the transaction
+ * timers of RFC 3261 section 17. Requests are sent again until a response
+ * arrives (timers A, B, E and F) and final responses to INVITE until the ACK
+ * arrives (timer G and section 13.3.1.4). Retransmissions received from the
+ * peer are absorbed here and answered with our latest message.
+ *
+ * Retransmissions must be identical to the original, so this sits in the
+ * transport flow of the peer after the Via with the branch has been added. */
+
+class SIPRetransmissions : public SIPMessageProcessor
+{
+  Q_OBJECT
+public:
+  SIPRetransmissions();
+
+  virtual void uninit();
+
+  // returns true while some transaction of the peer is still going on
+  bool hasTransactions() const;
+
+public slots:
+
+  virtual void processOutgoingRequest(SIPRequest& request, QVariant& content);
+  virtual void processOutgoingResponse(SIPResponse& response, QVariant& content);
+
+  virtual void processIncomingRequest(SIPRequest& request, QVariant& content,
+                                      SIPResponseStatus generatedResponse);
+  virtual void processIncomingResponse(SIPResponse& response, QVariant& content,
+                                       bool retryRequest);
+
+protected:
+
+  // handles the deadlines that are due now, called when the timer expires
+  void processDeadlines(int64_t now);
+
+private slots:
+  void timerExpired();
+
+private:
+
+  struct ClientTransaction
+  {
+    // see transactionPeer
+    QString peer;
+
+    SIPRequest request;
+    QVariant content;
+
+    // our ACK to a final response of INVITE
+    SIPRequest ack;
+
+    bool retransmit = true;
+    bool completed = false;
+    int intervalMs = 0;
+    int64_t nextSendMs = 0;
+
+    // the transaction is forgotten after this
+    int64_t endMs = 0;
+  };
+
+  struct ServerTransaction
+  {
+    QString peer;
+
+    // empty until we have responded
+    SIPResponse response;
+    QVariant content;
+
+    bool retransmit = false;
+    bool acknowledged = false;
+    int intervalMs = 0;
+    int64_t nextSendMs = 0;
+    int64_t endMs = 0;
+  };
+
+  // the transaction of a message, see section 17.2.3 of RFC 3261
+  QString transactionKey(const std::shared_ptr<SIPMessageHeader>& message) const;
+
+  // ACK to 2xx has a branch of its own, so it is matched by Call-ID and CSeq
+  QString acknowledgeKey(const std::shared_ptr<SIPMessageHeader>& message) const;
+
+  // the originator of the transaction, which is us for client transactions
+  QString transactionPeer(const std::shared_ptr<SIPMessageHeader>& message) const;
+
+  // Counts a new transaction of the peer, returns false if the peer has too
+  // many already. The type is only for the log.
+  bool addTransaction(const std::shared_ptr<SIPMessageHeader>& message, const QString& type);
+  void removeTransaction(const QString& peer);
+
+  void schedule(const QString& key, int64_t deadlineMs);
+
+  void sendAgain(ClientTransaction& transaction, int64_t nowMs);
+  void sendAgain(ServerTransaction& transaction, int64_t nowMs);
+
+  void removeClient(const QString& key);
+  void removeServer(const QString& key);
+
+  // key is transactionKey
+  std::unordered_map<QString, ClientTransaction> clients_;
+  std::unordered_map<QString, ServerTransaction> servers_;
+
+  // INVITE transactions, key is acknowledgeKey and value transactionKey
+  std::unordered_map<QString, QString> clientInvites_;
+  std::unordered_map<QString, QString> serverInvites_;
+
+  // Deadlines of the transactions in time order. Entries are not removed when
+  // a deadline changes, instead they are ignored when they are no longer due.
+  std::multimap<int64_t, QString> deadlines_;
+  QTimer timer_;
+
+  struct PeerTransactions
+  {
+    size_t count = 0;
+    bool limitReported = false;
+  };
+
+  // key is transactionPeer
+  std::unordered_map<QString, PeerTransactions> peerTransactions_;
+
+  uint32_t untracked_;
+};
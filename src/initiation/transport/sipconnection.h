@@ -0,0 +1,36 @@
+#pragma once
+
+#include "initiation/siptypes.h"
+
+#include <QString>
+
+#include <stdint.h>
+
+/* The part of a connection the SIP transport layer uses, regardless of whether
+ * the messages travel over a TCP stream or as UDP datagrams. */
+
+class SIPConnection
+{
+public:
+  virtual ~SIPConnection() {}
+
+  virtual SIPTransportProtocol transportProtocol() const = 0;
+
+  // returns true once messages can be sent
+  virtual bool waitUntilConnected() = 0;
+
+  // messages are held until the transport is ready for them
+  virtual void allowReceiving() = 0;
+
+  // returns empty string if not connected
+  virtual QString localAddress() const = 0;
+  virtual QString remoteAddress() const = 0;
+
+  // returns 0 if not connected
+  virtual uint16_t localPort() const = 0;
+  virtual uint16_t remotePort() const = 0;
+
+  // returns true once the connection has nothing more to carry and will not
+  // reconnect, so its transport can be removed
+  virtual bool hasEnded() const = 0;
+};
@@ -8,7 +8,7 @@
 
 #include <QSettings>
 
-SIPRouting::SIPRouting(std::shared_ptr<TCPConnection> connection):
+SIPRouting::SIPRouting(std::shared_ptr<SIPConnection> connection):
   connection_(connection),
   received_(""),
   rport_(0),
@@ -251,7 +251,7 @@ void SIPRouting::addVia(SIPRequestMethod type,
                         QString localAddress,
                         uint16_t localPort)
 {
-  ViaField via = ViaField{SIP_VERSION, DEFAULT_TRANSPORT, localAddress, localPort,
+  ViaField via = ViaField{SIP_VERSION, connection_->transportProtocol(), localAddress, localPort,
       QString(MAGIC_COOKIE + generateRandomString(BRANCH_TAIL_LENGTH)),
       false, false, 0, "", {}};
 
@@ -3,7 +3,7 @@
 
 #include "initiation/sipmessageprocessor.h"
 #include "initiation/siptypes.h"
-#include "initiation/transport/tcpconnection.h"
+#include "initiation/transport/sipconnection.h"
 
 #include <QString>
 
@@ -16,7 +16,7 @@ class SIPRouting : public SIPMessageProcessor
 {
   Q_OBJECT
 public:
-  SIPRouting(std::shared_ptr<TCPConnection> connection);
+  SIPRouting(std::shared_ptr<SIPConnection> connection);
 
 
 public slots:
@@ -62,7 +62,7 @@ private:
 
   bool getGruus(std::shared_ptr<SIPMessageHeader> message);
 
-  std::shared_ptr<TCPConnection> connection_;
+  std::shared_ptr<SIPConnection> connection_;
 
   QString received_;
   uint16_t rport_;
@@ -24,7 +24,8 @@
 #include <functional>
 
 
-SIPTransport::SIPTransport(StatisticsInterface *stats):
+SIPTransport::SIPTransport(StatisticsInterface *stats, SIPTransportProtocol protocol):
+  protocol_(protocol),
   partialMessage_(""),
   stats_(stats),
   processingInProgress_(0)
@@ -179,8 +180,9 @@ void SIPTransport::networkPackage(QString package)
     if (header != "" && firstLine != "" && !fields.empty())
     {
       // Here we start identifying is this a request or a response
-      QRegularExpression requestRE("^(\\w+) (sip:\\S+@\\S+) SIP/(" + SIP_VERSION + ")");
-      QRegularExpression responseRE("^SIP/(" + SIP_VERSION + ") (\\d\\d\\d) (.+)");
+      // compiled once instead of for every message
+      static const QRegularExpression requestRE("^(\\w+) (sip:\\S+@\\S+) SIP/(" + SIP_VERSION + ")");
+      static const QRegularExpression responseRE("^SIP/(" + SIP_VERSION + ") (\\d\\d\\d) (.+)");
       QRegularExpressionMatch request_match = requestRE.match(firstLine);
       QRegularExpressionMatch response_match = responseRE.match(firstLine);
 
@@ -295,7 +297,15 @@ bool SIPTransport::parsePackage(QString package, QStringList& headers, QStringLi
     contentLengthIndex = package.indexOf("content-length", 0, Qt::CaseInsensitive);
   }
 
-  partialMessage_ = package;
+  if (protocol_ == UDP && !package.isEmpty())
+  {
+    Logger::getLogger()->printPeerError(this, "Received an incomplete SIP datagram");
+  }
+  else
+  {
+    partialMessage_ = package;
+  }
+
   return !headers.empty() && headers.size() == bodies.size();
 }
 
@@ -19,7 +19,8 @@ class SIPTransport : public SIPMessageProcessor
 {
   Q_OBJECT
 public:
-  SIPTransport(StatisticsInterface *stats);
+  // Over UDP every datagram is a whole message, so nothing is kept for the next one
+  SIPTransport(StatisticsInterface *stats, SIPTransportProtocol protocol = DEFAULT_TRANSPORT);
   ~SIPTransport();
 
     // these translate the struct to a string and send the SIP message
@@ -53,6 +54,8 @@ private:
   void signalConnections();
 
 
+  SIPTransportProtocol protocol_;
+
   QString partialMessage_;
 
   StatisticsInterface *stats_;
@@ -9,8 +9,10 @@
 #include "common.h"
 #include "logger.h"
 
-#include <QRegularExpression>
-#include <QRegularExpressionMatch>
+#include <QStringView>
+
+#include <deque>
+#include <vector>
 
 
 // RFC 3261 7.3.1. The order in which header fields appear is not significant,
@@ -135,15 +137,91 @@ const std::map<QString, std::function<bool(const SIPField& field,
     {"WWW-Authenticate",    parseWWWAuthenticateField}
 };
 
-bool combineContinuationLines(QStringList& lines);
+// the more comma separated values a field has, the more likely it is an attack
+const int MAX_COMMA_SEPARATED = 500;
 
-bool parseFieldName(QString& line, SIPField &field);
-void parseFieldCommaSeparatedList(QString& line, QStringList &outValues);
-bool parseField(QString& values, SIPField& field);
+// Collects the characters of a word. Words are usually contiguous in the
+// field, so they are kept as a view until a character is left out inside one.
+class WordBuilder
+{
+public:
+  explicit WordBuilder(QStringView text):
+    text_(text)
+  {}
 
-void addParameterToSet(SIPParameter& currentParameter, QString& currentWord,
+  void append(qsizetype index)
+  {
+    if (copied_)
+    {
+      word_ += text_[index];
+    }
+    else if (start_ < 0)
+    {
+      start_ = index;
+      end_ = index + 1;
+    }
+    else if (index == end_)
+    {
+      ++end_;
+    }
+    else
+    {
+      word_ = text_.mid(start_, end_ - start_).toString();
+      word_ += text_[index];
+      copied_ = true;
+    }
+  }
+
+  bool isEmpty() const
+  {
+    return !copied_ && start_ < 0;
+  }
+
+  QString take()
+  {
+    QString word;
+    if (copied_)
+    {
+      word = word_;
+    }
+    else if (start_ >= 0)
+    {
+      word = text_.mid(start_, end_ - start_).toString();
+    }
+
+    clear();
+    return word;
+  }
+
+  void clear()
+  {
+    start_ = -1;
+    end_ = -1;
+    word_.clear();
+    copied_ = false;
+  }
+
+private:
+  QStringView text_;
+  qsizetype start_ = -1;
+  qsizetype end_ = -1;
+
+  QString word_;
+  bool copied_ = false;
+};
+
+// Splits the header to lines and combines the lines continuing a field. The
+// combined lines are stored, other lines are views to the header.
+void splitLines(QStringView header, std::vector<QStringView>& lines,
+                std::deque<QString>& combined);
+
+bool parseFieldName(QStringView line, QString& name, QStringView& values);
+bool parseField(QStringView values, SIPField& field);
+
+void addParameterToSet(SIPParameter& currentParameter, WordBuilder& currentWord,
                        SIPCommaValue& value);
-bool addWord(bool isParameter, QStringList &words, QString& currentWord, QChar character, QChar endCharacter);
+bool addWord(bool isParameter, QStringList &words, WordBuilder& currentWord,
+             QChar character, QChar endCharacter);
 
 void composeAllFields(QList<SIPField>& fields,
                       std::shared_ptr<SIPMessageHeader> header)
@@ -238,12 +316,10 @@ QString addContent(const std::shared_ptr<SIPMessageHeader> header,
 
 bool headerToFields(QString& header, QString& firstLine, QList<SIPField>& fields)
 {
-  // Divide into lines
-#if QT_VERSION < QT_VERSION_CHECK(5, 14, 0)
-    QStringList lines = header.split("\r\n", QString::SkipEmptyParts);
-#else
-    QStringList lines = header.split("\r\n", Qt::SkipEmptyParts);
-#endif
+  // the header is parsed in one pass through views and only the parsed words are copied
+  std::vector<QStringView> lines;
+  std::deque<QString> combined;
+  splitLines(header, lines, combined);
 
   Logger::getLogger()->printNormal("SIP Transport Helper", "Parsing SIP header to fields",
               "Fields", QString::number(lines.size()));
@@ -257,23 +333,37 @@ bool headerToFields(QString& header, QString& firstLine, QList<SIPField>& fields
   // Expect for WWW-Authenticate, Authorization,
   // Proxy-Authenticate, and Proxy-Authorization
 
-  // The message may contain fields that extend more than one line.
-  // Combine them so field is only present on one line
-  combineContinuationLines(lines);
-  firstLine = lines.at(0);
+  firstLine = lines.at(0).toString();
 
+  std::vector<QStringView> commaSeparated;
   QStringList debugLineNames = {};
-  for(int i = 1; i < lines.size(); ++i)
+  for(size_t i = 1; i < lines.size(); ++i)
   {
     SIPField field = {"", {}};
-    QStringList commaSeparated;
+    QStringView values;
 
-    if (parseFieldName(lines[i], field))
+    if (parseFieldName(lines.at(i), field.name, values))
     {
-      parseFieldCommaSeparatedList(lines[i], commaSeparated);
+      // separate value sections by commas
+      commaSeparated.clear();
+      qsizetype begin = 0;
+      while (begin <= values.size())
+      {
+        qsizetype comma = values.indexOf(u',', begin);
+        if (comma < 0)
+        {
+          comma = values.size();
+        }
+
+        if (comma > begin)
+        {
+          commaSeparated.push_back(values.mid(begin, comma - begin));
+        }
+        begin = comma + 1;
+      }
 
       // Check the correct number of values for Field
-      if (commaSeparated.size() > 500)
+      if (commaSeparated.size() > MAX_COMMA_SEPARATED)
       {
         Logger::getLogger()->printPeerError("SIP Transport Helper",
                    "Too many comma separated sets in field",
@@ -281,12 +371,12 @@ bool headerToFields(QString& header, QString& firstLine, QList<SIPField>& fields
         return false;
       }
 
-      for (QString& value : commaSeparated)
+      for (QStringView value : commaSeparated)
       {
         if (!parseField(value, field))
         {
           Logger::getLogger()->printWarning("SIP Transport Helper", "Failed to parse field",
-                       {"Name", "Field"}, {field.name, value});
+                       {"Name", "Field"}, {field.name, value.toString()});
           return false;
         }
       }
@@ -373,61 +463,99 @@ void parseContent(QVariant& content, MediaType mediaType, QString& body)
 }
 
 
-bool combineContinuationLines(QStringList& lines)
+void splitLines(QStringView header, std::vector<QStringView>& lines,
+                std::deque<QString>& combined)
 {
-  for (int i = 1; i < lines.size(); ++i)
+  qsizetype begin = 0;
+  while (begin < header.size())
   {
+    qsizetype end = header.indexOf(u'\n', begin);
+    if (end < 0)
+    {
+      end = header.size();
+    }
+
+    QStringView line = header.mid(begin, end - begin);
+    begin = end + 1;
+
+    // lines end with CRLF, but a bare LF is accepted as well
+    if (line.endsWith(u'\r'))
+    {
+      line.chop(1);
+    }
+
+    if (line.isEmpty())
+    {
+      continue;
+    }
+
     // combine current line with previous if there a space at the beginning
-    if (lines.at(i).front().isSpace())
+    if (!lines.empty() && line.front().isSpace())
     {
       Logger::getLogger()->printNormal("SIP Transport Helper", "Found a continuation line");
-      lines[i - 1].append(lines.at(i));
-      lines.erase(lines.begin() + i);
-      --i;
+
+      // the folding is equivalent to a single space (RFC 3261 section 7.3.1)
+      qsizetype contentStart = 0;
+      while (contentStart < line.size() && line[contentStart].isSpace())
+      {
+        ++contentStart;
+      }
+
+      combined.push_back(lines.back().toString());
+      combined.back().append(u' ');
+      combined.back().append(line.mid(contentStart));
+      lines.back() = combined.back();
+    }
+    else
+    {
+      lines.push_back(line);
     }
   }
-
-  return true;
 }
 
 
-bool parseFieldName(QString& line, SIPField& field)
+bool parseFieldName(QStringView line, QString& name, QStringView& values)
 {
-  QRegularExpression re_field("(\\S*):\\s+(.*)");
-  QRegularExpressionMatch field_match = re_field.match(line);
-
-  // separate name from rest
-  if(field_match.hasMatch() && field_match.lastCapturedIndex() == 2)
+  // The name ends with a colon, which may have whitespace on either side
+  // (HCOLON in RFC 3261 section 25.1). The value may be empty.
+  qsizetype colon = line.indexOf(u':');
+  if (colon < 0)
   {
-    field.name = field_match.captured(1);
-    line = field_match.captured(2);
+    return false;
   }
-  else
+
+  QStringView fieldName = line.left(colon).trimmed();
+  if (fieldName.isEmpty())
   {
     return false;
   }
-  return true;
-}
 
+  for (QChar character : fieldName)
+  {
+    if (character.isSpace())
+    {
+      return false;
+    }
+  }
 
-void parseFieldCommaSeparatedList(QString& line, QStringList& outValues)
-{
-  // separate value sections by commas
-#if QT_VERSION < QT_VERSION_CHECK(5, 14, 0)
-    outValues = line.split(",", QString::SkipEmptyParts);
-#else
-    outValues = line.split(",", Qt::SkipEmptyParts);
-#endif
+  qsizetype valueStart = colon + 1;
+  while (valueStart < line.size() && line[valueStart].isSpace())
+  {
+    ++valueStart;
+  }
 
+  name = fieldName.toString();
+  values = line.mid(valueStart);
+  return true;
 }
 
 
-bool parseField(QString& values, SIPField& field)
+bool parseField(QStringView values, SIPField& field)
 {
   // RFC3261_TODO: Uniformalize case formatting. Make everything big or small case expect quotes.
   SIPCommaValue set = SIPCommaValue{{}, {}};
 
-  QString currentWord = "";
+  WordBuilder currentWord(values);
   bool isQuotation = false;
   bool isURI = false;
   bool isParameter = false;
@@ -436,8 +564,9 @@ bool parseField(QString& values, SIPField& field)
   SIPParameter parameter;
 
 
-  for (QChar& character : values)
+  for (qsizetype i = 0; i < values.size(); ++i)
   {
+    QChar character = values[i];
     // add character to word if it is not parsed out
     if (isURI || (isQuotation && character != '\"') ||
         (character != ' '
@@ -448,7 +577,7 @@ bool parseField(QString& values, SIPField& field)
         && character != ')'
         && !comments))
     {
-      currentWord += character;
+      currentWord.append(i);
     }
 
     // push current word if it ended
@@ -470,11 +599,11 @@ bool parseField(QString& values, SIPField& field)
       }
       else if (character == ' ') // end of a word
       {
-        if (!isParameter && currentWord != "")
+        if (!isParameter && !currentWord.isEmpty())
         {
-          set.words.push_back(currentWord);
+          set.words.push_back(currentWord.take());
         }
-        currentWord = "";
+        currentWord.clear();
       }
       else if (isParameter)
       {
@@ -486,8 +615,7 @@ bool parseField(QString& values, SIPField& field)
           }
           else
           {
-            parameter.name = currentWord;
-            currentWord = "";
+            parameter.name = currentWord.take();
           }
         }
         else if (character == ';')
@@ -497,11 +625,10 @@ bool parseField(QString& values, SIPField& field)
       }
       else
       {
-        if (character == ';' && currentWord != "")
+        if (character == ';' && !currentWord.isEmpty())
         {
           // last word before parameters
-          set.words.push_back(currentWord);
-          currentWord = "";
+          set.words.push_back(currentWord.take());
         }
       }
     }
@@ -551,10 +678,9 @@ bool parseField(QString& values, SIPField& field)
   {
     addParameterToSet(parameter, currentWord, set);
   }
-  else if (currentWord != "")
+  else if (!currentWord.isEmpty())
   {
-    set.words.push_back(currentWord);
-    currentWord = "";
+    set.words.push_back(currentWord.take());
   }
 
   field.commaSeparated.push_back(set);
@@ -563,32 +689,30 @@ bool parseField(QString& values, SIPField& field)
 }
 
 
-void addParameterToSet(SIPParameter& currentParameter, QString &currentWord,
+void addParameterToSet(SIPParameter& currentParameter, WordBuilder& currentWord,
                        SIPCommaValue& value)
 {
   if (currentParameter.name == "")
   {
-    currentParameter.name = currentWord;
+    currentParameter.name = currentWord.take();
   }
   else
   {
-    currentParameter.value = currentWord;
+    currentParameter.value = currentWord.take();
   }
-  currentWord = "";
 
   value.parameters.push_back(currentParameter);
   currentParameter = SIPParameter{"",""};
 }
 
-bool addWord(bool isParameter, QStringList& words, QString& currentWord,
+bool addWord(bool isParameter, QStringList& words, WordBuilder& currentWord,
              QChar character, QChar endCharacter)
 {
   if (character == endCharacter)
   {
-    if (!isParameter && currentWord != "")
+    if (!isParameter && !currentWord.isEmpty())
     {
-      words.push_back(currentWord);
-      currentWord = "";
+      words.push_back(currentWord.take());
     }
     else if (!isParameter)
     {
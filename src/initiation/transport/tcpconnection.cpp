@@ -3,132 +3,107 @@
 #include "common.h"
 #include "logger.h"
 
-#include <QDataStream>
-#include <QtConcurrent/QtConcurrent>
+#include <algorithm>
 
 #include <stdint.h>
-#include <thread>
-
-const uint32_t MAX_READ_BYTES = 10000;
+#include <stdlib.h>
 
 const uint8_t NUMBER_OF_RETRIES = 3;
 
 const uint16_t CONNECTION_TIMEOUT_MS = 200;
 
-const uint16_t DISCONNECT_TIMEOUT_MS = 1000;
+const uint16_t WAIT_CONNECTED_MS = 500;
 
+// how long after a successful connection we may connect again
+const int64_t RECONNECT_DELAY_MS = 32000;
 
-TCPConnection::TCPConnection()
-  :
-    socket_(nullptr),
-    shouldConnect_(false),
-    destination_(),
-    port_(0),
-    socketDescriptor_(0),
-    buffer_(),
-    sendMutex_(),
-    active_(false),
-    allowedToSendMessages_(false),
-    next_connection_attempt_(std::chrono::system_clock::now())
-{}
+// the largest message we are willing to buffer
+const int MAX_MESSAGE_BYTES = 65536;
 
-TCPConnection::~TCPConnection()
-{
-  active_ = false;
-  if (eventDispatcher())
-  {
-    eventDispatcher()->interrupt();
-  }
+// what we are willing to hold for the peer while we are not connected
+const int MAX_UNSENT_BYTES = 4*MAX_MESSAGE_BYTES;
 
-  while (isRunning())
-  {
-    std::this_thread::sleep_for(std::chrono::milliseconds(3));
-  }
+// a peer is not allowed to fill our memory before the transport is created
+const size_t MAX_PENDING_MESSAGES = 32;
 
-  uninit();
-}
+// see section 4.4.1 of RFC 5626
+const int KEEP_ALIVE_INTERVAL_MS = 95000;
 
-void TCPConnection::init()
+const char PING[] = "\r\n\r\n";
+const char PONG[] = "\r\n";
+
+
+TCPConnection::TCPConnection():
+  socket_(new QTcpSocket(this)),
+  destination_(),
+  port_(0),
+  connectTimer_(),
+  attempts_(0),
+  lastConnectedMs_(0),
+  active_(false),
+  readBuffer_(),
+  writeBuffer_(),
+  flushScheduled_(false),
+  allowReceiving_(false),
+  pending_(),
+  keepAliveTimer_(),
+  pongPending_(false)
 {
   QObject::connect(this, &TCPConnection::error, this, &TCPConnection::printError);
-  active_ = true;
 
-  if (socket_ == nullptr)
-  {
-    socket_ = new QTcpSocket();
-
-    QObject::connect(socket_, &QAbstractSocket::disconnected,
-                     this,    &TCPConnection::disconnected);
-    QObject::connect(socket_, &QAbstractSocket::bytesWritten,
-                     this,    &TCPConnection::printBytesWritten);
-    QObject::connect(socket_, &QAbstractSocket::readyRead,
-                     this,    &TCPConnection::receivedMessage);
-  }
+  QObject::connect(socket_, &QAbstractSocket::connected,
+                   this,    &TCPConnection::connected);
+  QObject::connect(socket_, &QAbstractSocket::disconnected,
+                   this,    &TCPConnection::disconnected);
+  QObject::connect(socket_, &QAbstractSocket::bytesWritten,
+                   this,    &TCPConnection::printBytesWritten);
+  QObject::connect(socket_, &QAbstractSocket::readyRead,
+                   this,    &TCPConnection::receivedData);
+
+  connectTimer_.setSingleShot(true);
+  QObject::connect(&connectTimer_, &QTimer::timeout,
+                   this,           &TCPConnection::connectTimeout);
+
+  keepAliveTimer_.setSingleShot(true);
+  QObject::connect(&keepAliveTimer_, &QTimer::timeout,
+                   this,             &TCPConnection::sendKeepAlive);
 }
 
-void TCPConnection::uninit()
-{
-  if(socket_ != nullptr)
-  {
-    QObject::disconnect(socket_, &QAbstractSocket::disconnected,
-                        this,    &TCPConnection::disconnected);
-
-    QObject::disconnect(socket_, &QAbstractSocket::bytesWritten,
-                        this,    &TCPConnection::printBytesWritten);
 
-    QObject::disconnect(socket_, &QAbstractSocket::readyRead,
-                        this,    &TCPConnection::receivedMessage);
-    delete socket_;
-    socket_ = nullptr;
-  }
+TCPConnection::~TCPConnection()
+{
+  stopConnection();
 }
 
 
 bool TCPConnection::isConnected() const
 {
-  return socket_ != nullptr &&
-      socket_->state() == QAbstractSocket::ConnectedState;
+  return socket_->state() == QAbstractSocket::ConnectedState;
 }
 
 
 bool TCPConnection::waitUntilConnected()
 {
-  if (socket_ == nullptr && shouldConnect_)
+  if (isConnected())
   {
-    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    return true;
   }
 
-  if (socket_ != nullptr)
+  if (active_ &&
+      (socket_->state() == QAbstractSocket::HostLookupState ||
+       socket_->state() == QAbstractSocket::ConnectingState))
   {
-    if (socket_->state() == QAbstractSocket::ConnectedState)
-    {
-      return true;
-    }
-
-    if (socket_->state() == QAbstractSocket::UnconnectedState ||
-        socket_->state() == QAbstractSocket::HostLookupState  ||
-        socket_->state() == QAbstractSocket::ConnectingState)
-    {
-      int timeout_ms  = 500;
-      return socket_->waitForConnected(timeout_ms);
-    }
-    else
-    {
-      Logger::getLogger()->printWarning(this, "Socket in unsuitable state for connection");
-    }
-  }
-  else
-  {
-    Logger::getLogger()->printWarning(this, "No socket found");
+    return socket_->waitForConnected(WAIT_CONNECTED_MS);
   }
 
+  Logger::getLogger()->printWarning(this, "Socket in unsuitable state for connection");
   return false;
 }
 
 
 QString TCPConnection::localAddress() const
 {
-  if (socket_)
+  if (isConnected())
   {
     return socket_->localAddress().toString();
   }
@@ -155,6 +130,7 @@ uint16_t TCPConnection::localPort() const
   return 0;
 }
 
+
 uint16_t TCPConnection::remotePort() const
 {
   if (isConnected())
@@ -165,34 +141,36 @@ uint16_t TCPConnection::remotePort() const
 }
 
 
-QAbstractSocket::NetworkLayerProtocol TCPConnection::localProtocol() const
+bool TCPConnection::hasEnded() const
 {
-  if (isConnected())
-  {
-    return socket_->localAddress().protocol();
-  }
-
-  return QAbstractSocket::NetworkLayerProtocol::AnyIPProtocol;
+  return !active_ || (socket_->state() == QAbstractSocket::UnconnectedState &&
+                      !connectTimer_.isActive());
 }
 
 
-QAbstractSocket::NetworkLayerProtocol TCPConnection::remoteProtocol() const
+void TCPConnection::allowReceiving()
 {
-  if (isConnected())
+  allowReceiving_ = true;
+
+  while (!pending_.empty())
   {
-    return socket_->peerAddress().protocol();
+    emit messageAvailable(pending_.front());
+    pending_.pop();
   }
-
-  return QAbstractSocket::NetworkLayerProtocol::AnyIPProtocol;
 }
 
 
 void TCPConnection::stopConnection()
 {
   active_ = false;
-  if (eventDispatcher())
+  connectTimer_.stop();
+  keepAliveTimer_.stop();
+
+  if (socket_->state() != QAbstractSocket::UnconnectedState)
   {
-    eventDispatcher()->interrupt();
+    // the socket writes what it has buffered before closing
+    flush();
+    socket_->disconnectFromHost();
   }
 }
 
@@ -204,8 +182,10 @@ void TCPConnection::establishConnection(const QString &destination, uint16_t por
 
   destination_ = destination;
   port_ = port;
-  shouldConnect_ = true;
-  start();
+  active_ = true;
+  attempts_ = 0;
+
+  attemptConnection();
 }
 
 
@@ -214,239 +194,319 @@ void TCPConnection::setExistingConnection(qintptr socketDescriptor)
   Logger::getLogger()->printNormal(this, "Setting existing/incoming connection.",
                                    {"Sock desc"}, {QString::number(socketDescriptor)});
 
-  socketDescriptor_ = socketDescriptor;
-  shouldConnect_ = true;
-  start();
-}
-
-
-void TCPConnection::sendPacket(const QString &data)
-{
-  //Logger::getLogger()->printNormal(this, "Adding to send buffer");
-
-  if(active_)
-  {
-    sendMutex_.lock();
-    buffer_.push(data);
-    sendMutex_.unlock();
-
-    eventDispatcher()->wakeUp();
-  }
-  else
+  if (!socket_->setSocketDescriptor(socketDescriptor))
   {
-    Logger::getLogger()->printWarning(this, "Not sending message, "
-                                            "because sender has been shut down.");
+    Logger::getLogger()->printProgramError(this, "Could not set socket descriptor "
+                                                 "for existing connection.");
+    return;
   }
+
+  active_ = true;
+
+  // announced after the receiver has had a chance to connect our signals
+  QTimer::singleShot(0, this, &TCPConnection::connected);
 }
 
 
-void TCPConnection::receivedMessage()
+void TCPConnection::attemptConnection()
 {
-  //Logger::getLogger()->printNormal(this, "Socket ready to read.");
-  if (active_ )
+  if (!active_ || isConnected())
   {
-    eventDispatcher()->wakeUp();
-  }
-  else {
-    Logger::getLogger()->printWarning(this, "Socket not active when receiving message");
+    return;
   }
+
+  ++attempts_;
+  Logger::getLogger()->printNormal(this, "Attempting to connect",
+                                   {"Address", "Attempt"},
+                                   {destination_ + ":" + QString::number(port_),
+                                    QString::number(attempts_)});
+
+  socket_->abort();
+  socket_->connectToHost(destination_, port_);
+
+  // attempt connection with increasing wait time
+  connectTimer_.start(CONNECTION_TIMEOUT_MS*attempts_);
 }
 
 
-bool TCPConnection::connectLoop()
+void TCPConnection::connectTimeout()
 {
-  Logger::getLogger()->printNormal(this, "Starting to connect TCP");
-
-  if (socket_ == nullptr)
+  if (!active_ || isConnected())
   {
-    Logger::getLogger()->printProgramWarning(this, "Socket not initialized before connection");
-    init();
+    return;
   }
 
-  if (socketDescriptor_ != 0)
+  if (attempts_ < NUMBER_OF_RETRIES)
   {
-    Logger::getLogger()->printNormal(this, "Setting existing socket descriptor",
-        {"Sock desc"}, {QString::number(socketDescriptor_)});
-
-    if (!socket_->setSocketDescriptor(socketDescriptor_))
-    {
-      Logger::getLogger()->printProgramError(this, "Could not set socket descriptor "
-                                                   "for existing connection.");
-      return false;
-    }
+    attemptConnection();
+    return;
   }
-  else
-  {
-    Logger::getLogger()->printNormal(this, "Checking status",
-                {"Address"}, {destination_ + ":" + QString::number(port_)});
 
-    for (unsigned int i = 0; i < NUMBER_OF_RETRIES &&
-         socket_->state() != QAbstractSocket::ConnectedState; ++i)
-    {
-      Logger::getLogger()->printNormal(this, "Attempting to connect",
-                {"Attempt"}, {QString::number(i + 1)});
+  Logger::getLogger()->printWarning(this, "Failed to connect TCP connection");
+
+  socket_->abort();
+  active_ = false;
+
+  emit error(socket_->error(), socket_->errorString());
+  emit unableToConnect(destination_);
+}
 
-      socket_->connectToHost(destination_, port_);
-      // attempt connection with increasing wait time
-      socket_->waitForConnected(CONNECTION_TIMEOUT_MS * (i + 1));
-    }
-  }
 
-  if (socket_->state() != QAbstractSocket::ConnectedState)
+void TCPConnection::connected()
+{
+  if (!isConnected())
   {
-    emit error(socket_->error(), socket_->errorString());
-    emit unableToConnect(destination_);
-    return false;
+    return;
   }
 
+  connectTimer_.stop();
+  attempts_ = 0;
+  lastConnectedMs_ = clockNowMs();
+
   Logger::getLogger()->printNormal( this, "Connected succesfully", {"Connection"},
               {socket_->localAddress().toString() + ":" + QString::number(socket_->localPort()) + " <-> " +
                socket_->peerAddress().toString() + ":" + QString::number(socket_->peerPort())});
 
+  if (!destination_.isEmpty())
+  {
+    pongPending_ = false;
+    keepAliveTimer_.start(KEEP_ALIVE_INTERVAL_MS*(80 + rand()%21)/100);
+  }
 
-  emit socketConnected(socket_->localAddress().toString(), socket_->peerAddress().toString());
+  // send what was sent while we were connecting
+  flush();
 
-  next_connection_attempt_ = std::chrono::system_clock::now() + std::chrono::seconds(32);
-  return true;
+  emit socketConnected(socket_->localAddress().toString(), socket_->peerAddress().toString());
 }
 
 
-void TCPConnection::run()
+void TCPConnection::disconnected()
 {
-  Logger::getLogger()->printImportant(this, "Starting TCP loop");
+  Logger::getLogger()->printWarning(this, "TCP socket disconnected");
 
-  init();
+  keepAliveTimer_.stop();
+  readBuffer_.clear();
 
-  if(eventDispatcher() == nullptr)
+  if (active_ && !destination_.isEmpty())
   {
-    Logger::getLogger()->printWarning(this, "No event dispatcher for this connection.");
-    return;
+    attempts_ = 0;
+    connectTimer_.start(std::max<int64_t>(0, lastConnectedMs_ + RECONNECT_DELAY_MS - clockNowMs()));
   }
-  while(active_)
+  else if (!writeBuffer_.isEmpty())
   {
-    if(!isConnected() && shouldConnect_)
-    {
+    Logger::getLogger()->printWarning(this, "Discarding messages that could not be sent",
+                                      {"Bytes"}, {QString::number(writeBuffer_.size())});
+    writeBuffer_.clear();
+  }
+}
 
-      if (std::chrono::system_clock::now() > next_connection_attempt_ && !connectLoop())
-      {
-        Logger::getLogger()->printWarning(this, "Failed to connect TCP connection");
-        shouldConnect_ = false;
-        active_ = false;
-      }
-    }
 
-    if(socket_ != nullptr && socket_->bytesToWrite() > 0)
-    {
-      Logger::getLogger()->printNormal(this, "Detected need to send.", {"Bytes", "State"},
-                  {QString::number(socket_->bytesToWrite()), QString::number(socket_->state())});
-    }
+void TCPConnection::sendPacket(const QString &data)
+{
+  if (!active_)
+  {
+    Logger::getLogger()->printWarning(this, "Not sending message, "
+                                            "because sender has been shut down.");
+    return;
+  }
 
-    if(socket_ != nullptr && socket_->state() == QAbstractSocket::ConnectedState)
-    {
-      if(socket_ != nullptr &&
-         socket_->isValid() && socket_->canReadLine() && socket_->bytesAvailable() < MAX_READ_BYTES)
-      {
-        Logger::getLogger()->printNormal(this, "Can read one line", {"Bytes available"},
-                    {QString::number(socket_->bytesAvailable())});
+  QByteArray message = data.toUtf8();
 
-        // TODO: This should probably be some other stream, because we can also get non-text stuff in content?
+  if (writeBuffer_.size() + message.size() > MAX_UNSENT_BYTES)
+  {
+    LOG_FAST_WARNING(this, "Too much unsent data for peer, discarding message",
+                     {"Bytes"}, {writeBuffer_.size()});
+    return;
+  }
 
-        QTextStream in(socket_);
-        QString message;
-        message = in.read(MAX_READ_BYTES);
+  writeBuffer_.append(message);
 
-        while (!allowedToSendMessages_ && active_)
-        {
-          msleep(5);
-        }
+  // messages sent during the same event loop round are written together
+  if (!flushScheduled_)
+  {
+    flushScheduled_ = true;
+    QMetaObject::invokeMethod(this, &TCPConnection::flush, Qt::QueuedConnection);
+  }
+}
 
-        emit messageAvailable(message);
-      }
-      else if(socket_->bytesAvailable() > MAX_READ_BYTES)
-      {
-        Logger::getLogger()->printWarning(this, 
-                                        "Flushing the socket because of too much data!");
-        socket_->flush();
-      }
 
-      sendMutex_.lock();
-      while(buffer_.size() > 0 &&
-            socket_ != nullptr && socket_->state() == QAbstractSocket::ConnectedState)
-      {
-        bufferToSocket();
-      }
-      sendMutex_.unlock();
-    }
+void TCPConnection::flush()
+{
+  flushScheduled_ = false;
+
+  // the rest is written once we are connected
+  if (writeBuffer_.isEmpty() || !isConnected())
+  {
+    return;
+  }
+
+  Logger::getLogger()->printNormal(this, "Writing buffer to TCP socket",
+                                   {"Bytes"}, {QString::number(writeBuffer_.size())});
+
+  socket_->write(writeBuffer_);
+  writeBuffer_.clear();
+}
 
 
-    eventDispatcher()->processEvents(QEventLoop::WaitForMoreEvents);
+void TCPConnection::sendKeepAlive()
+{
+  if (!isConnected())
+  {
+    return;
   }
 
-  // send all remaining messages in buffer
-  while(buffer_.size() > 0 &&
-        socket_ != nullptr && socket_->state() == QAbstractSocket::ConnectedState)
+  if (pongPending_)
   {
-    bufferToSocket();
+    Logger::getLogger()->printWarning(this, "Peer did not answer our previous keep-alive",
+                                      {"Peer"}, {remoteAddress()});
   }
 
-  Logger::getLogger()->printNormal(this, "Disconnecting TCP connection");
-  disconnect();
-  uninit();
+  pongPending_ = true;
+  writeBuffer_.append(PING);
+  flush();
 
-  Logger::getLogger()->printImportant(this, "Ended TCP loop");
+  keepAliveTimer_.start(KEEP_ALIVE_INTERVAL_MS*(80 + rand()%21)/100);
 }
 
 
-void TCPConnection::bufferToSocket()
+void TCPConnection::receivedData()
 {
-  Logger::getLogger()->printNormal(this, "Writing buffer to TCP socket",
-              {"Buffer size"}, {QString::number(buffer_.size())});
+  readBuffer_.append(socket_->readAll());
 
-  if(buffer_.size() > MAX_READ_BYTES)
-  {
-    Logger::getLogger()->printWarning(this, 
-                                    "We are sending too much stuff to the other end",
-                                    {"Buffer size"}, {QString::number(buffer_.size())});
-  }
+  // the used bytes are removed once per read instead of once per message
+  readBuffer_.remove(0, frameMessages());
 
-  QString message = buffer_.front();
-  buffer_.pop();
+  // anything from the peer shows the connection is alive
+  pongPending_ = false;
 
-  // For some reason write stream has to be created every write, otherwise
-  // a mysterious crash appears.
-  QTextStream stream (socket_);
-  stream << message;
+  if (readBuffer_.size() > MAX_MESSAGE_BYTES)
+  {
+    Logger::getLogger()->printPeerError(this, "Too large SIP message, discarding it",
+                                        {"Bytes"}, {QString::number(readBuffer_.size())});
+    readBuffer_.clear();
+  }
 }
 
 
-void TCPConnection::disconnect()
+int TCPConnection::frameMessages()
 {
-  active_ = false;
-  shouldConnect_ = false;
-  if (socket_)
+  int offset = 0;
+
+  while (offset < readBuffer_.size())
   {
-    if(socket_->state() != QAbstractSocket::UnconnectedState)
+    const char* start = readBuffer_.constData() + offset;
+    int remaining = readBuffer_.size() - offset;
+
+    // keep-alives may arrive between messages
+    if (remaining >= int(sizeof(PING) - 1) && qstrncmp(start, PING, sizeof(PING) - 1) == 0)
+    {
+      writeBuffer_.append(PONG);
+      flush();
+      offset += sizeof(PING) - 1;
+      continue;
+    }
+
+    // A CRLF is the answer to our ping only if we are waiting for one.
+    // Otherwise it is ignored if a message follows (section 7.5 of RFC 3261).
+    if (remaining >= int(sizeof(PONG) - 1) && qstrncmp(start, PONG, sizeof(PONG) - 1) == 0 &&
+        (pongPending_ || remaining >= int(sizeof(PING) - 1)))
     {
-      socket_->disconnectFromHost();
+      pongPending_ = false;
+      offset += sizeof(PONG) - 1;
+      continue;
     }
 
-    if(socket_->state() == QAbstractSocket::UnconnectedState ||
-       socket_->waitForDisconnected(DISCONNECT_TIMEOUT_MS))
+    // the rest of a ping split between reads is still coming
+    if (remaining < int(sizeof(PING) - 1) && qstrncmp(start, PING, remaining) == 0)
     {
-      Logger::getLogger()->printNormal(this, "TCP disconnected");
+      break;
     }
-    else
+
+    int headerEnd = readBuffer_.indexOf("\r\n\r\n", offset);
+    if (headerEnd == -1)
+    {
+      break;
+    }
+    headerEnd += 4;
+
+    int length = contentLength(offset, headerEnd);
+    if (length < 0)
     {
-      emit error(socket_->error(), socket_->errorString());
-      return;
+      // TODO: Maybe also ban the peer at least temporarily.
+      Logger::getLogger()->printPeerError(this, "Got invalid content-length! "
+                                                "Peer is doing something very strange.");
+      return readBuffer_.size();
     }
+
+    if (readBuffer_.size() - headerEnd < length)
+    {
+      break;
+    }
+
+    // the message is decoded straight from the read buffer
+    deliverMessage(QString::fromUtf8(start, headerEnd + length - offset));
+    offset = headerEnd + length;
   }
+
+  return offset;
 }
 
 
-void TCPConnection::disconnected()
+int TCPConnection::contentLength(int headerStart, int headerEnd) const
 {
-  Logger::getLogger()->printWarning(this, "TCP socket disconnected");
+  int lineStart = headerStart;
+
+  while (lineStart < headerEnd)
+  {
+    int lineEnd = readBuffer_.indexOf("\r\n", lineStart);
+    if (lineEnd == -1 || lineEnd >= headerEnd)
+    {
+      break;
+    }
+
+    const char* line = readBuffer_.constData() + lineStart;
+    int colon = readBuffer_.indexOf(':', lineStart);
+
+    if (colon != -1 && colon < lineEnd)
+    {
+      int nameLength = colon - lineStart;
+      while (nameLength > 0 && (line[nameLength - 1] == ' ' || line[nameLength - 1] == '\t'))
+      {
+        --nameLength;
+      }
+
+      // l is the compact form of Content-Length
+      if ((nameLength == 14 && qstrnicmp(line, "content-length", 14) == 0) ||
+          (nameLength == 1 && (line[0] == 'l' || line[0] == 'L')))
+      {
+        bool ok = false;
+        int value = QByteArray::fromRawData(readBuffer_.constData() + colon + 1,
+                                            lineEnd - colon - 1).trimmed().toInt(&ok);
+        return ok && value >= 0 ? value : -1;
+      }
+    }
+
+    lineStart = lineEnd + 2;
+  }
+
+  return 0;
+}
+
+
+void TCPConnection::deliverMessage(const QString& message)
+{
+  if (allowReceiving_)
+  {
+    emit messageAvailable(message);
+  }
+  else if (pending_.size() < MAX_PENDING_MESSAGES)
+  {
+    pending_.push(message);
+  }
+  else
+  {
+    LOG_FAST_WARNING(this, "Too many messages waiting for transport, discarding");
+  }
 }
 
 
@@ -459,6 +519,6 @@ void TCPConnection::printError(int socketError, const QString &message)
 
 void TCPConnection::printBytesWritten(qint64 bytes)
 {
-  Logger::getLogger()->printNormal(this, "Written to socket", {"Bytes"}, 
+  Logger::getLogger()->printNormal(this, "Written to socket", {"Bytes"},
                                    {QString::number(bytes)});
 }
@@ -1,22 +1,29 @@
 #pragma once
+
+#include "sipconnection.h"
+
 #include <QByteArray>
-#include <QtNetwork>
+#include <QObject>
+#include <QTcpSocket>
+#include <QTimer>
 
 #include <queue>
-#include <functional>
 
 #include <stdint.h>
 
-/* Handles one TCP connection */
-// TODO: Implement a keep-alive CRLF sending.
+/* Handles one TCP connection. The socket is served by the event loop of the
+ * thread this object lives in, so all connections share the same loop instead
+ * of each running a thread of its own. Messages are framed here based on their
+ * Content-Length, so the transport always receives whole messages. */
 
-class TCPConnection : public QThread
+class TCPConnection : public QObject, public SIPConnection
 {
   Q_OBJECT
 public:
   TCPConnection();
   ~TCPConnection();
 
+  // writes what has been sent and closes the connection
   void stopConnection();
 
   // establishes a new TCP connection
@@ -26,20 +33,12 @@ public:
   // use this to give the socket to Connection
   void setExistingConnection(qintptr socketDescriptor);
 
-  void allowReceiving()
+  SIPTransportProtocol transportProtocol() const
   {
-    allowedToSendMessages_ = true;
+    return TCP;
   }
 
-  // callback
-  template <typename Class>
-  void addDataOutCallback (Class* o, void (Class::*method) (QByteArray& data))
-  {
-    outDataCallback_ = ([o,method] (QByteArray& data)
-    {
-      return (o->*method)(data);
-    });
-  }
+  void allowReceiving();
 
   bool waitUntilConnected();
 
@@ -51,9 +50,8 @@ public:
   uint16_t localPort() const;
   uint16_t remotePort() const;
 
-  // returns ANY if not connected
-  QAbstractSocket::NetworkLayerProtocol localProtocol() const;
-  QAbstractSocket::NetworkLayerProtocol remoteProtocol() const;
+  // closed by us, failed to connect or disconnected with no reconnect planned
+  bool hasEnded() const;
 
 signals:
   void error(int socketError, const QString &message);
@@ -69,58 +67,63 @@ public slots:
   void sendPacket(const QString &data);
 
 private slots:
-  void receivedMessage();
-  void printBytesWritten(qint64 bytes);
-
+  void connected();
+  void receivedData();
   void disconnected();
 
-protected:
-
-  void run();
+  void connectTimeout();
 
-private:
-
-  bool isConnected() const;
+  // writes all the messages sent since the last write at once
+  void flush();
 
-  // connects signals.
-  void init();
-  void uninit();
+  void sendKeepAlive();
 
   void printError(int socketError, const QString &message);
+  void printBytesWritten(qint64 bytes);
 
-  // return if succeeded
-  bool connectLoop();
-  void receiveLoop();
-  void sendLoop();
+private:
 
-  void bufferToSocket();
+  bool isConnected() const;
 
-  void disconnect();
+  void attemptConnection();
 
-  std::function<void(QByteArray& data)> outDataCallback_;
+  // returns the number of bytes used from the read buffer
+  int frameMessages();
 
-  QTcpSocket *socket_;
+  // returns -1 if the value is invalid
+  int contentLength(int headerStart, int headerEnd) const;
 
-  bool shouldConnect_;
+  void deliverMessage(const QString& message);
 
+  QTcpSocket* socket_;
+
+  // empty with incoming connections, which we do not reconnect
   QString destination_;
   uint16_t port_;
 
-  qintptr socketDescriptor_;
-  std::queue<QString> buffer_;
+  // connection attempts are retried with increasing wait time
+  QTimer connectTimer_;
+  unsigned int attempts_;
 
-  QMutex sendMutex_;
+  // this variable prevents us fom spamming connections
+  // if the connections are dropped right after succeeding
+  int64_t lastConnectedMs_;
 
   // Indicates whether the connection should be active or disconnected
   bool active_;
 
-  QMutex readWriteMutex_;
+  // bytes of a message that has not been received completely
+  QByteArray readBuffer_;
 
-  QString leftOvers_;
+  QByteArray writeBuffer_;
+  bool flushScheduled_;
 
-  bool allowedToSendMessages_;
+  bool allowReceiving_;
 
-  // this variable prevents us fom spamming connections
-  // if the connections are dropped right after succeeding
-  std::chrono::time_point<std::chrono::system_clock> next_connection_attempt_;
+  // messages received before the transport was ready
+  std::queue<QString> pending_;
+
+  // CRLF keep-alives of RFC 5626 on connections we have opened
+  QTimer keepAliveTimer_;
+  bool pongPending_;
 };
@@ -0,0 +1,169 @@
+#include "udpconnection.h"
+
+#include "udpserver.h"
+
+#include "common.h"
+#include "logger.h"
+
+#include <QNetworkProxy>
+#include <QUdpSocket>
+
+// a peer is not allowed to fill our memory before the transport is created
+const size_t MAX_PENDING_MESSAGES = 32;
+
+// 64*T1, the time after which all transactions of the peer have ended
+const int64_t IDLE_TIMEOUT_MS = 32000;
+
+
+UDPConnection::UDPConnection(UDPServer* server, QString host, QHostAddress remoteAddress,
+                             uint16_t remotePort):
+  server_(server),
+  host_(host),
+  resolving_(remoteAddress.isNull()),
+  hostNotFound_(false),
+  remoteAddress_(remoteAddress),
+  remotePort_(remotePort),
+  localAddress_(""),
+  allowReceiving_(false),
+  pending_(),
+  lastActivityMs_(clockNowMs())
+{
+  if (!resolving_)
+  {
+    lookupRoute();
+  }
+}
+
+
+bool UDPConnection::waitUntilConnected()
+{
+  return server_->isListening() && !localAddress_.isEmpty();
+}
+
+
+void UDPConnection::allowReceiving()
+{
+  allowReceiving_ = true;
+
+  while (!pending_.empty())
+  {
+    emit messageAvailable(pending_.front());
+    pending_.pop();
+  }
+}
+
+
+QString UDPConnection::localAddress() const
+{
+  return localAddress_;
+}
+
+
+QString UDPConnection::remoteAddress() const
+{
+  return remoteAddress_.toString();
+}
+
+
+uint16_t UDPConnection::localPort() const
+{
+  return server_->localPort();
+}
+
+
+uint16_t UDPConnection::remotePort() const
+{
+  return remotePort_;
+}
+
+
+bool UDPConnection::hasEnded() const
+{
+  return hostNotFound_ ||
+      (!resolving_ && clockNowMs() - lastActivityMs_ > IDLE_TIMEOUT_MS);
+}
+
+
+void UDPConnection::setRemoteAddress(const QHostAddress& address)
+{
+  resolving_ = false;
+  remoteAddress_ = address;
+  lastActivityMs_ = clockNowMs();
+
+  lookupRoute();
+
+  if (!localAddress_.isEmpty())
+  {
+    emit socketConnected(localAddress_, host_);
+  }
+}
+
+
+void UDPConnection::hostNotFound()
+{
+  resolving_ = false;
+  hostNotFound_ = true;
+}
+
+
+void UDPConnection::lookupRoute()
+{
+  // The shared socket listens to all addresses, so it cannot tell which one
+  // is ours towards this peer. Connecting a UDP socket sends nothing, but
+  // makes the operating system select the route. It completes immediately
+  // when given an address, so there is nothing to wait for.
+  QUdpSocket routeLookup;
+  routeLookup.setProxy(QNetworkProxy::NoProxy);
+  routeLookup.connectToHost(remoteAddress_, remotePort_);
+
+  if (routeLookup.state() == QAbstractSocket::ConnectedState)
+  {
+    localAddress_ = routeLookup.localAddress().toString();
+  }
+  else
+  {
+    Logger::getLogger()->printWarning(this, "Could not determine our address towards peer",
+                                      {"Peer"}, {remoteAddress_.toString()});
+  }
+}
+
+
+void UDPConnection::receiveDatagram(const QByteArray& datagram)
+{
+  lastActivityMs_ = clockNowMs();
+
+  QString message = QString::fromUtf8(datagram);
+
+  if (allowReceiving_)
+  {
+    emit messageAvailable(message);
+  }
+  else if (pending_.size() < MAX_PENDING_MESSAGES)
+  {
+    pending_.push(message);
+  }
+  else
+  {
+    LOG_FAST_WARNING(this, "Too many messages waiting for transport, discarding");
+  }
+}
+
+
+void UDPConnection::sendPacket(const QString &data)
+{
+  if (remoteAddress_.isNull())
+  {
+    Logger::getLogger()->printWarning(this, "Not sending SIP datagram, the peer has not "
+                                            "been resolved", {"Host"}, {host_});
+    return;
+  }
+
+  lastActivityMs_ = clockNowMs();
+
+  if (!server_->sendDatagram(data.toUtf8(), remoteAddress_, remotePort_))
+  {
+    Logger::getLogger()->printWarning(this, "Failed to send SIP datagram",
+                                      {"Peer"}, {remoteAddress_.toString() + ":" +
+                                                 QString::number(remotePort_)});
+  }
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include "sipconnection.h"
+
+#include <QHostAddress>
+#include <QObject>
+
+#include <queue>
+
+#include <stdint.h>
+
+class UDPServer;
+
+/* The state of one SIP peer reached over UDP. The socket is shared with all
+ * other peers and owned by UDPServer, so a peer costs only this object. */
+
+class UDPConnection : public QObject, public SIPConnection
+{
+  Q_OBJECT
+public:
+
+  // The address is null while the host is being resolved, in which case the
+  // server sets it with setRemoteAddress once the lookup has finished.
+  UDPConnection(UDPServer* server, QString host, QHostAddress remoteAddress,
+                uint16_t remotePort);
+
+  SIPTransportProtocol transportProtocol() const
+  {
+    return UDP;
+  }
+
+  // datagrams need no handshake, so this only checks that the peer is resolved
+  bool waitUntilConnected();
+
+  void allowReceiving();
+
+  QString localAddress() const;
+  QString remoteAddress() const;
+
+  uint16_t localPort() const;
+  uint16_t remotePort() const;
+
+  // the lookup failed or nothing has been sent or received in a while
+  bool hasEnded() const;
+
+  // called by the server when the host name has been resolved
+  void setRemoteAddress(const QHostAddress& address);
+  void hostNotFound();
+
+  // called by the server with every datagram from this peer
+  void receiveDatagram(const QByteArray& datagram);
+
+signals:
+  void messageAvailable(QString message);
+
+  // the host name has been resolved and messages can be sent
+  void socketConnected(QString localAddress, QString remoteAddress);
+
+public slots:
+
+  // sends packet to the peer as one datagram
+  void sendPacket(const QString &data);
+
+private:
+
+  // finds the address the operating system uses to reach this peer
+  void lookupRoute();
+
+  UDPServer* server_;
+
+  // the name the peer was asked for with, reported when it has been resolved
+  QString host_;
+  bool resolving_;
+  bool hostNotFound_;
+
+  QHostAddress remoteAddress_;
+  uint16_t remotePort_;
+
+  QString localAddress_;
+
+  bool allowReceiving_;
+
+  // messages received before the transport was ready
+  std::queue<QString> pending_;
+
+  int64_t lastActivityMs_;
+};
@@ -0,0 +1,278 @@
+#include "udpserver.h"
+
+#include "udpconnection.h"
+
+#include "common.h"
+#include "logger.h"
+
+#include <QHostInfo>
+#include <QNetworkDatagram>
+#include <QNetworkProxy>
+
+// the number of peers we keep state for
+const size_t MAX_UDP_PEERS = 4096;
+
+const qint64 MAX_DATAGRAM_SIZE = 65507;
+
+// how often idle peers are looked for
+const int CLEANUP_INTERVAL_MS = 32000;
+
+
+// IPv4 peers appear as mapped IPv6 addresses on a dual stack socket
+QHostAddress normalizeAddress(const QHostAddress& address)
+{
+  bool isIPv4 = false;
+  quint32 ipv4 = address.toIPv4Address(&isIPv4);
+
+  if (isIPv4)
+  {
+    return QHostAddress(ipv4);
+  }
+
+  return address;
+}
+
+
+QString peerKey(const QHostAddress& address, uint16_t port)
+{
+  return address.toString() + ":" + QString::number(port);
+}
+
+
+UDPServer::UDPServer():
+  socket_(),
+  connections_(),
+  cleanupTimer_(),
+  rejectedPeers_(0)
+{
+  QObject::connect(&socket_, &QUdpSocket::readyRead,
+                   this,     &UDPServer::readDatagrams);
+
+  QObject::connect(&cleanupTimer_, &QTimer::timeout,
+                   this,           &UDPServer::removeEndedConnections);
+}
+
+
+UDPServer::~UDPServer()
+{
+  close();
+}
+
+
+bool UDPServer::listen(uint16_t port)
+{
+  if (isListening())
+  {
+    Logger::getLogger()->printWarning(this, "Already listening to SIP UDP",
+                                      {"Port"}, {QString::number(localPort())});
+    return true;
+  }
+
+  socket_.setProxy(QNetworkProxy::NoProxy);
+
+  if (!socket_.bind(QHostAddress::Any, port))
+  {
+    Logger::getLogger()->printError(this, "Failed to bind SIP UDP socket",
+                                    {"Port", "Error"},
+                                    {QString::number(port), socket_.errorString()});
+    return false;
+  }
+
+  cleanupTimer_.start(CLEANUP_INTERVAL_MS);
+  return true;
+}
+
+
+void UDPServer::close()
+{
+  cleanupTimer_.stop();
+  connections_.clear();
+  socket_.close();
+}
+
+
+bool UDPServer::isListening() const
+{
+  return socket_.state() == QAbstractSocket::BoundState;
+}
+
+
+uint16_t UDPServer::localPort() const
+{
+  return socket_.localPort();
+}
+
+
+std::shared_ptr<UDPConnection> UDPServer::getConnection(QString address, uint16_t port)
+{
+  // we send from the same socket we receive with
+  if (!isListening() && !listen(0))
+  {
+    return nullptr;
+  }
+
+  QHostAddress remote(address);
+
+  if (remote.isNull())
+  {
+    // the connection is added to the peers once we know its address
+    std::shared_ptr<UDPConnection> connection =
+        std::shared_ptr<UDPConnection>(new UDPConnection(this, address, QHostAddress(), port));
+
+    std::weak_ptr<UDPConnection> pending = connection;
+    QHostInfo::lookupHost(address, this, [this, pending](const QHostInfo& info)
+    {
+      hostResolved(pending, info);
+    });
+
+    return connection;
+  }
+
+  remote = normalizeAddress(remote);
+
+  auto existing = connections_.find(peerKey(remote, port));
+  if (existing != connections_.end())
+  {
+    return existing->second;
+  }
+
+  return createConnection(remote, port);
+}
+
+
+bool UDPServer::sendDatagram(const QByteArray& datagram, const QHostAddress& address,
+                             uint16_t port)
+{
+  return socket_.writeDatagram(datagram, address, port) == datagram.size();
+}
+
+
+void UDPServer::readDatagrams()
+{
+  while (socket_.hasPendingDatagrams())
+  {
+    QNetworkDatagram datagram = socket_.receiveDatagram(MAX_DATAGRAM_SIZE);
+
+    if (!datagram.isValid())
+    {
+      continue;
+    }
+
+    QHostAddress sender = normalizeAddress(datagram.senderAddress());
+    uint16_t senderPort = datagram.senderPort();
+
+    if (handleKeepAlive(datagram.data(), sender, senderPort))
+    {
+      continue;
+    }
+
+    std::shared_ptr<UDPConnection> connection = nullptr;
+
+    // A connection only we hold has lost its transport, so the peer is
+    // announced again as new.
+    auto existing = connections_.find(peerKey(sender, senderPort));
+    if (existing != connections_.end() && existing->second.use_count() > 1)
+    {
+      connection = existing->second;
+    }
+    else
+    {
+      if (existing == connections_.end() && connections_.size() >= MAX_UDP_PEERS)
+      {
+        removeEndedConnections();
+      }
+
+      if (existing == connections_.end() && connections_.size() >= MAX_UDP_PEERS)
+      {
+        ++rejectedPeers_;
+        LOG_FAST_WARNING(this, "Too many SIP UDP peers, discarding datagram",
+                         {"Rejected"}, {rejectedPeers_});
+        continue;
+      }
+
+      Logger::getLogger()->printNormal(this, "Received SIP datagram from a new peer",
+                                       {"Address"}, {peerKey(sender, senderPort)});
+
+      connection = createConnection(sender, senderPort);
+      emit newConnection(connection);
+    }
+
+    connection->receiveDatagram(datagram.data());
+  }
+}
+
+
+std::shared_ptr<UDPConnection> UDPServer::createConnection(const QHostAddress& address,
+                                                           uint16_t port)
+{
+  std::shared_ptr<UDPConnection> connection =
+      std::shared_ptr<UDPConnection>(new UDPConnection(this, address.toString(), address, port));
+
+  connections_[peerKey(address, port)] = connection;
+  return connection;
+}
+
+
+void UDPServer::hostResolved(std::weak_ptr<UDPConnection> pending, const QHostInfo& info)
+{
+  std::shared_ptr<UDPConnection> connection = pending.lock();
+
+  // nobody needs the connection anymore
+  if (connection == nullptr)
+  {
+    return;
+  }
+
+  if (info.addresses().empty())
+  {
+    Logger::getLogger()->printError(this, "Could not resolve SIP peer address",
+                                    {"Address", "Error"}, {info.hostName(), info.errorString()});
+    connection->hostNotFound();
+    return;
+  }
+
+  QHostAddress remote = normalizeAddress(info.addresses().first());
+  QString key = peerKey(remote, connection->remotePort());
+
+  // If the peer already has a connection in use, it keeps receiving the
+  // datagrams and this one is only used for sending.
+  auto existing = connections_.find(key);
+  if (existing == connections_.end() || existing->second.use_count() == 1)
+  {
+    connections_[key] = connection;
+  }
+
+  connection->setRemoteAddress(remote);
+}
+
+
+void UDPServer::removeEndedConnections()
+{
+  for (auto it = connections_.begin(); it != connections_.end();)
+  {
+    if (it->second.use_count() == 1 && it->second->hasEnded())
+    {
+      it = connections_.erase(it);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+}
+
+
+bool UDPServer::handleKeepAlive(const QByteArray& datagram, const QHostAddress& address,
+                                uint16_t port)
+{
+  // The double CRLF ping of RFC 5626 is defined for streams, but many proxies
+  // send it over UDP as well to keep the NAT bindings open.
+  if (datagram == "\r\n\r\n")
+  {
+    sendDatagram("\r\n", address, port);
+    return true;
+  }
+
+  // a pong or stray line ending, which is not a SIP message
+  return datagram == "\r\n";
+}
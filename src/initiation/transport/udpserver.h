@@ -0,0 +1,70 @@
+#pragma once
+
+#include <QHostAddress>
+#include <QObject>
+#include <QTimer>
+#include <QUdpSocket>
+
+#include <map>
+#include <memory>
+
+#include <stdint.h>
+
+class UDPConnection;
+class QHostInfo;
+
+/* One UDP socket shared by all SIP peers. Datagrams are read in the thread of
+ * the server as they arrive and handed to the connection of their sender,
+ * which is created when the peer is first heard from. Connections nobody else
+ * holds are removed once they have been idle for a while. */
+
+class UDPServer : public QObject
+{
+  Q_OBJECT
+public:
+  UDPServer();
+  ~UDPServer();
+
+  bool listen(uint16_t port);
+  void close();
+
+  bool isListening() const;
+  uint16_t localPort() const;
+
+  // Returns the existing connection to this peer or creates a new one. A host
+  // name is resolved in the background and the connection announces with
+  // socketConnected when it can be used.
+  std::shared_ptr<UDPConnection> getConnection(QString address, uint16_t port);
+
+  // used by the connections to send their messages
+  bool sendDatagram(const QByteArray& datagram, const QHostAddress& address, uint16_t port);
+
+signals:
+
+  // a peer we did not know sent us a message
+  void newConnection(std::shared_ptr<UDPConnection> con);
+
+private slots:
+  void readDatagrams();
+
+  void removeEndedConnections();
+
+private:
+
+  std::shared_ptr<UDPConnection> createConnection(const QHostAddress& address, uint16_t port);
+
+  void hostResolved(std::weak_ptr<UDPConnection> pending, const QHostInfo& info);
+
+  // answers a keep-alive ping, returns false if the datagram was something else
+  bool handleKeepAlive(const QByteArray& datagram, const QHostAddress& address, uint16_t port);
+
+  QUdpSocket socket_;
+
+  // key is the remote address and port. The number of peers is limited so
+  // that a flood of senders cannot exhaust our memory.
+  std::map<QString, std::shared_ptr<UDPConnection>> connections_;
+
+  QTimer cleanupTimer_;
+
+  uint32_t rejectedPeers_;
+};
@@ -4,33 +4,136 @@
 
 #include <QDebug>
 
+#include <algorithm>
+#include <chrono>
+
 const int BEGIN_LENGTH = 40;
 
+// how often the logger thread writes the prints of the fast path
+const int WRITE_INTERVAL_MS = 20;
+
+// records of fast prints each thread can have waiting, must be a power of two
+const uint64_t RING_SIZE = 256;
+
+const int MAX_FAST_VALUES = 4;
 
-std::shared_ptr<Logger> Logger::instance_ = nullptr;
+const int64_t RATE_WINDOW_MS = 1000;
+const uint32_t MAX_PRINTS_PER_WINDOW = 5;
+
+
+struct FastRecord
+{
+  uint64_t sequence;
+  DebugType type;
+  const char* module;
+  const char* description;
+  uint32_t suppressed;
+
+  int count;
+  const char* names[MAX_FAST_VALUES];
+  LogValue values[MAX_FAST_VALUES];
+};
+
+// Written only by its own thread and read only by the logger thread, so
+// neither has to lock.
+struct LogRing
+{
+  FastRecord records[RING_SIZE];
+  std::atomic<uint64_t> head{0};
+  std::atomic<uint64_t> tail{0};
+  std::atomic<uint32_t> dropped{0};
+
+  // set when the thread exits, the ring is removed once it has been emptied
+  std::atomic<bool> closed{false};
+};
+
+
+namespace
+{
+  struct RingOwner
+  {
+    std::shared_ptr<LogRing> ring = nullptr;
+
+    ~RingOwner()
+    {
+      if (ring)
+      {
+        ring->closed.store(true, std::memory_order_release);
+      }
+    }
+  };
+
+  thread_local RingOwner threadRingOwner;
+
+  int64_t steadyNowMs()
+  {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+          std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
+}
+
+
+bool LogRateLimiter::allow(int64_t nowMs, uint32_t& suppressed)
+{
+  int64_t windowStart = windowStartMs_.load(std::memory_order_relaxed);
+
+  if (nowMs - windowStart >= RATE_WINDOW_MS &&
+      windowStartMs_.compare_exchange_strong(windowStart, nowMs, std::memory_order_relaxed))
+  {
+    printed_.store(0, std::memory_order_relaxed);
+  }
+
+  if (printed_.fetch_add(1, std::memory_order_relaxed) >= MAX_PRINTS_PER_WINDOW)
+  {
+    suppressed_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+  suppressed = suppressed_.exchange(0, std::memory_order_relaxed);
+  return true;
+}
 
 
 Logger::Logger():
-  printMutex_(),
   logFile_(),
-  triedOpeningFile_(false)
-{}
+  triedOpeningFile_(false),
+  sequence_(0),
+  queueMutex_(),
+  queueCV_(),
+  queue_(),
+  running_(true),
+  ringsMutex_(),
+  rings_(),
+  writeMutex_(),
+  writer_()
+{
+  writer_ = std::thread(&Logger::writeLoop, this);
+}
 
 
 Logger::~Logger()
 {
+  {
+    std::lock_guard<std::mutex> lock(queueMutex_);
+    running_ = false;
+    queueCV_.notify_all();
+  }
+
+  // the writer prints everything still waiting before it exits
+  if (writer_.joinable())
+  {
+    writer_.join();
+  }
+
   triedOpeningFile_ = false;
   logFile_.close();
 }
 
 std::shared_ptr<Logger> Logger::getLogger()
 {
-  if (Logger::instance_ == nullptr)
-  {
-    Logger::instance_ = std::shared_ptr<Logger>(new Logger());
-  }
-
-  return Logger::instance_;
+  // created only once even if several threads print for the first time together
+  static std::shared_ptr<Logger> instance(new Logger());
+  return instance;
 }
 
 
@@ -261,6 +364,209 @@ void Logger::printUnimplemented(const QString module, QString whatIsNotImplement
 
 void Logger::printDebug(DebugType type, QString className, QString description,
                         QStringList valueNames, QStringList values)
+{
+  if (debugLevel(type) < uvgComm_LOG_LEVEL)
+  {
+    return;
+  }
+
+  uint64_t sequence = sequence_.fetch_add(1, std::memory_order_relaxed);
+
+  {
+    std::lock_guard<std::mutex> lock(queueMutex_);
+    queue_.push_back({sequence, type, className, description, valueNames, values});
+    queueCV_.notify_one();
+  }
+
+  // errors are written before returning in case the program is about to crash
+  if (debugLevel(type) >= 2)
+  {
+    writePending();
+  }
+}
+
+
+void Logger::printFast(DebugType type, LogRateLimiter& limiter, const QObject* object,
+                       const char* description, std::initializer_list<const char*> valueNames,
+                       std::initializer_list<LogValue> values)
+{
+  // the class name is stored by Qt for the lifetime of the program
+  printFast(type, limiter, object->metaObject()->className(), description, valueNames, values);
+}
+
+
+void Logger::printFast(DebugType type, LogRateLimiter& limiter, const char* module,
+                       const char* description, std::initializer_list<const char*> valueNames,
+                       std::initializer_list<LogValue> values)
+{
+  uint32_t suppressed = 0;
+  if (!limiter.allow(steadyNowMs(), suppressed))
+  {
+    return;
+  }
+
+  LogRing* ring = threadRing();
+
+  uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+  if (tail - ring->head.load(std::memory_order_acquire) >= RING_SIZE)
+  {
+    ring->dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  FastRecord& record = ring->records[tail & (RING_SIZE - 1)];
+  record.sequence = sequence_.fetch_add(1, std::memory_order_relaxed);
+  record.type = type;
+  record.module = module;
+  record.description = description;
+  record.suppressed = suppressed;
+  record.count = 0;
+
+  auto name = valueNames.begin();
+  for (auto value = values.begin(); value != values.end() && record.count < MAX_FAST_VALUES; ++value)
+  {
+    record.names[record.count] = name != valueNames.end() ? *name++ : "";
+    record.values[record.count] = *value;
+    ++record.count;
+  }
+
+  ring->tail.store(tail + 1, std::memory_order_release);
+}
+
+
+LogRing* Logger::threadRing()
+{
+  if (!threadRingOwner.ring)
+  {
+    threadRingOwner.ring = std::make_shared<LogRing>();
+
+    std::lock_guard<std::mutex> lock(ringsMutex_);
+    rings_.push_back(threadRingOwner.ring);
+  }
+
+  return threadRingOwner.ring.get();
+}
+
+
+void Logger::writeLoop()
+{
+  std::unique_lock<std::mutex> lock(queueMutex_);
+
+  while (running_)
+  {
+    queueCV_.wait_for(lock, std::chrono::milliseconds(WRITE_INTERVAL_MS));
+
+    lock.unlock();
+    writePending();
+    lock.lock();
+  }
+
+  lock.unlock();
+  writePending();
+}
+
+
+void Logger::writePending()
+{
+  std::lock_guard<std::mutex> writeLock(writeMutex_);
+
+  std::vector<Entry> entries;
+
+  {
+    std::lock_guard<std::mutex> lock(queueMutex_);
+    entries.swap(queue_);
+  }
+
+  collectFastPrints(entries);
+
+  if (entries.empty())
+  {
+    return;
+  }
+
+  std::stable_sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b)
+  {
+    return a.sequence < b.sequence;
+  });
+
+  for (const Entry& entry : entries)
+  {
+    writeEntry(entry);
+  }
+
+  // the file is flushed once per batch instead of after every line
+  if (logFile_.isOpen())
+  {
+    logFile_.flush();
+  }
+}
+
+
+void Logger::collectFastPrints(std::vector<Entry>& entries)
+{
+  std::lock_guard<std::mutex> lock(ringsMutex_);
+
+  for (auto ring = rings_.begin(); ring != rings_.end();)
+  {
+    // checked before emptying, so nothing can be added after the last check
+    bool closed = (*ring)->closed.load(std::memory_order_acquire);
+
+    uint64_t head = (*ring)->head.load(std::memory_order_relaxed);
+    uint64_t tail = (*ring)->tail.load(std::memory_order_acquire);
+
+    for (; head != tail; ++head)
+    {
+      const FastRecord& record = (*ring)->records[head & (RING_SIZE - 1)];
+
+      Entry entry = {record.sequence, record.type, QString::fromLatin1(record.module),
+                     QString::fromUtf8(record.description), {}, {}};
+
+      for (int i = 0; i < record.count; ++i)
+      {
+        entry.valueNames.push_back(QString::fromUtf8(record.names[i]));
+
+        if (record.values[i].isReal)
+        {
+          entry.values.push_back(QString::number(record.values[i].real));
+        }
+        else
+        {
+          entry.values.push_back(QString::number(record.values[i].integer));
+        }
+      }
+
+      if (record.suppressed > 0)
+      {
+        entry.valueNames.push_back("Suppressed prints");
+        entry.values.push_back(QString::number(record.suppressed));
+      }
+
+      entries.push_back(std::move(entry));
+    }
+
+    (*ring)->head.store(head, std::memory_order_release);
+
+    uint32_t dropped = (*ring)->dropped.exchange(0, std::memory_order_relaxed);
+    if (dropped > 0)
+    {
+      entries.push_back({sequence_.fetch_add(1, std::memory_order_relaxed), DEBUG_WARNING,
+                         "Logger", "Print buffer of a thread was full, dropped prints",
+                         {"Dropped"}, {QString::number(dropped)}});
+    }
+
+    if (closed)
+    {
+      ring = rings_.erase(ring);
+    }
+    else
+    {
+      ++ring;
+    }
+  }
+}
+
+
+void Logger::writeEntry(const Entry& entry)
 {
   PrintSet print;
 
@@ -271,46 +577,51 @@ void Logger::printDebug(DebugType type, QString className, QString description,
 
   // This could be reduced, but it might change so not worth probably at the moment.
   // Choose which text to print based on type.
-  switch (type) {
+  switch (entry.type) {
   case DEBUG_NORMAL:
   {
-    createPrintSet(print, className, description, valueNames, values);
+    createPrintSet(print, entry.className, entry.description, entry.valueNames, entry.values);
     printHelper(black, print);
     break;
   }
   case DEBUG_IMPORTANT:
   {
-    createPrintSet(print, className, description, valueNames, values);
+    createPrintSet(print, entry.className, entry.description, entry.valueNames, entry.values);
     printHelper(blue, print, true);
     break;
   }
   case DEBUG_ERROR:
   {
-    createPrintSet(print, className, "ERROR! " + description, valueNames, values);
+    createPrintSet(print, entry.className, "ERROR! " + entry.description,
+                   entry.valueNames, entry.values);
     printHelper(red, print);
     break;
   }
   case DEBUG_WARNING:
   {
-    createPrintSet(print, className, "Warning! " + description, valueNames, values);
+    createPrintSet(print, entry.className, "Warning! " + entry.description,
+                   entry.valueNames, entry.values);
     printHelper(yellow, print);
     break;
   }
   case DEBUG_PEER_ERROR:
   {
-    createPrintSet(print, className, "PEER ERROR: " + description, valueNames, values);
+    createPrintSet(print, entry.className, "PEER ERROR: " + entry.description,
+                   entry.valueNames, entry.values);
     printHelper(red, print);
     break;
   }
   case DEBUG_PROGRAM_ERROR:
   {
-    createPrintSet(print, className, "BUG: " + description, valueNames, values);
+    createPrintSet(print, entry.className, "BUG: " + entry.description,
+                   entry.valueNames, entry.values);
     printHelper(red, print);
     break;
   }
   case DEBUG_PROGRAM_WARNING:
   {
-    createPrintSet(print, className, "Minor bug: " + description, valueNames, values);
+    createPrintSet(print, entry.className, "Minor bug: " + entry.description,
+                   entry.valueNames, entry.values);
     printHelper(yellow, print);
     break;
   }
@@ -408,8 +719,7 @@ void Logger::createPrintSet(PrintSet& set, QString className, QString descriptio
 
 void Logger::printHelper(QString color, PrintSet &set, bool emphasize)
 {
-  printMutex_.lock();
-
+  // only called with the write mutex held
   if (!triedOpeningFile_ && !logFile_.isOpen())
   {
     if (!openFileStream())
@@ -422,6 +732,8 @@ void Logger::printHelper(QString color, PrintSet &set, bool emphasize)
 
   // One additional line is added to printing when printing is destroyed
   QDebug printing = qDebug().nospace().noquote();
+
+  // the file is flushed by writePending after the whole batch
   QTextStream fileStream(&logFile_);
 
   QString longBar = "=============================================================================";
@@ -430,20 +742,14 @@ void Logger::printHelper(QString color, PrintSet &set, bool emphasize)
   {
 #if QT_VERSION < QT_VERSION_CHECK(5, 14, 0)
     printing << color << endl << longBar << endl;
-    fileStream << endl << longBar << endl;
 #else
     printing << color << Qt::endl << longBar << Qt::endl;
-    fileStream << Qt::endl << longBar << Qt::endl;
 #endif
+    fileStream << "\n" << longBar << "\n";
   }
 
   printing << color << set.firstLine;
-
-#if QT_VERSION < QT_VERSION_CHECK(5, 14, 0)
-  fileStream << set.firstLine << endl;
-#else
-  fileStream << set.firstLine << Qt::endl;
-#endif
+  fileStream << set.firstLine << "\n";
 
   if (!set.additionalLines.empty() || emphasize)
   {
@@ -458,38 +764,30 @@ void Logger::printHelper(QString color, PrintSet &set, bool emphasize)
   {
 #if QT_VERSION < QT_VERSION_CHECK(5, 14, 0)
     printing << additionalLine << endl;
-    fileStream  << additionalLine << endl;
 #else
     printing << additionalLine << Qt::endl;
-    fileStream  << additionalLine << Qt::endl;
 #endif
+    fileStream  << additionalLine << "\n";
   }
 
   if (!set.additionalLines.empty())
   {
-#if QT_VERSION < QT_VERSION_CHECK(5, 14, 0)
-    fileStream << endl;
-#else
-    fileStream << Qt::endl;
-#endif
-
+    fileStream << "\n";
   }
 
   if (emphasize)
   {
 #if QT_VERSION < QT_VERSION_CHECK(5, 14, 0)
     printing << color << longBar << endl;
-    fileStream << longBar << endl << endl;
 #else
     printing << color << longBar << Qt::endl;
-    fileStream << longBar << Qt::endl << Qt::endl;
 #endif
+    fileStream << longBar << "\n\n";
   }
 
   // make sure we reset the color back to previous color
   QString blackColor = "\033[0m";
   printing << blackColor;
-  printMutex_.unlock();
 }
 
 
@@ -8,12 +8,102 @@
 #include <QFile>
 #include <QTextStream>
 
+#include <atomic>
+#include <condition_variable>
+#include <initializer_list>
 #include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
 
 enum DebugType{DEBUG_NORMAL, DEBUG_IMPORTANT, DEBUG_ERROR, DEBUG_WARNING,
                DEBUG_PEER_ERROR, DEBUG_PROGRAM_ERROR, DEBUG_PROGRAM_WARNING};
 
-// A singleton class. Used to uniformalize debug prints across uvgComm
+// Prints below this level are compiled out: 0 prints everything, 1 warnings
+// and errors, 2 only errors and 3 nothing.
+#ifndef uvgComm_LOG_LEVEL
+#define uvgComm_LOG_LEVEL 0
+#endif
+
+constexpr int debugLevel(DebugType type)
+{
+  return (type == DEBUG_NORMAL || type == DEBUG_IMPORTANT) ? 0 :
+         (type == DEBUG_WARNING || type == DEBUG_PROGRAM_WARNING) ? 1 : 2;
+}
+
+// A value of a fast print. Only numbers are accepted, so nothing has to be
+// allocated or formatted by the printing thread.
+struct LogValue
+{
+  LogValue() = default;
+
+  template <typename T, typename = std::enable_if_t<std::is_arithmetic<T>::value>>
+  LogValue(T value):
+    isReal(std::is_floating_point<T>::value),
+    integer((int64_t)value),
+    real((double)value)
+  {}
+
+  bool isReal = false;
+  int64_t integer = 0;
+  double real = 0.0;
+};
+
+// Limits how often one print statement is printed. The prints left out are
+// counted and the count is shown with the next print that gets through.
+class LogRateLimiter
+{
+public:
+  // returns false if the print should be left out
+  bool allow(int64_t nowMs, uint32_t& suppressed);
+
+private:
+  std::atomic<int64_t> windowStartMs_{0};
+  std::atomic<uint32_t> printed_{0};
+  std::atomic<uint32_t> suppressed_{0};
+};
+
+// Prints for hot paths that may run for every packet or frame. The calling
+// thread only stores a record of the arguments, and formatting and writing are
+// done by the logger thread. The module, description and value names must be
+// string literals. Each call site is limited to a few prints per second.
+#define LOG_FAST(type, module, description, ...) \
+  do \
+  { \
+    static LogRateLimiter uvgCommLogLimiter; \
+    Logger::getLogger()->printFast(type, uvgCommLogLimiter, module, description, ##__VA_ARGS__); \
+  } while (false)
+
+#define LOG_DISABLED() do {} while (false)
+
+#if uvgComm_LOG_LEVEL <= 0
+#define LOG_FAST_NORMAL(module, description, ...) \
+  LOG_FAST(DEBUG_NORMAL, module, description, ##__VA_ARGS__)
+#else
+#define LOG_FAST_NORMAL(module, description, ...) LOG_DISABLED()
+#endif
+
+#if uvgComm_LOG_LEVEL <= 1
+#define LOG_FAST_WARNING(module, description, ...) \
+  LOG_FAST(DEBUG_WARNING, module, description, ##__VA_ARGS__)
+#else
+#define LOG_FAST_WARNING(module, description, ...) LOG_DISABLED()
+#endif
+
+#if uvgComm_LOG_LEVEL <= 2
+#define LOG_FAST_ERROR(module, description, ...) \
+  LOG_FAST(DEBUG_ERROR, module, description, ##__VA_ARGS__)
+#else
+#define LOG_FAST_ERROR(module, description, ...) LOG_DISABLED()
+#endif
+
+struct LogRing;
+
+// A singleton class. Used to uniformalize debug prints across uvgComm. The
+// prints are formatted and written by a logger thread, so printing does not
+// wait for the terminal or the log file. Errors are written before the print
+// returns.
 
 class Logger
 {
@@ -112,6 +202,15 @@ public:
   bool checkError(QObject* object, bool check, DebugType type = DEBUG_ERROR,
                   QString description = "", QStringList values = {});
 
+  // Use through the LOG_FAST macros. The record is dropped if the ring of
+  // this thread is full, and the drops are reported by the logger thread.
+  void printFast(DebugType type, LogRateLimiter& limiter, const QObject* object,
+                 const char* description, std::initializer_list<const char*> valueNames = {},
+                 std::initializer_list<LogValue> values = {});
+  void printFast(DebugType type, LogRateLimiter& limiter, const char* module,
+                 const char* description, std::initializer_list<const char*> valueNames = {},
+                 std::initializer_list<LogValue> values = {});
+
 private:
 
   Logger();
@@ -143,11 +242,44 @@ private:
 
   bool openFileStream();
 
+  // a print waiting for the logger thread
+  struct Entry
+  {
+    uint64_t sequence;
+    DebugType type;
+    QString className;
+    QString description;
+    QStringList valueNames;
+    QStringList values;
+  };
 
-  static std::shared_ptr<Logger> instance_;
+  void writeLoop();
+  void writePending();
+  void writeEntry(const Entry& entry);
+
+  // moves the records of the fast prints from the thread rings to entries
+  void collectFastPrints(std::vector<Entry>& entries);
+
+  LogRing* threadRing();
 
-  QMutex printMutex_;
   QFile logFile_;
 
   bool triedOpeningFile_;
+
+  // orders the prints of different threads
+  std::atomic<uint64_t> sequence_;
+
+  std::mutex queueMutex_;
+  std::condition_variable queueCV_;
+  std::vector<Entry> queue_;
+  bool running_;
+
+  std::mutex ringsMutex_;
+  std::vector<std::shared_ptr<LogRing>> rings_;
+
+  // Held while writing, so error prints can be written by the printing
+  // thread. Also makes it the only reader of the thread rings.
+  std::mutex writeMutex_;
+
+  std::thread writer_;
 };
@@ -9,6 +9,8 @@
 #include "udpsender.h"
 #include "udpreceiver.h"
 
+#include "media/resourceallocator.h"
+
 #include <QtEndian>
 #include <QHostInfo>
 #include <QCoreApplication>
@@ -357,11 +359,19 @@ std::shared_ptr<RelayInterface> Delivery::getUDPRelay(QString localAddress, uint
 
   if (relays_.find(relayKey) == relays_.end())
   {
-    Logger::getLogger()->printNormal(this, "Creating new UDP relay", "Local socket", relayKey);
+    // the SFU can receive with one thread per core
+    QSettings settings(getSettingsFile(), settingsFileFormat);
+    unsigned int workers = settings.value(SettingsKey::mediaRelayWorkers, 1).toUInt();
+
+    Logger::getLogger()->printNormal(this, "Creating new UDP relay",
+                                     {"Local socket", "Receive workers"},
+                                     {relayKey, QString::number(workers)});
 
     // Create a UVGRelay shared_ptr first so we can connect its signal, then
     // store it as a RelayInterface.
-    std::shared_ptr<UVGRelay> tmp = std::make_shared<UVGRelay>(localAddress.toStdString(), localPort);
+    std::shared_ptr<UVGRelay> tmp = std::make_shared<UVGRelay>(localAddress.toStdString(), localPort,
+                                                               hwResources_->getBufferPool(), stats_,
+                                                               workers);
     connect(tmp.get(), &UVGRelay::rtcpAppPacketReceived,
             this, &Delivery::rtcpAppPacketReceived);
     relays_[relayKey] = std::static_pointer_cast<RelayInterface>(tmp);
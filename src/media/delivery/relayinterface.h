@@ -1,5 +1,7 @@
 #pragma once
 
+#include "media/processing/databuffer.h"
+
 #include <string>
 #include <memory>
 
@@ -10,6 +12,16 @@ struct sockaddr_in6;
 
 class Filter;
 
+// one packet of a batch, the addresses must stay valid until the batch is sent
+struct UDPPacket
+{
+  const sockaddr_in* dest_addr;
+  const sockaddr_in6* dest_addr6;
+
+  DataBuffer data;
+  uint32_t size;
+};
+
 class RelayInterface
 {
 public:
@@ -26,15 +38,24 @@ public:
   virtual void registerRTPReceiver(uint32_t ssrc, std::shared_ptr<Filter> filter) = 0;
   virtual void registerRTCPReceiver(uint32_t ssrc, std::shared_ptr<Filter> filter) = 0;
 
+  // removes both the RTP and RTCP receivers of the SSRC
+  virtual void unregisterReceivers(uint32_t ssrc) = 0;
+
+  // the payload may be shared with other senders, it is only read
   virtual void sendUDPData(std::string destinationAddress, uint16_t port,
-                   std::unique_ptr<unsigned char[]> data, uint32_t size) = 0;
+                   DataBuffer data, uint32_t size) = 0;
 
   virtual void sendUDPData(sockaddr_in &dest_addr,
                            sockaddr_in6 &dest_addr6,
-                           std::unique_ptr<unsigned char[]> data,
+                           DataBuffer data,
                            uint32_t size) = 0;
 
   virtual void sendUDPData(sockaddr_in &dest_addr,
                            sockaddr_in6 &dest_addr6,
                            std::vector<std::vector<std::pair<size_t, uint8_t *>>>& buffers) = 0;
+
+  // Sends all packets with as few system calls as possible. Consecutive
+  // packets to the same destination should have the same size (except the
+  // last one) so they can be segmented by the kernel.
+  virtual void sendUDPData(std::vector<UDPPacket>& packets) = 0;
 };
@@ -0,0 +1,181 @@
+#include "rtpaudiopacketizer.h"
+
+#include "common.h"
+#include "logger.h"
+
+#include <QRandomGenerator>
+
+#include <algorithm>
+#include <cstring>
+
+constexpr uint32_t RTP_HEADER_SIZE = 12;
+constexpr uint8_t RTP_VERSION = 2;
+
+// the first dynamic payload type, used until the real one is known
+constexpr uint8_t DEFAULT_PAYLOAD_TYPE = 96;
+
+// after a longer pause the timestamp follows the wall clock and the marker starts a talkspurt
+constexpr int64_t TALKSPURT_GAP_MS = 100;
+
+namespace
+{
+uint16_t readUint16(const uint8_t* bytes)
+{
+  return (uint16_t)((bytes[0] << 8) | bytes[1]);
+}
+
+uint32_t readUint32(const uint8_t* bytes)
+{
+  return ((uint32_t)bytes[0] << 24) | ((uint32_t)bytes[1] << 16) |
+         ((uint32_t)bytes[2] << 8)  |  (uint32_t)bytes[3];
+}
+
+void writeUint32(uint8_t* bytes, uint32_t value)
+{
+  bytes[0] = (uint8_t)(value >> 24);
+  bytes[1] = (uint8_t)(value >> 16);
+  bytes[2] = (uint8_t)(value >> 8);
+  bytes[3] = (uint8_t)value;
+}
+}
+
+
+RTPAudioDepacketizer::RTPAudioDepacketizer(QString id, StatisticsInterface* stats,
+                                           std::shared_ptr<ResourceAllocator> hwResources,
+                                           DataType type):
+  Filter(id, "RTP Depacketizer", stats, hwResources, DT_RTP, type)
+{
+  taskCompatible_ = true;
+}
+
+
+void RTPAudioDepacketizer::process()
+{
+  std::unique_ptr<Data> input = getInput();
+
+  while (input)
+  {
+    const uint8_t* packet = input->data.get();
+    uint32_t end = input->data_size;
+
+    if (packet == nullptr || end < RTP_HEADER_SIZE || (packet[0] >> 6) != RTP_VERSION)
+    {
+      Logger::getLogger()->printWarning(this, "Received an invalid RTP packet",
+                                        "Size", QString::number(end));
+      input = getInput();
+      continue;
+    }
+
+    // RFC 3550 section 5.1
+    uint32_t offset = RTP_HEADER_SIZE + 4*(packet[0] & 0x0F);
+
+    if ((packet[0] & 0x10) && offset + 4 <= end)
+    {
+      offset += 4 + 4*readUint16(packet + offset + 2);
+    }
+
+    if ((packet[0] & 0x20) && end > 0)
+    {
+      end -= std::min<uint32_t>(end, packet[end - 1]);
+    }
+
+    if (offset >= end)
+    {
+      input = getInput();
+      continue;
+    }
+
+    std::unique_ptr<Data> payload = initializeData(outputType(), DS_REMOTE);
+    payload->creationTimestamp = input->creationTimestamp;
+    payload->presentationTimestamp = input->presentationTimestamp;
+    payload->rtpSequence = readUint16(packet + 2);
+    payload->rtpTimestamp = readUint32(packet + 4);
+    payload->ssrc = readUint32(packet + 8);
+
+    if (payload->aInfo)
+    {
+      payload->aInfo->payloadType = packet[1] & 0x7F;
+    }
+
+    // the payload is small, so copying it is cheaper than referencing the packet
+    payload->data_size = end - offset;
+    payload->data = allocateBuffer(payload->data_size);
+    memcpy(payload->data.writable(payload->data_size), packet + offset, payload->data_size);
+
+    sendOutput(std::move(payload));
+    input = getInput();
+  }
+}
+
+
+RTPAudioPacketizer::RTPAudioPacketizer(QString id, StatisticsInterface* stats,
+                                       std::shared_ptr<ResourceAllocator> hwResources,
+                                       DataType type, uint32_t ssrc):
+  Filter(id, "RTP Packetizer", stats, hwResources, type, DT_RTP),
+  ssrc_(ssrc),
+  payloadType_(DEFAULT_PAYLOAD_TYPE),
+  sequence_((uint16_t)QRandomGenerator::global()->generate()),
+  timestamp_(initializeRtpTimestamp()),
+  lastSentMs_(-1)
+{
+  taskCompatible_ = true;
+}
+
+
+void RTPAudioPacketizer::process()
+{
+  std::unique_ptr<Data> input = getInput();
+
+  while (input)
+  {
+    int64_t now = clockNowMs();
+    bool marker = false;
+
+    if (input->aInfo && input->aInfo->payloadType != 0)
+    {
+      payloadType_ = input->aInfo->payloadType;
+    }
+
+    if (lastSentMs_ == -1 || now - lastSentMs_ > TALKSPURT_GAP_MS)
+    {
+      // nothing was sent during the pause, but the receiver measures its
+      // jitter against the timestamps
+      if (lastSentMs_ != -1)
+      {
+        timestamp_ += (uint32_t)((now - lastSentMs_)*OPUS_RTP_TIMESTAMP_RATE/1000);
+      }
+      marker = true;
+    }
+    else
+    {
+      timestamp_ = updateAudioRtpTimestamp(timestamp_);
+    }
+
+    lastSentMs_ = now;
+
+    uint32_t packetSize = RTP_HEADER_SIZE + input->data_size;
+    DataBuffer packet = allocateBuffer(packetSize);
+    uint8_t* header = packet.writable(packetSize);
+
+    header[0] = RTP_VERSION << 6;
+    header[1] = (marker ? 0x80 : 0x00) | payloadType_;
+    header[2] = (uint8_t)(sequence_ >> 8);
+    header[3] = (uint8_t)sequence_;
+    writeUint32(header + 4, timestamp_);
+    writeUint32(header + 8, ssrc_);
+    memcpy(header + RTP_HEADER_SIZE, input->data.get(), input->data_size);
+
+    std::unique_ptr<Data> output = initializeData(DT_RTP, DS_LOCAL);
+    output->creationTimestamp = input->creationTimestamp;
+    output->presentationTimestamp = input->presentationTimestamp;
+    output->rtpTimestamp = timestamp_;
+    output->rtpSequence = sequence_;
+    output->ssrc = ssrc_;
+    output->data = std::move(packet);
+    output->data_size = packetSize;
+
+    ++sequence_;
+    sendOutput(std::move(output));
+    input = getInput();
+  }
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "media/processing/filter.h"
+
+// The SFU relays RTP packets as they are. When it mixes the audio itself, the
+// audio payload is taken out of the received packets and the mixed audio is
+// put into packets of its own with these filters.
+
+class RTPAudioDepacketizer : public Filter
+{
+public:
+  RTPAudioDepacketizer(QString id, StatisticsInterface* stats,
+                       std::shared_ptr<ResourceAllocator> hwResources,
+                       DataType type);
+
+protected:
+  virtual void process() override;
+};
+
+
+class RTPAudioPacketizer : public Filter
+{
+public:
+  RTPAudioPacketizer(QString id, StatisticsInterface* stats,
+                     std::shared_ptr<ResourceAllocator> hwResources,
+                     DataType type, uint32_t ssrc);
+
+protected:
+  virtual void process() override;
+
+private:
+
+  uint32_t ssrc_;
+
+  // copied from the received packets the audio was decoded from
+  uint8_t payloadType_;
+
+  uint16_t sequence_;
+  uint32_t timestamp_;
+
+  int64_t lastSentMs_;
+};
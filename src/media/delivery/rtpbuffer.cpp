@@ -62,7 +62,9 @@ RTPBuffer::RTPBuffer(QString id, StatisticsInterface* stats,
   currentSSRC_(0),
   currentRTPTimestamp_(0),
   timestampInitialized_(false)
-{}
+{
+  taskCompatible_ = true;
+}
 
 
 void RTPBuffer::process()
@@ -73,7 +75,7 @@ void RTPBuffer::process()
   {
     if (isHybridDummyPacket(input.get()))
     {
-      Logger::getLogger()->printNormal(this, "Dropped Hybrid dummy packet in RTPBuffer", "SSRC", QString::number(input->ssrc));
+      LOG_FAST_NORMAL(this, "Dropped Hybrid dummy packet in RTPBuffer", {"SSRC"}, {input->ssrc});
       input = getInput();
       continue;
     }
@@ -95,21 +97,21 @@ void RTPBuffer::process()
 
       if (timestampInitialized_ && oldPacket)
       {
-        Logger::getLogger()->printWarning(this, "Discarding stale buffered packet during SSRC transition",
-                                          {"CurrentTS", "IncomingTS"},
-                                          {QString::number(currentRTPTimestamp_), QString::number(buffer_.back()->rtpTimestamp)});
+        LOG_FAST_WARNING(this, "Discarding stale buffered packet during SSRC transition",
+                         {"CurrentTS", "IncomingTS"},
+                         {currentRTPTimestamp_, buffer_.back()->rtpTimestamp});
         buffer_.pop_back();
       }
       else if (timestampInitialized_ && !caughtUp && !bufferFull)
       {
-        Logger::getLogger()->printNormal(this, "Buffering RTP packets due to SSRC change",
-                                         "RTP Diff", QString::number(rtpTimestampDiffForward(currentRTPTimestamp_, buffer_.front()->rtpTimestamp)));
+        LOG_FAST_NORMAL(this, "Buffering RTP packets due to SSRC change",
+                        {"RTP Diff"}, {rtpTimestampDiffForward(currentRTPTimestamp_, buffer_.front()->rtpTimestamp)});
       }
       else if (timestampInitialized_ && !caughtUp && bufferFull && !isIntra && buffer_.size() < MAX_BUFFER_SIZE*2)
       {
-        Logger::getLogger()->printWarning(this, "Waiting for intra NAL unit to release buffer",
-                                          {"BufferedPackets", "TargetSSRC"},
-                                          {QString::number(buffer_.size()), QString::number(buffer_.front()->ssrc)});
+        LOG_FAST_WARNING(this, "Waiting for intra NAL unit to release buffer",
+                         {"BufferedPackets", "TargetSSRC"},
+                         {buffer_.size(), buffer_.front()->ssrc});
       }
       else if (timestampInitialized_ && !caughtUp && bufferFull && (isIntra || buffer_.size() >= MAX_BUFFER_SIZE*2))
       {
@@ -1,7 +1,5 @@
 #include "udpsender.h"
 
-#include "media/delivery/relayinterface.h"
-
 #include "logger.h"
 
 #include <QDateTime>
@@ -23,6 +21,9 @@
 #include <arpa/inet.h>
 #endif
 
+// the maximum number of packets sent with one call
+const size_t MAX_BATCH_PACKETS = 256;
+
 
 UDPSender::UDPSender(QString id,
                      StatisticsInterface *stats,
@@ -66,9 +67,9 @@ UDPSender::~UDPSender()
 }
 
 
-bool UDPSender::lastFragment(std::unique_ptr<uchar[]>& data)
+bool UDPSender::lastFragment(const DataBuffer& data)
 {
-  return (data[1] >> 7) & 0x01;
+  return (data.get()[1] >> 7) & 0x01;
 }
 
 
@@ -77,41 +78,30 @@ void UDPSender::process()
   std::unique_ptr<Data> input = getInput();
 
   while (input)
-  { 
-    /*
-    TODO: uvgRTP does not always set marker bit correctly
-    if (fragments_.empty() && lastFragment(input->data))
+  {
+    bool last = lastFragment(input->data);
+    packets_.push_back({&dest_addr_, &dest_addr6_, std::move(input->data), input->data_size});
+
+    if (last || packets_.size() >= MAX_BATCH_PACKETS)
     {
-      // no need to fragment
-      relay_->sendUDPData(dest_addr_, dest_addr6_, std::move(input->data), input->data_size);
+      flushPackets();
     }
-    else if (lastFragment(input->data))
-    {
-      fragments_.push_back(std::move(input));
-
-      std::vector<std::vector<std::pair<size_t, uint8_t *>>> fragments;
 
-      for(auto& fragment : fragments_)
-      {
-        std::vector<std::pair<size_t, uint8_t *>> frag;
-        frag.push_back(std::make_pair(fragment->data_size, fragment->data.get()));
-        fragments.push_back(frag);
-      }
+    input = getInput();
+  }
 
-      // send all fragments
-      relay_->sendUDPData(dest_addr_, dest_addr6_, fragments);
-      fragments_.clear();
-    }
-    else
-    {
-      fragments_.push_back(std::move(input));
-    }
-    */
+  // uvgRTP does not always set the marker bit correctly, so whatever we have
+  // is sent once there is no more input
+  flushPackets();
+}
 
-    // remove if above optimization is enabled
-    relay_->sendUDPData(dest_addr_, dest_addr6_, std::move(input->data), input->data_size);
 
-    input = getInput();
+void UDPSender::flushPackets()
+{
+  if (!packets_.empty())
+  {
+    relay_->sendUDPData(packets_);
+    packets_.clear();
   }
 }
 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "media/processing/filter.h"
+#include "media/delivery/relayinterface.h"
 
 #include <QTimer>
 
@@ -27,7 +28,10 @@ protected:
 
 private:
 
-  bool lastFragment(std::unique_ptr<uchar[]>& data);
+  bool lastFragment(const DataBuffer& data);
+
+  // sends the collected packets in one batch
+  void flushPackets();
 
   std::string destination_;
   int port_;
@@ -38,6 +42,7 @@ private:
   sockaddr_in dest_addr_ = {};
   sockaddr_in6 dest_addr6_ = {};
 
-  std::vector<std::unique_ptr<Data>> fragments_;
+  // fragments of the current frame
+  std::vector<UDPPacket> packets_;
 };
 
@@ -1,7 +1,9 @@
 #include "uvgrelay.h"
 
 #include "src/media/processing/filter.h"
+#include "src/media/processing/bufferpool.h"
 
+#include "statisticsinterface.h"
 #include "common.h"
 #include "logger.h"
 
@@ -11,7 +13,17 @@
 #include <errno.h>
 #include <poll.h>
 #include <pthread.h>
-#else
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#endif
+
+#ifdef __linux__
+#include <sched.h>
+#include <linux/filter.h>
+#endif
+
+#ifdef _WIN32
 #define MSG_DONTWAIT 0
 #endif
 
@@ -19,58 +31,148 @@ const int POLL_TIMEOUT_MS = 200;
 
 const int BUFFER_SIZE = 1500;
 
-UVGRelay::UVGRelay(std::string localAddress, uint16_t port):
+// maximum number of packets read with one system call
+const int RECEIVE_BATCH_SIZE = 32;
+
+// packets waiting for processing, must be a power of two
+const uint32_t PACKET_QUEUE_SIZE = 4096;
+
+const int64_t STATISTICS_INTERVAL_MS = 1000;
+
+// pins the calling thread to one core so its receive queue and routing stay cache hot
+static void setThreadAffinity(size_t worker)
+{
+#ifdef __linux__
+  unsigned int cores = std::thread::hardware_concurrency();
+  if (cores == 0)
+  {
+    return;
+  }
+
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  CPU_SET(worker % cores, &cpus);
+  pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpus);
+#else
+  Q_UNUSED(worker);
+#endif
+}
+
+// limits of one segmented send
+const size_t MAX_SEGMENTS = 64;
+const uint32_t MAX_SEGMENTED_BYTES = 65000;
+
+UVGRelay::UVGRelay(std::string localAddress, uint16_t port, std::shared_ptr<BufferPool> pool,
+                   StatisticsInterface *stats, unsigned int receiveWorkers):
+  routes_(std::make_shared<RoutingTable>()),
+  routesMutex_(),
   socket_(0),
+  localAddress_(localAddress),
+  port_(port),
+  workers_(),
+  pool_(pool),
+  stats_(stats),
   running_(false),
   ipv6_(false),
-  processingRunning_(false)
+  segmentation_(false),
+  packetQueue_(PACKET_QUEUE_SIZE),
+  queueHead_(0),
+  queueTail_(0),
+  queueMutex_(),
+  queueCV_(),
+  processingSleeping_(false),
+  processingRunning_(false),
+  droppedPackets_(0),
+  lastReport_(0)
 {
   // check if the local address is IPv4 or IPv6
-  if (localAddress.find(':') != std::string::npos)
+  ipv6_ = localAddress.find(':') != std::string::npos;
+  if (ipv6_)
   {
     Logger::getLogger()->printNormal(this, "IPv6 address detected");
-    socket_.init(AF_INET6, SOCK_DGRAM, 0);
-
-    sockaddr_in6 local_addr;
-    local_addr.sin6_family = AF_INET6;
-    local_addr.sin6_port = htons(port);
-    inet_pton(AF_INET6, localAddress.c_str(), &local_addr.sin6_addr);
-    ipv6_ = true;
-    socket_.bind_ip6(local_addr);
-
   }
   else
   {
     Logger::getLogger()->printNormal(this, "IPv4 address detected");
-    socket_.init(AF_INET, SOCK_DGRAM, 0);
-    ipv6_ = false;
-    sockaddr_in local_addr;
-    local_addr.sin_family = AF_INET;
-    local_addr.sin_port = htons(port);
-    inet_pton(AF_INET, localAddress.c_str(), &local_addr.sin_addr);
+  }
 
-    socket_.bind(local_addr);
+#ifndef __linux__
+  if (receiveWorkers > 1)
+  {
+    Logger::getLogger()->printWarning(this, "Multiple receive workers are only supported on Linux");
+    receiveWorkers = 1;
   }
+#endif
 
-  /* Set the default UDP send/recv buffer sizes to 4MB as on Windows
-     * the default size is way too small for a larger video conference */
-  int buf_size = 4 * 1024 * 1024;
+  if (receiveWorkers == 0)
+  {
+    receiveWorkers = 1;
+  }
 
-  if (socket_.setsockopt(SOL_SOCKET, SO_SNDBUF, (const char*)&buf_size, sizeof(int)) != RTP_OK ||
-      socket_.setsockopt(SOL_SOCKET, SO_RCVBUF, (const char*)&buf_size, sizeof(int)) != RTP_OK)
+  // all sockets of the group must be bound before packets are divided between them
+  workers_.push_back(std::make_unique<ReceiveWorker>());
+  workers_.back()->socket = &socket_;
+  if (!bindSocket(socket_, receiveWorkers > 1))
   {
-    Logger::getLogger()->printError(this, "Failed to set the UDP buffer sizes");
+    Logger::getLogger()->printError(this, "Failed to bind relay socket");
+
+    // the workers would not share a port with the first socket
+    receiveWorkers = 1;
+  }
+
+  for (unsigned int i = 1; i < receiveWorkers; ++i)
+  {
+    std::unique_ptr<ReceiveWorker> worker = std::make_unique<ReceiveWorker>();
+    worker->ownSocket = std::make_unique<uvgrtp::socket>(0);
+
+    if (!bindSocket(*worker->ownSocket, true))
+    {
+      Logger::getLogger()->printError(this, "Failed to create receive worker socket");
+      break;
+    }
+
+    worker->socket = worker->ownSocket.get();
+    workers_.push_back(std::move(worker));
+  }
+
+  if (workers_.size() > 1 && !attachShardingFilter())
+  {
+    // the kernel divides packets by source address which usually keeps one SSRC in one worker
+    Logger::getLogger()->printWarning(this, "Failed to shard receive workers by SSRC");
   }
+
+#if defined(__linux__) && defined(UDP_SEGMENT)
+  // setting the segment size to zero does nothing, but tells whether the kernel supports GSO
+  int segmentSize = 0;
+  segmentation_ = socket_.setsockopt(SOL_UDP, UDP_SEGMENT, (const char*)&segmentSize,
+                                     sizeof(int)) == RTP_OK;
+#endif
+
+  Logger::getLogger()->printNormal(this, "UDP relay created",
+                                   {"Receive workers", "UDP segmentation offload"},
+                                   {QString::number(workers_.size()),
+                                    segmentation_ ? "yes" : "no"});
 }
 
 
 UVGRelay::~UVGRelay()
 {
+  running_ = false;
+  for (auto& worker : workers_)
+  {
+    if (worker->thread.joinable())
+    {
+      worker->thread.join();
+    }
+  }
+
   // Stop the processing thread if it's running
   if (processingRunning_)
   {
+    queueMutex_.lock();
     processingRunning_ = false;
     queueCV_.notify_all();
+    queueMutex_.unlock();
     if (processingThread_.joinable())
     {
       processingThread_.join();
@@ -79,20 +181,130 @@ UVGRelay::~UVGRelay()
 }
 
 
+bool UVGRelay::bindSocket(uvgrtp::socket& socket, bool reusePort)
+{
+  socket.init(ipv6_ ? AF_INET6 : AF_INET, SOCK_DGRAM, 0);
+
+#ifdef SO_REUSEPORT
+  int enable = 1;
+  if (reusePort &&
+      socket.setsockopt(SOL_SOCKET, SO_REUSEPORT, (const char*)&enable, sizeof(int)) != RTP_OK)
+  {
+    Logger::getLogger()->printError(this, "Failed to set SO_REUSEPORT");
+    return false;
+  }
+#else
+  Q_UNUSED(reusePort);
+#endif
+
+  rtp_error_t ret = RTP_OK;
+  if (ipv6_)
+  {
+    sockaddr_in6 local_addr = {};
+    local_addr.sin6_family = AF_INET6;
+    local_addr.sin6_port = htons(port_);
+    inet_pton(AF_INET6, localAddress_.c_str(), &local_addr.sin6_addr);
+    ret = socket.bind_ip6(local_addr);
+  }
+  else
+  {
+    sockaddr_in local_addr = {};
+    local_addr.sin_family = AF_INET;
+    local_addr.sin_port = htons(port_);
+    inet_pton(AF_INET, localAddress_.c_str(), &local_addr.sin_addr);
+    ret = socket.bind(local_addr);
+  }
+
+  if (ret != RTP_OK)
+  {
+    return false;
+  }
+
+  /* Set the default UDP send/recv buffer sizes to 4MB as on Windows
+     * the default size is way too small for a larger video conference */
+  int buf_size = 4 * 1024 * 1024;
+
+  if (socket.setsockopt(SOL_SOCKET, SO_SNDBUF, (const char*)&buf_size, sizeof(int)) != RTP_OK ||
+      socket.setsockopt(SOL_SOCKET, SO_RCVBUF, (const char*)&buf_size, sizeof(int)) != RTP_OK)
+  {
+    Logger::getLogger()->printError(this, "Failed to set the UDP buffer sizes");
+  }
+
+  return true;
+}
+
+
+bool UVGRelay::attachShardingFilter()
+{
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+  // The program sees the UDP payload and returns the index of the socket in
+  // the order they were bound. RTCP is sharded by the sender SSRC and RTP by
+  // the SSRC so each receiver filter gets all its packets from one thread.
+  sock_filter code[] = {
+    { BPF_LD  | BPF_B   | BPF_ABS, 0, 0, 1 },   // A = packet type byte
+    { BPF_JMP | BPF_JGE | BPF_K,   0, 3, 200 }, // RTP if below 200
+    { BPF_JMP | BPF_JGT | BPF_K,   2, 0, 206 }, // RTP if above 206
+    { BPF_LD  | BPF_W   | BPF_ABS, 0, 0, 4 },   // A = RTCP sender SSRC
+    { BPF_JMP | BPF_JA,            0, 0, 1 },
+    { BPF_LD  | BPF_W   | BPF_ABS, 0, 0, 8 },   // A = RTP SSRC
+    { BPF_ALU | BPF_MOD | BPF_K,   0, 0, (uint32_t)workers_.size() },
+    { BPF_RET | BPF_A,             0, 0, 0 }
+  };
+
+  sock_fprog program = {};
+  program.len = sizeof(code)/sizeof(code[0]);
+  program.filter = code;
+
+  return socket_.setsockopt(SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program,
+                            sizeof(program)) == RTP_OK;
+#else
+  return false;
+#endif
+}
+
+
+std::shared_ptr<const UVGRelay::RoutingTable> UVGRelay::loadRoutes() const
+{
+  return std::atomic_load(&routes_);
+}
+
+
+void UVGRelay::publishRoutes(std::shared_ptr<const RoutingTable> routes)
+{
+  std::atomic_store(&routes_, routes);
+}
+
+
 void UVGRelay::registerRTPReceiver(uint32_t ssrc, std::shared_ptr<Filter> filter)
 {
-  rtpReceivers_[ssrc] = filter;
+  std::lock_guard<std::mutex> lock(routesMutex_);
+  std::shared_ptr<RoutingTable> routes = std::make_shared<RoutingTable>(*loadRoutes());
+  routes->rtp[ssrc] = filter;
+  publishRoutes(routes);
 }
 
 
 void UVGRelay::registerRTCPReceiver(uint32_t ssrc, std::shared_ptr<Filter> filter)
 {
-  rtcpReceivers_[ssrc] = filter;
+  std::lock_guard<std::mutex> lock(routesMutex_);
+  std::shared_ptr<RoutingTable> routes = std::make_shared<RoutingTable>(*loadRoutes());
+  routes->rtcp[ssrc] = filter;
+  publishRoutes(routes);
+}
+
+
+void UVGRelay::unregisterReceivers(uint32_t ssrc)
+{
+  std::lock_guard<std::mutex> lock(routesMutex_);
+  std::shared_ptr<RoutingTable> routes = std::make_shared<RoutingTable>(*loadRoutes());
+  routes->rtp.erase(ssrc);
+  routes->rtcp.erase(ssrc);
+  publishRoutes(routes);
 }
 
 
 void UVGRelay::sendUDPData(std::string destinationAddress, uint16_t port,
-                           std::unique_ptr<unsigned char[]> data, uint32_t size)
+                           DataBuffer data, uint32_t size)
 {
   sockaddr_in dest_addr = {};
   sockaddr_in6 dest_addr6 = {};
@@ -110,14 +322,15 @@ void UVGRelay::sendUDPData(std::string destinationAddress, uint16_t port,
     inet_pton(AF_INET, destinationAddress.c_str(), &dest_addr.sin_addr);
   }
 
-  socket_.sendto(dest_addr, dest_addr6, data.get(), size, 0);
+  sendUDPData(dest_addr, dest_addr6, std::move(data), size);
 }
 
 
 void UVGRelay::sendUDPData(sockaddr_in& dest_addr, sockaddr_in6& dest_addr6,
-                           std::unique_ptr<unsigned char[]> data, uint32_t size)
+                           DataBuffer data, uint32_t size)
 {
-  socket_.sendto(dest_addr, dest_addr6, data.get(), size, 0);
+  // the socket has no send handlers installed so it does not modify the shared payload
+  socket_.sendto(dest_addr, dest_addr6, const_cast<uint8_t*>(data.get()), size, 0);
 }
 
 
@@ -130,14 +343,195 @@ void UVGRelay::sendUDPData(sockaddr_in& dest_addr,
 }
 
 
+void UVGRelay::sendUDPData(std::vector<UDPPacket>& packets)
+{
+  sendBatch(packets, 0);
+}
+
+
+void UVGRelay::sendBatch(std::vector<UDPPacket>& packets, size_t first)
+{
+  if (first >= packets.size())
+  {
+    return;
+  }
+
+#ifdef __linux__
+  std::vector<iovec> vectors(packets.size() - first);
+  std::vector<mmsghdr> messages;
+  messages.reserve(vectors.size());
+
+  // index of the first packet of each message
+  std::vector<size_t> firstPackets;
+  firstPackets.reserve(vectors.size());
+
+#ifdef UDP_SEGMENT
+  std::vector<uint16_t> segmentSizes;
+  segmentSizes.reserve(vectors.size());
+  std::vector<std::vector<char>> controls;
+  controls.reserve(vectors.size());
+#endif
+
+  bool segmentation = segmentation_;
+
+  for (size_t i = first; i < packets.size(); ++i)
+  {
+    vectors[i - first].iov_base = const_cast<uchar*>(packets[i].data.get());
+    vectors[i - first].iov_len = packets[i].size;
+  }
+
+  size_t i = first;
+  while (i < packets.size())
+  {
+    size_t segments = 1;
+    uint32_t totalSize = packets[i].size;
+
+    // The kernel splits one buffer of equal sized segments to packets. Only the
+    // last segment may be smaller.
+    if (segmentation)
+    {
+      while (i + segments < packets.size() &&
+             segments < MAX_SEGMENTS &&
+             packets[i + segments].dest_addr == packets[i].dest_addr &&
+             packets[i + segments].dest_addr6 == packets[i].dest_addr6 &&
+             packets[i + segments - 1].size == packets[i].size &&
+             packets[i + segments].size <= packets[i].size &&
+             totalSize + packets[i + segments].size <= MAX_SEGMENTED_BYTES)
+      {
+        totalSize += packets[i + segments].size;
+        ++segments;
+      }
+    }
+
+    mmsghdr message = {};
+    if (ipv6_)
+    {
+      message.msg_hdr.msg_name = (void*)packets[i].dest_addr6;
+      message.msg_hdr.msg_namelen = sizeof(sockaddr_in6);
+    }
+    else
+    {
+      message.msg_hdr.msg_name = (void*)packets[i].dest_addr;
+      message.msg_hdr.msg_namelen = sizeof(sockaddr_in);
+    }
+    message.msg_hdr.msg_iov = &vectors[i - first];
+    message.msg_hdr.msg_iovlen = segments;
+
+#ifdef UDP_SEGMENT
+    if (segments > 1)
+    {
+      controls.push_back(std::vector<char>(CMSG_SPACE(sizeof(uint16_t)), 0));
+      message.msg_hdr.msg_control = controls.back().data();
+      message.msg_hdr.msg_controllen = controls.back().size();
+
+      cmsghdr* control = CMSG_FIRSTHDR(&message.msg_hdr);
+      control->cmsg_level = SOL_UDP;
+      control->cmsg_type = UDP_SEGMENT;
+      control->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+
+      uint16_t segmentSize = packets[i].size;
+      std::memcpy(CMSG_DATA(control), &segmentSize, sizeof(uint16_t));
+    }
+#endif
+
+    messages.push_back(message);
+    firstPackets.push_back(i);
+    i += segments;
+  }
+
+  size_t sent = 0;
+  while (sent < messages.size())
+  {
+    int ret = sendmmsg(socket_.get_raw_socket(), &messages[sent], messages.size() - sent, 0);
+
+    if (ret < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+
+      // a segmented message was refused, the rest is sent without segmentation
+      if (messages[sent].msg_hdr.msg_control != nullptr &&
+          (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT))
+      {
+        Logger::getLogger()->printWarning(this, "UDP segmentation offload failed, disabling it");
+        segmentation_ = false;
+        sendBatch(packets, firstPackets[sent]);
+        return;
+      }
+
+      // skip the message that could not be sent
+      Logger::getLogger()->printError(this, "sendmmsg() failed", "Error", QString::number(errno));
+      ++sent;
+      continue;
+    }
+
+    sent += ret;
+  }
+#else
+  // no batched send available
+  for (size_t i = first; i < packets.size(); ++i)
+  {
+    sendUDPData(*const_cast<sockaddr_in*>(packets[i].dest_addr),
+                *const_cast<sockaddr_in6*>(packets[i].dest_addr6),
+                packets[i].data, packets[i].size);
+  }
+#endif
+}
+
+
 void UVGRelay::run()
 {
   setPriority(QThread::TimeCriticalPriority);
 
-  // Start the processing thread
-  processingRunning_ = true;
-  processingThread_ = std::thread(&UVGRelay::processPackets, this);
+  if (workers_.size() == 1)
+  {
+    // Start the processing thread
+    processingRunning_ = true;
+    processingThread_ = std::thread(&UVGRelay::processPackets, this);
+  }
+  else
+  {
+    // each worker processes its own packets on its own core
+    setThreadAffinity(0);
+
+    for (size_t i = 1; i < workers_.size(); ++i)
+    {
+      workers_[i]->thread = std::thread([this, i]()
+      {
+        setThreadAffinity(i);
+        receiveLoop(*workers_[i]);
+      });
+    }
+  }
+
+  lastReport_ = clockNowMs();
+
+  receiveLoop(*workers_.front());
+
+  for (size_t i = 1; i < workers_.size(); ++i)
+  {
+    if (workers_[i]->thread.joinable())
+    {
+      workers_[i]->thread.join();
+    }
+  }
+
+  // Stop the processing thread
+  queueMutex_.lock();
+  processingRunning_ = false;
+  queueCV_.notify_all();
+  queueMutex_.unlock();
+  if (processingThread_.joinable())
+  {
+    processingThread_.join();
+  }
+}
+
 
+void UVGRelay::receiveLoop(ReceiveWorker& worker)
+{
   // poll from socket
 #ifdef _WIN32
   LPWSAPOLLFD pfds = new pollfd();
@@ -145,11 +539,17 @@ void UVGRelay::run()
   pollfd* pfds = new pollfd();
 #endif
 
-  size_t read_fds = socket_.get_raw_socket();
+  size_t read_fds = worker.socket->get_raw_socket();
   pfds->fd = read_fds;
   pfds->events = POLLIN;
 
-  uint8_t buffer[BUFFER_SIZE];
+  bool sharded = workers_.size() > 1;
+  bool reporter = &worker == workers_.front().get();
+
+  // received buffers are handed over as is and the empty slots are filled
+  // from the pool before the next read
+  std::vector<DataBuffer> buffers(RECEIVE_BATCH_SIZE);
+  std::vector<int> sizes(RECEIVE_BATCH_SIZE, 0);
 
   while (running_)
   {
@@ -160,86 +560,255 @@ void UVGRelay::run()
     if (poll(pfds, 1, POLL_TIMEOUT_MS) < 0) {
 #endif
       Logger::getLogger()->printError(this, "poll() failed");
+      running_ = false;
       break;
     }
+    worker.receiveSyscalls.fetch_add(1, std::memory_order_relaxed);
 
     if (pfds->revents & POLLIN)
     {
       while(running_)
       {
-        int read = 0;
-        rtp_error_t ret = socket_.recvfrom(buffer, BUFFER_SIZE, MSG_DONTWAIT, &read);
+        int received = receiveBatch(worker, buffers, sizes);
 
-        if (ret == RTP_INTERRUPTED)
+        if (received < 0)
         {
+          Logger::getLogger()->printError(this, "Failed to receive packets");
+          running_ = false;
           break;
         }
-        else if (ret != RTP_OK)
+        else if (received == 0)
         {
-          Logger::getLogger()->printError(this, "recvfrom() failed");
-          running_ = false;
           break;
         }
 
-        if (read < 12)
+        if (sharded)
         {
-          continue;
+          // the same table is used for the whole batch
+          std::shared_ptr<const RoutingTable> routes = loadRoutes();
+          for (int i = 0; i < received; ++i)
+          {
+            // buffers of too small packets are reused
+            if (sizes[i] >= 12)
+            {
+              processReceivedPacket(*routes, std::move(buffers[i]), sizes[i]);
+            }
+          }
+        }
+        else
+        {
+          bool queued = false;
+          for (int i = 0; i < received; ++i)
+          {
+            // buffers of too small packets are reused
+            if (sizes[i] >= 12 && queuePacket(buffers[i], sizes[i]))
+            {
+              queued = true;
+            }
+          }
+
+          // one wake up per batch
+          if (queued)
+          {
+            wakeProcessing();
+          }
         }
 
-        // Queue the packet for processing - this is fast and doesn't block
-        ReceivedPacket packet;
-        packet.size = read;
-        std::memcpy(packet.buffer, buffer, read);
-
+        // the socket has been emptied
+        if (received < RECEIVE_BATCH_SIZE)
         {
-          std::lock_guard<std::mutex> lock(queueMutex_);
-          packetQueue_.push(packet);
+          break;
         }
-        queueCV_.notify_one();
       }
     }
+
+    if (reporter)
+    {
+      reportStatistics();
+    }
   }
 
-  // Stop the processing thread
-  processingRunning_ = false;
-  queueCV_.notify_all();
-  if (processingThread_.joinable())
+  delete pfds;
+}
+
+
+int UVGRelay::receiveBatch(ReceiveWorker& worker, std::vector<DataBuffer>& buffers,
+                           std::vector<int>& sizes)
+{
+  for (DataBuffer& buffer : buffers)
   {
-    processingThread_.join();
+    if (!buffer)
+    {
+      buffer = pool_->allocate(BUFFER_SIZE);
+    }
   }
 
-  delete pfds;
+#ifdef __linux__
+  mmsghdr messages[RECEIVE_BATCH_SIZE] = {};
+  iovec vectors[RECEIVE_BATCH_SIZE];
+
+  for (int i = 0; i < RECEIVE_BATCH_SIZE; ++i)
+  {
+    // the buffers are not shared so this does not copy
+    vectors[i].iov_base = buffers[i].writable(BUFFER_SIZE);
+    vectors[i].iov_len = BUFFER_SIZE;
+    messages[i].msg_hdr.msg_iov = &vectors[i];
+    messages[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  int received = recvmmsg(worker.socket->get_raw_socket(), messages, RECEIVE_BATCH_SIZE,
+                          MSG_DONTWAIT, nullptr);
+  worker.receiveSyscalls.fetch_add(1, std::memory_order_relaxed);
+
+  if (received < 0)
+  {
+    if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+    {
+      return 0;
+    }
+    return -1;
+  }
+
+  for (int i = 0; i < received; ++i)
+  {
+    // truncated packets are not valid RTP
+    sizes[i] = (messages[i].msg_hdr.msg_flags & MSG_TRUNC) ? 0 : (int)messages[i].msg_len;
+  }
+
+  worker.receivedPackets.fetch_add(received, std::memory_order_relaxed);
+  return received;
+#else
+  // no batched receive available, read one packet at a time
+  int read = 0;
+  rtp_error_t ret = worker.socket->recvfrom(buffers[0].writable(BUFFER_SIZE), BUFFER_SIZE,
+                                            MSG_DONTWAIT, &read);
+  worker.receiveSyscalls.fetch_add(1, std::memory_order_relaxed);
+
+  if (ret == RTP_INTERRUPTED)
+  {
+    return 0;
+  }
+  else if (ret != RTP_OK)
+  {
+    return -1;
+  }
+
+  sizes[0] = read;
+  worker.receivedPackets.fetch_add(1, std::memory_order_relaxed);
+  return 1;
+#endif
 }
 
+
+bool UVGRelay::queuePacket(DataBuffer& data, int size)
+{
+  uint64_t tail = queueTail_.load(std::memory_order_relaxed);
+  uint64_t head = queueHead_.load(std::memory_order_acquire);
+
+  if (tail - head >= PACKET_QUEUE_SIZE)
+  {
+    ++droppedPackets_;
+    LOG_FAST_WARNING(this, "Packet queue full, discarding packets",
+                     {"Discarded"}, {droppedPackets_});
+    return false;
+  }
+
+  ReceivedPacket& packet = packetQueue_[tail & (PACKET_QUEUE_SIZE - 1)];
+  packet.data = std::move(data);
+  packet.size = size;
+
+  queueTail_.store(tail + 1, std::memory_order_release);
+  return true;
+}
+
+
+void UVGRelay::wakeProcessing()
+{
+  // pairs with the fence in processPackets
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+
+  if (processingSleeping_.load(std::memory_order_relaxed))
+  {
+    std::lock_guard<std::mutex> lock(queueMutex_);
+    queueCV_.notify_one();
+  }
+}
+
+
+bool UVGRelay::dequeuePacket(ReceivedPacket& packet)
+{
+  uint64_t head = queueHead_.load(std::memory_order_relaxed);
+  if (head == queueTail_.load(std::memory_order_acquire))
+  {
+    return false;
+  }
+
+  packet = std::move(packetQueue_[head & (PACKET_QUEUE_SIZE - 1)]);
+  queueHead_.store(head + 1, std::memory_order_release);
+  return true;
+}
+
+
+void UVGRelay::reportStatistics()
+{
+  int64_t now = clockNowMs();
+  if (stats_ != nullptr && now - lastReport_ >= STATISTICS_INTERVAL_MS)
+  {
+    uint64_t receivedPackets = 0;
+    uint64_t receiveSyscalls = 0;
+
+    for (auto& worker : workers_)
+    {
+      receivedPackets += worker->receivedPackets.exchange(0, std::memory_order_relaxed);
+      receiveSyscalls += worker->receiveSyscalls.exchange(0, std::memory_order_relaxed);
+    }
+
+    stats_->addRelayReceive((uint32_t)receivedPackets, (uint32_t)receiveSyscalls);
+    lastReport_ = now;
+  }
+}
+
+
 void UVGRelay::processPackets()
 {
+  ReceivedPacket packet;
+
   while (processingRunning_)
   {
+    // the routing table is reloaded after each batch to see new receivers
+    std::shared_ptr<const RoutingTable> routes = loadRoutes();
+
+    int processed = 0;
+    while (processed < RECEIVE_BATCH_SIZE && dequeuePacket(packet))
+    {
+      processReceivedPacket(*routes, std::move(packet.data), packet.size);
+      ++processed;
+    }
+
+    if (processed > 0)
+    {
+      continue;
+    }
+
     std::unique_lock<std::mutex> lock(queueMutex_);
-    
-    // Wait for packets or stop signal
-    queueCV_.wait(lock, [this] { 
-      return !packetQueue_.empty() || !processingRunning_; 
-    });
-
-    // Process all available packets
-    while (!packetQueue_.empty() && processingRunning_)
+    processingSleeping_.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    // Wait for packets or stop signal. The receiving thread either sees that
+    // we are sleeping or we see its packets.
+    if (processingRunning_ &&
+        queueHead_.load(std::memory_order_relaxed) == queueTail_.load(std::memory_order_acquire))
     {
-      ReceivedPacket packet = packetQueue_.front();
-      packetQueue_.pop();
-      
-      // Unlock while processing to allow reception to continue
-      lock.unlock();
-      
-      processReceivedPacket(packet.buffer, packet.size);
-      
-      lock.lock();
+      queueCV_.wait(lock);
     }
+    processingSleeping_.store(false, std::memory_order_relaxed);
   }
 }
 
-void UVGRelay::processReceivedPacket(const uint8_t* buffer, int read)
+void UVGRelay::processReceivedPacket(const RoutingTable& routes, DataBuffer data, int read)
 {
+  const uint8_t* buffer = data.get();
+
   // check if this is an RTP or RTCP packet
   uint8_t rtcp_pt = buffer[1];
   uint8_t rtp_pt = rtcp_pt & 0x7F;
@@ -251,9 +820,10 @@ void UVGRelay::processReceivedPacket(const uint8_t* buffer, int read)
     std::memcpy(&ssrc, buffer + 8, sizeof(ssrc));
     ssrc = ntohl(ssrc);
 
-    if (rtpReceivers_.find(ssrc) != rtpReceivers_.end())
+    auto receiver = routes.rtp.find(ssrc);
+    if (receiver != routes.rtp.end())
     {
-      std::shared_ptr<Filter> filter = rtpReceivers_[ssrc];
+      const std::shared_ptr<Filter>& filter = receiver->second;
 
       std::unique_ptr<Data> receivedRTPFrame = Filter::initializeData(DT_RTP, DS_REMOTE);
       receivedRTPFrame->creationTimestamp = clockNowMs();
@@ -265,16 +835,16 @@ void UVGRelay::processReceivedPacket(const uint8_t* buffer, int read)
       std::memcpy(&net_ts, buffer + 4, sizeof(net_ts));
       receivedRTPFrame->rtpTimestamp = ntohl(net_ts);
 
-      receivedRTPFrame->data = std::unique_ptr<uchar[]>(new uchar[read]);
-      memcpy(receivedRTPFrame->data.get(), buffer, read);
+      // the receive buffer becomes the payload
+      receivedRTPFrame->data = std::move(data);
       receivedRTPFrame->data_size = read;
 
       filter->putInput(std::move(receivedRTPFrame));
     }
     else
     {
-      Logger::getLogger()->printWarning(this, "Received an RTP packet for which we have no receiver",
-                                      {"SSRC"}, {QString::number(ssrc)});
+      LOG_FAST_WARNING(this, "Received an RTP packet for which we have no receiver",
+                       {"SSRC"}, {ssrc});
     }
   }
   else if (rtcp_pt == 200 || rtcp_pt == 201 || rtcp_pt == 202)
@@ -286,32 +856,31 @@ void UVGRelay::processReceivedPacket(const uint8_t* buffer, int read)
     std::memcpy(&ssrc, buffer + 4, sizeof(ssrc));
     ssrc = ntohl(ssrc);
 
-    if (rtcpReceivers_.find(ssrc) != rtcpReceivers_.end())
+    auto receiver = routes.rtcp.find(ssrc);
+    if (receiver != routes.rtcp.end())
     {
-      std::shared_ptr<Filter> filter = rtcpReceivers_[ssrc];
+      const std::shared_ptr<Filter>& filter = receiver->second;
 
       std::unique_ptr<Data> receivedRTPFrame = Filter::initializeData(DT_RTP, DS_REMOTE);
       receivedRTPFrame->creationTimestamp = clockNowMs();
       receivedRTPFrame->presentationTimestamp = receivedRTPFrame->creationTimestamp;
       receivedRTPFrame->rtpTimestamp = 0; // RTCP has not RTP timestamp (expect SR for sync purposes)
 
-      receivedRTPFrame->data = std::unique_ptr<uchar[]>(new uchar[read]);
-      memcpy(receivedRTPFrame->data.get(), buffer, read);
+      receivedRTPFrame->data = std::move(data);
       receivedRTPFrame->data_size = read;
 
       filter->putInput(std::move(receivedRTPFrame));
     }
     else
     {
-      Logger::getLogger()->printWarning(this, "Received an RTCP packet for which we have no receiver",
-                                      {"SSRC"}, {QString::number(ssrc)});
+      LOG_FAST_WARNING(this, "Received an RTCP packet for which we have no receiver",
+                       {"SSRC"}, {ssrc});
     }
   }
   else
   {
-    Logger::getLogger()->printWarning(this, "Received a packet which does not follow RTP specifications",
-                                    {"Payload type"},
-                                    {QString::number(rtp_pt)});
+    LOG_FAST_WARNING(this, "Received a packet which does not follow RTP specifications",
+                     {"Payload type"}, {rtp_pt});
   }
 }
 
@@ -7,7 +7,7 @@
 #include <memory>
 #include <string>
 #include <unordered_map>
-#include <queue>
+#include <vector>
 #include <mutex>
 #include <condition_variable>
 #include <thread>
@@ -17,24 +17,32 @@
 #include <QString>
 
 class Filter;
+class BufferPool;
+class StatisticsInterface;
 
 
 class UVGRelay : public QThread, public RelayInterface
 {
   Q_OBJECT
 public:
-  UVGRelay(std::string localAddress, uint16_t port);
+  // With more than one receive worker, each worker has its own socket bound
+  // to the same port with SO_REUSEPORT and the kernel divides the packets
+  // between them based on SSRC. Only supported on Linux.
+  UVGRelay(std::string localAddress, uint16_t port, std::shared_ptr<BufferPool> pool,
+           StatisticsInterface* stats, unsigned int receiveWorkers = 1);
   ~UVGRelay();
 
+  // can be called while packets are being forwarded
   virtual void registerRTPReceiver(uint32_t ssrc, std::shared_ptr<Filter> filter);
   virtual void registerRTCPReceiver(uint32_t ssrc, std::shared_ptr<Filter> filter);
+  virtual void unregisterReceivers(uint32_t ssrc);
 
   virtual void sendUDPData(std::string destinationAddress, uint16_t port,
-                           std::unique_ptr<unsigned char[]> data, uint32_t size);
+                           DataBuffer data, uint32_t size);
 
   virtual void sendUDPData(sockaddr_in &dest_addr,
                    sockaddr_in6 &dest_addr6,
-                   std::unique_ptr<unsigned char[]> data,
+                   DataBuffer data,
                    uint32_t size);
 
 
@@ -42,6 +50,8 @@ public:
                            sockaddr_in6 &dest_addr6,
                            std::vector<std::vector<std::pair<size_t, uint8_t *>>>& buffers);
 
+  virtual void sendUDPData(std::vector<UDPPacket>& packets);
+
   virtual void run();
 
   virtual void start()
@@ -70,28 +80,109 @@ signals:
 
 private:
 
+  // The table is never modified after it has been published. Registering a
+  // receiver copies the table and swaps the pointer, so forwarding threads
+  // never wait for registration. An old table is freed once the last
+  // forwarding thread has stopped using it.
+  struct RoutingTable
+  {
+    std::unordered_map<uint32_t, std::shared_ptr<Filter>> rtp;
+    std::unordered_map<uint32_t, std::shared_ptr<Filter>> rtcp;
+  };
+
+  struct ReceiveWorker
+  {
+    uvgrtp::socket* socket = nullptr;
+
+    // the first worker uses the sending socket, others own their socket
+    std::unique_ptr<uvgrtp::socket> ownSocket;
+    std::thread thread;
+
+    std::atomic<uint64_t> receivedPackets{0};
+    std::atomic<uint64_t> receiveSyscalls{0};
+  };
+
   struct ReceivedPacket {
-    uint8_t buffer[1500];
-    int size;
+    DataBuffer data;
+    int size = 0;
   };
 
+  bool bindSocket(uvgrtp::socket& socket, bool reusePort);
+
+  // makes the kernel choose the worker socket based on SSRC
+  bool attachShardingFilter();
+
+  std::shared_ptr<const RoutingTable> loadRoutes() const;
+  void publishRoutes(std::shared_ptr<const RoutingTable> routes);
+
+  // Receives packets until the relay is stopped. With one worker the packets
+  // are queued for the processing thread, otherwise they are processed by the
+  // worker itself.
+  void receiveLoop(ReceiveWorker& worker);
+
+  // Reads as many packets as are available up to the size of the batch.
+  // Packets are received directly to the buffers, empty buffers are allocated
+  // from the pool. Returns the number of packets or -1 on error.
+  int receiveBatch(ReceiveWorker& worker, std::vector<DataBuffer>& buffers,
+                   std::vector<int>& sizes);
+
+  // called only by the receiving thread
+  bool queuePacket(DataBuffer& data, int size);
+  void wakeProcessing();
+
+  // called only by the processing thread
+  bool dequeuePacket(ReceivedPacket& packet);
+
+  void reportStatistics();
+
+  // sends the packets starting from index first
+  void sendBatch(std::vector<UDPPacket>& packets, size_t first);
+
   void handleRTCPCompound(const uint8_t* buffer, int length);
   void processPackets(); // Worker thread function
-  void processReceivedPacket(const uint8_t* buffer, int size);
+  void processReceivedPacket(const RoutingTable& routes, DataBuffer data, int size);
 
-  std::unordered_map<uint32_t, std::shared_ptr<Filter>> rtpReceivers_;
-  std::unordered_map<uint32_t, std::shared_ptr<Filter>> rtcpReceivers_;
+  // accessed only with std::atomic_load and std::atomic_store
+  std::shared_ptr<const RoutingTable> routes_;
+
+  // serializes the modifications of the routing table
+  std::mutex routesMutex_;
 
   // this class is stolen from uvgRTP
   uvgrtp::socket socket_;
 
-  bool running_;
+  std::string localAddress_;
+  uint16_t port_;
+
+  std::vector<std::unique_ptr<ReceiveWorker>> workers_;
+
+  // packets are received to buffers from this pool
+  std::shared_ptr<BufferPool> pool_;
+
+  StatisticsInterface* stats_;
+
+  std::atomic<bool> running_;
   bool ipv6_;
 
-  // Packet queue for decoupling reception from processing
-  std::queue<ReceivedPacket> packetQueue_;
+  // whether the kernel supports UDP segmentation offload (GSO)
+  std::atomic<bool> segmentation_;
+
+  // Single producer single consumer queue for decoupling reception from
+  // processing. The head is only written by the processing thread and the
+  // tail only by the receiving thread.
+  std::vector<ReceivedPacket> packetQueue_;
+  alignas(64) std::atomic<uint64_t> queueHead_;
+  alignas(64) std::atomic<uint64_t> queueTail_;
+
+  // the mutex is only used when the processing thread sleeps
   std::mutex queueMutex_;
   std::condition_variable queueCV_;
+  std::atomic<bool> processingSleeping_;
+
   std::thread processingThread_;
   std::atomic<bool> processingRunning_;
+
+  // statistics of the receiving threads
+  uint64_t droppedPackets_;
+  int64_t lastReport_;
 };
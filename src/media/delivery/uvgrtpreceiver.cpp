@@ -216,6 +216,7 @@ void UvgRTPReceiver::receiveHook(uvg_rtp::frame::rtp_frame *frame)
 
   // Extract RTP timestamp from packet header
   received_picture->rtpTimestamp = frame->header.timestamp;
+  received_picture->rtpSequence = frame->header.seq;
 
   // Record SSRC so downstream filters can identify the packet source
   received_picture->ssrc = frame->header.ssrc;
@@ -264,14 +265,15 @@ void UvgRTPReceiver::receiveHook(uvg_rtp::frame::rtp_frame *frame)
     Logger::getLogger()->printWarning(this, "uvgRTP did not add the start code. Please use newer version"
                                             " of uvgRTP and make sure RCE_H26X_PREPEND_SC flag is used");
     received_picture->data_size = (uint32_t)frame->payload_len + 4;
-    received_picture->data = std::unique_ptr<uchar[]>(new uchar[received_picture->data_size]);
+    std::unique_ptr<uchar[]> payload(new uchar[received_picture->data_size]);
 
-    received_picture->data[0] = 0;
-    received_picture->data[1] = 0;
-    received_picture->data[2] = 0;
-    received_picture->data[3] = 1;
+    payload[0] = 0;
+    payload[1] = 0;
+    payload[2] = 0;
+    payload[3] = 1;
 
-    memcpy(received_picture->data.get() + 4, frame->payload, received_picture->data_size - 4);
+    memcpy(payload.get() + 4, frame->payload, received_picture->data_size - 4);
+    received_picture->data = std::move(payload);
   }
   else
   {
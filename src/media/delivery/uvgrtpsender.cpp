@@ -330,12 +330,13 @@ void UvgRTPSender::process()
 
       if (input->rtpTimestamp != 0)
       {
-        ret = stream_->push_frame(std::move(input->data), input->data_size, input->rtpTimestamp, rtpFlags_);
+        ret = stream_->push_frame(input->data.release(input->data_size), input->data_size,
+                                  input->rtpTimestamp, rtpFlags_);
       }
       else
       {
         Logger::getLogger()->printWarning(this, "No RTP timestamp available");
-        ret = stream_->push_frame(std::move(input->data), input->data_size, rtpFlags_);
+        ret = stream_->push_frame(input->data.release(input->data_size), input->data_size, rtpFlags_);
       }
     }
     streamMutex_.unlock();
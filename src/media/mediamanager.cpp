@@ -56,7 +56,7 @@ void MediaManager::init(std::shared_ptr<VideoviewFactory> viewFactory,
     this,
     &MediaManager::handleNoEncryption);
 
-  hwResources_ = std::shared_ptr<ResourceAllocator>(new ResourceAllocator());
+  hwResources_ = std::shared_ptr<ResourceAllocator>(new ResourceAllocator(stats_));
 
   clientFg_->init(stats, hwResources_);
   clientFg_->setSelfViews(viewFactory_->getSelfVideos());
@@ -228,7 +228,7 @@ void AudioCaptureFilter::readMore()
 
       if (muteSamples_ > 0)
       {
-        memset(audioFrame->data.get(), 0, audioFrame->data_size);
+        memset(audioFrame->data.writable(audioFrame->data_size), 0, audioFrame->data_size);
         --muteSamples_;
       }
 
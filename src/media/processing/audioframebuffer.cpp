@@ -27,25 +27,27 @@ AudioFrameBuffer::~AudioFrameBuffer()
 }
 
 
-void AudioFrameBuffer::inputData(uint8_t* data, uint32_t dataAmount)
+void AudioFrameBuffer::inputData(const uint8_t* data, uint32_t dataAmount)
 {
   if (data == nullptr)
   {
     return;
   }
 
-  uint8_t* totalData = data;
+  const uint8_t* totalData = data;
+  uint8_t* combinedData = nullptr;
   uint32_t totalDataAmount = dataAmount;
 
   // Step 1: Take previous partial frame into account if it exists
   if (partialFrameSize_ != 0)
   {
-    totalData = new uint8_t [partialFrameSize_ + dataAmount];
+    combinedData = new uint8_t [partialFrameSize_ + dataAmount];
     totalDataAmount = partialFrameSize_ + dataAmount;
 
-    memcpy(totalData,                     partialFrame_, partialFrameSize_);
-    memcpy(totalData + partialFrameSize_, data,          dataAmount);
+    memcpy(combinedData,                     partialFrame_, partialFrameSize_);
+    memcpy(combinedData + partialFrameSize_, data,          dataAmount);
 
+    totalData = combinedData;
     partialFrameSize_ = 0;
   }
 
@@ -65,10 +67,10 @@ void AudioFrameBuffer::inputData(uint8_t* data, uint32_t dataAmount)
     memcpy(partialFrame_, totalData + processedData, partialFrameSize_);
   }
 
-  // totaldata is deleted if we had to allocate new memory for it because of previous data
-  if (totalDataAmount != dataAmount)
+  // combined data is deleted if we had to allocate new memory for it because of previous data
+  if (combinedData != nullptr)
   {
-    delete[] totalData;
+    delete[] combinedData;
   }
 }
 
@@ -107,7 +109,7 @@ void AudioFrameBuffer::changeDesiredFrameSize(uint32_t desiredSize)
 }
 
 
-void AudioFrameBuffer::addSampleToBuffer(uint8_t *sample, int sampleSize)
+void AudioFrameBuffer::addSampleToBuffer(const uint8_t *sample, int sampleSize)
 {
   uint8_t* new_sample = new uint8_t[sampleSize];
   memcpy(new_sample, sample, sampleSize);
@@ -15,7 +15,7 @@ public:
 
   // Put any size data into frame buffer.
   // Does not modify or delete input data.
-  void inputData(uint8_t* data, uint32_t dataAmount);
+  void inputData(const uint8_t* data, uint32_t dataAmount);
 
   // returns desired size frames if available. Returns nullptr if not
   // Gives away the ownership of the returned frame. Delete with delete[]
@@ -35,7 +35,7 @@ public:
 
 private:
 
-  void addSampleToBuffer(uint8_t* sample, int sampleSize);
+  void addSampleToBuffer(const uint8_t* sample, int sampleSize);
 
   uint32_t desiredFrameSize_;
 
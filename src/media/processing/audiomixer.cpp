@@ -1,5 +1,8 @@
 #include "audiomixer.h"
 
+#include "bufferpool.h"
+#include "speakerselector.h"
+
 #include "common.h"
 #include "global.h"
 #include "logger.h"
@@ -7,27 +10,66 @@
 
 #include <QString>
 
+#include <algorithm>
 #include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define MIXER_SSE2
+#endif
 
 const unsigned int MAX_MIX_BUFFER = AUDIO_FRAMES_PER_SECOND/5;
 
-const int16_t DEFAULT_COMPRESSION_THRESHOLD = INT16_MAX/2;
-const uint8_t DEFAULT_COMPRESSION_RATIO = 5;
+const float DEFAULT_COMPRESSION_THRESHOLD_DB = -6.0f;
+const float DEFAULT_COMPRESSION_RATIO = 5.0f;
+
+// the compression starts gradually this many dB below the threshold and
+// reaches the full ratio the same amount above it
+const float KNEE_WIDTH_DB = 6.0f;
 
+// the gain is calculated for blocks of this many samples, which is short
+// enough to catch the start of a loud sound
+const uint32_t COMPRESSOR_BLOCK_SAMPLES = 64;
 
-AudioMixer::AudioMixer():
+// the gain drops immediately, but recovers by 1/N of the difference per block
+const float RELEASE_DIVISOR = 32.0f;
+
+
+AudioMixer::AudioMixer(std::shared_ptr<BufferPool> pool):
   inputs_(0),
   mixingMutex_(),
   mixingBuffer_(),
-  compressionThreshold_(DEFAULT_COMPRESSION_THRESHOLD),
-  compressionRatio_(DEFAULT_COMPRESSION_RATIO)
+  sourceSSRCs_(),
+  pool_(pool),
+  selector_(nullptr),
+  sources_(),
+  mixSum_(),
+  compressionThresholdDB_(DEFAULT_COMPRESSION_THRESHOLD_DB),
+  compressionRatio_(DEFAULT_COMPRESSION_RATIO),
+  gain_(1.0f),
+  mixedFrames_(0),
+  compressedBlocks_(0),
+  clippedSamples_(0),
+  minGain_(1.0f)
 {}
 
 
 void AudioMixer::updateSettings()
 {
-  compressionThreshold_ = dbToint16(settingValue(SettingsKey::audioCompressionThreshold));
-  compressionRatio_ = settingValue(SettingsKey::audioCompressionRatio);
+  mixingMutex_.lock();
+  compressionThresholdDB_ = settingValue(SettingsKey::audioCompressionThreshold);
+  compressionRatio_ = std::max(1, settingValue(SettingsKey::audioCompressionRatio));
+  mixingMutex_.unlock();
+}
+
+
+void AudioMixer::setSpeakerSelector(std::shared_ptr<SpeakerSelector> selector)
+{
+  mixingMutex_.lock();
+  selector_ = selector;
+  mixingMutex_.unlock();
 }
 
 
@@ -37,6 +79,16 @@ std::unique_ptr<Data> AudioMixer::mixAudio(std::unique_ptr<Data> input,
 {
   mixingMutex_.lock();
 
+  sourceSSRCs_[sessionID] = input->ssrc;
+
+  if (selector_ && !selector_->isSelected(input->ssrc))
+  {
+    // the source is not waited for until it is selected again
+    mixingBuffer_.erase(sessionID);
+    mixingMutex_.unlock();
+    return std::unique_ptr<Data> (nullptr);
+  }
+
   // make sure the buffer exists for this sessionID
   if (mixingBuffer_.find(sessionID) == mixingBuffer_.end())
   {
@@ -59,8 +111,10 @@ std::unique_ptr<Data> AudioMixer::mixAudio(std::unique_ptr<Data> input,
     }
   }
 
+  unsigned int expected = selector_ ? selectedSources() : inputs_;
+
   // if all inputs have provided a sample for mixing
-  if (samples == inputs_)
+  if (samples == expected)
   {
     potentialOutput->data = doMixing(data_size);
     mixingMutex_.unlock();
@@ -68,10 +122,9 @@ std::unique_ptr<Data> AudioMixer::mixAudio(std::unique_ptr<Data> input,
   }
   else if (mixingBuffer_.at(sessionID).size() >= MAX_MIX_BUFFER)
   {
-    Logger::getLogger()->printWarning(this, "Too many samples from one source and not enough from others. "
-                                            "Forced mixing to avoid latency",
-                                      "Buffer status", QString::number(mixingBuffer_.at(sessionID).size()) + "/" +
-                                                         QString::number(MAX_MIX_BUFFER));
+    LOG_FAST_WARNING(this, "Too many samples from one source and not enough from others. "
+                           "Forced mixing to avoid latency",
+                     {"Buffered", "Max"}, {mixingBuffer_.at(sessionID).size(), MAX_MIX_BUFFER});
 
     potentialOutput->data = doMixing(data_size);
     mixingMutex_.unlock();
@@ -84,17 +137,32 @@ std::unique_ptr<Data> AudioMixer::mixAudio(std::unique_ptr<Data> input,
 }
 
 
-std::unique_ptr<uchar[]> AudioMixer::doMixing(uint32_t frameSize)
+unsigned int AudioMixer::selectedSources()
+{
+  // the selected sources which do not send to this mixer are not waited for
+  unsigned int selected = 0;
+  for (auto& source : sourceSSRCs_)
+  {
+    if (selector_->isSelected(source.second))
+    {
+      ++selected;
+    }
+  }
+
+  return selected;
+}
+
+
+DataBuffer AudioMixer::doMixing(uint32_t frameSize)
 {
   // don't do mixing if we have only one stream.
   if (mixingBuffer_.size() == 1)
   {
     if (!mixingBuffer_.begin()->second.empty())
     {
-    std::unique_ptr<uchar[]> oneSample =
+    DataBuffer oneSample =
         std::move(mixingBuffer_.begin()->second.front()->data);
     mixingBuffer_.begin()->second.pop_front();
-    mixingBuffer_.clear();
     return oneSample;
     }
     else
@@ -104,51 +172,33 @@ std::unique_ptr<uchar[]> AudioMixer::doMixing(uint32_t frameSize)
     }
   }
 
-  std::unique_ptr<uchar[]> result =
-      std::unique_ptr<uint8_t[]>(new uint8_t[frameSize]);
-  int16_t * output_ptr = (int16_t*)result.get();
+  uint32_t samples = frameSize/sizeof(int16_t);
 
-  for (unsigned int i = 0; i < frameSize/2; ++i)
+  sources_.clear();
+  for (auto& buffer : mixingBuffer_)
   {
-    int32_t sum = 0;
-
-    // This is in my understanding the correct way to do audio mixing.
-    // Just add them up and divide by number of participants
-    // the level should be corrected with Speex AGC
-    for (auto& buffer : mixingBuffer_)
+    if (!buffer.second.empty())
     {
-      if (!buffer.second.empty())
-      {
-        sum += *((int16_t*)buffer.second.front()->data.get() + i);
-      }
+      const Data* frame = buffer.second.front().get();
+      sources_.push_back({(const int16_t*)frame->data.get(),
+                          (uint32_t)(frame->data_size/sizeof(int16_t))});
     }
+  }
 
-    // audio compression, reduces the peaks in audio
-    if (sum > compressionThreshold_)
-    {
-      Logger::getLogger()->printWarning(this, "Compressing audio");
-      sum = compressionThreshold_ + (sum - compressionThreshold_)/compressionRatio_;
-    }
-    else if (sum < -compressionThreshold_)
-    {
-      Logger::getLogger()->printWarning(this, "Compressing audio");
-      sum = -compressionThreshold_ + (sum + compressionThreshold_)/compressionRatio_;
-    }
+  if (mixSum_.size() < samples)
+  {
+    mixSum_.resize(samples);
+  }
 
-    // limiting
-    if (sum > INT16_MAX)
-    {
-      Logger::getLogger()->printWarning(this, "Limiting mixed audio to maximum");
-      sum = INT16_MAX;
-    }
-    else if (sum < INT16_MIN)
-    {
-      Logger::getLogger()->printWarning(this, "Limiting mixed audio to minimum");
-      sum = INT16_MIN;
-    }
+  accumulate(samples);
+
+  DataBuffer result = pool_->allocate(frameSize);
+  int16_t* output = (int16_t*)result.writable(frameSize);
 
-    *output_ptr = (int16_t)sum;
-    ++output_ptr;
+  for (uint32_t i = 0; i < samples; i += COMPRESSOR_BLOCK_SAMPLES)
+  {
+    compressBlock(mixSum_.data() + i, output + i,
+                  std::min(COMPRESSOR_BLOCK_SAMPLES, samples - i));
   }
 
   // remove the samples that were mixed
@@ -160,35 +210,165 @@ std::unique_ptr<uchar[]> AudioMixer::doMixing(uint32_t frameSize)
     }
   }
 
+  reportStatistics();
+
   return result;
 }
 
 
-int16_t AudioMixer::dbToint16(float dB) const
+void AudioMixer::accumulate(uint32_t samples)
 {
-  if (dB == 0)
+  int32_t* sum = mixSum_.data();
+  memset(sum, 0, samples*sizeof(int32_t));
+
+  // Accumulating at 32 bits cannot overflow, so the sum does not need
+  // saturation until it is packed back to 16 bits.
+  for (const Source& source : sources_)
   {
-    return INT16_MAX;
+    // sources with shorter frames only contribute to the beginning
+    uint32_t count = std::min(samples, source.samples);
+    uint32_t i = 0;
+
+#ifdef MIXER_SSE2
+    for (; i + 8 <= count; i += 8)
+    {
+      __m128i pcm = _mm_loadu_si128((const __m128i*)(source.pcm + i));
+
+      // sign extend to 32 bits
+      __m128i low  = _mm_srai_epi32(_mm_unpacklo_epi16(pcm, pcm), 16);
+      __m128i high = _mm_srai_epi32(_mm_unpackhi_epi16(pcm, pcm), 16);
+
+      __m128i* target = (__m128i*)(sum + i);
+      _mm_storeu_si128(target,     _mm_add_epi32(_mm_loadu_si128(target), low));
+      _mm_storeu_si128(target + 1, _mm_add_epi32(_mm_loadu_si128(target + 1), high));
+    }
+#endif
+
+    for (; i < count; ++i)
+    {
+      sum[i] += source.pcm[i];
+    }
   }
+}
 
-  float amplitude = std::pow(10, dB/20.0f);
-  float value = amplitude*INT16_MAX;
 
-  return static_cast<int16_t>(std::clamp(value, float(INT16_MIN), float(INT16_MAX)));
+void AudioMixer::compressBlock(const int32_t* sum, int16_t* output, uint32_t samples)
+{
+  int32_t peak = 0;
+  for (uint32_t i = 0; i < samples; ++i)
+  {
+    peak = std::max(peak, std::abs(sum[i]));
+  }
+
+  float target = compressorGain(peak);
+
+  // attack immediately so the peak is not clipped, release slowly
+  float startGain = std::min(gain_, target);
+  float endGain = target < gain_ ? target : gain_ + (target - gain_)/RELEASE_DIVISOR;
+  gain_ = endGain;
+
+  if (target < 1.0f)
+  {
+    ++compressedBlocks_;
+    minGain_ = std::min(minGain_, target);
+  }
+
+  float step = (endGain - startGain)/samples;
+  uint32_t i = 0;
+
+#ifdef MIXER_SSE2
+  __m128 gains = _mm_add_ps(_mm_set1_ps(startGain),
+                            _mm_mul_ps(_mm_set1_ps(step), _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f)));
+  __m128 increment = _mm_set1_ps(4*step);
+  __m128 maximum = _mm_set1_ps(INT16_MAX);
+  __m128 minimum = _mm_set1_ps(INT16_MIN);
+  __m128i clipped = _mm_setzero_si128();
+
+  for (; i + 8 <= samples; i += 8)
+  {
+    __m128 low = _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(sum + i))), gains);
+    gains = _mm_add_ps(gains, increment);
+    __m128 high = _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*)(sum + i + 4))), gains);
+    gains = _mm_add_ps(gains, increment);
+
+    // the comparison masks are -1 for clipped samples
+    clipped = _mm_sub_epi32(clipped, _mm_castps_si128(_mm_or_ps(_mm_cmpgt_ps(low, maximum),
+                                                                _mm_cmplt_ps(low, minimum))));
+    clipped = _mm_sub_epi32(clipped, _mm_castps_si128(_mm_or_ps(_mm_cmpgt_ps(high, maximum),
+                                                                _mm_cmplt_ps(high, minimum))));
+
+    // the pack saturates, which works as the final limiter
+    _mm_storeu_si128((__m128i*)(output + i), _mm_packs_epi32(_mm_cvtps_epi32(low),
+                                                             _mm_cvtps_epi32(high)));
+  }
+
+  int32_t lanes[4];
+  _mm_storeu_si128((__m128i*)lanes, clipped);
+  clippedSamples_ += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+
+  for (; i < samples; ++i)
+  {
+    float value = sum[i]*(startGain + step*i);
+
+    if (value > INT16_MAX || value < INT16_MIN)
+    {
+      ++clippedSamples_;
+    }
+
+    output[i] = (int16_t)std::lround(std::clamp(value, float(INT16_MIN), float(INT16_MAX)));
+  }
 }
 
 
-float AudioMixer::int16ToDB(int16_t value) const
+float AudioMixer::compressorGain(int32_t peak) const
 {
-  float normalized = float(value)/float(INT_MAX);
+  if (peak == 0)
+  {
+    return 1.0f;
+  }
+
+  float level = 20.0f*std::log10(float(peak)/INT16_MAX);
+  float overThreshold = level - compressionThresholdDB_;
+  float compressed = level;
+
+  if (2*overThreshold > KNEE_WIDTH_DB)
+  {
+    compressed = compressionThresholdDB_ + overThreshold/compressionRatio_;
+  }
+  else if (2*overThreshold > -KNEE_WIDTH_DB)
+  {
+    // quadratic curve between no compression and the full ratio
+    float knee = overThreshold + KNEE_WIDTH_DB/2;
+    compressed = level + (1.0f/compressionRatio_ - 1.0f)*knee*knee/(2*KNEE_WIDTH_DB);
+  }
+
+  float gain = std::pow(10.0f, (compressed - level)/20.0f);
 
-  if (normalized == 0.0f)
+  // limit whatever the compression leaves above the maximum
+  return std::min(gain, float(INT16_MAX)/peak);
+}
+
+
+void AudioMixer::reportStatistics()
+{
+  if (++mixedFrames_ < AUDIO_FRAMES_PER_SECOND)
   {
-    return -96.0f; // really quiet
+    return;
   }
 
-  float magnitude = std::fabs(normalized);
+  if (compressedBlocks_ > 0 || clippedSamples_ > 0)
+  {
+    Logger::getLogger()->printWarning(this, "Compressed mixed audio",
+                                      {"Compressed blocks", "Clipped samples", "Max reduction"},
+                                      {QString::number(compressedBlocks_) + "/" +
+                                       QString::number(mixedFrames_) + " frames",
+                                       QString::number(clippedSamples_),
+                                       QString::number(20.0f*std::log10(minGain_), 'f', 1) + " dB"});
+  }
 
-  // log of less than one is negative, as should be. DB is always negative or 0 dB
-  return 20.0f * std::log10(magnitude);
+  mixedFrames_ = 0;
+  compressedBlocks_ = 0;
+  clippedSamples_ = 0;
+  minGain_ = 1.0f;
 }
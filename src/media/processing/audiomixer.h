@@ -7,18 +7,24 @@
 
 #include <map>
 #include <deque>
+#include <vector>
 
 #include <memory>
 
 struct Data;
+class BufferPool;
+class SpeakerSelector;
 
-// Mixes multiple audio tracks into one
+// Mixes multiple audio tracks into one. The sum of the tracks is accumulated
+// at 32 bits and brought back to 16 bits with a soft-knee compressor whose
+// gain is calculated once per block of samples. The mixing buffers are reused
+// between frames, so the mixing does not allocate memory.
 
 class AudioMixer : public QObject
 {
   Q_OBJECT
 public:
-  AudioMixer();
+  AudioMixer(std::shared_ptr<BufferPool> pool);
 
   // TODO: This should take into account different sizes of audio frames for
   // compatability with other applications
@@ -29,6 +35,10 @@ public:
 
   void updateSettings();
 
+  // Only the sources selected as speakers are mixed. Without a selector the
+  // mixer waits for every input, with it only for the selected ones.
+  void setSpeakerSelector(std::shared_ptr<SpeakerSelector> selector);
+
   void addInput()
   {
     ++inputs_;
@@ -41,16 +51,52 @@ public:
 
 private:
 
-  int16_t dbToint16(float dB) const;
-  float int16ToDB(int16_t value) const;
+  // how many of the sources sending to this mixer are selected as speakers
+  unsigned int selectedSources();
+
+  DataBuffer doMixing(uint32_t frameSize);
+
+  // sums the first samples of every source to mixSum_
+  void accumulate(uint32_t samples);
 
-  std::unique_ptr<uchar[]> doMixing(uint32_t frameSize);
+  // compresses the sum of one block and writes it to output
+  void compressBlock(const int32_t* sum, int16_t* output, uint32_t samples);
+
+  // the gain which brings the peak of a block to the compressor curve
+  float compressorGain(int32_t peak) const;
+
+  // reports the compression and clipping of the last second at once
+  void reportStatistics();
 
   int32_t inputs_;
 
   QMutex mixingMutex_;
   std::map<uint32_t, std::deque<std::unique_ptr<Data>>> mixingBuffer_;
 
-  int16_t compressionThreshold_;
-  uint8_t compressionRatio_;
+  // the SSRC last received from each session, key is sessionID
+  std::map<uint32_t, uint32_t> sourceSSRCs_;
+
+  std::shared_ptr<BufferPool> pool_;
+  std::shared_ptr<SpeakerSelector> selector_;
+
+  struct Source
+  {
+    const int16_t* pcm;
+    uint32_t samples;
+  };
+
+  // gathered once per frame so the mixing loop does not touch the map
+  std::vector<Source> sources_;
+  std::vector<int32_t> mixSum_;
+
+  float compressionThresholdDB_;
+  float compressionRatio_;
+
+  // the gain applied at the end of the previous block
+  float gain_;
+
+  uint32_t mixedFrames_;
+  uint32_t compressedBlocks_;
+  uint32_t clippedSamples_;
+  float minGain_;
 };
@@ -16,7 +16,9 @@ AudioMixerFilter::AudioMixerFilter(QString id, StatisticsInterface* stats,
   sessionID_(sessionID),
   mixer_(mixer),
   stats_(stats)
-{}
+{
+  taskCompatible_ = true;
+}
 
 
 AudioMixerFilter::~AudioMixerFilter()
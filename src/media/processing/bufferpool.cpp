@@ -0,0 +1,128 @@
+#include "bufferpool.h"
+
+#include "global.h"
+
+// frames are rounded up to whole pages so small differences in the size
+// of the same resolution do not create new size classes
+const uint32_t FRAME_SIZE_GRANULARITY = 4096;
+
+
+BufferPool::BufferPool(uint64_t maxIdleBytes):
+  poolMutex_(),
+  idleBlocks_(),
+  maxIdleBytes_(maxIdleBytes),
+  idleBytes_(0),
+  hits_(0),
+  misses_(0)
+{}
+
+
+BufferPool::~BufferPool()
+{
+  clear();
+}
+
+
+DataBuffer BufferPool::allocate(uint32_t size)
+{
+  uint32_t capacity = sizeClass(size);
+  DataBuffer::Block* block = nullptr;
+
+  poolMutex_.lock();
+  auto idle = idleBlocks_.find(capacity);
+  if (idle != idleBlocks_.end() && !idle->second.empty())
+  {
+    block = idle->second.back();
+    idle->second.pop_back();
+    idleBytes_ -= capacity;
+  }
+  poolMutex_.unlock();
+
+  if (block != nullptr)
+  {
+    ++hits_;
+    block->references.store(1, std::memory_order_relaxed);
+  }
+  else
+  {
+    ++misses_;
+    block = new DataBuffer::Block{{1}, new uchar[capacity], capacity};
+  }
+
+  block->pool = shared_from_this();
+  return DataBuffer(block);
+}
+
+
+void BufferPool::clear()
+{
+  poolMutex_.lock();
+  for (auto& sizeClass : idleBlocks_)
+  {
+    for (DataBuffer::Block* block : sizeClass.second)
+    {
+      delete[] block->memory;
+      delete block;
+    }
+  }
+  idleBlocks_.clear();
+  idleBytes_ = 0;
+  poolMutex_.unlock();
+}
+
+
+void BufferPool::recycle(DataBuffer::Block* block)
+{
+  std::vector<DataBuffer::Block*> evicted;
+
+  poolMutex_.lock();
+
+  // make room by dropping idle buffers of other size classes. These are
+  // typically left over from a previous resolution.
+  for (auto& other : idleBlocks_)
+  {
+    if (idleBytes_ + block->capacity <= maxIdleBytes_)
+    {
+      break;
+    }
+
+    while (other.first != block->capacity && !other.second.empty() &&
+           idleBytes_ + block->capacity > maxIdleBytes_)
+    {
+      evicted.push_back(other.second.back());
+      other.second.pop_back();
+      idleBytes_ -= other.first;
+    }
+  }
+
+  if (idleBytes_ + block->capacity <= maxIdleBytes_)
+  {
+    idleBlocks_[block->capacity].push_back(block);
+    idleBytes_ += block->capacity;
+    block = nullptr;
+  }
+  poolMutex_.unlock();
+
+  // this size class already uses the whole pool
+  if (block != nullptr)
+  {
+    evicted.push_back(block);
+  }
+
+  for (DataBuffer::Block* freed : evicted)
+  {
+    delete[] freed->memory;
+    delete freed;
+  }
+}
+
+
+uint32_t BufferPool::sizeClass(uint32_t size) const
+{
+  if (size <= DEFAULT_MTU_BYTES)
+  {
+    return DEFAULT_MTU_BYTES;
+  }
+
+  return ((size + FRAME_SIZE_GRANULARITY - 1)/FRAME_SIZE_GRANULARITY)*FRAME_SIZE_GRANULARITY;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "databuffer.h"
+
+#include <QMutex>
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+// A size class pool for sample payloads. Packets are served from a single
+// MTU sized class and frames from classes rounded up to whole pages, so all
+// frames of one resolution and format share a class. Buffers return to the
+// pool when the last DataBuffer referencing them is destroyed, avoiding
+// the allocation of a new payload for every packet and frame.
+
+class BufferPool : public std::enable_shared_from_this<BufferPool>
+{
+public:
+  BufferPool(uint64_t maxIdleBytes = 64*1024*1024);
+  ~BufferPool();
+
+  // returns a buffer with room for at least size bytes
+  DataBuffer allocate(uint32_t size);
+
+  // frees all idle buffers, for example after a resolution change
+  void clear();
+
+  uint64_t getHits() const
+  {
+    return hits_.load(std::memory_order_relaxed);
+  }
+
+  uint64_t getMisses() const
+  {
+    return misses_.load(std::memory_order_relaxed);
+  }
+
+  uint64_t getIdleBytes() const
+  {
+    return idleBytes_.load(std::memory_order_relaxed);
+  }
+
+private:
+  friend class DataBuffer;
+
+  // called by DataBuffer when the last reference to a pooled block is dropped
+  void recycle(DataBuffer::Block* block);
+
+  uint32_t sizeClass(uint32_t size) const;
+
+  QMutex poolMutex_;
+
+  // key is the capacity of the buffers in the class
+  std::unordered_map<uint32_t, std::vector<DataBuffer::Block*>> idleBlocks_;
+
+  uint64_t maxIdleBytes_;
+
+  std::atomic<uint64_t> idleBytes_;
+  std::atomic<uint64_t> hits_;
+  std::atomic<uint64_t> misses_;
+};
@@ -362,9 +362,9 @@ void CameraFilter::process()
       totalSize += cloneFrame.mappedBytes(plane);
     }
 
-    newImage->data = std::unique_ptr<uchar[]>(new uchar[totalSize]);
+    std::unique_ptr<uchar[]> frame(new uchar[totalSize]);
 
-    uint8_t* ptr = newImage->data.get();
+    uint8_t* ptr = frame.get();
     for (int plane = 0; plane < cloneFrame.planeCount(); ++plane)
     {
       uchar *bits = cloneFrame.bits(plane);
@@ -372,6 +372,8 @@ void CameraFilter::process()
       ptr += cloneFrame.mappedBytes(plane);
     }
 
+    newImage->data = std::move(frame);
+
     newImage->data_size = totalSize;
 
     // kvazaar requires divisable by 8 resolution
@@ -0,0 +1,204 @@
+#include "databuffer.h"
+
+#include "bufferpool.h"
+
+#include <cstring>
+
+static std::atomic<uint64_t> payloadCopies(0);
+
+DataBuffer::DataBuffer():
+  block_(nullptr)
+{}
+
+
+DataBuffer::DataBuffer(std::nullptr_t):
+  block_(nullptr)
+{}
+
+
+DataBuffer::DataBuffer(std::unique_ptr<uchar[]> data):
+  block_(nullptr)
+{
+  if (data)
+  {
+    block_ = new Block{{1}, data.release()};
+  }
+}
+
+
+DataBuffer::DataBuffer(uchar* memory, std::function<void()> giveBack):
+  block_(nullptr)
+{
+  if (memory)
+  {
+    block_ = new Block{{1}, memory};
+    block_->giveBack = std::move(giveBack);
+  }
+}
+
+
+DataBuffer::DataBuffer(Block* block):
+  block_(block)
+{}
+
+
+DataBuffer::DataBuffer(const DataBuffer& other):
+  block_(nullptr)
+{
+  reference(other.block_);
+}
+
+
+DataBuffer::DataBuffer(DataBuffer&& other) noexcept:
+  block_(other.block_)
+{
+  other.block_ = nullptr;
+}
+
+
+DataBuffer::~DataBuffer()
+{
+  dereference();
+}
+
+
+DataBuffer& DataBuffer::operator=(const DataBuffer& other)
+{
+  if (block_ != other.block_)
+  {
+    dereference();
+    reference(other.block_);
+  }
+  return *this;
+}
+
+
+DataBuffer& DataBuffer::operator=(DataBuffer&& other) noexcept
+{
+  if (this != &other)
+  {
+    dereference();
+    block_ = other.block_;
+    other.block_ = nullptr;
+  }
+  return *this;
+}
+
+
+DataBuffer& DataBuffer::operator=(std::unique_ptr<uchar[]> data)
+{
+  return *this = DataBuffer(std::move(data));
+}
+
+
+DataBuffer& DataBuffer::operator=(std::nullptr_t)
+{
+  dereference();
+  return *this;
+}
+
+
+uchar* DataBuffer::writable(uint32_t size)
+{
+  if (isShared())
+  {
+    payloadCopies.fetch_add(1, std::memory_order_relaxed);
+
+    // pooled buffers are copied to a buffer from the same pool
+    if (block_->pool)
+    {
+      DataBuffer copy = block_->pool->allocate(size);
+      memcpy(copy.block_->memory, block_->memory, size);
+      *this = std::move(copy);
+    }
+    else
+    {
+      std::unique_ptr<uchar[]> copy(new uchar[size]);
+      memcpy(copy.get(), block_->memory, size);
+      *this = std::move(copy);
+    }
+  }
+
+  return block_ ? block_->memory : nullptr;
+}
+
+
+std::unique_ptr<uchar[]> DataBuffer::release(uint32_t size)
+{
+  if (block_ == nullptr)
+  {
+    return nullptr;
+  }
+
+  // memory owned by someone else must be copied
+  if (block_->giveBack)
+  {
+    std::unique_ptr<uchar[]> copy(new uchar[size]);
+    memcpy(copy.get(), block_->memory, size);
+    dereference();
+    return copy;
+  }
+
+  writable(size);
+
+  std::unique_ptr<uchar[]> memory(block_->memory);
+  delete block_;
+  block_ = nullptr;
+
+  return memory;
+}
+
+
+bool DataBuffer::isShared() const
+{
+  return block_ != nullptr &&
+      block_->references.load(std::memory_order_acquire) > 1;
+}
+
+
+uint64_t DataBuffer::getCopies()
+{
+  return payloadCopies.load(std::memory_order_relaxed);
+}
+
+
+void DataBuffer::reset()
+{
+  dereference();
+}
+
+
+void DataBuffer::reference(Block* block)
+{
+  block_ = block;
+  if (block_ != nullptr)
+  {
+    block_->references.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+
+void DataBuffer::dereference()
+{
+  if (block_ != nullptr &&
+      block_->references.fetch_sub(1, std::memory_order_acq_rel) == 1)
+  {
+    if (block_->pool)
+    {
+      // the pool does not keep references to itself in idle blocks
+      std::shared_ptr<BufferPool> pool = std::move(block_->pool);
+      pool->recycle(block_);
+    }
+    else if (block_->giveBack)
+    {
+      block_->giveBack();
+      delete block_;
+    }
+    else
+    {
+      delete[] block_->memory;
+      delete block_;
+    }
+  }
+  block_ = nullptr;
+}
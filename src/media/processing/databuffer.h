@@ -0,0 +1,109 @@
+#pragma once
+
+#include <QtGlobal>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+// Reference counted payload of a Data sample. Copying a DataBuffer does not copy
+// the payload, instead all copies share the same allocation which is released
+// when the last copy is destroyed. This way a filter can send the same sample
+// to any number of out connections without copying it.
+
+// The payload must be considered immutable once it has been shared. A filter
+// that modifies the payload in place must request it with writable(), which
+// copies the payload first if someone else still references it (copy-on-write).
+
+// Buffers allocated from a BufferPool are returned to the pool when the last
+// reference is dropped. Memory owned by someone else, for example an encoder
+// picture, can be wrapped with a function that gives it back.
+
+class BufferPool;
+
+class DataBuffer
+{
+public:
+  DataBuffer();
+  DataBuffer(std::nullptr_t);
+
+  // takes ownership of memory allocated with new[]
+  DataBuffer(std::unique_ptr<uchar[]> data);
+
+  // references memory owned by someone else, giveBack is called when the
+  // last reference is dropped
+  DataBuffer(uchar* memory, std::function<void()> giveBack);
+
+  DataBuffer(const DataBuffer& other);
+  DataBuffer(DataBuffer&& other) noexcept;
+
+  ~DataBuffer();
+
+  DataBuffer& operator=(const DataBuffer& other);
+  DataBuffer& operator=(DataBuffer&& other) noexcept;
+  DataBuffer& operator=(std::unique_ptr<uchar[]> data);
+  DataBuffer& operator=(std::nullptr_t);
+
+  // read only access to the payload
+  const uchar* get() const
+  {
+    return block_ ? block_->memory : nullptr;
+  }
+
+  // Returns a pointer which can be used to modify the payload. If the payload
+  // is shared, the first size bytes are copied to a new allocation first.
+  uchar* writable(uint32_t size);
+
+  // Gives up the ownership of the payload, for example for libraries that
+  // take a unique_ptr. The payload is copied if it is still shared.
+  std::unique_ptr<uchar[]> release(uint32_t size);
+
+  // whether other DataBuffers reference the same payload
+  bool isShared() const;
+
+  // number of payloads copied because they were shared, for statistics
+  static uint64_t getCopies();
+
+  void reset();
+
+  explicit operator bool() const
+  {
+    return block_ != nullptr;
+  }
+
+  bool operator==(std::nullptr_t) const
+  {
+    return block_ == nullptr;
+  }
+
+  bool operator!=(std::nullptr_t) const
+  {
+    return block_ != nullptr;
+  }
+
+private:
+  friend class BufferPool;
+
+  struct Block
+  {
+    std::atomic<uint32_t> references;
+    uchar* memory;
+
+    // set only for pooled buffers
+    uint32_t capacity = 0;
+    std::shared_ptr<BufferPool> pool = nullptr;
+
+    // set only for memory owned by someone else
+    std::function<void()> giveBack = nullptr;
+  };
+
+  // adopts a block whose reference has already been counted
+  explicit DataBuffer(Block* block);
+
+  void reference(Block* block);
+  void dereference();
+
+  Block* block_;
+};
@@ -18,6 +18,7 @@ DisplayFilter::DisplayFilter(QString id, StatisticsInterface *stats,
   widgets_(widgets), 
   sessionID_(sessionID)
 {
+  taskCompatible_ = true;
 
   if (widgets.empty())
   {
@@ -62,6 +63,22 @@ DisplayFilter::DisplayFilter(QString id, StatisticsInterface *stats,
 }
 
 
+QSize DisplayFilter::viewSize() const
+{
+  QSize largest(0, 0);
+
+  for (auto& widget : widgets_)
+  {
+    if (widget != nullptr)
+    {
+      largest = largest.expandedTo(widget->viewSize());
+    }
+  }
+
+  return largest;
+}
+
+
 DisplayFilter::~DisplayFilter()
 {}
 
@@ -100,10 +117,8 @@ void DisplayFilter::process()
           /* This is a bit of a hack in that multiple widgets are only used for
          * the self view. The first index contains the self view (if this display filter
          * is used for selfviews and not peer views) and needs the horizontal mirroring
-         * whereas other don't want it. We also must copy the data for all but the
-         * last one since the life of the the data in widgets differs.
-         *
-         * TODO: This copying could probably be eliminated by using shared_ptr in widgets */
+         * whereas other don't want it. The widgets share the same frame data,
+         * the orientation is restored for all but the last one. */
 
           input = deliverFrame(widgets_.at(i), std::move(input),
                                format, i != 0,
@@ -120,19 +135,14 @@ void DisplayFilter::process()
 std::unique_ptr<Data> DisplayFilter::deliverFrame(VideoInterface* screen,
                                                   std::unique_ptr<Data> input,
                                                   QImage::Format format,
-                                                  bool useCopy, bool mirrorHorizontally)
+                                                  bool keepOriginal, bool mirrorHorizontally)
 {
-  std::unique_ptr<uchar[]> tmpData = nullptr;
-
-  // replace input data with copy
-  if (useCopy)
+  // normalizing the orientation replaces the data so we keep a reference
+  // to the unflipped frame for the other widgets
+  DataBuffer original = nullptr;
+  if (keepOriginal)
   {
-    // save input data temporarily
-    tmpData = std::move(input->data);
-
-    // create a copy to input data structure for normalize orientation
-    input->data = std::unique_ptr<uchar[]>(new uchar[input->data_size]);
-    memcpy(input->data.get(), tmpData.get(), input->data_size);
+    original = input->data;
   }
 
   bool verticalOrientation = input->vInfo->flippedVertically;
@@ -145,15 +155,15 @@ std::unique_ptr<Data> DisplayFilter::deliverFrame(VideoInterface* screen,
         input->vInfo->height,
         format);
   
-  screen->inputImage(std::move(input->data), image,
+  screen->inputImage(input->data, image,
                      double(input->vInfo->framerateNumerator/input->vInfo->framerateDenominator),
                      input->creationTimestamp, input->presentationTimestamp);
 
-  if (useCopy)
+  if (keepOriginal)
   {
     input->vInfo->flippedVertically = verticalOrientation;
     input->vInfo->flippedHorizontally = horizontalOrientation;
-    input->data = std::move(tmpData);
+    input->data = std::move(original);
   }
 
   return input;
@@ -18,19 +18,22 @@ public:
     horizontalMirroring_ = status;
   }
 
+  // the largest view this filter draws to, can be called from any thread
+  QSize viewSize() const;
+
 protected:
   void process();
 
 private:
 
   /* The purpose of this function is to deliver frames to widgets
-   * that draw the frames. The copy is needed since the final life
-   * of the frames can be different. Non-copy operations
-   * invalidate the data */
+   * that draw the frames. The widgets share the frame data, but if
+   * keepOriginal is set, the original orientation of the input is
+   * restored for the next widget. */
   std::unique_ptr<Data> deliverFrame(VideoInterface* screen,
                                      std::unique_ptr<Data> input,
                                      QImage::Format format,
-                                     bool useCopy, bool mirrorHorizontally);
+                                     bool keepOriginal, bool mirrorHorizontally);
 
   bool horizontalMirroring_;
 
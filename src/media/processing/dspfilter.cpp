@@ -60,13 +60,13 @@ void DSPFilter::process()
     // do dsp operation such as denoise, dereverb and agc
     if (doDSP_ && dsp_)
     {
-      input->data = dsp_->processInputFrame(std::move(input->data), input->data_size);
+      input->data = dsp_->processInputFrame(input->data.release(input->data_size), input->data_size);
     }
 
     // do echo cancellation
     if (doAEC_ && aec_)
     {
-      input->data = aec_->processInputFrame(std::move(input->data), input->data_size);
+      input->data = aec_->processInputFrame(input->data.release(input->data_size), input->data_size);
     }
 
     // provide a reference frame of our speaker output so AEC can remove echo
@@ -132,8 +132,9 @@ void FakeCamera::process()
     newImage->vInfo->height = resolution_.height();
     newImage->vInfo->framerateNumerator = framerate_;
     newImage->vInfo->framerateDenominator = 1;
-    newImage->data = std::make_unique<uchar[]>(frameSize);
-    memcpy(newImage->data.get(), buffer.data(), frameSize);
+    std::unique_ptr<uchar[]> frame = std::make_unique<uchar[]>(frameSize);
+    memcpy(frame.get(), buffer.data(), frameSize);
+    newImage->data = std::move(frame);
 
     newImage->creationTimestamp = clockNowMs();
     newImage->presentationTimestamp = newImage->creationTimestamp;
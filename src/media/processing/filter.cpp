@@ -1,5 +1,7 @@
 #include "filter.h"
 
+#include "filterscheduler.h"
+#include "media/resourceallocator.h"
 #include "statisticsinterface.h"
 #include "yuvconversions.h"
 
@@ -8,8 +10,15 @@
 #include <QImage>
 #include <QDebug>
 
+#include <libyuv.h>
+
 #include <thread>
 
+// maximum number of samples in the lock-free input, must be a power of two
+const uint32_t INPUT_RING_SIZE = 2048;
+
+// the filter whose task or fused processing the current thread is running
+thread_local Filter* currentTask = nullptr;
 
 const std::map<DataType, QString> typeString = {
   {DT_NONE, "None"},
@@ -69,6 +78,9 @@ Filter::Filter(QString id, QString name, StatisticsInterface *stats,
                std::shared_ptr<ResourceAllocator> hwResources,
                DataType input, DataType output, bool enforceFramerate):
   maxBufferSize_(10),
+  lockFreeInput_(true),
+  taskCompatible_(false),
+  stridedInput_(false),
   input_(input),
   output_(output),
   name_(name),
@@ -77,7 +89,24 @@ Filter::Filter(QString id, QString name, StatisticsInterface *stats,
   waitMutex_(new QMutex),
   hasInput_(),
   running_(true),
+  sleeping_(false),
+  scheduler_(nullptr),
+  taskWorker_(-1),
+  scheduled_(false),
+  executing_(false),
+  fused_(false),
+  sendsStarted_(0),
+  sendsFinished_(0),
+  producers_(0),
+  sharedInput_(false),
+  bufferedInputs_(0),
+  inRing_(INPUT_RING_SIZE),
+  ringHead_(0),
+  ringTail_(0),
+  ringEmptiedTo_(0),
   inputTaken_(0),
+  inputConsumed_(0),
+  consumedBeforeSleep_(0),
   inputDiscarded_(0),
   hwResources_(hwResources),
   filterID_(0),
@@ -137,12 +166,23 @@ bool Filter::isAudio(DataType type)
 
 void Filter::addOutConnection(std::shared_ptr<Filter> out)
 {
+  // Counted before sending starts so the receiver stops using the ring. The
+  // ring is not used again even if the other producers are removed, because
+  // the samples already in the locked buffer would be overtaken.
+  if (out->producers_.fetch_add(1, std::memory_order_acq_rel) > 0)
+  {
+    out->sharedInput_.store(true, std::memory_order_release);
+  }
+
+  connectionMutex_.lock();
   outConnections_.push_back({out, true});
+  connectionMutex_.unlock();
 }
 
 void Filter::removeOutConnection(std::shared_ptr<Filter> out)
 {
   bool removed = false;
+  uint64_t started = 0;
   connectionMutex_.lock();
   for(unsigned int i = 0; i < outConnections_.size(); ++i)
   {
@@ -153,12 +193,35 @@ void Filter::removeOutConnection(std::shared_ptr<Filter> out)
       break;
     }
   }
+  started = sendsStarted_.load(std::memory_order_acquire);
   connectionMutex_.unlock();
 
   if(!removed)
   {
     Logger::getLogger()->printWarning(this, "Did not succeed at removing outconnection.");
+    return;
+  }
+
+  // the sends before the removal may still be inside putInput of the filter
+  while (currentTask != this && sendsFinished_.load(std::memory_order_acquire) < started)
+  {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  out->producers_.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+
+std::vector<std::shared_ptr<Filter>> Filter::getOutFilters()
+{
+  QMutexLocker lock(&connectionMutex_);
+
+  std::vector<std::shared_ptr<Filter>> filters;
+  for (auto& connection : outConnections_)
+  {
+    filters.push_back(connection.filter);
   }
+  return filters;
 }
 
 int Filter::getOutConnectionIndex(std::shared_ptr<Filter> target) const
@@ -183,9 +246,15 @@ void Filter::emptyBuffer()
   //std::queue<std::unique_ptr<Data>> empty;
   std::deque<std::unique_ptr<Data>> empty;
   std::swap( inBuffer_, empty );
+  bufferedInputs_.store(0, std::memory_order_release);
   bufferMutex_.unlock();
+
+  // only the filter thread may read the ring so it discards the samples
+  ringEmptiedTo_.store(ringTail_.load(std::memory_order_acquire),
+                       std::memory_order_release);
 }
 
+
 void Filter::putInput(std::unique_ptr<Data> data)
 {
   Q_ASSERT(data);
@@ -203,6 +272,19 @@ void Filter::putInput(std::unique_ptr<Data> data)
 
   ++inputTaken_;
 
+  // only a fused filter processes the frame while the planes are still valid
+  if (data->vInfo && data->vInfo->planes[0] && !(fused_ && stridedInput_))
+  {
+    data = packFrame(std::move(data));
+  }
+
+  if (useInputRing())
+  {
+    pushToRing(std::move(data));
+    wakeUp();
+    return;
+  }
+
   bufferMutex_.lock();
 
   if(inputTaken_%30 == 0)
@@ -214,48 +296,210 @@ void Filter::putInput(std::unique_ptr<Data> data)
 
   if(maxBufferSize_ != -1 && inBuffer_.size() >= (uint32_t)maxBufferSize_)
   {
-    if(inBuffer_[0]->type == DT_HEVCVIDEO)
+    size_t discard = samplesToDiscard([this](size_t i)
     {
-      // Search for intra frames and discard everything up to it
-      for(uint32_t i = 0; i < inBuffer_.size(); ++i)
-      {
-        const unsigned char *buff = inBuffer_.at(i)->data.get();
-        if(!isHEVCIntra(buff))
-        {
-          Logger::getLogger()->printWarning(this, "Discarding HEVC frames from buffer. Finding next intra",
-                                            "Frames discarded", QString::number(i));
-
-          for(int j = i; j != 0; --j)
-          {
-            inBuffer_.pop_front();
-          }
-          break;
-        }
-      }
+      return inBuffer_.at(i).get();
+    }, inBuffer_.size());
+
+    for(size_t j = discard; j != 0; --j)
+    {
+      inBuffer_.pop_front();
     }
-    else
+
+    if (discard > 0)
+    {
+      reportDiscard();
+    }
+  }
+
+  bufferedInputs_.store((uint32_t)inBuffer_.size(), std::memory_order_release);
+  bufferMutex_.unlock();
+
+  wakeUp();
+}
+
+
+bool Filter::useInputRing() const
+{
+  return lockFreeInput_ &&
+      !sharedInput_.load(std::memory_order_acquire) &&
+      maxBufferSize_ != -1 && (uint32_t)maxBufferSize_ < INPUT_RING_SIZE;
+}
+
+
+void Filter::pushToRing(std::unique_ptr<Data> data)
+{
+  uint64_t tail = ringTail_.load(std::memory_order_relaxed);
+  uint64_t head = ringHead_.load(std::memory_order_acquire);
+
+  if(inputTaken_%30 == 0)
+  {
+    stats_->updateBufferStatus(filterID_, (uint16_t)(tail - head), maxBufferSize_);
+  }
+
+  // The drop policy is applied when the filter thread reads the ring, so the
+  // ring may hold more than the buffer size, but only up to the next power of
+  // two. If the filter thread has not read it in that long, only the newest
+  // sample can be discarded without synchronizing with it.
+  uint64_t capacity = 1;
+  while (capacity < (uint64_t)maxBufferSize_ && capacity < INPUT_RING_SIZE)
+  {
+    capacity <<= 1;
+  }
+
+  if (tail - head >= capacity)
+  {
+    reportDiscard();
+    return;
+  }
+
+  inRing_[tail & (INPUT_RING_SIZE - 1)] = std::move(data);
+  ringTail_.store(tail + 1, std::memory_order_release);
+}
+
+
+std::unique_ptr<Data> Filter::popFromRing()
+{
+  uint64_t head = ringHead_.load(std::memory_order_relaxed);
+  uint64_t tail = ringTail_.load(std::memory_order_acquire);
+
+  uint64_t emptiedTo = ringEmptiedTo_.load(std::memory_order_acquire);
+  while (head < emptiedTo && head != tail)
+  {
+    inRing_[head & (INPUT_RING_SIZE - 1)].reset();
+    ++head;
+  }
+
+  if (maxBufferSize_ != -1)
+  {
+    // same policy as with the locked buffer, but applied when reading
+    while (tail - head >= (uint64_t)maxBufferSize_)
     {
-      if(inBuffer_[0]->type == DT_OPUSAUDIO)
+      size_t discard = samplesToDiscard([this, head](size_t i)
+      {
+        return inRing_[(head + i) & (INPUT_RING_SIZE - 1)].get();
+      }, tail - head);
+
+      for (size_t j = discard; j != 0; --j)
+      {
+        inRing_[head & (INPUT_RING_SIZE - 1)].reset();
+        ++head;
+      }
+
+      if (discard == 0)
       {
-        Logger::getLogger()->printWarning(this, "Should input Null pointer to opus decoder.");
+        break;
       }
-      inBuffer_.pop_front(); // discard the oldest
+
+      reportDiscard();
     }
+  }
+
+  std::unique_ptr<Data> r = nullptr;
+  if (head != tail)
+  {
+    r = std::move(inRing_[head & (INPUT_RING_SIZE - 1)]);
+    ++head;
+  }
 
-    ++inputDiscarded_;
-    stats_->packetDropped(filterID_);
+  ringHead_.store(head, std::memory_order_release);
+  return r;
+}
 
-    if (inputDiscarded_ == 1 || inputDiscarded_%10 == 0)
+
+bool Filter::hasQueuedInput() const
+{
+  return bufferedInputs_.load(std::memory_order_acquire) > 0 ||
+      ringHead_.load(std::memory_order_relaxed) !=
+      ringTail_.load(std::memory_order_acquire);
+}
+
+
+size_t Filter::samplesToDiscard(const std::function<const Data* (size_t)>& sample,
+                                size_t size)
+{
+  if(sample(0)->type == DT_HEVCVIDEO)
+  {
+    // Search for intra frames and discard everything up to it
+    for(uint32_t i = 0; i < size; ++i)
     {
-      Logger::getLogger()->printWarning(this, "Buffer too full",
-                                      {"Name", "Discarded/total input"},
-                                      {name_, QString::number(inputDiscarded_) + "/" +
-                                              QString::number(inputTaken_)});
+      const unsigned char *buff = sample(i)->data.get();
+      if(!isHEVCIntra(buff))
+      {
+        Logger::getLogger()->printWarning(this, "Discarding HEVC frames from buffer. Finding next intra",
+                                          "Frames discarded", QString::number(i));
+        return i;
+      }
     }
+    return 0;
   }
-  wakeUp();
 
-  bufferMutex_.unlock();
+  if(sample(0)->type == DT_OPUSAUDIO)
+  {
+    Logger::getLogger()->printWarning(this, "Should input Null pointer to opus decoder.");
+  }
+  return 1; // discard the oldest
+}
+
+
+void Filter::reportDiscard()
+{
+  unsigned int discarded = ++inputDiscarded_;
+  stats_->packetDropped(filterID_);
+
+  // the filter is identified by its ID, since its name would have to be copied
+  LOG_FAST_WARNING(this, "Buffer too full",
+                   {"Filter ID", "Discarded", "Total input"},
+                   {filterID_, discarded, inputTaken_});
+}
+
+
+void Filter::wakeUp()
+{
+  if (fused_)
+  {
+    runInline();
+    return;
+  }
+
+  if (scheduler_)
+  {
+    scheduleTask();
+    return;
+  }
+
+  // Pairs with the fence in waitForInput. Either we see that the filter
+  // thread is going to sleep or it sees our input.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+
+  if (sleeping_.load(std::memory_order_relaxed))
+  {
+    waitMutex_->lock();
+    hasInput_.wakeOne();
+    waitMutex_->unlock();
+  }
+}
+
+
+void Filter::waitForInput()
+{
+  waitMutex_->lock();
+  sleeping_.store(true, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+
+  // Input that arrived during process() is handled right away. If process()
+  // did not take any input, we wait for the next wake up like before.
+  bool consumed = inputConsumed_ != consumedBeforeSleep_;
+  consumedBeforeSleep_ = inputConsumed_;
+
+  if (running_ && !(consumed && hasQueuedInput()))
+  {
+    // unlocks the mutex
+    hasInput_.wait(waitMutex_, maxSleepMs());
+  }
+
+  sleeping_.store(false, std::memory_order_relaxed);
+  waitMutex_->unlock();
 }
 
 
@@ -299,6 +543,99 @@ std::unique_ptr<Data> Filter::initializeData(DataType type, DataSource source)
 }
 
 
+DataBuffer Filter::allocateBuffer(uint32_t size) const
+{
+  return hwResources_->getBufferPool()->allocate(size);
+}
+
+
+void Filter::setBufferLender(std::weak_ptr<BufferLender> lender)
+{
+  connectionMutex_.lock();
+  bufferLender_ = lender;
+  connectionMutex_.unlock();
+}
+
+
+DataBuffer Filter::allocateFrame(DataType type, uint16_t width, uint16_t height,
+                                 uint32_t size)
+{
+  connectionMutex_.lock();
+  std::shared_ptr<BufferLender> lender = bufferLender_.lock();
+  connectionMutex_.unlock();
+
+  if (lender)
+  {
+    DataBuffer buffer = lender->borrowBuffer(type, width, height, size);
+    if (buffer)
+    {
+      return buffer;
+    }
+  }
+
+  return allocateBuffer(size);
+}
+
+
+bool Filter::outputsTakeStridedFrames()
+{
+  QMutexLocker lock(&connectionMutex_);
+
+  if (!outDataCallbacks_.empty() || outConnections_.empty())
+  {
+    return false;
+  }
+
+  for (auto& connection : outConnections_)
+  {
+    // with other producers the frame could wait in the buffer
+    if (!connection.filter->isFused() ||
+        !connection.filter->acceptsStridedInput() ||
+        connection.filter->producers_.load(std::memory_order_acquire) != 1)
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+std::unique_ptr<Data> Filter::packFrame(std::unique_ptr<Data> frame) const
+{
+  if (frame->type != DT_YUV420VIDEO || !frame->vInfo || !frame->vInfo->planes[0])
+  {
+    return frame;
+  }
+
+  int width = frame->vInfo->width;
+  int height = frame->vInfo->height;
+  uint32_t lumaSize = width*height;
+  uint32_t finalDataSize = lumaSize + lumaSize/2;
+
+  DataBuffer yuvFrame = allocateBuffer(finalDataSize);
+  uint8_t* yuv = yuvFrame.writable(finalDataSize);
+
+  libyuv::I420Copy(frame->vInfo->planes[0], frame->vInfo->pitches[0],
+                   frame->vInfo->planes[1], frame->vInfo->pitches[1],
+                   frame->vInfo->planes[2], frame->vInfo->pitches[2],
+                   yuv, width,
+                   yuv + lumaSize, width/2,
+                   yuv + lumaSize + lumaSize/4, width/2,
+                   width, height);
+
+  for (int i = 0; i < 3; ++i)
+  {
+    frame->vInfo->planes[i] = nullptr;
+    frame->vInfo->pitches[i] = 0;
+  }
+
+  frame->data = std::move(yuvFrame);
+  frame->data_size = finalDataSize;
+  return frame;
+}
+
+
 std::unique_ptr<Data> Filter::normalizeOrientation(std::unique_ptr<Data> video,
                                                    bool forceHorizontalFlip)
 {
@@ -314,9 +651,10 @@ std::unique_ptr<Data> Filter::normalizeOrientation(std::unique_ptr<Data> video,
   {
 
     uint32_t finalDataSize = video->vInfo->width*video->vInfo->height*4;
-    std::unique_ptr<uchar[]> flipped_data(new uchar[finalDataSize]);
+    DataBuffer flipped_data = allocateBuffer(finalDataSize);
 
-    flip_rgb(video->data.get(), flipped_data.get(), video->vInfo->width, video->vInfo->height,
+    flip_rgb(video->data.get(), flipped_data.writable(finalDataSize),
+             video->vInfo->width, video->vInfo->height,
              forceHorizontalFlip || video->vInfo->flippedHorizontally, video->vInfo->flippedVertically);
 
 
@@ -335,14 +673,32 @@ std::unique_ptr<Data> Filter::normalizeOrientation(std::unique_ptr<Data> video,
 
 std::unique_ptr<Data> Filter::getInput()
 {
-  bufferMutex_.lock();
-  std::unique_ptr<Data> r;
-  if(!inBuffer_.empty())
+  // Samples left in the ring were sent before a second producer was
+  // connected, so they are older than anything in the locked buffer.
+  std::unique_ptr<Data> r = popFromRing();
+
+  if (!r && bufferedInputs_.load(std::memory_order_acquire) > 0)
+  {
+    bufferMutex_.lock();
+
+    // The producer of the ring fills it before it moves to the locked buffer,
+    // so under the lock we see its last ring sample if we see its first
+    // buffered one.
+    r = popFromRing();
+
+    if(!r && !inBuffer_.empty())
+    {
+      r = std::move(inBuffer_.front());
+      inBuffer_.pop_front();
+    }
+    bufferedInputs_.store((uint32_t)inBuffer_.size(), std::memory_order_release);
+    bufferMutex_.unlock();
+  }
+
+  if (r)
   {
-    r = std::move(inBuffer_.front());
-    inBuffer_.pop_front();
+    ++inputConsumed_;
   }
-  bufferMutex_.unlock();
 
   // optional enforcement of smooth frame rate, only done if there was input
   // TODO: Does not work at the moment
@@ -412,62 +768,222 @@ void Filter::sendOutput(std::unique_ptr<Data> output, bool inverse)
     return;
   }
 
-  // TODO: If data is HEVC, I think we can safely use shallowcopy
-
+  // The outputs are taken under the lock, but called after it, because a
+  // fused output processes the sample before putInput returns.
   connectionMutex_.lock();
+  sendsStarted_.fetch_add(1, std::memory_order_acq_rel);
+  std::vector<std::function<void(std::unique_ptr<Data>)> > callbacks = outDataCallbacks_;
+  std::vector<FilterOutput> connections = outConnections_;
+  connectionMutex_.unlock();
+
+  // The copies only reference the payload of the output so the payload is
+  // allocated only once regardless of the number of outputs.
   // Copy data to callbacks (except for the last one which is moved)
-  if (!outDataCallbacks_.empty())
+  if (!callbacks.empty())
   {
     // All callbacks except the last
-    for (unsigned int i = 0; i < outDataCallbacks_.size() - 1; ++i)
+    for (unsigned int i = 0; i < callbacks.size() - 1; ++i)
     {
-      Data* copy = deepDataCopy(output.get());
+      Data* copy = sharedDataCopy(output.get());
       std::unique_ptr<Data> u_copy(copy);
-      outDataCallbacks_[i](std::move(u_copy));
+      callbacks[i](std::move(u_copy));
     }
 
     // Copy the last callback and move the last connection
-    if (!outConnections_.empty())
+    if (!connections.empty())
     {
-      Data* copy = deepDataCopy(output.get());
+      Data* copy = sharedDataCopy(output.get());
       std::unique_ptr<Data> u_copy(copy);
-      outDataCallbacks_.back()(std::move(u_copy));
+      callbacks.back()(std::move(u_copy));
     }
     else // Move the last callback
     {
-      outDataCallbacks_.back()(std::move(output));
+      callbacks.back()(std::move(output));
     }
   }
 
   // Handle all connected filters, considering 'enabled' status
-  if (!outConnections_.empty())
+  if (!connections.empty())
   {
     // All output connections except the last (which will be moved)
-    for (unsigned int i = 0; i < outConnections_.size() - 1; ++i)
+    for (unsigned int i = 0; i < connections.size() - 1; ++i)
     {
       // Only send to enabled connections
-      if ((outConnections_[i].enabled && !inverse) || (!outConnections_[i].enabled && inverse))
+      if ((connections[i].enabled && !inverse) || (!connections[i].enabled && inverse))
       {
-        Data* copy = deepDataCopy(output.get());
+        Data* copy = sharedDataCopy(output.get());
         std::unique_ptr<Data> u_copy(copy);
-        outConnections_[i].filter->putInput(std::move(u_copy));
+        connections[i].filter->putInput(std::move(u_copy));
       }
     }
 
     // Always move the last connection
-    if ((outConnections_.back().enabled && !inverse) || (!outConnections_.back().enabled && inverse))
+    if ((connections.back().enabled && !inverse) || (!connections.back().enabled && inverse))
     {
-      outConnections_.back().filter->putInput(std::move(output));
+      connections.back().filter->putInput(std::move(output));
     }
   }
 
-  connectionMutex_.unlock();
+  sendsFinished_.fetch_add(1, std::memory_order_acq_rel);
 }
 
 void Filter::stop()
 {
+  waitMutex_->lock();
   running_ = false;
   hasInput_.wakeAll();
+  waitMutex_->unlock();
+
+  if (fused_)
+  {
+    // the filter before may be in the middle of our process()
+    while (currentTask != this && executing_.load(std::memory_order_seq_cst))
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    if (filterID_ != 0)
+    {
+      stats_->removeFilter(filterID_);
+      filterID_ = 0;
+    }
+  }
+  else if (scheduler_)
+  {
+    // process() may be stopping itself, which does not need to wait. The
+    // executing flag is read first, since a finishing task may queue itself.
+    while (currentTask != this &&
+           (executing_.load(std::memory_order_seq_cst) ||
+            scheduled_.load(std::memory_order_seq_cst)))
+    {
+      if (scheduler_->cancel(this))
+      {
+        scheduled_.store(false, std::memory_order_seq_cst);
+      }
+      else
+      {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+    }
+
+    if (filterID_ != 0)
+    {
+      stats_->removeFilter(filterID_);
+      filterID_ = 0;
+    }
+  }
+}
+
+
+void Filter::setScheduler(std::shared_ptr<FilterScheduler> scheduler, int worker)
+{
+  if (!taskCompatible_ || isRunning())
+  {
+    return;
+  }
+
+  scheduler_ = scheduler;
+  taskWorker_ = worker;
+}
+
+
+void Filter::setFused(bool fused)
+{
+  if ((fused && !taskCompatible_) || isRunning())
+  {
+    return;
+  }
+
+  fused_ = fused;
+}
+
+
+void Filter::startTask()
+{
+  if (stats_ != nullptr && filterID_ == 0)
+  {
+    filterID_ = stats_->addFilter(name_, id_, 0);
+  }
+
+  // a fused filter waits for the next input from the filter before
+  if (!fused_ && hasQueuedInput())
+  {
+    scheduleTask();
+  }
+}
+
+
+void Filter::scheduleTask()
+{
+  // Pairs with the fence in runTask. Either the running task sees our input
+  // or we see that it is no longer scheduled.
+  if (!scheduled_.exchange(true, std::memory_order_seq_cst))
+  {
+    if (running_)
+    {
+      scheduler_->schedule(this, taskWorker_);
+    }
+    else
+    {
+      scheduled_.store(false, std::memory_order_seq_cst);
+    }
+  }
+}
+
+
+void Filter::runTask()
+{
+  executing_.store(true, std::memory_order_seq_cst);
+  currentTask = this;
+
+  if (running_)
+  {
+    process();
+  }
+
+  currentTask = nullptr;
+
+  scheduled_.store(false, std::memory_order_seq_cst);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+
+  // input that arrived during process() did not queue the task again
+  if (running_ && hasQueuedInput())
+  {
+    scheduleTask();
+  }
+
+  executing_.store(false, std::memory_order_seq_cst);
+}
+
+
+void Filter::runInline()
+{
+  // With several producers, whoever gets here first processes the input of
+  // all of them. The others only leave their input in the buffer.
+  while (running_ && !executing_.exchange(true, std::memory_order_seq_cst))
+  {
+    // the filter before us may itself be running as a task or fused
+    Filter* producer = currentTask;
+    currentTask = this;
+
+    uint64_t consumedBefore = inputConsumed_;
+
+    if (running_)
+    {
+      process();
+    }
+
+    bool consumed = inputConsumed_ != consumedBefore;
+
+    currentTask = producer;
+    executing_.store(false, std::memory_order_seq_cst);
+
+    // input from another producer may have arrived while we were processing
+    if (!consumed || !hasQueuedInput())
+    {
+      break;
+    }
+  }
 }
 
 void Filter::run()
@@ -498,10 +1014,12 @@ Data* Filter::shallowDataCopy(Data* original) const
     copy->type = original->type;
 
     copy->source = original->source;
+    copy->ssrc = original->ssrc;
 
     copy->creationTimestamp = original->creationTimestamp;
     copy->presentationTimestamp = original->presentationTimestamp;
     copy->rtpTimestamp = original->rtpTimestamp;
+    copy->rtpSequence = original->rtpSequence;
 
     copy->data_size = 0; // no data in shallow copy
 
@@ -516,6 +1034,12 @@ Data* Filter::shallowDataCopy(Data* original) const
       copy->vInfo->flippedHorizontally = original->vInfo->flippedHorizontally;
       copy->vInfo->flippedVertically   = original->vInfo->flippedVertically;
       copy->vInfo->keyframe            = original->vInfo->keyframe;
+
+      for (int i = 0; i < 3; ++i)
+      {
+        copy->vInfo->planes[i]  = original->vInfo->planes[i];
+        copy->vInfo->pitches[i] = original->vInfo->pitches[i];
+      }
     }
 
     if (original->aInfo != nullptr)
@@ -523,6 +1047,7 @@ Data* Filter::shallowDataCopy(Data* original) const
       copy->aInfo = std::unique_ptr<AudioInfo> (new AudioInfo);
 
       copy->aInfo->sampleRate = original->aInfo->sampleRate;
+      copy->aInfo->payloadType = original->aInfo->payloadType;
     }
 
     return copy;
@@ -532,12 +1057,33 @@ Data* Filter::shallowDataCopy(Data* original) const
 }
 
 Data* Filter::deepDataCopy(Data* original) const
+{
+  if(original != nullptr)
+  {
+    // the planes of a decoder picture are not in the payload
+    if (original->vInfo != nullptr && original->vInfo->planes[0] != nullptr)
+    {
+      return packFrame(std::unique_ptr<Data>(sharedDataCopy(original))).release();
+    }
+
+    Data* copy = shallowDataCopy(original);
+    std::unique_ptr<uchar[]> payload(new uchar[original->data_size]);
+    memcpy(payload.get(), original->data.get(), original->data_size);
+    copy->data = std::move(payload);
+    copy->data_size = original->data_size;
+
+    return copy;
+  }
+  Logger::getLogger()->printWarning(this, "Trying to copy nullptr Data pointer.");
+  return nullptr;
+}
+
+Data* Filter::sharedDataCopy(Data* original) const
 {
   if(original != nullptr)
   {
     Data* copy = shallowDataCopy(original);
-    copy->data = std::unique_ptr<uchar[]>(new uchar[original->data_size]);
-    memcpy(copy->data.get(), original->data.get(), original->data_size);
+    copy->data = original->data;
     copy->data_size = original->data_size;
 
     return copy;
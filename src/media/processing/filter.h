@@ -1,5 +1,7 @@
 #pragma once
 
+#include "databuffer.h"
+
 #include "global.h"
 #include <QWaitCondition>
 #include <QThread>
@@ -12,6 +14,8 @@
 #include <WinSock2.h>
 #endif
 
+#include <atomic>
+#include <climits>
 #include <cstdint>
 #include <vector>
 #include <deque>
@@ -22,7 +26,9 @@
 // One of the most fundamental classes of uvgComm. A filter is an indipendent data processing
 // unit running on its own thread. Filters can be linked together to form a data processing pipeline
 // called filter graph. A class inherited from filter can do any sort of processing to the data it
-// receives. The filter sleeps when it does not have any input to process.
+// receives. The filter sleeps when it does not have any input to process. Alternatively, filters
+// that allow it can run their processing as tasks of a FilterScheduler when input arrives or be
+// fused to the filter before them, in which case they are processed on its thread.
 
 // the numbers will change as new formats are added, please use enum values
 enum DataType {DT_NONE        = 0,
@@ -96,25 +102,36 @@ struct VideoInfo
   float psnrU = -1.0;
   float psnrV = -1.0;
 
+  // Set when the Y, U and V planes are not packed in the payload, but belong
+  // to a decoder picture. The planes are only valid while the sample is sent
+  // to the next filter, see Filter::packFrame. Pitches are in bytes.
+  const uint8_t* planes[3] = {nullptr, nullptr, nullptr};
+  int32_t pitches[3] = {0, 0, 0};
+
   RoiMap roi;
 };
 
 struct AudioInfo
 {
   uint16_t sampleRate = 0;
+
+  // RTP payload type of the packet this sample was decoded from, 0 if unknown
+  uint8_t payloadType = 0;
 };
 
 struct Data
 {
   DataSource source = DS_UNKNOWN;
   DataType type = DT_NONE;
-  std::unique_ptr<uchar[]> data = nullptr;
+  // shared between the copies of this sample, see DataBuffer
+  DataBuffer data = nullptr;
   uint32_t data_size = 0;
 
   // SSRC of the RTP stream that produced this packet (0 = unknown)
   uint32_t ssrc = 0;
 
   uint32_t rtpTimestamp = 0;
+  uint16_t rtpSequence = 0;
 
   // indicate the moment of creation for this sample for latency calculations
   int64_t creationTimestamp = -1;
@@ -127,8 +144,21 @@ struct Data
 };
 
 class StatisticsInterface;
+class FilterScheduler;
 class ResourceAllocator;
 
+// A filter that can lend the memory it processes, so the filter before it
+// can write its output directly there instead of the output being copied.
+class BufferLender
+{
+public:
+  virtual ~BufferLender() {}
+
+  // returns a null buffer if nothing can be lent for this frame
+  virtual DataBuffer borrowBuffer(DataType type, uint16_t width, uint16_t height,
+                                  uint32_t size) = 0;
+};
+
 class Filter : public QThread
 {
   Q_OBJECT
@@ -147,8 +177,12 @@ public:
 
   // adds one outbound connection to this filter.
   void addOutConnection(std::shared_ptr<Filter> out);
+
+  // returns once the removed filter no longer receives output from us
   void removeOutConnection(std::shared_ptr<Filter> out);
 
+  std::vector<std::shared_ptr<Filter>> getOutFilters();
+
   // callback registeration enables other classes besides Filter
   // to receive output data
   template <typename Class>
@@ -163,6 +197,9 @@ public:
   // empties the input buffer
   void emptyBuffer();
 
+  // Can be called from any thread. While the filter has at most one producer,
+  // the input goes through a lock-free ring buffer. Samples coming from outside
+  // the filter graph must then all be put from the same thread.
   void putInput(std::unique_ptr<Data> data);
 
   // for debugging filter graphs
@@ -178,17 +215,78 @@ public:
   virtual void start()
   {
     running_ = true;
-    QThread::start();
+
+    if (scheduler_ || fused_)
+    {
+      startTask();
+    }
+    else
+    {
+      QThread::start();
+    }
   }
 
+  // with a scheduler, also waits until process() is no longer queued or running
   virtual void stop();
 
+  // Runs process() on the scheduler when input arrives instead of on the
+  // thread of this filter. Only done if the filter is task compatible.
+  // The worker is the preferred worker of the scheduler. Call before start().
+  void setScheduler(std::shared_ptr<FilterScheduler> scheduler, int worker);
+
+  bool isTaskCompatible() const
+  {
+    return taskCompatible_;
+  }
+
+  bool acceptsStridedInput() const
+  {
+    return stridedInput_;
+  }
+
+  bool runsAsTask() const
+  {
+    return scheduler_ != nullptr;
+  }
+
+  int taskWorker() const
+  {
+    return taskWorker_;
+  }
+
+  // called by the scheduler worker
+  void runTask();
+
+  // Processes input right away on the thread of the filter that sends it
+  // instead of waking a thread of our own. Only done if the filter is task
+  // compatible. Call before start().
+  void setFused(bool fused);
+
+  bool isFused() const
+  {
+    return fused_;
+  }
+
+  bool isStopped() const
+  {
+    return !running_;
+  }
+
+  int outConnectionCount()
+  {
+    QMutexLocker lock(&connectionMutex_);
+    return (int)outConnections_.size();
+  }
+
   QString printOutputs();
 
   // helper function for copying Data
   Data* shallowDataCopy(Data* original) const;
   Data* deepDataCopy(Data* original) const;
 
+  // copies the sample information, but references the same payload
+  Data* sharedDataCopy(Data* original) const;
+
   QString getName() const
   {
     return name_;
@@ -202,6 +300,9 @@ public:
   // threads; will lock the connection mutex briefly.
   void setOutConnectionEnabledByIndex(int index, bool enabled);
 
+  // output frames are borrowed from the lender when possible, see allocateFrame
+  void setBufferLender(std::weak_ptr<BufferLender> lender);
+
   static std::unique_ptr<Data> initializeData(DataType type, DataSource source);
 
   static bool isVideo(DataType type);
@@ -227,19 +328,16 @@ protected:
   bool isHEVCIntra(const unsigned char *buff) const;
   bool isHEVCInter(const unsigned char *buff) const;
 
-  void wakeUp()
-  {
-    waitMutex_->lock();
-    hasInput_.wakeOne();
-    waitMutex_->unlock();
-  }
+  // wakes the filter thread if it is sleeping
+  void wakeUp();
 
-  void waitForInput()
+  void waitForInput();
+
+  // The filter thread calls process() at the latest after this time even
+  // without input, for filters that have to keep time.
+  virtual unsigned long maxSleepMs() const
   {
-    waitMutex_->lock();
-    // unlocks the mutex
-    hasInput_.wait(waitMutex_);
-    waitMutex_->unlock();
+    return ULONG_MAX;
   }
 
   StatisticsInterface* getStats() const
@@ -253,9 +351,36 @@ protected:
     return hwResources_;
   }
 
+  // returns a payload buffer of at least size bytes from the shared buffer pool
+  DataBuffer allocateBuffer(uint32_t size) const;
+
+  // Returns a buffer for an output frame. The buffer is borrowed from the
+  // lender if it has one for this frame, otherwise it is allocated.
+  DataBuffer allocateFrame(DataType type, uint16_t width, uint16_t height,
+                           uint32_t size);
+
+  // Whether all outputs process the frame before sendOutput returns and
+  // can read it from strided planes, so it does not have to be packed.
+  bool outputsTakeStridedFrames();
+
+  // copies a YUV 420 frame with strided planes into a packed payload
+  std::unique_ptr<Data> packFrame(std::unique_ptr<Data> frame) const;
+
   // -1 disables buffer, but its not recommended because delay
   int maxBufferSize_;
 
+  // Set to false in constructor if the input should always use the locked buffer.
+  // Buffers larger than the ring also use the locked buffer.
+  bool lockFreeInput_;
+
+  // Set to true in constructor if process() only reacts to input and does not
+  // block, so it can be run by a shared scheduler worker or by the filter before.
+  bool taskCompatible_;
+
+  // Set to true in constructor if process() can read YUV 420 frames from
+  // strided planes. The planes may only be read inside process().
+  bool stridedInput_;
+
   DataType input_;
   DataType output_;
 
@@ -276,11 +401,28 @@ protected:
   void printDataBytes(QString type, const uint8_t *payload, size_t size,
                       int bytes, int shift);
 
-  unsigned int inputDiscarded_;
+  std::atomic<unsigned int> inputDiscarded_;
 private:
 
   std::unique_ptr<Data> validityCheck(std::unique_ptr<Data> data, bool &ok);
 
+  bool useInputRing() const;
+  void pushToRing(std::unique_ptr<Data> data);
+  std::unique_ptr<Data> popFromRing();
+
+  // whether the consumer has input waiting, only called by the filter thread
+  bool hasQueuedInput() const;
+
+  // returns how many of the oldest samples the drop policy discards from a
+  // full buffer. HEVC is discarded up to the next intra frame.
+  size_t samplesToDiscard(const std::function<const Data* (size_t)>& sample,
+                          size_t size);
+  void reportDiscard();
+
+  void startTask();
+  void scheduleTask();
+  void runInline();
+
   std::chrono::time_point<std::chrono::high_resolution_clock> getFrameTimepoint();
   void resetSynchronizationPoint(int32_t framerateNumerator,
                                  int32_t framerateDenominator);
@@ -292,7 +434,21 @@ private:
   QMutex *waitMutex_;
   QWaitCondition hasInput_;
 
-  bool running_;
+  std::atomic<bool> running_;
+
+  // set by the filter thread while it waits so producers only signal when needed
+  std::atomic<bool> sleeping_;
+
+  std::shared_ptr<FilterScheduler> scheduler_;
+  int taskWorker_;
+
+  // true while the task is queued or running, so it is never run twice at once
+  std::atomic<bool> scheduled_;
+
+  // true until runTask or runInline no longer touches the filter
+  std::atomic<bool> executing_;
+
+  std::atomic<bool> fused_;
 
   std::vector<std::function<void(std::unique_ptr<Data>)> > outDataCallbacks_;
 
@@ -305,12 +461,41 @@ private:
 
   std::vector<FilterOutput> outConnections_;
 
+  // a removed output waits until the sends that saw it have finished
+  std::atomic<uint64_t> sendsStarted_;
+  std::atomic<uint64_t> sendsFinished_;
+
+  // protected by the connection mutex
+  std::weak_ptr<BufferLender> bufferLender_;
+
+  // number of filters sending to this filter
+  std::atomic<uint32_t> producers_;
+
+  // set when a second producer is connected, after which input is never
+  // taken through the ring
+  std::atomic<bool> sharedInput_;
+
   QMutex bufferMutex_;
   //std::queue<std::unique_ptr<Data>> inBuffer_;
   std::deque<std::unique_ptr<Data>> inBuffer_;
+  std::atomic<uint32_t> bufferedInputs_;
+
+  // single producer single consumer ring. The head is only written by the
+  // filter thread and the tail only by the producer. The drop policy is applied
+  // by the filter thread when it reads the ring.
+  std::vector<std::unique_ptr<Data>> inRing_;
+  alignas(64) std::atomic<uint64_t> ringHead_;
+  alignas(64) std::atomic<uint64_t> ringTail_;
+
+  // samples before this position are discarded, set by emptyBuffer
+  std::atomic<uint64_t> ringEmptiedTo_;
 
   unsigned int inputTaken_;
 
+  // used by the filter thread to detect whether process() consumed input
+  uint64_t inputConsumed_;
+  uint64_t consumedBeforeSleep_;
+
   std::shared_ptr<ResourceAllocator> hwResources_;
 
   uint32_t filterID_;
@@ -2,18 +2,24 @@
 
 #include "logger.h"
 #include "filter.h"
+#include "filterscheduler.h"
 
 #include "media/processing/libyuvconverter.h"
 #include "media/processing/yuvtorgb32.h"
 
 #include "media/resourceallocator.h"
 
+#include "settingskeys.h"
+#include "common.h"
+
 #include <thread>
 
 FilterGraph::FilterGraph():
   quitting_(false),
   stats_(nullptr),
   hwResources_(nullptr),
+  scheduler_(nullptr),
+  fuseSegments_(false),
   peers_()
 {}
 
@@ -27,6 +33,23 @@ void FilterGraph::init(StatisticsInterface* stats, std::shared_ptr<ResourceAlloc
   quitting_ = false;
   stats_ = stats;
   hwResources_ = hwResources;
+
+  if (settingEnabled(SettingsKey::mediaTaskScheduler))
+  {
+    if (!scheduler_)
+    {
+      scheduler_ = std::make_shared<FilterScheduler>();
+    }
+
+    Logger::getLogger()->printNormal(this, "Running input driven filters on a task scheduler",
+                                     {"Workers"}, {QString::number(scheduler_->workerCount())});
+  }
+  else
+  {
+    scheduler_ = nullptr;
+  }
+
+  fuseSegments_ = settingEnabled(SettingsKey::mediaFusedSegments);
 }
 
 void FilterGraph::running(bool state)
@@ -169,6 +192,8 @@ bool FilterGraph::addToGraph(std::shared_ptr<Filter> filter,
                                 GraphSegment &graph,
                                 size_t connectIndex)
 {
+  bool fused = false;
+
   // // check if we need some sort of conversion and connect to index
   if(graph.size() > 0 && connectIndex <= graph.size() - 1)
   {
@@ -211,6 +236,37 @@ bool FilterGraph::addToGraph(std::shared_ptr<Filter> filter,
       connectIndex = (unsigned int)graph.size() - 1;
     }
     connectFilters(graph.at(connectIndex), filter);
+
+    // Fan-out keeps the queues so the outputs are processed in parallel, see
+    // updateFusion. The first filter of a segment keeps its thread to
+    // decouple it from the sender.
+    if (fuseSegments_ && filter->isTaskCompatible() &&
+        graph.at(connectIndex)->outConnectionCount() == 1)
+    {
+      filter->setFused(true);
+      fused = filter->isFused();
+    }
+  }
+
+  if (!fused && scheduler_ && filter->isTaskCompatible())
+  {
+    // keep the filters of one segment on the same worker so the data stays in its cache
+    int worker = -1;
+    for (auto& segmentFilter : graph)
+    {
+      if (segmentFilter->runsAsTask())
+      {
+        worker = segmentFilter->taskWorker();
+        break;
+      }
+    }
+
+    if (worker == -1)
+    {
+      worker = scheduler_->nextWorker();
+    }
+
+    filter->setScheduler(scheduler_, worker);
   }
 
   graph.push_back(filter);
@@ -241,10 +297,94 @@ bool FilterGraph::connectFilters(std::shared_ptr<Filter> previous, std::shared_p
     return false;
   }
   previous->addOutConnection(filter);
+  updateFusion(previous);
   return true;
 }
 
 
+void FilterGraph::disconnectFilters(std::shared_ptr<Filter> previous, std::shared_ptr<Filter> filter)
+{
+  Q_ASSERT(filter != nullptr && previous != nullptr);
+
+  previous->removeOutConnection(filter);
+  updateFusion(previous);
+}
+
+
+void FilterGraph::updateFusion(std::shared_ptr<Filter> previous)
+{
+  if (!fuseSegments_)
+  {
+    return;
+  }
+
+  std::vector<std::shared_ptr<Filter>> outputs = previous->getOutFilters();
+
+  if (outputs.size() > 1)
+  {
+    for (auto& filter : outputs)
+    {
+      if (filter->isFused())
+      {
+        setFusion(filter, false);
+        fannedOut_.push_back(filter);
+      }
+    }
+  }
+  else if (outputs.size() == 1)
+  {
+    for (auto it = fannedOut_.begin(); it != fannedOut_.end();)
+    {
+      std::shared_ptr<Filter> filter = it->lock();
+      if (!filter || filter == outputs.front())
+      {
+        if (filter)
+        {
+          setFusion(filter, true);
+        }
+        it = fannedOut_.erase(it);
+      }
+      else
+      {
+        ++it;
+      }
+    }
+  }
+}
+
+
+void FilterGraph::setFusion(std::shared_ptr<Filter> filter, bool fused)
+{
+  Logger::getLogger()->printNormal(this, fused ? "Fusing filter to the filter before it"
+                                               : "Giving fused filter its own thread",
+                                   {"Filter"}, {filter->getName()});
+
+  // the filter is switched while stopped, its input waits in the buffer
+  bool started = !filter->isStopped();
+  if (started)
+  {
+    filter->stop();
+
+    while(filter->isRunning())
+    {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+
+  filter->setFused(fused);
+
+  if (!fused && scheduler_ && !filter->runsAsTask())
+  {
+    filter->setScheduler(scheduler_, scheduler_->nextWorker());
+  }
+
+  if (started)
+  {
+    filter->start();
+  }
+}
+
+
 void FilterGraph::removeParticipant(uint32_t sessionID)
 {
   if (peers_.find(sessionID) != peers_.end() &&
@@ -13,6 +13,7 @@ class Filter;
 class ResourceAllocator;
 class StatisticsInterface;
 class LibYUVConverter;
+class FilterScheduler;
 
 
 typedef std::vector<std::shared_ptr<Filter>> GraphSegment;
@@ -23,8 +24,8 @@ class FilterGraph : public QObject
 public:
   FilterGraph();
 
-  void init(StatisticsInterface *stats,
-            std::shared_ptr<ResourceAllocator> hwResources);
+  virtual void init(StatisticsInterface *stats,
+                    std::shared_ptr<ResourceAllocator> hwResources);
 
   virtual void uninit() = 0;
 
@@ -93,7 +94,8 @@ protected:
   void checkParticipant(uint32_t sessionID);
 
   // Adds fitler to graph and connects it to connectIndex unless this is
-  // the first filter in graph. Adds format conversion if needed.
+  // the first filter in graph. Adds format conversion if needed. The filter
+  // is fused to the filter it connects to while nothing else is connected to it.
   bool addToGraph(std::shared_ptr<Filter> filter,
                   GraphSegment& graph,
                   size_t connectIndex = 0);
@@ -101,8 +103,18 @@ protected:
   // connects the two filters and checks for any problems
   bool connectFilters(std::shared_ptr<Filter> previous, std::shared_ptr<Filter> filter);
 
+  void disconnectFilters(std::shared_ptr<Filter> previous, std::shared_ptr<Filter> filter);
+
   void changeState(std::shared_ptr<Filter> f, bool state);
 
+  // Fan-out gives the fused outputs of previous their own thread back, so
+  // the outputs are processed in parallel. They are fused again once
+  // previous has only one output.
+  void updateFusion(std::shared_ptr<Filter> previous);
+
+  // switches a started filter between running fused and on its own
+  void setFusion(std::shared_ptr<Filter> filter, bool fused);
+
 
   void destroyFilters(std::vector<std::shared_ptr<Filter>>& filters);
 
@@ -115,6 +127,15 @@ protected:
   std::shared_ptr<ResourceAllocator> hwResources_;
   StatisticsInterface* stats_;
 
+  // shared workers for task compatible filters, null if each filter has its own thread
+  std::shared_ptr<FilterScheduler> scheduler_;
+
+  // whether task compatible filters with only one filter before them are run on its thread
+  bool fuseSegments_;
+
+  // fused filters that got their own thread when their producer fanned out
+  std::vector<std::weak_ptr<Filter>> fannedOut_;
+
   // key is sessionID
   std::map<uint32_t, Peer*> peers_;
 };
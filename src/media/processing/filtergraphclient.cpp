@@ -135,10 +135,25 @@ void FilterGraphClient::refreshResolutions()
                                        {QString("%1x%2").arg(hwRes.width()).arg(hwRes.height()),
                                         QString::number(hwBitrate)});
 
-      kvazaar_->restartEncoder();
+      // the restart takes the current bitrate too
+      bool bitrateApplied = true;
+
+      if (resolutionChanged)
+      {
+        kvazaar_->restartEncoder();
+      }
+      else
+      {
+        bitrateApplied = kvazaar_->setTargetBitrate(hwBitrate);
+      }
 
       lastAppliedResolution_ = hwRes;
-      lastAppliedBitrate_ = hwBitrate;
+
+      // a change too small to apply is compared again on the next refresh
+      if (bitrateApplied)
+      {
+        lastAppliedBitrate_ = hwBitrate;
+      }
     }
     else
     {
@@ -479,6 +494,17 @@ void FilterGraphClient::initVideoSend(std::pair<uint16_t, uint16_t> resolution)
   addToGraph(kvazaar_, screenShareGraph_, 0);
   addToGraph(kvazaar_, fileInputGraph_, 1); // libyuv, could also be roi
 
+  // the converters write their frames directly to Kvazaar input pictures
+  if (libyuv_)
+  {
+    libyuv_->setBufferLender(kvazaar_);
+  }
+
+  if (libyuv2_)
+  {
+    libyuv2_->setBufferLender(kvazaar_);
+  }
+
   // only the camera filter needs hybrid as all senders are attached to end of camera graph
   addHybridFilter(std::shared_ptr<HybridFilter>(new HybridFilter("", stats_, hwResources_)),
                   cameraGraph_);
@@ -631,10 +657,25 @@ void FilterGraphClient::receiveVideoFrom(uint32_t sessionID,
       std::shared_ptr<GraphSegment> graph = std::shared_ptr<GraphSegment> (new GraphSegment);
       peers_[sessionID]->videoViewFlow[cname] = graph;
 
+      std::shared_ptr<DisplayFilter> displayFilter =
+      std::shared_ptr<DisplayFilter>(new DisplayFilter(QString::number(sessionID),
+                                                         stats_, hwResources_, {view}, sessionID, cname));
+
       addToGraph(std::shared_ptr<Filter>(new RTPBuffer(QString::number(sessionID), stats_, hwResources_, receiver->outputType())), *graph, 0);
       if (receiver->outputType() == DT_HEVCVIDEO)
       {
-        addToGraph(std::shared_ptr<Filter>(new OpenHEVCFilter(sessionID, cname, stats_, hwResources_)), *graph, (unsigned int)graph->size() - 1);
+        std::shared_ptr<OpenHEVCFilter> decoder =
+            std::make_shared<OpenHEVCFilter>(sessionID, cname, stats_, hwResources_);
+
+        // decode only as much as the view shows
+        std::weak_ptr<DisplayFilter> display = displayFilter;
+        decoder->setViewSize([display]()
+        {
+          std::shared_ptr<DisplayFilter> view = display.lock();
+          return view ? view->viewSize() : QSize();
+        });
+
+        addToGraph(decoder, *graph, (unsigned int)graph->size() - 1);
       }
       else
       {
@@ -642,10 +683,6 @@ void FilterGraphClient::receiveVideoFrom(uint32_t sessionID,
                                                "Format", QString::number(receiver->outputType()));
       }
 
-      std::shared_ptr<DisplayFilter> displayFilter =
-      std::shared_ptr<DisplayFilter>(new DisplayFilter(QString::number(sessionID),
-                                                         stats_, hwResources_, {view}, sessionID, cname));
-
       addToGraph(displayFilter, *graph, (unsigned int)graph->size() - 1);
     }
 
@@ -725,7 +762,7 @@ void FilterGraphClient::receiveAudioFrom(uint32_t sessionID, std::shared_ptr<Fil
       // mixer helps mix the incoming audio streams into one output stream
       if (mixer_ == nullptr)
       {
-        mixer_ = std::make_shared<AudioMixer>();
+        mixer_ = std::make_shared<AudioMixer>(hwResources_->getBufferPool());
       }
 
       std::shared_ptr<AudioMixerFilter> audioMixer =
@@ -942,11 +979,11 @@ void FilterGraphClient::destroyPeer(Peer* peer)
 
   for (auto& audioSender : peer->audioSenders)
   {
-    audioInputGraph_.back()->removeOutConnection(audioSender.second);
+    disconnectFilters(audioInputGraph_.back(), audioSender.second);
   }
   for (auto& videoSender : peer->videoSenders)
   {
-    cameraGraph_.back()->removeOutConnection(videoSender.second);
+    disconnectFilters(cameraGraph_.back(), videoSender.second);
   }
 
   FilterGraph::destroyPeer(peer);
@@ -1,14 +1,91 @@
 #include "filtergraphsfu.h"
 
 #include "filter.h"
+#include "audiomixer.h"
+#include "audiomixerfilter.h"
+#include "opusdecoderfilter.h"
+#include "opusencoderfilter.h"
+#include "opuslevelfilter.h"
+#include "speakerselector.h"
 #include "logger.h"
+#include "../delivery/rtpaudiopacketizer.h"
 #include "../delivery/udpreceiver.h"
+#include "../resourceallocator.h"
 
+#include "common.h"
+#include "settingskeys.h"
 
-FilterGraphSFU::FilterGraphSFU() : FilterGraph()
+#include <QSettings>
+
+#include <algorithm>
+
+const unsigned int DEFAULT_MIXED_SPEAKERS = 3;
+
+// the audio flows of a peer in mixing mode
+const QString AUDIO_DECODE_FLOW = "decode";
+const QString AUDIO_MIX_FLOW = "mix";
+
+// the audio flow of a peer when only the loudest speakers are forwarded
+const QString AUDIO_LEVEL_FLOW = "level";
+
+// position of the decoder in the decode flow, the mixer filters follow it
+const size_t DECODER_INDEX = 1;
+
+
+FilterGraphSFU::FilterGraphSFU() : FilterGraph(),
+  audioMixing_(false),
+  forwardedSpeakers_(0),
+  audioFormat_(),
+  speakers_(nullptr),
+  audioMixers_(),
+  audioMixerFilters_()
 {}
 
 
+void FilterGraphSFU::init(StatisticsInterface *stats,
+                          std::shared_ptr<ResourceAllocator> hwResources)
+{
+  FilterGraph::init(stats, hwResources);
+
+  QSettings settings(getSettingsFile(), settingsFileFormat);
+  audioMixing_ = settings.value(SettingsKey::sfuAudioMixing, false).toBool();
+  unsigned int speakers = settings.value(SettingsKey::sfuMixedSpeakers,
+                                         DEFAULT_MIXED_SPEAKERS).toUInt();
+  forwardedSpeakers_ = settings.value(SettingsKey::sfuForwardedSpeakers, 0).toUInt();
+
+  audioFormat_.setSampleRate(OPUS_RTP_TIMESTAMP_RATE);
+  audioFormat_.setChannelCount(1);
+  audioFormat_.setSampleFormat(QAudioFormat::Int16);
+
+  if (audioMixing_)
+  {
+    speakers_ = std::make_shared<SpeakerSelector>(speakers);
+
+    Logger::getLogger()->printNormal(this, "Mixing the audio of the loudest speakers",
+                                     {"Speakers"}, {QString::number(speakers)});
+  }
+  else
+  {
+    speakers_ = std::make_shared<SpeakerSelector>(forwardedSpeakers_);
+
+    if (limitsAudioForwarding())
+    {
+      // the connections are changed in the thread of the graph
+      speakers_->setSelectionCallback([this]()
+      {
+        QMetaObject::invokeMethod(this, [this]()
+        {
+          updateAudioForwarding();
+        }, Qt::QueuedConnection);
+      });
+
+      Logger::getLogger()->printNormal(this, "Forwarding the audio of the loudest speakers",
+                                       {"Speakers"}, {QString::number(forwardedSpeakers_)});
+    }
+  }
+}
+
+
 void FilterGraphSFU::uninit()
 {
   quitting_ = true;
@@ -183,6 +260,13 @@ void FilterGraphSFU::sendAudioTo(uint32_t sessionID, std::shared_ptr<Filter> sen
 
   peers_.at(sessionID)->audioSenders[localSSRC] = sender; // TODO: this is probably incorrect, it should be remote SSRC
 
+  if (audioMixing_)
+  {
+    sendMixedAudioTo(sessionID, sender, localSSRC);
+    sender->start();
+    return;
+  }
+
   // find the other participant whose stream is supposed to connected to this sender
   for (auto& peer : peers_)
   {
@@ -196,7 +280,8 @@ void FilterGraphSFU::sendAudioTo(uint32_t sessionID, std::shared_ptr<Filter> sen
                                         {"Sender SSRC"},
                                         {QString::number(localSSRC)});
 
-        connectFilters(peer.second->audioReceivers.begin()->second, sender);
+        connectAudioForwarding(peer.second->audioReceivers.begin()->second, sender,
+                               peer.second->audioReceivers.begin()->first);
         // Also connect any RTCP-only receivers from this participant to the new audio sender
         if (!peer.second->videoRTCPReceivers.empty())
         {
@@ -236,6 +321,13 @@ void FilterGraphSFU::receiveAudioFrom(uint32_t sessionID, std::shared_ptr<Filter
   // add the participant to the graph
   peers_.at(sessionID)->audioReceivers[remoteSSRC] = receiver;
 
+  if (audioMixing_)
+  {
+    receiveMixedAudioFrom(sessionID, receiver, remoteSSRC);
+    receiver->start();
+    return;
+  }
+
   // connect the receiver to existing senders to distribute this new media
   for (auto& peer : peers_)
   {
@@ -243,11 +335,17 @@ void FilterGraphSFU::receiveAudioFrom(uint32_t sessionID, std::shared_ptr<Filter
     {
       if (!peer.second->audioSenders.empty())
       {
-        connectFilters(receiver, peer.second->audioSenders.begin()->second);
+        connectAudioForwarding(receiver, peer.second->audioSenders.begin()->second,
+                               remoteSSRC);
       }
     }
   }
 
+  if (limitsAudioForwarding())
+  {
+    measureAudioFrom(sessionID, receiver);
+  }
+
   // receiver is connected to senders later when the other call are renegotiated
   receiver->start();
 }
@@ -270,10 +368,11 @@ void FilterGraphSFU::receiveAudioRTCPFrom(uint32_t sessionID, std::shared_ptr<Fi
 
   // Connect this RTCP-only receiver to existing senders so it follows the
   // same topology as the RTP receiver. Do not record outConnectionIndexMap_
-  // entries so APP control messages do not affect this receiver.
+  // entries so APP control messages do not affect this receiver. When mixing,
+  // the SFU is the source of the audio the others receive, so RTCP is not forwarded.
   for (auto& peer : peers_)
   {
-    if (peer.first != sessionID && peer.second != nullptr)
+    if (!audioMixing_ && peer.first != sessionID && peer.second != nullptr)
     {
       if (!peer.second->audioSenders.empty())
       {
@@ -287,9 +386,218 @@ void FilterGraphSFU::receiveAudioRTCPFrom(uint32_t sessionID, std::shared_ptr<Fi
 }
 
 
+void FilterGraphSFU::receiveMixedAudioFrom(uint32_t sessionID, std::shared_ptr<Filter> receiver,
+                                           uint32_t remoteSSRC)
+{
+  decodeAudioFrom(sessionID, receiver);
+
+  Logger::getLogger()->printNormal(this, "Decoding audio for mixing",
+                                   {"SSRC"}, {QString::number(remoteSSRC)});
+
+  for (auto& peer : peers_)
+  {
+    if (peer.first != sessionID && peer.second != nullptr &&
+        peer.second->audioViewFlow.find(AUDIO_MIX_FLOW) != peer.second->audioViewFlow.end())
+    {
+      connectAudioMix(sessionID, peer.first);
+    }
+  }
+}
+
+
+void FilterGraphSFU::decodeAudioFrom(uint32_t sessionID, std::shared_ptr<Filter> receiver)
+{
+  std::shared_ptr<GraphSegment> decoding = std::make_shared<GraphSegment>();
+  peers_.at(sessionID)->audioViewFlow[AUDIO_DECODE_FLOW] = decoding;
+
+  addToGraph(std::make_shared<RTPAudioDepacketizer>(QString::number(sessionID), stats_,
+                                                    hwResources_, DT_OPUSAUDIO), *decoding);
+
+  std::shared_ptr<OpusDecoderFilter> decoder =
+      std::make_shared<OpusDecoderFilter>(sessionID, audioFormat_, stats_, hwResources_);
+
+  // the level of each publisher is measured once, not separately for every subscriber
+  decoder->addDataOutCallback(speakers_.get(), &SpeakerSelector::measureLevel);
+  addToGraph(decoder, *decoding, 0);
+
+  connectFilters(receiver, decoding->front());
+}
+
+
+void FilterGraphSFU::measureAudioFrom(uint32_t sessionID, std::shared_ptr<Filter> receiver)
+{
+  std::shared_ptr<GraphSegment> measuring = std::make_shared<GraphSegment>();
+  peers_.at(sessionID)->audioViewFlow[AUDIO_LEVEL_FLOW] = measuring;
+
+  addToGraph(std::make_shared<RTPAudioDepacketizer>(QString::number(sessionID), stats_,
+                                                    hwResources_, DT_OPUSAUDIO), *measuring);
+  addToGraph(std::make_shared<OpusLevelFilter>(QString::number(sessionID), stats_,
+                                               hwResources_, speakers_), *measuring, 0);
+
+  connectFilters(receiver, measuring->front());
+}
+
+
+void FilterGraphSFU::connectAudioForwarding(std::shared_ptr<Filter> receiver,
+                                            std::shared_ptr<Filter> sender,
+                                            uint32_t publisherSSRC)
+{
+  connectFilters(receiver, sender);
+
+  // the speakers that are not selected stay connected so the selection only
+  // has to toggle the connection
+  if (!forwardsAudioOf(publisherSSRC))
+  {
+    int idx = receiver->getOutConnectionIndex(sender);
+    if (idx >= 0)
+    {
+      receiver->setOutConnectionEnabledByIndex(idx, false);
+    }
+  }
+}
+
+
+bool FilterGraphSFU::forwardsAudioOf(uint32_t publisherSSRC) const
+{
+  return !limitsAudioForwarding() || speakers_->isSelected(publisherSSRC);
+}
+
+
+void FilterGraphSFU::updateAudioForwarding()
+{
+  for (auto& publisher : peers_)
+  {
+    if (publisher.second == nullptr || publisher.second->audioReceivers.empty())
+    {
+      continue;
+    }
+
+    std::shared_ptr<Filter> receiver = publisher.second->audioReceivers.begin()->second;
+    bool forwarded = forwardsAudioOf(publisher.second->audioReceivers.begin()->first);
+
+    for (auto& subscriber : peers_)
+    {
+      if (subscriber.first == publisher.first || subscriber.second == nullptr ||
+          subscriber.second->audioSenders.empty())
+      {
+        continue;
+      }
+
+      int idx = receiver->getOutConnectionIndex(subscriber.second->audioSenders.begin()->second);
+      if (idx >= 0)
+      {
+        receiver->setOutConnectionEnabledByIndex(idx, forwarded);
+      }
+    }
+  }
+}
+
+
+void FilterGraphSFU::sendMixedAudioTo(uint32_t sessionID, std::shared_ptr<Filter> sender,
+                                      uint32_t localSSRC)
+{
+  std::shared_ptr<AudioMixer> mixer = std::make_shared<AudioMixer>(hwResources_->getBufferPool());
+  mixer->setSpeakerSelector(speakers_);
+  mixer->updateSettings();
+  audioMixers_[sessionID] = mixer;
+
+  std::shared_ptr<GraphSegment> mixing = std::make_shared<GraphSegment>();
+  peers_.at(sessionID)->audioViewFlow[AUDIO_MIX_FLOW] = mixing;
+
+  addToGraph(std::make_shared<OpusEncoderFilter>(QString::number(sessionID), audioFormat_,
+                                                 stats_, hwResources_), *mixing);
+  addToGraph(std::make_shared<RTPAudioPacketizer>(QString::number(sessionID), stats_, hwResources_,
+                                                  DT_OPUSAUDIO, localSSRC), *mixing, 0);
+
+  connectFilters(mixing->back(), sender);
+
+  for (auto& peer : peers_)
+  {
+    if (peer.first != sessionID && peer.second != nullptr &&
+        peer.second->audioViewFlow.find(AUDIO_DECODE_FLOW) != peer.second->audioViewFlow.end())
+    {
+      connectAudioMix(peer.first, sessionID);
+    }
+  }
+}
+
+
+void FilterGraphSFU::connectAudioMix(uint32_t publisherSessionID, uint32_t subscriberSessionID)
+{
+  std::shared_ptr<GraphSegment> decoding =
+      peers_.at(publisherSessionID)->audioViewFlow.at(AUDIO_DECODE_FLOW);
+  std::shared_ptr<GraphSegment> mixing =
+      peers_.at(subscriberSessionID)->audioViewFlow.at(AUDIO_MIX_FLOW);
+
+  std::shared_ptr<Filter> mixerFilter =
+      std::make_shared<AudioMixerFilter>(QString::number(publisherSessionID), stats_, hwResources_,
+                                         publisherSessionID, audioMixers_.at(subscriberSessionID));
+
+  // connected to the encoder before it is started so no mixed frame is lost
+  connectFilters(mixerFilter, mixing->front());
+  addToGraph(mixerFilter, *decoding, DECODER_INDEX);
+
+  audioMixerFilters_[{publisherSessionID, subscriberSessionID}] = mixerFilter;
+}
+
+
+void FilterGraphSFU::destroyPeer(Peer* peer)
+{
+  uint32_t sessionID = 0;
+  for (auto& candidate : peers_)
+  {
+    if (candidate.second == peer)
+    {
+      sessionID = candidate.first;
+    }
+  }
+
+  for (auto it = audioMixerFilters_.begin(); it != audioMixerFilters_.end();)
+  {
+    uint32_t publisher = it->first.first;
+
+    if (publisher == sessionID)
+    {
+      // destroyed with the decode flow of the peer
+      it = audioMixerFilters_.erase(it);
+    }
+    else if (it->first.second == sessionID)
+    {
+      // the other publishers stop feeding the mix of this peer
+      if (peers_[publisher] != nullptr &&
+          peers_[publisher]->audioViewFlow.find(AUDIO_DECODE_FLOW) != peers_[publisher]->audioViewFlow.end())
+      {
+        GraphSegment& decoding = *peers_[publisher]->audioViewFlow.at(AUDIO_DECODE_FLOW);
+        disconnectFilters(decoding.at(DECODER_INDEX), it->second);
+        changeState(it->second, false);
+        decoding.erase(std::remove(decoding.begin(), decoding.end(), it->second), decoding.end());
+      }
+      it = audioMixerFilters_.erase(it);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+
+  audioMixers_.erase(sessionID);
+
+  if (speakers_)
+  {
+    for (auto& receiver : peer->audioReceivers)
+    {
+      speakers_->removeSource(receiver.first);
+    }
+  }
+
+  FilterGraph::destroyPeer(peer);
+}
+
+
 void FilterGraphSFU::lastPeerRemoved()
 {
-  // nothing to do
+  audioMixers_.clear();
+  audioMixerFilters_.clear();
 }
 
 
@@ -1,14 +1,24 @@
 #pragma once
 
 #include "filtergraph.h"
+
+#include <QtMultimedia/QAudioFormat>
+
 #include <map>
 #include <utility>
 
+class AudioMixer;
+class SpeakerSelector;
+
 class FilterGraphSFU : public FilterGraph
 {
 public:
   FilterGraphSFU();
 
+  // reads whether audio is mixed or forwarded
+  virtual void init(StatisticsInterface *stats,
+                    std::shared_ptr<ResourceAllocator> hwResources);
+
   virtual void uninit();
 
   // localSSRC here is the SSRC of the destination client, the one we are sending to
@@ -42,9 +52,59 @@ public slots:
 
 protected:
 
+  // also removes the audio mixing between this and other peers
+  virtual void destroyPeer(Peer* peer);
+
   virtual void lastPeerRemoved();
 
   // Map (publisherSSRC, targetSSRC) -> out-connection index on the receiver
   std::map<std::pair<uint32_t, uint32_t>, int> outConnectionIndexMap_;
 
+private:
+
+  // In mixing mode the audio of each publisher is decoded once and the loudest
+  // speakers are mixed and encoded separately for each participant, leaving
+  // out their own voice.
+  void receiveMixedAudioFrom(uint32_t sessionID, std::shared_ptr<Filter> receiver,
+                             uint32_t remoteSSRC);
+  void sendMixedAudioTo(uint32_t sessionID, std::shared_ptr<Filter> sender,
+                        uint32_t localSSRC);
+
+  // adds the audio of publisher to the mix of subscriber
+  void connectAudioMix(uint32_t publisherSessionID, uint32_t subscriberSessionID);
+
+  // decodes the audio of the publisher for mixing, measuring its level on the way
+  void decodeAudioFrom(uint32_t sessionID, std::shared_ptr<Filter> receiver);
+
+  // measures the level of the forwarded audio without a full decoder
+  void measureAudioFrom(uint32_t sessionID, std::shared_ptr<Filter> receiver);
+
+  // whether the forwarded audio is limited to the loudest speakers
+  bool limitsAudioForwarding() const
+  {
+    return !audioMixing_ && forwardedSpeakers_ > 0;
+  }
+
+  bool forwardsAudioOf(uint32_t publisherSSRC) const;
+
+  // connects the audio of a publisher to a subscriber, disabled if not selected
+  void connectAudioForwarding(std::shared_ptr<Filter> receiver, std::shared_ptr<Filter> sender,
+                              uint32_t publisherSSRC);
+
+  // enables the audio connections of the selected speakers and disables the rest
+  void updateAudioForwarding();
+
+  bool audioMixing_;
+  unsigned int forwardedSpeakers_;
+  QAudioFormat audioFormat_;
+
+  std::shared_ptr<SpeakerSelector> speakers_;
+
+  // key is subscriber sessionID
+  std::map<uint32_t, std::shared_ptr<AudioMixer>> audioMixers_;
+
+  // Map (publisher sessionID, subscriber sessionID) -> the filter passing the
+  // decoded audio of the publisher to the mixer of the subscriber
+  std::map<std::pair<uint32_t, uint32_t>, std::shared_ptr<Filter>> audioMixerFilters_;
+
 };
@@ -0,0 +1,155 @@
+#include "filterscheduler.h"
+
+#include "filter.h"
+
+#include "logger.h"
+
+#include <QString>
+
+#include <algorithm>
+
+
+FilterScheduler::FilterScheduler(unsigned int workers):
+  state_(std::make_shared<State>()),
+  threads_(),
+  nextWorker_(0)
+{
+  if (workers == 0)
+  {
+    workers = std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  for (unsigned int i = 0; i < workers; ++i)
+  {
+    state_->workers.push_back(std::make_unique<Worker>());
+  }
+
+  // all queues must exist before any worker starts stealing
+  for (unsigned int i = 0; i < workers; ++i)
+  {
+    threads_.push_back(std::thread(&FilterScheduler::workerLoop, state_, i));
+  }
+
+  Logger::getLogger()->printNormal("FilterScheduler", "Started filter workers",
+                                   "Workers", QString::number(workers));
+}
+
+
+FilterScheduler::~FilterScheduler()
+{
+  {
+    std::lock_guard<std::mutex> lock(state_->sleepMutex);
+    state_->running = false;
+  }
+  state_->hasTasks.notify_all();
+
+  for (auto& thread : threads_)
+  {
+    // The last filter may be released by one of the workers. It cannot join
+    // itself, but keeps the state alive until it has left its loop.
+    if (thread.get_id() == std::this_thread::get_id())
+    {
+      thread.detach();
+    }
+    else if (thread.joinable())
+    {
+      thread.join();
+    }
+  }
+}
+
+
+int FilterScheduler::nextWorker()
+{
+  return (int)(nextWorker_.fetch_add(1, std::memory_order_relaxed) % threads_.size());
+}
+
+
+void FilterScheduler::schedule(Filter* filter, int worker)
+{
+  Worker* home = state_->workers.at((unsigned int)worker % state_->workers.size()).get();
+
+  {
+    std::lock_guard<std::mutex> lock(home->mutex);
+    home->tasks.push_back(filter);
+  }
+
+  state_->queuedTasks.fetch_add(1, std::memory_order_release);
+
+  // taking the lock guarantees that a worker checking the count is either
+  // before it or already waiting
+  {
+    std::lock_guard<std::mutex> lock(state_->sleepMutex);
+  }
+  state_->hasTasks.notify_one();
+}
+
+
+bool FilterScheduler::cancel(Filter* filter)
+{
+  for (auto& worker : state_->workers)
+  {
+    std::lock_guard<std::mutex> lock(worker->mutex);
+    auto it = std::find(worker->tasks.begin(), worker->tasks.end(), filter);
+    if (it != worker->tasks.end())
+    {
+      worker->tasks.erase(it);
+      state_->queuedTasks.fetch_sub(1, std::memory_order_relaxed);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+
+void FilterScheduler::workerLoop(std::shared_ptr<State> state, unsigned int index)
+{
+  // the scheduler may be destroyed during runTask, so only the state is used
+  while (state->running)
+  {
+    Filter* task = takeTask(*state, index);
+
+    if (task != nullptr)
+    {
+      task->runTask();
+      continue;
+    }
+
+    std::unique_lock<std::mutex> lock(state->sleepMutex);
+    state->hasTasks.wait(lock, [&state]
+    {
+      return !state->running || state->queuedTasks.load(std::memory_order_acquire) > 0;
+    });
+  }
+}
+
+
+Filter* FilterScheduler::takeTask(State& state, unsigned int index)
+{
+  for (unsigned int i = 0; i < state.workers.size(); ++i)
+  {
+    Worker* worker = state.workers.at((index + i) % state.workers.size()).get();
+    std::lock_guard<std::mutex> lock(worker->mutex);
+
+    if (!worker->tasks.empty())
+    {
+      Filter* task = nullptr;
+      if (i == 0)
+      {
+        task = worker->tasks.front();
+        worker->tasks.pop_front();
+      }
+      else
+      {
+        task = worker->tasks.back();
+        worker->tasks.pop_back();
+      }
+
+      state.queuedTasks.fetch_sub(1, std::memory_order_relaxed);
+      return task;
+    }
+  }
+
+  return nullptr;
+}
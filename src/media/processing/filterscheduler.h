@@ -0,0 +1,72 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class Filter;
+
+// Runs filters as tasks on a fixed number of worker threads instead of each
+// filter sleeping on a thread of its own. Every worker has its own task queue.
+// A filter is always queued to its home worker so that a chain of filters
+// keeps its data in the cache of one core. Workers without tasks steal from
+// the back of the other queues.
+
+class FilterScheduler
+{
+public:
+  // zero workers means one worker per core
+  FilterScheduler(unsigned int workers = 0);
+  ~FilterScheduler();
+
+  unsigned int workerCount() const
+  {
+    return (unsigned int)threads_.size();
+  }
+
+  // home worker for a new chain of filters, assigned round robin
+  int nextWorker();
+
+  // queues the filter to run its process(). Can be called from any thread.
+  void schedule(Filter* filter, int worker);
+
+  // Removes a queued filter. Returns false if the filter was not queued,
+  // meaning it is being run at the moment.
+  bool cancel(Filter* filter);
+
+private:
+
+  struct Worker
+  {
+    std::mutex mutex;
+    std::deque<Filter*> tasks;
+  };
+
+  // Shared with the worker threads. The last filter may release the scheduler
+  // on one of the workers, which then finishes its loop with only this left.
+  struct State
+  {
+    std::vector<std::unique_ptr<Worker>> workers;
+
+    // idle workers sleep until something is queued
+    std::mutex sleepMutex;
+    std::condition_variable hasTasks;
+    std::atomic<unsigned int> queuedTasks{0};
+
+    std::atomic<bool> running{true};
+  };
+
+  static void workerLoop(std::shared_ptr<State> state, unsigned int index);
+
+  // own tasks are taken from the front, stolen tasks from the back
+  static Filter* takeTask(State& state, unsigned int index);
+
+  std::shared_ptr<State> state_;
+  std::vector<std::thread> threads_;
+
+  std::atomic<unsigned int> nextWorker_;
+};
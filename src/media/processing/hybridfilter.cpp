@@ -759,14 +759,15 @@ void HybridFilter::sendDummies(uint32_t currentTimestamp)
 
   newDummy->type = output_;
   newDummy->data_size = sizeof(dummy_packet);
-  newDummy->data = std::unique_ptr<uchar[]>(new uchar[sizeof(dummy_packet)]);
+  std::unique_ptr<uchar[]> payload(new uchar[sizeof(dummy_packet)]);
+  memcpy(payload.get(), dummy_packet, sizeof(dummy_packet));
+  newDummy->data = std::move(payload);
 
   if (newDummy->vInfo)
   {
     newDummy->vInfo->keyframe = true;
   }
 
-  memcpy(newDummy->data.get(), dummy_packet, sizeof(dummy_packet));
   sendOutput(std::move(newDummy), true); // inverse = true to send data to inactive paths
 }
 
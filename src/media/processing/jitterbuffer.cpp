@@ -0,0 +1,244 @@
+#include "jitterbuffer.h"
+
+#include <algorithm>
+#include <vector>
+
+// how many recent packets the jitter is measured from
+const size_t TRANSIT_WINDOW = 100;
+
+// the share of recent packets that must arrive in time, in percent
+const size_t ON_TIME_PERCENTILE = 95;
+
+const int MAX_TARGET_DELAY_MS = 300;
+
+// a larger decrease of jitter lowers the target delay by 1/N of the difference per packet
+const int TARGET_DECAY_DIVISOR = 16;
+
+// after this many concealed frames with nothing buffered, the stream is considered paused
+const uint32_t MAX_CONCEALED_FRAMES = 10;
+
+// packets this far ahead of the playout mean the sender has jumped in time
+const int64_t MAX_BUFFERED_MS = 2000;
+
+
+JitterBuffer::JitterBuffer(uint32_t clockRate, uint32_t frameTicks):
+  clockRate_(clockRate),
+  frameTicks_(frameTicks),
+  packets_(),
+  timestampsInitialized_(false),
+  lastTimestamp_(0),
+  active_(false),
+  playoutTimestamp_(0),
+  startMs_(0),
+  lastSequenceValid_(false),
+  lastSequence_(0),
+  concealed_(0),
+  transits_(),
+  sortedTransits_(),
+  targetDelayMs_((int)ticksToMs(frameTicks)),
+  lost_(0),
+  recovered_(0),
+  late_(0)
+{}
+
+
+bool JitterBuffer::insert(std::unique_ptr<Data> packet, uint32_t durationTicks,
+                          int64_t arrivalMs)
+{
+  int64_t timestamp = unwrapTimestamp(packet->rtpTimestamp);
+
+  updateTargetDelay(arrivalMs - ticksToMs(timestamp));
+
+  if (active_ && timestamp < playoutTimestamp_)
+  {
+    ++late_;
+    return false;
+  }
+
+  if (packets_.find(timestamp) != packets_.end())
+  {
+    return false;
+  }
+
+  if (active_ && ticksToMs(timestamp - playoutTimestamp_) > MAX_BUFFERED_MS)
+  {
+    packets_.clear();
+    active_ = false;
+  }
+
+  if (!active_ && packets_.empty())
+  {
+    startMs_ = arrivalMs + targetDelayMs_;
+  }
+
+  packets_[timestamp] = {std::move(packet), durationTicks};
+  return true;
+}
+
+
+JitterBuffer::Playout JitterBuffer::pop(int64_t nowMs)
+{
+  Playout playout;
+
+  if (!active_)
+  {
+    if (packets_.empty() || nowMs < startMs_)
+    {
+      return playout;
+    }
+
+    active_ = true;
+    playoutTimestamp_ = packets_.begin()->first;
+    lastSequenceValid_ = false;
+    concealed_ = 0;
+  }
+
+  auto current = packets_.find(playoutTimestamp_);
+
+  if (current != packets_.end())
+  {
+    playout.type = PLAYOUT_NORMAL;
+    playout.packet = std::move(current->second.data);
+
+    if (current->second.durationTicks != 0)
+    {
+      frameTicks_ = current->second.durationTicks;
+    }
+    packets_.erase(current);
+
+    lastSequence_ = playout.packet->rtpSequence;
+    lastSequenceValid_ = true;
+    concealed_ = 0;
+  }
+  else
+  {
+    auto next = packets_.find(playoutTimestamp_ + frameTicks_);
+
+    // the FEC of a packet describes the packet sent before it
+    if (next != packets_.end() &&
+        (!lastSequenceValid_ || (uint16_t)(lastSequence_ + 2) == next->second.data->rtpSequence))
+    {
+      const Data* source = next->second.data.get();
+
+      playout.type = PLAYOUT_FEC;
+      playout.packet = std::unique_ptr<Data>(new Data);
+      playout.packet->type = source->type;
+      playout.packet->source = source->source;
+      playout.packet->ssrc = source->ssrc;
+      playout.packet->rtpTimestamp = source->rtpTimestamp - frameTicks_;
+      playout.packet->rtpSequence = source->rtpSequence - 1;
+      playout.packet->creationTimestamp = source->creationTimestamp;
+      playout.packet->presentationTimestamp = source->presentationTimestamp;
+      playout.packet->data = source->data;
+      playout.packet->data_size = source->data_size;
+
+      if (source->aInfo)
+      {
+        playout.packet->aInfo = std::unique_ptr<AudioInfo>(new AudioInfo(*source->aInfo));
+      }
+
+      ++lost_;
+      ++recovered_;
+      concealed_ = 0;
+    }
+    else if (packets_.empty() && ++concealed_ > MAX_CONCEALED_FRAMES)
+    {
+      // the sender has paused, the next packet starts a new playout
+      active_ = false;
+      return playout;
+    }
+    else
+    {
+      playout.type = PLAYOUT_CONCEAL;
+
+      if (!packets_.empty())
+      {
+        ++lost_;
+      }
+    }
+
+    ++lastSequence_;
+  }
+
+  playout.durationTicks = frameTicks_;
+  playoutTimestamp_ += frameTicks_;
+  return playout;
+}
+
+
+int JitterBuffer::bufferedMs() const
+{
+  if (packets_.empty())
+  {
+    return 0;
+  }
+
+  int64_t first = active_ ? playoutTimestamp_ : packets_.begin()->first;
+  return (int)ticksToMs(packets_.rbegin()->first + packets_.rbegin()->second.durationTicks - first);
+}
+
+
+void JitterBuffer::reset()
+{
+  packets_.clear();
+  timestampsInitialized_ = false;
+  active_ = false;
+  lastSequenceValid_ = false;
+  concealed_ = 0;
+  transits_.clear();
+  targetDelayMs_ = (int)ticksToMs(frameTicks_);
+}
+
+
+int64_t JitterBuffer::unwrapTimestamp(uint32_t timestamp)
+{
+  if (!timestampsInitialized_)
+  {
+    timestampsInitialized_ = true;
+    lastTimestamp_ = timestamp;
+    return lastTimestamp_;
+  }
+
+  // the difference to the newest timestamp is correct across the wrap around
+  int64_t unwrapped = lastTimestamp_ + (int32_t)(timestamp - (uint32_t)lastTimestamp_);
+
+  if (unwrapped > lastTimestamp_)
+  {
+    lastTimestamp_ = unwrapped;
+  }
+
+  return unwrapped;
+}
+
+
+void JitterBuffer::updateTargetDelay(int64_t transitMs)
+{
+  transits_.push_back(transitMs);
+  if (transits_.size() > TRANSIT_WINDOW)
+  {
+    transits_.pop_front();
+  }
+
+  // the clocks of the sender and us are not synchronized, so only the
+  // variation of the transit time is meaningful
+  int64_t fastest = *std::min_element(transits_.begin(), transits_.end());
+
+  // the scratch copy keeps its capacity, so this does not allocate per packet
+  sortedTransits_.assign(transits_.begin(), transits_.end());
+
+  auto percentile = sortedTransits_.begin() + (sortedTransits_.size() - 1)*ON_TIME_PERCENTILE/100;
+  std::nth_element(sortedTransits_.begin(), percentile, sortedTransits_.end());
+
+  int frameMs = (int)ticksToMs(frameTicks_);
+  int desired = std::min(MAX_TARGET_DELAY_MS, (int)(*percentile - fastest) + frameMs);
+
+  // grow right away so late packets are not lost, but shrink slowly
+  if (desired > targetDelayMs_)
+  {
+    targetDelayMs_ = desired;
+  }
+  else
+  {
+    targetDelayMs_ -= (targetDelayMs_ - desired + TARGET_DECAY_DIVISOR - 1)/TARGET_DECAY_DIVISOR;
+  }
+}
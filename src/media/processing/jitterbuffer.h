@@ -0,0 +1,131 @@
+#pragma once
+
+#include "filter.h"
+
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <vector>
+
+// An adaptive jitter buffer for audio packets. Packets are ordered by their
+// RTP timestamp and taken out one frame at a time by the playout clock of the
+// decoder. The target delay follows the measured jitter, so the buffer stays
+// small on good networks and grows when packets start arriving late. The
+// decoder stretches or compresses its output to move the buffer towards the
+// target.
+
+class JitterBuffer
+{
+public:
+  // frameTicks is the expected RTP timestamp increment of one packet
+  JitterBuffer(uint32_t clockRate, uint32_t frameTicks);
+
+  // Duration is in RTP timestamp ticks, since the sender may use another
+  // frame size than we do. Returns false if the packet was a duplicate or too
+  // late to be played.
+  bool insert(std::unique_ptr<Data> packet, uint32_t durationTicks, int64_t arrivalMs);
+
+  enum PlayoutType {PLAYOUT_NONE,     // nothing to play, the stream is not active
+                    PLAYOUT_NORMAL,   // decode the packet
+                    PLAYOUT_FEC,      // decode the FEC of the packet, which follows the lost one
+                    PLAYOUT_CONCEAL}; // the packet is lost, conceal it
+
+  struct Playout
+  {
+    PlayoutType type = PLAYOUT_NONE;
+
+    // the played packet, or with FEC the packet following the lost one
+    std::unique_ptr<Data> packet = nullptr;
+
+    // how much the playout advanced, in RTP timestamp ticks
+    uint32_t durationTicks = 0;
+  };
+
+  // takes the next frame to be played out and advances the playout position
+  Playout pop(int64_t nowMs);
+
+  // how much audio is waiting to be played
+  int bufferedMs() const;
+
+  int targetDelayMs() const
+  {
+    return targetDelayMs_;
+  }
+
+  bool isActive() const
+  {
+    return active_;
+  }
+
+  void reset();
+
+  uint32_t getLost() const
+  {
+    return lost_;
+  }
+
+  uint32_t getRecovered() const
+  {
+    return recovered_;
+  }
+
+  uint32_t getLate() const
+  {
+    return late_;
+  }
+
+private:
+
+  int64_t unwrapTimestamp(uint32_t timestamp);
+
+  int64_t ticksToMs(int64_t ticks) const
+  {
+    return ticks*1000/clockRate_;
+  }
+
+  void updateTargetDelay(int64_t transitMs);
+
+  uint32_t clockRate_;
+
+  // duration of the latest played packet, which is used for the lost ones
+  uint32_t frameTicks_;
+
+  struct Packet
+  {
+    std::unique_ptr<Data> data;
+    uint32_t durationTicks;
+  };
+
+  // key is the unwrapped RTP timestamp
+  std::map<int64_t, Packet> packets_;
+
+  bool timestampsInitialized_;
+  int64_t lastTimestamp_;
+
+  // the timestamp of the next frame to be played
+  bool active_;
+  int64_t playoutTimestamp_;
+
+  // playout is started once the first packet has waited the target delay
+  int64_t startMs_;
+
+  // to check that the packet after a lost one carries its FEC
+  bool lastSequenceValid_;
+  uint16_t lastSequence_;
+
+  // how many frames in a row have been concealed
+  uint32_t concealed_;
+
+  // Transit times of recent packets. Their spread above the fastest one
+  // is the jitter the target delay has to absorb.
+  std::deque<int64_t> transits_;
+
+  // reused for finding the percentile of transits_
+  std::vector<int64_t> sortedTransits_;
+  int targetDelayMs_;
+
+  uint32_t lost_;
+  uint32_t recovered_;
+  uint32_t late_;
+};
@@ -15,10 +15,16 @@
 
 #include <QThread>
 
+#include <algorithm>
+#include <cstdlib>
+
 enum RETURN_STATUS {C_SUCCESS = 0, C_FAILURE = -1};
 
 const int CU_MIN_SIZE_PIXELS = 8;
 
+// bitrate changes smaller than this do not swap the encoder
+const int BITRATE_TOLERANCE_PERCENT = 15;
+
 unsigned get_padding(unsigned width_or_height)
 {
   if (width_or_height % CU_MIN_SIZE_PIXELS)
@@ -36,25 +42,134 @@ KvazaarFilter::KvazaarFilter(QString id, StatisticsInterface *stats,
                              std::shared_ptr<ResourceAllocator> hwResources,
                              std::pair<uint16_t, uint16_t> resolution):
   Filter(id, "Kvazaar", stats, hwResources, DT_YUV420VIDEO, DT_HEVCVIDEO),
-  api_(nullptr),
+  api_(kvz_api_get(8)),
   config_(nullptr),
   currentResolution_(),
-  encoders_(),
+  encoder_(nullptr),
   pts_(0),
   encodingFrames_(),
   inputPics_(),
   nextInputPic_(-1),
+  lentPics_(std::make_shared<KvazaarPicturePool>()),
   timestampInterval_(0),
   currentFrame_(0),
-  initialized_(false)
+  psnr_(),
+  initialized_(false),
+  encoderFrames_(0),
+  reconfigMutex_(),
+  reconfigThread_(),
+  reconfigRunning_(false),
+  reconfigAgain_(false),
+  pendingSetup_(nullptr),
+  setupPending_(false),
+  preparedBitrate_(-1),
+  preparedSignature_()
 {
   maxBufferSize_ = 30;
 }
 
 
+KvazaarFilter::~KvazaarFilter()
+{
+  stop();
+  wait();
+
+  if (reconfigThread_.joinable())
+  {
+    reconfigThread_.join();
+  }
+
+  if (pendingSetup_)
+  {
+    destroyEncoder(*pendingSetup_);
+    pendingSetup_ = nullptr;
+  }
+
+  close();
+}
+
+
 void KvazaarFilter::restartEncoder()
 {
-  reInitializeKvazaar();
+  std::lock_guard<std::mutex> lock(reconfigMutex_);
+
+  // the running preparation is outdated, so prepare again once it finishes
+  if (reconfigRunning_)
+  {
+    reconfigAgain_ = true;
+    return;
+  }
+
+  if (reconfigThread_.joinable())
+  {
+    reconfigThread_.join();
+  }
+
+  reconfigRunning_ = true;
+  reconfigThread_ = std::thread(&KvazaarFilter::reconfigurationLoop, this);
+}
+
+
+bool KvazaarFilter::setTargetBitrate(int bitrate)
+{
+  int current = preparedBitrate_.load();
+  if (bitrate == current)
+  {
+    return true;
+  }
+
+  // zero means fixed QP, so switching to or from it changes the rate control
+  if (current > 0 && bitrate > 0 &&
+      std::abs(bitrate - current) * 100 < current * BITRATE_TOLERANCE_PERCENT)
+  {
+    Logger::getLogger()->printNormal(this, "Bitrate change is small, keeping the encoder "
+                                           "and its target",
+                                     {"Encoder", "Target"},
+                                     {QString::number(current), QString::number(bitrate)});
+    return false;
+  }
+
+  Logger::getLogger()->printNormal(this, "Swapping encoder for a new bitrate",
+                                   {"Encoder", "Target"},
+                                   {QString::number(current), QString::number(bitrate)});
+  restartEncoder();
+  return true;
+}
+
+
+void KvazaarFilter::reconfigurationLoop()
+{
+  bool again = true;
+  while (again)
+  {
+    std::unique_ptr<EncoderSetup> setup = std::make_unique<EncoderSetup>();
+    if (!prepareEncoder(*setup))
+    {
+      Logger::getLogger()->printError(this, "Failed to prepare new Kvazaar encoder, keeping the old one");
+      setup = nullptr;
+    }
+
+    std::unique_ptr<EncoderSetup> replaced = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(reconfigMutex_);
+      if (setup)
+      {
+        replaced = std::move(pendingSetup_);
+        pendingSetup_ = std::move(setup);
+        setupPending_ = true;
+      }
+
+      again = reconfigAgain_;
+      reconfigAgain_ = false;
+      reconfigRunning_ = again;
+    }
+
+    // the filter never took the previous one into use
+    if (replaced)
+    {
+      destroyEncoder(*replaced);
+    }
+  }
 }
 
 
@@ -129,41 +244,23 @@ void KvazaarFilter::updateSettings()
   Logger::getLogger()->printNormal(this, "Updating kvazaar settings",
                                    "Timestamp Interval", QString::number(timestampInterval_));
 
-  reInitializeKvazaar();
-
-  Filter::updateSettings();
-}
-
-
-void KvazaarFilter::reInitializeKvazaar()
-{
-  stop();
-  initialized_ = false;
-  while(isRunning())
-  {
-    Logger::getLogger()->printNormal(this, "Waiting for Kvazaar to stop...");
-    msleep(5);
-  }
-
-  settingsMutex_.lock();
-  for (auto encoder : encoders_)
+  QString signature = encoderSignature(settings);
+  bool structureChanged = false;
   {
-    close(encoder.first);
+    std::lock_guard<std::mutex> lock(reconfigMutex_);
+    structureChanged = signature != preparedSignature_;
   }
-  encoders_.clear();
 
-  if(init())
+  if (structureChanged)
   {
-    Logger::getLogger()->printNormal(this, "Resolution change successful");
+    restartEncoder();
   }
   else
   {
-    Logger::getLogger()->printNormal(this, "Failed to change resolution");
+    setTargetBitrate(getHWManager()->getEncoderBitrate(DT_HEVCVIDEO));
   }
-  encodingFrames_.clear();
-  settingsMutex_.unlock();
 
-  start();
+  Filter::updateSettings();
 }
 
 
@@ -171,37 +268,41 @@ bool KvazaarFilter::init()
 {
   QSettings settings(getSettingsFile(), settingsFileFormat);
   timestampInterval_ = settings.value(SettingsKey::sipTimestampInterval).toInt();
-  int enumerator = settings.value(SettingsKey::videoFramerateNumerator).toInt();
-  int denominator = settings.value(SettingsKey::videoFramerateDenominator).toInt();
 
   Logger::getLogger()->printNormal(this, "Iniating Kvazaar",
                                    "Timestamp interval", QString::number(timestampInterval_));
 
-
-  if (!api_)
+  if(!api_)
   {
-    api_ = kvz_api_get(8);
+    Logger::getLogger()->printProgramError(this, "Failed to retrieve Kvazaar API.");
+    return false;
+  }
 
-    if(!api_)
-    {
-      Logger::getLogger()->printProgramError(this, "Failed to retrieve Kvazaar API.");
-      return false;
-    }
+  EncoderSetup setup;
+  if (!prepareEncoder(setup))
+  {
+    return false;
   }
 
-  config_ = api_->config_alloc();
+  activateEncoder(setup);
+  return initialized_;
+}
+
 
-  if(!config_)
+bool KvazaarFilter::prepareEncoder(EncoderSetup& setup)
+{
+  if (!api_)
   {
-    Logger::getLogger()->printProgramError(this, "Failed to allocate Kvazaar config.");
     return false;
   }
 
-  api_->config_init(config_);
+  QSettings settings(getSettingsFile(), settingsFileFormat);
+  int enumerator = settings.value(SettingsKey::videoFramerateNumerator).toInt();
+  int denominator = settings.value(SettingsKey::videoFramerateDenominator).toInt();
 
   QString preset = settings.value(SettingsKey::videoPreset).toString().toUtf8();
 
-  config_->target_bitrate = getHWManager()->getEncoderBitrate(DT_HEVCVIDEO);
+  int bitrate = getHWManager()->getEncoderBitrate(DT_HEVCVIDEO);
   QSize partResolution = getHWManager()->getVideoResolution();
 
   if (partResolution.width() <= 0 || partResolution.height() <= 0)
@@ -240,10 +341,194 @@ bool KvazaarFilter::init()
     return false;
   }
 
+  setup.config = api_->config_alloc();
+
+  if(!setup.config)
+  {
+    Logger::getLogger()->printProgramError(this, "Failed to allocate Kvazaar config.");
+    return false;
+  }
+
+  api_->config_init(setup.config);
+
+  configureEncoder(setup.config, settings, preset, resolutionStr, framerateStr, bitrate);
+
+  // PSNR is measured for every Nth frame, 0 disables it
+  setup.psnrInterval = settings.value(SettingsKey::videoPSNRInterval, 1).toUInt();
+  setup.psnrAsync = settings.value(SettingsKey::videoPSNRAsync, true).toBool();
+
+  // opening the encoder starts its worker threads, which is the slow part
+  setup.encoder = api_->encoder_open(setup.config);
+
+  if(!setup.encoder)
+  {
+    Logger::getLogger()->printProgramError(this, "Failed to open Kvazaar encoder.");
+    destroyEncoder(setup);
+    return false;
+  }
+
+  // only an encoder that opened counts, so a failed one is retried
+  preparedBitrate_ = bitrate;
+  {
+    std::lock_guard<std::mutex> lock(reconfigMutex_);
+    preparedSignature_ = encoderSignature(settings);
+  }
+
+  return true;
+}
+
+
+void KvazaarFilter::activateEncoder(EncoderSetup& setup)
+{
+  config_ = setup.config;
+  currentResolution_ = std::make_pair(config_->width, config_->height);
+  encoder_ = setup.encoder;
+
+  psnr_.init(setup.psnrInterval, setup.psnrAsync,
+             getHWManager()->isAVX2Enabled(), getHWManager()->isSSE41Enabled());
+
+  // the encoders are owned by the filter now
+  setup = EncoderSetup();
+  encoderFrames_ = 0;
+
+  // a bitrate change keeps the pictures of the previous encoder
+  if (inputPics_.empty())
+  {
+    createInputVector(config_->owf + 1);
+  }
+
+  // pictures are only lent for the resolution the encoder accepts
+  lentPics_->setResolution(config_->width, config_->height);
+
+  if(inputPics_.empty())
+  {
+    Logger::getLogger()->printProgramError(this, "Could not allocate input picture vector!");
+    initialized_ = false;
+    return;
+  }
+
+  double fps = 0.0;
+  if (config_->framerate_denom != 0)
+  {
+    fps = config_->framerate_num / (double)config_->framerate_denom;
+  }
+
+  QString resolutionStr = QString::number(config_->width) + "x" + QString::number(config_->height);
+  QString bitrateStr = QString::number(config_->target_bitrate) + " bps (" +
+                       QString::number(config_->target_bitrate / 1000.0, 'f', 1) + " kbps)";
+  QString fpsStr = QString::number(fps, 'f', 3);
+
+  Logger::getLogger()->printNormal(this, "Kvazaar initiation succeeded",
+                                   {"Resolution", "Bitrate", "Frame rate"},
+                                   {resolutionStr, bitrateStr, fpsStr});
+  initialized_ = true;
+}
+
+
+bool KvazaarFilter::matchesInput(const kvz_config* config, const Data& input) const
+{
+  return config->width == input.vInfo->width
+      && config->height == input.vInfo->height
+      && config->framerate_num == input.vInfo->framerateNumerator
+      && config->framerate_denom == input.vInfo->framerateDenominator;
+}
+
+
+void KvazaarFilter::applyPendingSetup(const Data& input)
+{
+  std::unique_ptr<EncoderSetup> setup = nullptr;
+  {
+    std::lock_guard<std::mutex> lock(reconfigMutex_);
+    if (!pendingSetup_)
+    {
+      setupPending_ = false;
+      return;
+    }
+
+    if (initialized_)
+    {
+      // the converter changes the resolution on its own schedule, so keep
+      // encoding the old resolution until it arrives
+      if (!matchesInput(pendingSetup_->config, input))
+      {
+        return;
+      }
+
+      // With the same input, switch where the old encoder would have started
+      // a new intra period anyway. The new encoder starts with an IDR frame.
+      if (matchesInput(config_, input))
+      {
+        int period = config_->intra_period > 0 ? config_->intra_period
+                                               : std::max(1, (int)config_->gop_len);
+        if (encoderFrames_ % period != 0)
+        {
+          return;
+        }
+      }
+    }
+
+    setup = std::move(pendingSetup_);
+    setupPending_ = false;
+  }
+
+  if (initialized_)
+  {
+    drainEncoder();
+
+    if (currentResolution_ == std::make_pair(setup->config->width, setup->config->height))
+    {
+      closeEncoder();
+    }
+    else
+    {
+      close();
+    }
+  }
+
+  activateEncoder(*setup);
+}
+
+
+void KvazaarFilter::drainEncoder()
+{
+  kvz_picture *recon_pic = nullptr;
+  kvz_frame_info frame_info;
+  kvz_data_chunk *data_out = nullptr;
+  uint32_t len_out = 0;
+
+  while (!encodingFrames_.empty())
+  {
+    api_->encoder_encode(encoder_, nullptr,
+                         &data_out, &len_out,
+                         &recon_pic, nullptr,
+                         &frame_info );
+
+    if (data_out == nullptr)
+    {
+      break;
+    }
+
+    parseEncodedFrame(data_out, len_out, recon_pic, frame_info);
+  }
+
+  for (auto& frame : encodingFrames_)
+  {
+    delete[] frame.roi_array;
+  }
+  encodingFrames_.clear();
+}
+
+
+void KvazaarFilter::configureEncoder(kvz_config* config, QSettings& settings,
+                                     const QString& preset, const QString& resolution,
+                                     const QString& framerate, int bitrate)
+{
+  config->target_bitrate = bitrate;
+
   // Input
-  api_->config_parse(config_, "preset",    preset.toLocal8Bit());
-  api_->config_parse(config_, "input-res", resolutionStr.toLocal8Bit());
-  api_->config_parse(config_, "input-fps", framerateStr.toLocal8Bit());
+  api_->config_parse(config, "preset",    preset.toLocal8Bit());
+  api_->config_parse(config, "input-res", resolution.toLocal8Bit());
+  api_->config_parse(config, "input-fps", framerate.toLocal8Bit());
 
   QString threads = "0";
 
@@ -261,171 +546,194 @@ bool KvazaarFilter::init()
     threads = settings.value(SettingsKey::videoKvzThreads).toString();
   }
 
-  api_->config_parse(config_, "threads", threads.toLocal8Bit());
-  api_->config_parse(config_, "owf", settings.value(SettingsKey::videoOWF).toString().toLocal8Bit());
-  api_->config_parse(config_, "wpp", settings.value(SettingsKey::videoWPP).toString().toLocal8Bit());
+  api_->config_parse(config, "threads", threads.toLocal8Bit());
+  api_->config_parse(config, "owf", settings.value(SettingsKey::videoOWF).toString().toLocal8Bit());
+  api_->config_parse(config, "wpp", settings.value(SettingsKey::videoWPP).toString().toLocal8Bit());
 
   bool tiles = settings.value(SettingsKey::videoTiles).toBool();
 
   if (tiles)
   {
     std::string dimensions = settings.value(SettingsKey::videoTileDimensions).toString().toStdString();
-    api_->config_parse(config_, "tiles", dimensions.c_str());
+    api_->config_parse(config, "tiles", dimensions.c_str());
   }
 
   // this does not work with uvgRTP at the moment. Avoid using slices.
   if(settings.value(SettingsKey::videoSlices).toInt() == 1)
   {
-    if(config_->wpp)
+    if(config->wpp)
     {
-      api_->config_parse(config_, "slices", "wpp");
+      api_->config_parse(config, "slices", "wpp");
     }
     else if (tiles)
     {
-      api_->config_parse(config_, "slices", "tiles");
+      api_->config_parse(config, "slices", "tiles");
     }
   }
 
   // Video structure
 
-  api_->config_parse(config_, "qp",         settings.value(SettingsKey::videoQP).toString().toLocal8Bit());
-  api_->config_parse(config_, "period",     settings.value(SettingsKey::videoIntra).toString().toLocal8Bit());
-  api_->config_parse(config_, "vps-period", settings.value(SettingsKey::videoVPS).toString().toLocal8Bit());
+  api_->config_parse(config, "qp",         settings.value(SettingsKey::videoQP).toString().toLocal8Bit());
+  api_->config_parse(config, "period",     settings.value(SettingsKey::videoIntra).toString().toLocal8Bit());
+  api_->config_parse(config, "vps-period", settings.value(SettingsKey::videoVPS).toString().toLocal8Bit());
 
-  if (config_->target_bitrate != 0)
+  if (config->target_bitrate != 0)
   {
-    api_->config_parse(config_, "rc-algorithm",    settings.value(SettingsKey::videoRCAlgorithm).toString().toLocal8Bit());
+    api_->config_parse(config, "rc-algorithm",    settings.value(SettingsKey::videoRCAlgorithm).toString().toLocal8Bit());
   }
 
-  api_->config_parse(config_, "intra-bits", "1");
+  api_->config_parse(config, "intra-bits", "1");
 
   // TODO: Move to settings
-  api_->config_parse(config_, "gop", "lp-g4d3t1");
+  api_->config_parse(config, "gop", "lp-g4d3t1");
 
   if (settings.value(SettingsKey::videoScalingList).toInt() == 0)
   {
-    api_->config_parse(config_, "scaling-list", "off");
+    api_->config_parse(config, "scaling-list", "off");
   }
   else
   {
-    api_->config_parse(config_, "scaling-list", "default");
+    api_->config_parse(config, "scaling-list", "default");
   }
 
-  config_->lossless = settings.value(SettingsKey::videoLossless).toInt();
+  config->lossless = settings.value(SettingsKey::videoLossless).toInt();
 
   QString constraint = settings.value(SettingsKey::videoMVConstraint).toString();
 
   if (constraint == "frame" || constraint == "frametile" || constraint == "frametilemargin")
   {
-    api_->config_parse(config_, "mv-constraint", "");
+    api_->config_parse(config, "mv-constraint", "");
   }
   else
   {
-    api_->config_parse(config_, "mv-constraint", "none");
+    api_->config_parse(config, "mv-constraint", "none");
   }
 
   if (constraint == "frame")
   {
-    config_->mv_constraint = KVZ_MV_CONSTRAIN_FRAME;
+    config->mv_constraint = KVZ_MV_CONSTRAIN_FRAME;
   }
   else if (constraint == "tile")
   {
-    config_->mv_constraint = KVZ_MV_CONSTRAIN_TILE;
+    config->mv_constraint = KVZ_MV_CONSTRAIN_TILE;
   }
   else if (constraint == "frametile")
   {
-    config_->mv_constraint = KVZ_MV_CONSTRAIN_FRAME_AND_TILE;
+    config->mv_constraint = KVZ_MV_CONSTRAIN_FRAME_AND_TILE;
   }
   else if (constraint == "frametilemargin")
   {
-    config_->mv_constraint = KVZ_MV_CONSTRAIN_FRAME_AND_TILE_MARGIN;
+    config->mv_constraint = KVZ_MV_CONSTRAIN_FRAME_AND_TILE_MARGIN;
   }
   else
   {
-    config_->mv_constraint = KVZ_MV_CONSTRAIN_NONE;
+    config->mv_constraint = KVZ_MV_CONSTRAIN_NONE;
   }
 
-  config_->set_qp_in_cu = settings.value(SettingsKey::videoQPInCU).toInt();
+  config->set_qp_in_cu = settings.value(SettingsKey::videoQPInCU).toInt();
 
   int vaq = settings.value(SettingsKey::videoVAQ).toInt();
   if (vaq > 0 && vaq <= 20)
   {
-    api_->config_parse(config_, "vaq", settings.value(SettingsKey::videoVAQ).toString().toLocal8Bit());
+    api_->config_parse(config, "vaq", settings.value(SettingsKey::videoVAQ).toString().toLocal8Bit());
   }
 
   // compression-tab
-  customParameters(settings);
+  customParameters(config, settings);
 
-  config_->hash = KVZ_HASH_NONE;
+  config->hash = KVZ_HASH_NONE;
+}
 
-  // This is partial code for a system that is not working. A system was planned that would hot swap encoders with
-  // different resolutions, but since resetting worked well enough, I gave up on that idea
-  currentResolution_ = std::make_pair(partResolution.width(), partResolution.height());
-  encoders_[currentResolution_] = api_->encoder_open(config_);
 
-  if(!encoders_[currentResolution_])
+void KvazaarFilter::destroyEncoder(EncoderSetup& setup)
+{
+  if (setup.encoder)
   {
-    Logger::getLogger()->printProgramError(this, "Failed to open Kvazaar encoder.");
-    return false;
+    api_->encoder_close(setup.encoder);
+    setup.encoder = nullptr;
   }
 
-  createInputVector(config_->owf + 1);
-
-  if(inputPics_.empty())
+  if (setup.config)
   {
-    Logger::getLogger()->printProgramError(this, "Could not allocate input picture vector!");
-    return false;
+    api_->config_destroy(setup.config);
+    setup.config = nullptr;
   }
+}
 
-  double fps = 0.0;
-  if (config_->framerate_denom != 0)
+
+DataBuffer KvazaarFilter::borrowBuffer(DataType type, uint16_t width, uint16_t height,
+                                       uint32_t size)
+{
+  Q_UNUSED(size);
+
+  if (type != DT_YUV420VIDEO)
   {
-    fps = config_->framerate_num / (double)config_->framerate_denom;
+    return nullptr;
   }
 
-  QString bitrateStr = QString::number(config_->target_bitrate) + " bps (" +
-                       QString::number(config_->target_bitrate / 1000.0, 'f', 1) + " kbps)";
-  QString fpsStr = QString::number(fps, 'f', 3);
-
-  Logger::getLogger()->printNormal(this, "Kvazaar initiation succeeded",
-                                   {"Resolution", "Bitrate", "Frame rate"},
-                                   {resolutionStr, bitrateStr, fpsStr});
-  initialized_ = true;
-  return true;
+  return lentPics_->lend(width, height);
 }
 
 
-void KvazaarFilter::close(std::pair<int, int> resolution)
+void KvazaarFilter::close()
 {
-  if(api_ && encoders_.find(resolution) != encoders_.end())
+  if(api_ && encoder_)
   {
-    api_->encoder_close(encoders_[resolution]);
-    api_->config_destroy(config_);
-    config_ = nullptr;
-
+    closeEncoder();
     cleanupInputVector();
-    api_ = nullptr;
   }
 
+  initialized_ = false;
   pts_ = 0;
 
   Logger::getLogger()->printNormal(this, "Closed Kvazaar");
 }
 
 
+void KvazaarFilter::closeEncoder()
+{
+  if(api_ && encoder_)
+  {
+    EncoderSetup setup;
+    setup.config = config_;
+    setup.encoder = encoder_;
+    destroyEncoder(setup);
+
+    encoder_ = nullptr;
+    config_ = nullptr;
+  }
+
+  initialized_ = false;
+  pts_ = 0;
+}
+
+
 void KvazaarFilter::process()
 {
   std::unique_ptr<Data> input = getInput();
 
-  while(input && initialized_)
+  while(input)
   {
+    settingsMutex_.lock();
+    if (setupPending_ && input->vInfo)
+    {
+      applyPendingSetup(*input);
+    }
+
+    if (!initialized_)
+    {
+      settingsMutex_.unlock();
+      break;
+    }
+
     if(inputPics_.empty())
     {
+      settingsMutex_.unlock();
       Logger::getLogger()->printProgramError(this,
                                       "Input pictures have not been allocated");
       break;
     }
-    settingsMutex_.lock();
+
     feedInput(std::move(input));
     settingsMutex_.unlock();
 
@@ -434,7 +742,29 @@ void KvazaarFilter::process()
 }
 
 
-void KvazaarFilter::customParameters(QSettings& settings)
+QString KvazaarFilter::encoderSignature(QSettings& settings) const
+{
+  QSize resolution = getHWManager()->getVideoResolution();
+  QString signature = QString::number(resolution.width()) + "x" +
+                      QString::number(resolution.height());
+
+  QStringList keys = settings.allKeys();
+  keys.sort();
+
+  for (auto& key : keys)
+  {
+    if ((key.startsWith("video/") && key != SettingsKey::videoBitrate) ||
+        key.startsWith(SettingsKey::videoCustomParameters + "/"))
+    {
+      signature += ";" + key + "=" + settings.value(key).toString();
+    }
+  }
+
+  return signature;
+}
+
+
+void KvazaarFilter::customParameters(kvz_config* config, QSettings& settings)
 {
   int size = settings.beginReadArray(SettingsKey::videoCustomParameters);
 
@@ -446,7 +776,7 @@ void KvazaarFilter::customParameters(QSettings& settings)
     settings.setArrayIndex(i);
     QString name = settings.value("Name").toString();
     QString value = settings.value("Value").toString();
-    if (api_->config_parse(config_, name.toStdString().c_str(),
+    if (api_->config_parse(config, name.toStdString().c_str(),
                            value.toStdString().c_str()) != 1)
     {
       Logger::getLogger()->printWarning(this, "Invalid custom parameter for kvazaar",
@@ -464,13 +794,11 @@ void KvazaarFilter::feedInput(std::unique_ptr<Data> input)
   kvz_data_chunk *data_out = nullptr;
   uint32_t len_out = 0;
 
-  if (config_->width != input->vInfo->width
-      || config_->height != input->vInfo->height
-      || config_->framerate_num != input->vInfo->framerateNumerator
-      || config_->framerate_denom != input->vInfo->framerateDenominator)
+  if (!matchesInput(config_, *input))
   {
-    // This should not happen.
-    Logger::getLogger()->printProgramError(this,
+    // Can happen for a moment if the converter changes the resolution before
+    // the new encoder has been prepared.
+    Logger::getLogger()->printWarning(this,
                                     "Input resolution or framerate differs from settings",
                                     {"Settings", "Input"},
                                     {QString::number(config_->width) + "x" +
@@ -484,27 +812,35 @@ void KvazaarFilter::feedInput(std::unique_ptr<Data> input)
     return;
   }
 
-  if (nextInputPic_ == -1 || nextInputPic_ >= inputPics_.size())
+  // the converter may have written the frame directly to our picture. The
+  // picture stays lent until the frame has been encoded.
+  kvz_picture* inputPic = lentPics_->findPicture(input->data);
+
+  if (inputPic == nullptr)
   {
-    Logger::getLogger()->printProgramError(this, "Input vec initilized incorrectly");
-    return;
-  }
+    if (nextInputPic_ == -1 || nextInputPic_ >= inputPics_.size())
+    {
+      Logger::getLogger()->printProgramError(this, "Input vec initilized incorrectly");
+      return;
+    }
 
-  kvz_picture* inputPic = getNextPic();
+    inputPic = getNextPic();
 
-  // copy input to kvazaar picture
-  memcpy(inputPic->y,
-         input->data.get(),
-         input->vInfo->width*input->vInfo->height);
-  memcpy(inputPic->u,
-         &(input->data.get()[input->vInfo->width*input->vInfo->height]),
-         input->vInfo->width*input->vInfo->height/4);
-  memcpy(inputPic->v,
-         &(input->data.get()[input->vInfo->width*input->vInfo->height + input->vInfo->width*input->vInfo->height/4]),
-         input->vInfo->width*input->vInfo->height/4);
+    // copy input to kvazaar picture
+    memcpy(inputPic->y,
+           input->data.get(),
+           input->vInfo->width*input->vInfo->height);
+    memcpy(inputPic->u,
+           &(input->data.get()[input->vInfo->width*input->vInfo->height]),
+           input->vInfo->width*input->vInfo->height/4);
+    memcpy(inputPic->v,
+           &(input->data.get()[input->vInfo->width*input->vInfo->height + input->vInfo->width*input->vInfo->height/4]),
+           input->vInfo->width*input->vInfo->height/4);
+  }
 
   inputPic->pts = pts_;
   ++pts_;
+  ++encoderFrames_;
 
   if (config_->target_bitrate == 0)
   {
@@ -524,7 +860,7 @@ void KvazaarFilter::feedInput(std::unique_ptr<Data> input)
 
   encodingFrames_.push_front({std::move(input), inputPic, inputPic->roi.roi_array});
 
-  api_->encoder_encode(encoders_[currentResolution_], inputPic,
+  api_->encoder_encode(encoder_, inputPic,
                        &data_out, &len_out,
                        &recon_pic, nullptr,
                        &frame_info );
@@ -534,7 +870,7 @@ void KvazaarFilter::feedInput(std::unique_ptr<Data> input)
     parseEncodedFrame(data_out, len_out, recon_pic, frame_info);
 
     // see if there is more output ready
-    api_->encoder_encode(encoders_[currentResolution_], nullptr,
+    api_->encoder_encode(encoder_, nullptr,
                          &data_out, &len_out,
                          &recon_pic, nullptr,
                          &frame_info );
@@ -572,8 +908,8 @@ void KvazaarFilter::parseEncodedFrame(kvz_data_chunk *data_out,
     timestampSize += sizeof(int64_t);  // timestamp
   }
 
-  std::unique_ptr<uchar[]> hevc_frame(new uchar[len_out + timestampSize]);
-  uint8_t* writer = hevc_frame.get();
+  DataBuffer hevc_frame = allocateBuffer(len_out + timestampSize);
+  uint8_t* writer = hevc_frame.writable(len_out + timestampSize);
   uint32_t dataWritten = 0;
 
 
@@ -622,21 +958,29 @@ void KvazaarFilter::parseEncodedFrame(kvz_data_chunk *data_out,
     dataWritten += chunk->len;
   }
 
-  double psnr_y  = -1.0;
-  double psnr_u  = -1.0;
-  double psnr_v  = -1.0;
-
-  if (info.inputPic && recon_pic)
+  if (recon_pic && info.data && info.data->vInfo && psnr_.sampleFrame())
+  {
+    // the input and reconstruction are released once the measurement is done
+    const kvz_api* api = api_;
+    psnr_.measure(info.data->data, info.data->vInfo->width, info.data->vInfo->height,
+                  std::shared_ptr<kvz_picture>(recon_pic, [api](kvz_picture* pic)
+                  {
+                    api->picture_free(pic);
+                  }));
+  }
+  else
   {
-    calculate_psnr(info.inputPic, recon_pic, psnr_y, psnr_u, psnr_v);
-    info.data->vInfo->psnrY = static_cast<float>(psnr_y);
-    info.data->vInfo->psnrU = static_cast<float>(psnr_u);
-    info.data->vInfo->psnrV = static_cast<float>(psnr_v);
+    api_->picture_free(recon_pic);
   }
 
   api_->chunk_free(data_out);
-  api_->picture_free(recon_pic);
-  
+
+  // with asynchronous measurement, the result belongs to an earlier frame
+  if (info.data && info.data->vInfo)
+  {
+    psnr_.takeResult(info.data->vInfo->psnrY, info.data->vInfo->psnrU, info.data->vInfo->psnrV);
+  }
+
   const int64_t since_epoch = clockNowMs();
   const int64_t delay64 = since_epoch - (info.data ? info.data->creationTimestamp : 0);
   const uint32_t delay = delay64 > 0 ? static_cast<uint32_t>(delay64) : 0;
@@ -662,7 +1006,7 @@ void KvazaarFilter::parseEncodedFrame(kvz_data_chunk *data_out,
 
 
 void KvazaarFilter::sendEncodedFrame(std::unique_ptr<Data> input,
-                                     std::unique_ptr<uchar[]> hevc_frame,
+                                     DataBuffer hevc_frame,
                                      uint32_t dataWritten)
 {
   input->type = DT_HEVCVIDEO;
@@ -671,47 +1015,3 @@ void KvazaarFilter::sendEncodedFrame(std::unique_ptr<Data> input,
   sendOutput(std::move(input));
 }
 
-
-void KvazaarFilter::calculate_psnr(const kvz_picture *orig, const kvz_picture *recon,
-                                   double& psnr_y, double& psnr_u, double& psnr_v)
-{
-  const int max_val = 255;
-  double mse_y = 0.0, mse_u = 0.0, mse_v = 0.0;
-
-  int width = orig->width;
-  int height = orig->height;
-
-  // Luma (Y)
-  int y_size = width * height;
-  for (int i = 0; i < y_size; ++i) {
-    int diff = orig->y[i] - recon->y[i];
-    mse_y += diff * diff;
-  }
-  mse_y /= y_size;
-
-  // Chroma (U and V), subsampled (4:2:0 assumed)
-  int uv_width = width / 2;
-  int uv_height = height / 2;
-  int uv_size = uv_width * uv_height;
-
-  for (int i = 0; i < uv_size; ++i) {
-    int diff_u = orig->u[i] - recon->u[i];
-    int diff_v = orig->v[i] - recon->v[i];
-    mse_u += diff_u * diff_u;
-    mse_v += diff_v * diff_v;
-  }
-  mse_u /= uv_size;
-  mse_v /= uv_size;
-
-  psnr_y = (mse_y == 0) ? INFINITY : 10.0 * log10((max_val * max_val) / mse_y);
-  psnr_u = (mse_u == 0) ? INFINITY : 10.0 * log10((max_val * max_val) / mse_u);
-  psnr_v = (mse_v == 0) ? INFINITY : 10.0 * log10((max_val * max_val) / mse_v);
-
-/*
-  Logger::getLogger()->printNormal(this, "PSNR",
-                                   {"Y", "U", "V"},
-                                   {QString::number(psnr_y, 'f', 2),
-                                    QString::number(psnr_u, 'f', 2),
-                                    QString::number(psnr_v, 'f', 2)});
-*/
-}
@@ -1,9 +1,15 @@
 #pragma once
 #include "filter.h"
+#include "psnrcalculator.h"
+#include "kvazaarpicturepool.h"
 
 #include <QSize>
 #include <QSettings>
 
+#include <atomic>
+#include <mutex>
+#include <thread>
+
 struct kvz_api;
 struct kvz_config;
 struct kvz_encoder;
@@ -11,27 +17,78 @@ struct kvz_picture;
 struct kvz_data_chunk;
 struct kvz_frame_info;
 
-class KvazaarFilter : public Filter
+class KvazaarFilter : public Filter, public BufferLender
 {
 public:
   KvazaarFilter(QString id, StatisticsInterface* stats,
                 std::shared_ptr<ResourceAllocator> hwResources,
                 std::pair<uint16_t, uint16_t> resolution);
+  ~KvazaarFilter();
 
+  // Opens an encoder with the current settings on a background thread. The
+  // filter keeps encoding with the old encoder until it switches over.
   void restartEncoder();
 
+  // Kvazaar cannot retarget the rate control of an open encoder. Larger changes
+  // swap in an encoder with the same structure, keeping the input pictures.
+  // Small changes are not worth the swap, so the encoder keeps its previous
+  // target and false is returned. Resolution, preset and thread changes need
+  // restartEncoder.
+  bool setTargetBitrate(int bitrate);
+
   virtual void updateSettings();
 
   virtual bool init();
 
-  void close(std::pair<int, int> resolution);
+  void close();
+
+  // Lends an input picture to the converter before the encoder so the frame
+  // does not have to be copied to Kvazaar. Can be called from any thread.
+  virtual DataBuffer borrowBuffer(DataType type, uint16_t width, uint16_t height,
+                                  uint32_t size);
 
 protected:
   virtual void process();
 
 private:
 
-  void customParameters(QSettings& settings);
+  // an encoder configuration, either in use or waiting to be taken into use
+  struct EncoderSetup
+  {
+    kvz_config* config = nullptr;
+    kvz_encoder* encoder = nullptr;
+
+    unsigned int psnrInterval = 0;
+    bool psnrAsync = false;
+  };
+
+  void configureEncoder(kvz_config* config, QSettings& settings,
+                        const QString& preset, const QString& resolution,
+                        const QString& framerate, int bitrate);
+
+  void customParameters(kvz_config* config, QSettings& settings);
+
+  // everything that needs a new encoder structure, i.e. all but the bitrate
+  QString encoderSignature(QSettings& settings) const;
+
+  // Opens an encoder. Does not touch the encoder in use, so it can be called
+  // from the reconfiguration thread.
+  bool prepareEncoder(EncoderSetup& setup);
+  void destroyEncoder(EncoderSetup& setup);
+
+  // closes the encoder in use, but keeps the input pictures
+  void closeEncoder();
+
+  void reconfigurationLoop();
+
+  // switches to the prepared encoder if this input is a good place to do it
+  void applyPendingSetup(const Data& input);
+  void activateEncoder(EncoderSetup& setup);
+
+  // encodes the frames still in the encoder before it is closed
+  void drainEncoder();
+
+  bool matchesInput(const kvz_config* config, const Data& input) const;
 
   // copy the frame data to kvazaar input in suitable format.
   void feedInput(std::unique_ptr<Data> input);
@@ -42,7 +99,7 @@ private:
                          const kvz_frame_info &frame_info);
 
   void sendEncodedFrame(std::unique_ptr<Data> input,
-                        std::unique_ptr<uchar[]> hevc_frame,
+                        DataBuffer hevc_frame,
                         uint32_t dataWritten);
 
   void createInputVector(int size);
@@ -52,15 +109,11 @@ private:
 
   kvz_picture* getNextPic();
 
-  void reInitializeKvazaar();
-
-  void calculate_psnr(const kvz_picture *orig, const kvz_picture *recon, double& psnr_y, double& psnr_u, double& psnr_v);
-
   const kvz_api *api_;
   kvz_config *config_;
 
   std::pair<int, int> currentResolution_;
-  std::map<std::pair<int, int>, kvz_encoder*> encoders_;
+  kvz_encoder* encoder_;
 
   int64_t pts_;
 
@@ -68,6 +121,9 @@ private:
   std::vector<kvz_picture*> inputPics_;
   int nextInputPic_;
 
+  // pictures lent to the converter, used instead of inputPics_ when possible
+  std::shared_ptr<KvazaarPicturePool> lentPics_;
+
   QMutex settingsMutex_;
   struct FrameInfo
   {
@@ -83,6 +139,27 @@ private:
 
   uint64_t currentFrame_;
 
+  PSNRCalculator psnr_;
+
   bool initialized_;
+
+  // frames given to the encoder in use, used to find the GOP boundaries
+  uint64_t encoderFrames_;
+
+  // the next encoder is prepared in reconfigThread_ and taken into use by the
+  // filter thread. Protected by reconfigMutex_.
+  std::mutex reconfigMutex_;
+  std::thread reconfigThread_;
+  bool reconfigRunning_;
+  bool reconfigAgain_;
+  std::unique_ptr<EncoderSetup> pendingSetup_;
+
+  // avoids locking for every frame
+  std::atomic<bool> setupPending_;
+
+  // bitrate of the latest prepared encoder and the settings it was built from
+  std::atomic<int> preparedBitrate_;
+  QString preparedSignature_;
+
   int initialDelayMs_ = 200;
 };
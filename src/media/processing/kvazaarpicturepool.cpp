@@ -0,0 +1,156 @@
+#include "kvazaarpicturepool.h"
+
+#include <kvazaar.h>
+
+#ifdef _MSC_VER
+#include <windows.h>
+#endif
+
+// pictures kept for reuse, more are allocated when needed
+const size_t MAX_IDLE_PICTURES = 8;
+
+// the smallest block Kvazaar encodes, smaller resolutions are padded
+const int MIN_BLOCK_SIZE = 8;
+
+
+// Kvazaar changes the reference count with atomic operations from its threads
+static int32_t loadRefcount(kvz_picture* picture)
+{
+#ifdef _MSC_VER
+  return InterlockedCompareExchange((volatile long*)&picture->refcount, 0, 0);
+#else
+  return __atomic_load_n(&picture->refcount, __ATOMIC_ACQUIRE);
+#endif
+}
+
+
+KvazaarPicturePool::KvazaarPicturePool():
+  api_(kvz_api_get(8)),
+  mutex_(),
+  width_(0),
+  height_(0),
+  idle_(),
+  lent_()
+{}
+
+
+KvazaarPicturePool::~KvazaarPicturePool()
+{
+  clear();
+}
+
+
+void KvazaarPicturePool::setResolution(int width, int height)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (width_ != width || height_ != height)
+  {
+    width_ = width;
+    height_ = height;
+
+    for (kvz_picture* picture : idle_)
+    {
+      api_->picture_free(picture);
+    }
+    idle_.clear();
+  }
+}
+
+
+DataBuffer KvazaarPicturePool::lend(int width, int height)
+{
+  if (!api_ || width % MIN_BLOCK_SIZE != 0 || height % MIN_BLOCK_SIZE != 0)
+  {
+    return nullptr;
+  }
+
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  if (width != width_ || height != height_)
+  {
+    return nullptr;
+  }
+
+  kvz_picture* picture = nullptr;
+
+  // Kvazaar holds its own reference while it encodes the picture
+  for (auto it = idle_.begin(); it != idle_.end(); ++it)
+  {
+    if (loadRefcount(*it) == 1)
+    {
+      picture = *it;
+      idle_.erase(it);
+      break;
+    }
+  }
+
+  if (picture == nullptr)
+  {
+    picture = api_->picture_alloc(width, height);
+
+    if (picture == nullptr)
+    {
+      return nullptr;
+    }
+  }
+
+  lent_[picture->y] = picture;
+
+  // the pool outlives the buffers it has lent
+  std::shared_ptr<KvazaarPicturePool> pool = shared_from_this();
+  return DataBuffer(picture->y, [pool, picture]()
+  {
+    pool->giveBack(picture);
+  });
+}
+
+
+kvz_picture* KvazaarPicturePool::findPicture(const DataBuffer& buffer)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  auto it = lent_.find(buffer.get());
+  if (it == lent_.end())
+  {
+    return nullptr;
+  }
+
+  return it->second;
+}
+
+
+void KvazaarPicturePool::clear()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  for (kvz_picture* picture : idle_)
+  {
+    api_->picture_free(picture);
+  }
+  idle_.clear();
+}
+
+
+void KvazaarPicturePool::giveBack(kvz_picture* picture)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+
+  lent_.erase(picture->y);
+
+  // the ROI map belongs to the frame it was encoded with
+  picture->roi.width = 0;
+  picture->roi.height = 0;
+  picture->roi.roi_array = nullptr;
+
+  if (picture->width != width_ || picture->height != height_ ||
+      idle_.size() >= MAX_IDLE_PICTURES)
+  {
+    // also releases our reference if Kvazaar still has one
+    api_->picture_free(picture);
+  }
+  else
+  {
+    idle_.push_back(picture);
+  }
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "databuffer.h"
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+struct kvz_api;
+struct kvz_picture;
+
+// Lends Kvazaar input pictures as DataBuffers so a converter can write a
+// frame directly to the picture that is given to the encoder. A picture
+// returns to the pool when the last DataBuffer referencing it is dropped.
+// Only resolutions that Kvazaar does not pad are lent, because then the
+// picture memory has the same layout as a YUV 4:2:0 frame.
+
+class KvazaarPicturePool : public std::enable_shared_from_this<KvazaarPicturePool>
+{
+public:
+  KvazaarPicturePool();
+  ~KvazaarPicturePool();
+
+  // lent pictures of other resolutions are freed when they return
+  void setResolution(int width, int height);
+
+  // returns a null buffer if the resolution does not match
+  DataBuffer lend(int width, int height);
+
+  // returns the picture the buffer was lent from or nullptr
+  kvz_picture* findPicture(const DataBuffer& buffer);
+
+  // frees the idle pictures
+  void clear();
+
+private:
+
+  void giveBack(kvz_picture* picture);
+
+  const kvz_api* api_;
+
+  std::mutex mutex_;
+
+  int width_;
+  int height_;
+
+  std::vector<kvz_picture*> idle_;
+
+  // lent pictures by the address of their luma plane
+  std::unordered_map<const uchar*, kvz_picture*> lent_;
+};
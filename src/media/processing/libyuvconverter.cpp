@@ -152,22 +152,25 @@ void LibYUVConverter::process()
     size_t newWidth = input->vInfo->width - width_crop;
     size_t newHeight = input->vInfo->height - height_crop;
 
+    bool needScaling = input->vInfo->width > targetResolution_.width() && input->vInfo->height > targetResolution_.height();
+
     // how much each region of UUV takes space
     size_t y_size = newWidth*newHeight;
     size_t uv_size = ((newWidth + 1)/2)*((newHeight + 1)/2);
 
-    // reserve memory for converted YUV
+    // reserve memory for converted YUV, which is the output if no scaling is needed
     size_t finalDataSize = y_size + 2*uv_size;
-    std::unique_ptr<uchar[]> yuv_data(new uchar[finalDataSize]);
+    DataBuffer yuv_data = needScaling ? allocateBuffer(finalDataSize) :
+                                        allocateFrame(DT_YUV420VIDEO, newWidth, newHeight, finalDataSize);
 
     int dst_y_stride = newWidth;
     int dst_u_stride = (newWidth + 1)/2; // +1 is for rounding up
     int dst_v_stride = (newWidth + 1)/2;
 
     // where each region begins
-    uint8_t* dst_y = yuv_data.get();
-    uint8_t* dst_u = yuv_data.get() + y_size;
-    uint8_t* dst_v = yuv_data.get() + y_size + uv_size;
+    uint8_t* dst_y = yuv_data.writable(finalDataSize);
+    uint8_t* dst_u = dst_y + y_size;
+    uint8_t* dst_v = dst_y + y_size + uv_size;
 
     // convert and possibly crop
     libyuv::ConvertToI420(input->data.get(), input->data_size,
@@ -180,8 +183,6 @@ void LibYUVConverter::process()
                           libyuv::kRotate0,
                           fourcc);
 
-    bool needScaling = input->vInfo->width > targetResolution_.width() && input->vInfo->height > targetResolution_.height();
-
     // update the possible cropping to width
     input->vInfo->width = newWidth;
     input->vInfo->height = newHeight;
@@ -204,12 +205,13 @@ void LibYUVConverter::process()
 
       // reserve memory for scaled YUV
       finalDataSize = scaled_y_size + 2*scaled_color_size;
-      std::unique_ptr<uchar[]> scaled_yuv_data(new uchar[finalDataSize]);
+      DataBuffer scaled_yuv_data = allocateFrame(DT_YUV420VIDEO, scaledWidth, scaledHeight,
+                                                 finalDataSize);
 
       // get YUV regions
-      uint8_t* sy = scaled_yuv_data.get();
-      uint8_t* su = scaled_yuv_data.get() + scaled_y_size;
-      uint8_t* sv = scaled_yuv_data.get() + scaled_y_size + scaled_color_size;
+      uint8_t* sy = scaled_yuv_data.writable(finalDataSize);
+      uint8_t* su = sy + scaled_y_size;
+      uint8_t* sv = sy + scaled_y_size + scaled_color_size;
 
       int sy_stride = scaledWidth;
       int su_stride = (scaledWidth + 1)/2;
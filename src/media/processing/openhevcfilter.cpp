@@ -8,8 +8,23 @@
 
 #include <QSettings>
 
+#include <libyuv.h>
+
+#include <algorithm>
+#include <atomic>
+
 enum OHThreadType {OH_THREAD_FRAME  = 1, OH_THREAD_SLICE = 2, OH_THREAD_FRAMESLICE  = 3};
 
+// the sub-layer non-reference picture types are the even types up to this
+const uint8_t RSV_VCL_N14 = 14;
+
+// views showing at most this fraction of the decoded pixels skip non-reference pictures
+const int SMALL_VIEW_AREA_DIVISOR = 4;
+
+// frames shown nearly at full width are not scaled, since scaling has a cost of its own
+const int MIN_SCALED_WIDTH_NUMERATOR = 3;
+const int MIN_SCALED_WIDTH_DENOMINATOR = 4;
+
 OpenHEVCFilter::OpenHEVCFilter(uint32_t sessionID,
                                QString cname,
                                StatisticsInterface *stats,
@@ -25,8 +40,13 @@ OpenHEVCFilter::OpenHEVCFilter(uint32_t sessionID,
     , parallelizationMode_("Slice")
   , discardedFrames_(0)
   , pendingParamSetBytes_(0),
-    last_timestamp_(0)
-{}
+    last_timestamp_(0),
+    viewSize_(nullptr),
+    smallView_(false),
+    skippedPictures_(0)
+{
+  taskCompatible_ = true;
+}
 
 
 bool OpenHEVCFilter::init()
@@ -147,7 +167,16 @@ void OpenHEVCFilter::process()
 
     //Logger::getLogger()->printNormal(this, cname_ + " RTP timestamp: " + QString::number(input->rtpTimestamp) + ", NAL type: " + QString::number(nalType));
 
-    if((vpsReceived_ && spsReceived_ && ppsReceived_) || !vcl)
+    if (vcl && smallView_ && isDroppable(buff, input->data_size))
+    {
+      if (skippedPictures_ == 0)
+      {
+        Logger::getLogger()->printNormal(this, "Skipping non-reference pictures for a small view");
+      }
+
+      ++skippedPictures_;
+    }
+    else if((vpsReceived_ && spsReceived_ && ppsReceived_) || !vcl)
     {
       if (discardedFrames_ != 0)
       {
@@ -248,42 +277,134 @@ void OpenHEVCFilter::sendDecodedOutput(int& gotPicture)
 
     decodedFrame->vInfo->width = openHevcFrame.frameInfo.nWidth;
     decodedFrame->vInfo->height = openHevcFrame.frameInfo.nHeight;
-    uint32_t finalDataSize = decodedFrame->vInfo->width*decodedFrame->vInfo->height +
-        decodedFrame->vInfo->width*decodedFrame->vInfo->height/2;
-    std::unique_ptr<uchar[]> yuv_frame(new uchar[finalDataSize]);
-
-    uint8_t* pY = (uint8_t*)yuv_frame.get();
-    uint8_t* pU = (uint8_t*)&(yuv_frame.get()[decodedFrame->vInfo->width*decodedFrame->vInfo->height]);
-    uint8_t* pV = (uint8_t*)&(yuv_frame.get()[decodedFrame->vInfo->width*decodedFrame->vInfo->height +
-        decodedFrame->vInfo->width*decodedFrame->vInfo->height/4]);
+    decodedFrame->vInfo->framerateNumerator = openHevcFrame.frameInfo.frameRate.num;
+    decodedFrame->vInfo->framerateDenominator = openHevcFrame.frameInfo.frameRate.den;
 
-    uint32_t s_stride = openHevcFrame.frameInfo.nYPitch;
-    uint32_t qs_stride = openHevcFrame.frameInfo.nUPitch/2;
+    // The planes stay valid only until the next decode call, because the
+    // wrapper has no way of holding a reference to the decoder picture.
+    decodedFrame->vInfo->planes[0] = (const uint8_t*)openHevcFrame.pvY;
+    decodedFrame->vInfo->planes[1] = (const uint8_t*)openHevcFrame.pvU;
+    decodedFrame->vInfo->planes[2] = (const uint8_t*)openHevcFrame.pvV;
+    decodedFrame->vInfo->pitches[0] = openHevcFrame.frameInfo.nYPitch;
+    decodedFrame->vInfo->pitches[1] = openHevcFrame.frameInfo.nUPitch;
+    decodedFrame->vInfo->pitches[2] = openHevcFrame.frameInfo.nVPitch;
+    decodedFrame->type = DT_YUV420VIDEO;
 
-    uint32_t d_stride = decodedFrame->vInfo->width/2;
-    uint32_t dd_stride = decodedFrame->vInfo->width;
+    std::shared_ptr<std::atomic<bool>> pictureReleased = nullptr;
+    QSize resolution = outputResolution(decodedFrame->vInfo->width, decodedFrame->vInfo->height);
 
-    for (int i=0; i<decodedFrame->vInfo->height; i++) {
-      memcpy(pY,  (uint8_t *) openHevcFrame.pvY + i*s_stride, dd_stride);
-      pY += dd_stride;
+    if (resolution != QSize(decodedFrame->vInfo->width, decodedFrame->vInfo->height))
+    {
+      // the scaled frame is smaller than the copy of the full frame would be
+      decodedFrame = scaleFrame(std::move(decodedFrame), resolution);
+    }
+    else if (outputsTakeStridedFrames())
+    {
+      // the next filters read the picture of the decoder before sendOutput returns
+      pictureReleased = std::make_shared<std::atomic<bool>>(false);
+      decodedFrame->data = DataBuffer((uchar*)openHevcFrame.pvY, [pictureReleased]()
+      {
+        pictureReleased->store(true, std::memory_order_release);
+      });
+      decodedFrame->data_size = openHevcFrame.frameInfo.nYPitch*decodedFrame->vInfo->height;
+    }
+    else
+    {
+      decodedFrame = packFrame(std::move(decodedFrame));
+    }
 
-      if (! (i%2) ) {
-        memcpy(pU,  (uint8_t *) openHevcFrame.pvU + i*qs_stride, d_stride);
-        pU += d_stride;
+    sendOutput(std::move(decodedFrame));
 
-        memcpy(pV,  (uint8_t *) openHevcFrame.pvV + i*qs_stride, d_stride);
-        pV += d_stride;
-      }
+    if (pictureReleased && !pictureReleased->load(std::memory_order_acquire))
+    {
+      Logger::getLogger()->printProgramWarning(this, "Decoder picture was kept after it was sent");
     }
+  }
+}
 
-    decodedFrame->type = DT_YUV420VIDEO;
-    decodedFrame->vInfo->framerateNumerator = openHevcFrame.frameInfo.frameRate.num;
-    decodedFrame->vInfo->framerateDenominator = openHevcFrame.frameInfo.frameRate.den;
-    decodedFrame->data_size = finalDataSize;
-    decodedFrame->data = std::move(yuv_frame);
 
-    sendOutput(std::move(decodedFrame));
+
+
+bool OpenHEVCFilter::isDroppable(const unsigned char* nal, uint32_t size) const
+{
+  if (size < 6)
+  {
+    return false;
+  }
+
+  uint8_t nalType = (nal[4] >> 1);
+  int temporalID = (nal[5] & 0x7) - 1;
+
+  // Higher temporal layers can always be removed. Without them, the sub-layer
+  // non-reference pictures of the lowest layer are not referenced at all.
+  return temporalID > 0 || (nalType <= RSV_VCL_N14 && nalType % 2 == 0);
+}
+
+
+QSize OpenHEVCFilter::outputResolution(int width, int height)
+{
+  QSize view = viewSize_ ? viewSize_() : QSize();
+  QSize frame(width, height);
+
+  if (view.isEmpty() || frame.isEmpty())
+  {
+    smallView_ = false;
+    return frame;
+  }
+
+  // the view may crop the frame to fill itself, so the frame must cover it
+  QSize shown = frame.scaled(view, Qt::KeepAspectRatioByExpanding);
+
+  bool smallView = shown.width()*shown.height()*SMALL_VIEW_AREA_DIVISOR <= width*height;
+  if (smallView != smallView_)
+  {
+    Logger::getLogger()->printNormal(this, smallView ? "View is small, decoding only the lowest layer" :
+                                                       "View is large, decoding all pictures",
+                                     {"View", "Skipped pictures"},
+                                     {QString::number(view.width()) + "x" + QString::number(view.height()),
+                                      QString::number(skippedPictures_)});
+    smallView_ = smallView;
+    skippedPictures_ = 0;
   }
+
+  if (shown.width()*MIN_SCALED_WIDTH_DENOMINATOR > width*MIN_SCALED_WIDTH_NUMERATOR)
+  {
+    return frame;
+  }
+
+  // 4:2:0 needs even dimensions
+  return QSize(std::max(2, shown.width() & ~1), std::max(2, shown.height() & ~1));
 }
 
 
+std::unique_ptr<Data> OpenHEVCFilter::scaleFrame(std::unique_ptr<Data> frame, QSize resolution)
+{
+  uint32_t lumaSize = resolution.width()*resolution.height();
+  uint32_t finalDataSize = lumaSize + lumaSize/2;
+
+  DataBuffer yuvFrame = allocateBuffer(finalDataSize);
+  uint8_t* yuv = yuvFrame.writable(finalDataSize);
+
+  // box filter averages all the source pixels, which also works for large reductions
+  libyuv::I420Scale(frame->vInfo->planes[0], frame->vInfo->pitches[0],
+                    frame->vInfo->planes[1], frame->vInfo->pitches[1],
+                    frame->vInfo->planes[2], frame->vInfo->pitches[2],
+                    frame->vInfo->width, frame->vInfo->height,
+                    yuv, resolution.width(),
+                    yuv + lumaSize, resolution.width()/2,
+                    yuv + lumaSize + lumaSize/4, resolution.width()/2,
+                    resolution.width(), resolution.height(),
+                    libyuv::kFilterBox);
+
+  for (int i = 0; i < 3; ++i)
+  {
+    frame->vInfo->planes[i] = nullptr;
+    frame->vInfo->pitches[i] = 0;
+  }
+
+  frame->vInfo->width = resolution.width();
+  frame->vInfo->height = resolution.height();
+  frame->data = std::move(yuvFrame);
+  frame->data_size = finalDataSize;
+  return frame;
+}
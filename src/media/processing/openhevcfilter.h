@@ -2,6 +2,10 @@
 #include "filter.h"
 
 #include "openHevcWrapper.h"
+
+#include <QSize>
+
+#include <functional>
 #include <utility>
 
 class OpenHEVCFilter : public Filter
@@ -15,6 +19,14 @@ public:
 
   virtual void updateSettings();
 
+  // Decoded frames are scaled down to the size of the view they are shown in.
+  // For small views, pictures no other picture depends on are not decoded.
+  // Call before start().
+  void setViewSize(std::function<QSize()> viewSize)
+  {
+    viewSize_ = viewSize;
+  }
+
 protected:
   virtual void process();
 
@@ -22,6 +34,15 @@ private:
 
   void sendDecodedOutput(int &gotPicture);
 
+  // whether the picture can be left undecoded when only the lowest temporal layer is shown
+  bool isDroppable(const unsigned char* nal, uint32_t size) const;
+
+  // the resolution the frame is shown at, updates smallView_
+  QSize outputResolution(int width, int height);
+
+  // scales the strided planes of the decoder picture to a packed frame
+  std::unique_ptr<Data> scaleFrame(std::unique_ptr<Data> frame, QSize resolution);
+
   OpenHevc_Handle handle_;
 
   bool vpsReceived_;
@@ -45,4 +66,10 @@ private:
   uint32_t pendingParamSetBytes_;
 
   int64_t last_timestamp_ = 0;
+
+  std::function<QSize()> viewSize_;
+
+  // set when the view shows only a fraction of the decoded pixels
+  bool smallView_;
+  uint32_t skippedPictures_;
 };
@@ -5,6 +5,15 @@
 #include "common.h"
 #include "logger.h"
 
+#include <algorithm>
+#include <cmath>
+
+// the highest voice pitch searched when stretching audio
+const int MAX_PITCH_HZ = 400;
+
+// after a longer stall the playout clock is restarted instead of catching up
+const int64_t MAX_PLAYOUT_LAG_MS = 200;
+
 OpusDecoderFilter::OpusDecoderFilter(uint32_t sessionID, QAudioFormat format,
                                      StatisticsInterface *stats,
                                      std::shared_ptr<ResourceAllocator> hwResources):
@@ -13,7 +22,13 @@ OpusDecoderFilter::OpusDecoderFilter(uint32_t sessionID, QAudioFormat format,
   pcmOutput_(nullptr),
   max_data_bytes_(65536),
   format_(format),
-  sessionID_(sessionID)
+  sessionID_(sessionID),
+  jitterBuffer_(OPUS_RTP_TIMESTAMP_RATE, OPUS_RTP_TIMESTAMP_RATE/AUDIO_FRAMES_PER_SECOND),
+  frameSamples_(format.sampleRate()/AUDIO_FRAMES_PER_SECOND),
+  frameMs_(1000/AUDIO_FRAMES_PER_SECOND),
+  pcmQueue_(),
+  nextPlayout_(-1),
+  latestPacket_(nullptr)
 {
   pcmOutput_ = new int16_t[max_data_bytes_];
 }
@@ -40,46 +55,270 @@ bool OpusDecoderFilter::init()
       {"Errorcode"}, {QString::number(error)});
     return false;
   }
+
+  jitterBuffer_.reset();
+  pcmQueue_.clear();
+  nextPlayout_ = -1;
   return true;
 }
 
 
+unsigned long OpusDecoderFilter::maxSleepMs() const
+{
+  if (nextPlayout_ != -1)
+  {
+    return (unsigned long)std::max<int64_t>(1, nextPlayout_ - clockNowMs());
+  }
+  else if (jitterBuffer_.bufferedMs() > 0)
+  {
+    // waiting for the playout to start
+    return 1;
+  }
+
+  return ULONG_MAX;
+}
+
+
 void OpusDecoderFilter::process()
 {
   std::unique_ptr<Data> input = getInput();
+  int64_t now = clockNowMs();
 
   while(input)
   {
     getStats()->addReceivePacket(sessionID_, "", "Audio", input->data_size);
 
-    // TODO: get number of channels from opus sample: opus_packet_get_nb_channels
-    int32_t len = 0;
-    int frame_size = max_data_bytes_/(format_.channelCount()*sizeof(opus_int16));
+    // the sender may use another frame size than we do
+    int ticks = opus_packet_get_nb_samples(input->data.get(), input->data_size,
+                                           OPUS_RTP_TIMESTAMP_RATE);
+    if (ticks > 0)
+    {
+      jitterBuffer_.insert(std::move(input), (uint32_t)ticks, now);
+    }
+    else
+    {
+      Logger::getLogger()->printWarning(this, "Received an invalid Opus packet",
+                                        {"Error"}, {QString::number(ticks)});
+    }
 
-    len = opus_decode(dec_, input->data.get(), input->data_size, pcmOutput_, frame_size, 0);
+    input = getInput();
+  }
 
-    uint32_t datasize = len*format_.channelCount()*sizeof(opus_int16);
+  if (nextPlayout_ != -1 && now - nextPlayout_ > MAX_PLAYOUT_LAG_MS)
+  {
+    nextPlayout_ = now;
+  }
 
-    //Logger::getLogger()->printNormal(this, "Decoded Opus audio.", 
-    //                                {"Input size", "Output size"},
-    //                                {QString::number(input->data_size),
-    //                                 QString::number(datasize)};
+  while (nextPlayout_ == -1 || nextPlayout_ <= now)
+  {
+    while ((int)pcmQueue_.size() < frameSamples_*format_.channelCount() && decodeNext(now))
+    {}
 
-    if(len > -1)
+    if ((int)pcmQueue_.size() < frameSamples_*format_.channelCount())
     {
-      std::unique_ptr<uchar[]> pcm_frame(new uchar[datasize]);
-      memcpy(pcm_frame.get(), pcmOutput_, datasize);
-      input->data_size = datasize;
+      // not playing, the output device fills the gap with silence
+      pcmQueue_.clear();
+      nextPlayout_ = -1;
+      break;
+    }
+
+    sendFrame();
+    nextPlayout_ = (nextPlayout_ == -1 ? now : nextPlayout_) + frameMs_;
+  }
+}
+
 
-      input->data = std::move(pcm_frame);
-      input->type = DT_RAWAUDIO;
-      sendOutput(std::move(input));
+bool OpusDecoderFilter::decodeNext(int64_t nowMs)
+{
+  JitterBuffer::Playout playout = jitterBuffer_.pop(nowMs);
+
+  int maxSamples = max_data_bytes_/(format_.channelCount()*sizeof(opus_int16));
+  int lostSamples = std::min<int>(maxSamples,
+                                  playout.durationTicks*format_.sampleRate()/OPUS_RTP_TIMESTAMP_RATE);
+  int len = 0;
+
+  switch (playout.type)
+  {
+    case JitterBuffer::PLAYOUT_NONE:
+    {
+      return false;
     }
-    else
+    case JitterBuffer::PLAYOUT_NORMAL:
     {
-      Logger::getLogger()->printWarning(this, "Failed to decode audio frame.", 
-                                        {"Error"}, {QString::number(len)});
+      len = opus_decode(dec_, playout.packet->data.get(), playout.packet->data_size,
+                        pcmOutput_, maxSamples, 0);
+      break;
     }
-    input = getInput();
+    case JitterBuffer::PLAYOUT_FEC:
+    {
+      // the frame size tells the decoder how much was lost
+      len = opus_decode(dec_, playout.packet->data.get(), playout.packet->data_size,
+                        pcmOutput_, lostSamples, 1);
+      break;
+    }
+    case JitterBuffer::PLAYOUT_CONCEAL:
+    {
+      len = opus_decode(dec_, nullptr, 0, pcmOutput_, lostSamples, 0);
+      break;
+    }
+  }
+
+  if (len < 0)
+  {
+    Logger::getLogger()->printWarning(this, "Failed to decode audio frame, concealing it",
+                                      {"Error"}, {QString::number(len)});
+
+    len = opus_decode(dec_, nullptr, 0, pcmOutput_, lostSamples, 0);
+    if (len < 0)
+    {
+      return false;
+    }
+  }
+
+  if (playout.packet)
+  {
+    latestPacket_ = std::move(playout.packet);
+  }
+
+  // move the buffer towards the target delay
+  int buffered = jitterBuffer_.bufferedMs();
+  int target = jitterBuffer_.targetDelayMs();
+
+  if (playout.type == JitterBuffer::PLAYOUT_NORMAL && buffered > target + frameMs_)
+  {
+    appendCompressed(pcmOutput_, len);
+  }
+  else if (buffered + frameMs_ < target)
+  {
+    appendExpanded(pcmOutput_, len);
+  }
+  else
+  {
+    pcmQueue_.insert(pcmQueue_.end(), pcmOutput_, pcmOutput_ + len*format_.channelCount());
   }
+
+  return true;
+}
+
+
+void OpusDecoderFilter::appendCompressed(const int16_t* pcm, int samples)
+{
+  int channels = format_.channelCount();
+  int lag = findPitchLag(pcm, samples, true);
+  int middle = samples/2;
+
+  if (lag == 0)
+  {
+    pcmQueue_.insert(pcmQueue_.end(), pcm, pcm + samples*channels);
+    return;
+  }
+
+  pcmQueue_.insert(pcmQueue_.end(), pcm, pcm + middle*channels);
+
+  // fade from the middle to one period later, skipping the period
+  for (int i = 0; i < lag; ++i)
+  {
+    float weight = float(i + 1)/(lag + 1);
+    for (int c = 0; c < channels; ++c)
+    {
+      pcmQueue_.push_back((int16_t)((1.0f - weight)*pcm[(middle + i)*channels + c] +
+                                    weight*pcm[(middle + lag + i)*channels + c]));
+    }
+  }
+
+  pcmQueue_.insert(pcmQueue_.end(), pcm + (middle + 2*lag)*channels, pcm + samples*channels);
+}
+
+
+void OpusDecoderFilter::appendExpanded(const int16_t* pcm, int samples)
+{
+  int channels = format_.channelCount();
+  int lag = findPitchLag(pcm, samples, false);
+  int middle = samples/2;
+
+  if (lag == 0)
+  {
+    pcmQueue_.insert(pcmQueue_.end(), pcm, pcm + samples*channels);
+    return;
+  }
+
+  pcmQueue_.insert(pcmQueue_.end(), pcm, pcm + middle*channels);
+
+  // fade from the middle to one period earlier, playing the period twice
+  for (int i = 0; i < lag; ++i)
+  {
+    float weight = float(i + 1)/(lag + 1);
+    for (int c = 0; c < channels; ++c)
+    {
+      pcmQueue_.push_back((int16_t)((1.0f - weight)*pcm[(middle + i)*channels + c] +
+                                    weight*pcm[(middle - lag + i)*channels + c]));
+    }
+  }
+
+  pcmQueue_.insert(pcmQueue_.end(), pcm + middle*channels, pcm + samples*channels);
+}
+
+
+int OpusDecoderFilter::findPitchLag(const int16_t* pcm, int samples, bool forward) const
+{
+  int channels = format_.channelCount();
+  int minLag = std::max(1, format_.sampleRate()/MAX_PITCH_HZ);
+
+  // the skipped or repeated period must fit in the frame on both sides of the middle
+  int maxLag = samples/4;
+  int middle = samples/2;
+
+  if (maxLag < minLag)
+  {
+    return 0;
+  }
+
+  int window = minLag;
+  int bestLag = maxLag;
+  double bestScore = -1.0;
+
+  // the first channel is enough for finding the period
+  for (int lag = minLag; lag <= maxLag; ++lag)
+  {
+    int offset = forward ? lag : -lag;
+    int64_t correlation = 0;
+    int64_t energy = 0;
+
+    for (int i = 0; i < window; ++i)
+    {
+      int32_t a = pcm[(middle + i)*channels];
+      int32_t b = pcm[(middle + offset + i)*channels];
+      correlation += a*b;
+      energy += b*b;
+    }
+
+    double score = energy > 0 ? correlation/std::sqrt((double)energy) : 0.0;
+    if (score > bestScore)
+    {
+      bestScore = score;
+      bestLag = lag;
+    }
+  }
+
+  return bestLag;
+}
+
+
+void OpusDecoderFilter::sendFrame()
+{
+  int values = frameSamples_*format_.channelCount();
+  uint32_t frameBytes = values*sizeof(int16_t);
+
+  std::unique_ptr<Data> output = latestPacket_ ?
+        std::unique_ptr<Data>(shallowDataCopy(latestPacket_.get())) :
+        initializeData(DT_RAWAUDIO, DS_REMOTE);
+
+  DataBuffer pcmFrame = allocateBuffer(frameBytes);
+  memcpy(pcmFrame.writable(frameBytes), pcmQueue_.data(), frameBytes);
+  pcmQueue_.erase(pcmQueue_.begin(), pcmQueue_.begin() + values);
+
+  output->type = DT_RAWAUDIO;
+  output->data = std::move(pcmFrame);
+  output->data_size = frameBytes;
+  sendOutput(std::move(output));
 }
@@ -1,9 +1,16 @@
 #pragma once
 #include "filter.h"
+#include "jitterbuffer.h"
 
 #include <opus/opus.h>
 #include <QtMultimedia/QAudioFormat>
 
+#include <vector>
+
+// Decodes Opus packets through an adaptive jitter buffer. The filter keeps a
+// playout clock of its own, so lost packets are recovered with FEC or
+// concealed when they are due instead of leaving gaps in the output.
+
 class OpusDecoderFilter : public Filter
 {
 public:
@@ -17,11 +24,27 @@ public:
 
 protected:
 
-  // decodes input until buffer is empty
+  // buffers the arrived packets and sends the frames that are due
   void process();
 
+  // the playout clock runs even when no packets arrive
+  virtual unsigned long maxSleepMs() const;
+
 private:
 
+  // decodes the next frame of the jitter buffer to the PCM queue
+  bool decodeNext(int64_t nowMs);
+
+  // Removes or repeats one pitch period in the middle of the frame with a
+  // crossfade. This changes the duration of the frame without changing its pitch.
+  void appendCompressed(const int16_t* pcm, int samples);
+  void appendExpanded(const int16_t* pcm, int samples);
+
+  // the period that best matches the middle of the frame, 0 if the frame is too short
+  int findPitchLag(const int16_t* pcm, int samples, bool forward) const;
+
+  void sendFrame();
+
   OpusDecoder *dec_;
 
   int16_t* pcmOutput_;
@@ -30,4 +53,19 @@ private:
   QAudioFormat format_;
 
   uint32_t sessionID_;
+
+  JitterBuffer jitterBuffer_;
+
+  // samples per channel in one output frame
+  int frameSamples_;
+  int frameMs_;
+
+  // decoded audio waiting to be sent as whole frames, interleaved
+  std::vector<int16_t> pcmQueue_;
+
+  // when the next frame is due, -1 if nothing is being played
+  int64_t nextPlayout_;
+
+  // the sent frames get their timing information from the latest played packet
+  std::unique_ptr<Data> latestPacket_;
 };
@@ -10,6 +10,9 @@
 
 #include <QSettings>
 
+// how much redundancy the encoder adds for the FEC of the receiver
+const int EXPECTED_PACKET_LOSS_PERC = 10;
+
 
 OpusEncoderFilter::OpusEncoderFilter(QString id, QAudioFormat format,
                                      StatisticsInterface* stats,
@@ -65,6 +68,10 @@ void OpusEncoderFilter::updateSettings()
   opus_encoder_ctl(enc_, OPUS_SET_BITRATE(bitrate));
   opus_encoder_ctl(enc_, OPUS_SET_COMPLEXITY(complexity));
 
+  // the receiver recovers single lost packets from the FEC of the next one
+  opus_encoder_ctl(enc_, OPUS_SET_INBAND_FEC(1));
+  opus_encoder_ctl(enc_, OPUS_SET_PACKET_LOSS_PERC(EXPECTED_PACKET_LOSS_PERC));
+
   if (type == "Auto")
   {
     opus_encoder_ctl(enc_, OPUS_SET_SIGNAL(OPUS_AUTO));
@@ -106,7 +113,7 @@ void OpusEncoderFilter::process()
 
     // The audiocapturefilter makes sure the frames are the samplesPerFrame size.
 
-    len = opus_encode(enc_, (opus_int16*)input->data.get(), samplesPerFrame_,
+    len = opus_encode(enc_, (const opus_int16*)input->data.get(), samplesPerFrame_,
                       opusOutput_ + pos, max_data_bytes_ - pos);
     if(len <= 0)
     {
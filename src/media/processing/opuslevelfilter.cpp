@@ -0,0 +1,76 @@
+#include "opuslevelfilter.h"
+
+#include "speakerselector.h"
+
+#include "common.h"
+#include "logger.h"
+
+// Opus decodes at any of its rates, and the narrowband skips most of the work
+// of decoding the full band
+const int LEVEL_SAMPLE_RATE = 8000;
+
+// the longest Opus packet is 120 ms
+const int MAX_LEVEL_SAMPLES = LEVEL_SAMPLE_RATE*120/1000;
+
+
+OpusLevelFilter::OpusLevelFilter(QString id, StatisticsInterface *stats,
+                                 std::shared_ptr<ResourceAllocator> hwResources,
+                                 std::shared_ptr<SpeakerSelector> speakers):
+  Filter(id, "Opus Level", stats, hwResources, DT_OPUSAUDIO, DT_NONE),
+  dec_(nullptr),
+  pcmOutput_(new int16_t[MAX_LEVEL_SAMPLES]),
+  speakers_(speakers)
+{
+  taskCompatible_ = true;
+}
+
+
+OpusLevelFilter::~OpusLevelFilter()
+{
+  if (dec_)
+  {
+    opus_decoder_destroy(dec_);
+  }
+  dec_ = nullptr;
+}
+
+
+bool OpusLevelFilter::init()
+{
+  int error = 0;
+  dec_ = opus_decoder_create(LEVEL_SAMPLE_RATE, 1, &error);
+
+  if (error)
+  {
+    Logger::getLogger()->printWarning(this, "Failed to initialize opus decoder.",
+      {"Errorcode"}, {QString::number(error)});
+    return false;
+  }
+
+  return true;
+}
+
+
+void OpusLevelFilter::process()
+{
+  std::unique_ptr<Data> input = getInput();
+
+  while (input)
+  {
+    int len = opus_decode(dec_, input->data.get(), input->data_size,
+                          pcmOutput_.get(), MAX_LEVEL_SAMPLES, 0);
+
+    if (len > 0)
+    {
+      speakers_->updateLevel(input->ssrc, SpeakerSelector::pcmLevel(pcmOutput_.get(), len),
+                             clockNowMs());
+    }
+    else if (len < 0)
+    {
+      LOG_FAST_WARNING(this, "Failed to measure the level of an Opus packet",
+                       {"Error"}, {len});
+    }
+
+    input = getInput();
+  }
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include "filter.h"
+
+#include <opus/opus.h>
+
+#include <memory>
+
+class SpeakerSelector;
+
+// Measures the level of Opus packets for the speaker selection. Each packet is
+// decoded as it arrives at a low sample rate without a jitter buffer, FEC or
+// concealment, because the level only has to rank the speakers and the audio
+// is not played. Lost and reordered packets are simply measured as they come.
+
+class OpusLevelFilter : public Filter
+{
+public:
+  OpusLevelFilter(QString id, StatisticsInterface* stats,
+                  std::shared_ptr<ResourceAllocator> hwResources,
+                  std::shared_ptr<SpeakerSelector> speakers);
+  ~OpusLevelFilter();
+
+  // setups decoder
+  virtual bool init();
+
+protected:
+
+  void process();
+
+private:
+
+  OpusDecoder *dec_;
+
+  std::unique_ptr<int16_t[]> pcmOutput_;
+
+  std::shared_ptr<SpeakerSelector> speakers_;
+};
@@ -0,0 +1,201 @@
+#include "psnrcalculator.h"
+
+#include "yuvconversions.h"
+
+#include <kvazaar.h>
+
+#include <cmath>
+
+// if the worker falls behind, frames are left unmeasured
+const size_t MAX_PENDING_JOBS = 2;
+
+const double MAX_PIXEL_VALUE = 255.0;
+
+
+PSNRCalculator::PSNRCalculator():
+  interval_(1),
+  frame_(0),
+  async_(false),
+  avx2_(false),
+  sse41_(false),
+  resultMutex_(),
+  hasResult_(false),
+  psnrY_(-1.0f),
+  psnrU_(-1.0f),
+  psnrV_(-1.0f),
+  jobMutex_(),
+  jobCV_(),
+  jobs_(),
+  running_(false),
+  thread_()
+{}
+
+
+PSNRCalculator::~PSNRCalculator()
+{
+  stopWorker();
+}
+
+
+void PSNRCalculator::init(uint32_t interval, bool async, bool avx2, bool sse41)
+{
+  // the worker is stopped so the mode does not change under it
+  stopWorker();
+
+  interval_ = interval;
+  frame_ = 0;
+  async_ = async && interval != 0;
+  avx2_ = avx2;
+  sse41_ = sse41;
+
+  {
+    std::lock_guard<std::mutex> lock(resultMutex_);
+    hasResult_ = false;
+  }
+
+  if (async_)
+  {
+    running_ = true;
+    thread_ = std::thread(&PSNRCalculator::worker, this);
+  }
+}
+
+
+bool PSNRCalculator::sampleFrame()
+{
+  if (interval_ == 0)
+  {
+    return false;
+  }
+
+  return (frame_++ % interval_) == 0;
+}
+
+
+void PSNRCalculator::measure(DataBuffer original, int width, int height,
+                             std::shared_ptr<kvz_picture> recon)
+{
+  if (!original || !recon)
+  {
+    return;
+  }
+
+  if (!async_)
+  {
+    calculate({std::move(original), width, height, std::move(recon)});
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(jobMutex_);
+  if (jobs_.size() < MAX_PENDING_JOBS)
+  {
+    jobs_.push_back({std::move(original), width, height, std::move(recon)});
+    jobCV_.notify_one();
+  }
+}
+
+
+bool PSNRCalculator::takeResult(float& psnrY, float& psnrU, float& psnrV)
+{
+  std::lock_guard<std::mutex> lock(resultMutex_);
+  if (!hasResult_)
+  {
+    return false;
+  }
+
+  psnrY = psnrY_;
+  psnrU = psnrU_;
+  psnrV = psnrV_;
+  hasResult_ = false;
+  return true;
+}
+
+
+void PSNRCalculator::worker()
+{
+  std::unique_lock<std::mutex> lock(jobMutex_);
+
+  while (running_)
+  {
+    if (jobs_.empty())
+    {
+      jobCV_.wait(lock);
+      continue;
+    }
+
+    Job job = std::move(jobs_.front());
+    jobs_.pop_front();
+
+    lock.unlock();
+    calculate(job);
+    lock.lock();
+  }
+}
+
+
+void PSNRCalculator::stopWorker()
+{
+  {
+    std::lock_guard<std::mutex> lock(jobMutex_);
+    running_ = false;
+    jobs_.clear();
+    jobCV_.notify_all();
+  }
+
+  if (thread_.joinable())
+  {
+    thread_.join();
+  }
+}
+
+
+void PSNRCalculator::calculate(const Job& job)
+{
+  const uint8_t* y = job.original.get();
+  const uint8_t* u = y + job.width*job.height;
+  const uint8_t* v = u + job.width*job.height/4;
+
+  int uv_width = job.width/2;
+  int uv_height = job.height/2;
+
+  // the reconstruction may be padded, only the visible area is compared
+  uint64_t sse_y = planeSSE(y, job.width, job.recon->y, job.recon->stride,
+                            job.width, job.height);
+  uint64_t sse_u = planeSSE(u, uv_width, job.recon->u, job.recon->stride/2,
+                            uv_width, uv_height);
+  uint64_t sse_v = planeSSE(v, uv_width, job.recon->v, job.recon->stride/2,
+                            uv_width, uv_height);
+
+  auto toPSNR = [](uint64_t sse, int samples)
+  {
+    if (sse == 0 || samples == 0)
+    {
+      return (float)INFINITY;
+    }
+
+    double mse = sse/(double)samples;
+    return (float)(10.0*log10(MAX_PIXEL_VALUE*MAX_PIXEL_VALUE/mse));
+  };
+
+  std::lock_guard<std::mutex> lock(resultMutex_);
+  psnrY_ = toPSNR(sse_y, job.width*job.height);
+  psnrU_ = toPSNR(sse_u, uv_width*uv_height);
+  psnrV_ = toPSNR(sse_v, uv_width*uv_height);
+  hasResult_ = true;
+}
+
+
+uint64_t PSNRCalculator::planeSSE(const uint8_t* a, int a_stride, const uint8_t* b, int b_stride,
+                                  int width, int height) const
+{
+  if (avx2_)
+  {
+    return plane_sse_avx2(a, a_stride, b, b_stride, width, height);
+  }
+  else if (sse41_)
+  {
+    return plane_sse_sse41(a, a_stride, b, b_stride, width, height);
+  }
+
+  return plane_sse_c(a, a_stride, b, b_stride, width, height);
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "databuffer.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+struct kvz_picture;
+
+// Measures the PSNR of encoded frames against the original input. Only every
+// Nth frame is measured and the measurement can be done in a worker thread so
+// it does not add to the encoding latency. In the worker the reconstructed
+// picture and the input are kept alive by references until the measurement is
+// done and the result is attached to the next frame sent by the encoder.
+
+class PSNRCalculator
+{
+public:
+  PSNRCalculator();
+  ~PSNRCalculator();
+
+  // interval 0 disables the measurement
+  void init(uint32_t interval, bool async, bool avx2, bool sse41);
+
+  // whether the next encoded frame should be measured
+  bool sampleFrame();
+
+  // the original is an unpadded YUV 4:2:0 frame
+  void measure(DataBuffer original, int width, int height,
+               std::shared_ptr<kvz_picture> recon);
+
+  // returns true if a result has been completed since the last call
+  bool takeResult(float& psnrY, float& psnrU, float& psnrV);
+
+private:
+
+  struct Job
+  {
+    DataBuffer original;
+    int width;
+    int height;
+    std::shared_ptr<kvz_picture> recon;
+  };
+
+  void calculate(const Job& job);
+
+  void worker();
+  void stopWorker();
+
+  uint64_t planeSSE(const uint8_t* a, int a_stride, const uint8_t* b, int b_stride,
+                    int width, int height) const;
+
+  uint32_t interval_;
+  uint64_t frame_;
+
+  bool async_;
+  bool avx2_;
+  bool sse41_;
+
+  std::mutex resultMutex_;
+  bool hasResult_;
+  float psnrY_;
+  float psnrU_;
+  float psnrV_;
+
+  std::mutex jobMutex_;
+  std::condition_variable jobCV_;
+  std::deque<Job> jobs_;
+  bool running_;
+  std::thread thread_;
+};
@@ -7,6 +7,7 @@
 #include "media/resourceallocator.h"
 #include "global.h"
 #include "common.h"
+#include "yuvconversions.h"
 
 #ifdef uvgComm_HAVE_OPENCV
 #include <opencv2/imgproc.hpp>
@@ -24,33 +25,70 @@
 #include <algorithm>
 
 
+// the detection never takes more than this share of a core if not set
+const int DEFAULT_CPU_BUDGET = 30;
+
+// how much of the previous estimate is kept when a detection is timed
+const float INFERENCE_TIME_SMOOTHING = 0.8f;
+
+// Boxes are moved along their motion at most this long after the detection.
+// After that the detections have probably stopped and the motion is no longer
+// reliable.
+const int64_t MAX_EXTRAPOLATION_MS = 500;
+
+// used when the model does not fix its input size
+const int DEFAULT_INPUT_SIZE = 640;
+
+const uint8_t LETTERBOX_COLOR = 114;
+
+
 ROIYoloFilter::ROIYoloFilter(QString id, StatisticsInterface *stats, std::shared_ptr<ResourceAllocator> hwResources,
                      bool cuda, VideoInterface* roiInterface)
   : Filter(id, "RoI", stats, hwResources, DT_YUV420VIDEO, DT_YUV420VIDEO),
-    prevInputDiscarded_(0),
-    skipInput_(1),
     minBbSize_{0, 0},
     drawBbox_(false),
     minRelativeBbSize_(0),
+    faceDetection_(false),
     useCuda_(cuda),
     roiEnabled_(false),
-    frameCount_(0),
     roi_({0,0,nullptr}),
-    roiSurface_(roiInterface),
-    faceDetection_(false)
+    detectionMutex_(),
+    detectionCV_(),
+    detecting_(false),
+    detectionBusy_(false),
+    hasJob_(false),
+    job_(),
+    hasResult_(false),
+    result_(),
+    resultSize_{0, 0},
+    resultFrameMs_(0),
+    detectionThread_(),
+    cpuBudget_(DEFAULT_CPU_BUDGET),
+    inferenceMs_(0.0f),
+    nextDetectionMs_(0),
+    tracked_(),
+    tracking_(false),
+    letterboxSource_{0, 0},
+    letterboxLeft_(0),
+    letterboxTop_(0),
+    letterboxColumns_(),
+    letterboxRows_(),
+    gatherWidth_(0),
+    loadWidth_(0),
+    roiSurface_(roiInterface)
 {}
 
 
 ROIYoloFilter::~ROIYoloFilter()
-{}
+{
+  stopDetection();
+}
 
 
 void ROIYoloFilter::updateSettings()
 {
   Logger::getLogger()->printNormal(this, "Updating RoI filter settings");
   QMutexLocker lock(&settingsMutex_);
-  prevInputDiscarded_ = 0;
-  skipInput_ = 1;
 
   init();
   Filter::updateSettings();
@@ -66,11 +104,27 @@ bool ROIYoloFilter::init()
   roiSettings_.qp = settings.value(SettingsKey::videoQP).toInt();
   QString newModelQstr = settings.value(SettingsKey::roiDetectorModel).toString();
 
+  int cpuBudget = settings.value(SettingsKey::roiCpuBudget, DEFAULT_CPU_BUDGET).toInt();
+
+  {
+    // the rate is measured again, since the model or its threads may have changed
+    std::lock_guard<std::mutex> lock(detectionMutex_);
+    cpuBudget_ = std::max(1, cpuBudget);
+    inferenceMs_ = 0.0f;
+    nextDetectionMs_ = 0;
+  }
+
   roiEnabled_ = settingValue(SettingsKey::roiEnabled) && !newModelQstr.isEmpty();
   int threads = settings.value(SettingsKey::roiMaxThreads).toInt();
   if (roiEnabled_)
   {
     roiEnabled_ = initYolo(threads, newModelQstr);
+
+    if (roiEnabled_)
+    {
+      startDetection();
+    }
+
     return roiEnabled_;
   }
 
@@ -88,22 +142,22 @@ void ROIYoloFilter::process()
     {
       QMutexLocker lock(&settingsMutex_);
 
-      if(inputDiscarded_ > prevInputDiscarded_)
-      {
-        skipInput_++;
-        prevInputDiscarded_ = inputDiscarded_;
-      }
+      int64_t frameMs = input->creationTimestamp >= 0 ? input->creationTimestamp : clockNowMs();
 
-      if(frameCount_ % skipInput_ == 0)
-      {
-        // run onnx yolo face detection
-        std::vector<Detection> detections = yolo_detection(input.get());
+      // the frame is never held back for the detection
+      offerFrame(input.get(), frameMs);
+
+      std::vector<Detection> detections;
+      Size detectedSize;
+      int64_t detectedMs = 0;
 
+      if (takeDetections(detections, detectedSize, detectedMs))
+      {
         // find detection with largest bounding box
         Rect largest_bbox = find_largest_bbox(detections);
         double largest_area_pix = largest_bbox.width * largest_bbox.height;
 
-        std::vector<Rect> face_roi_rects;
+        std::vector<Rect> boxes;
         for (Detection& face : detections)
         {
           double area = face.bbox.width * face.bbox.height;
@@ -114,45 +168,25 @@ void ROIYoloFilter::process()
             continue;
           }
 
-          face.bbox = enlarge_bb(face);
-          Rect roi = bbox_to_roi(face.bbox);
-          face_roi_rects.push_back(roi);
-
-#ifdef uvgComm_HAVE_OPENCV
-          if (drawBbox_)
-          {
-            cv::rectangle(rgb, face.bbox, {255, 0, 0}, 3);
-            auto &landmarks = face.landmarks;
-            cv::Vec3i colours[5] = {{255, 0, 0}, {0, 255, 0}, {0, 0, 255}, {255, 255, 0}, {0, 255, 255}};
-            for (size_t i = 0; i < 5; i++)
-            {
-              cv::circle(rgb, landmarks[i], 2, colours[i]);
-            }
-          }
-#endif
+          boxes.push_back(enlarge_bb(face));
         }
 
-        Size roi_size = calculate_roi_size(input->vInfo->width, input->vInfo->height);
-        roi_.width = roi_size.width;
-        roi_.height = roi_size.height;
+        updateTracking(boxes, detectedMs);
+        tracking_ = true;
 
-        if(roi_.width != roiSettings_.width || roi_.height != roiSettings_.height)
-        {
-          roiSettings_.width = roi_size.width;
-          roiSettings_.height = roi_size.height;
-        }
-
-        int roi_length = (roi_size.width+1)*(roi_size.height+1);
+        roiSurface_->inputDetections(detections, {detectedSize.width, detectedSize.height}, 0);
+      }
 
+      if (tracking_)
+      {
+        Size roi_size = calculate_roi_size(input->vInfo->width, input->vInfo->height);
+        roiSettings_.width = roi_size.width;
+        roiSettings_.height = roi_size.height;
         roiSettings_.roiQP = getHWManager()->getRoiQp();
         roiSettings_.backgroundQP = getHWManager()->getBackgroundQp();
 
-        clip_coords(face_roi_rects, roi_size);
-        RoiMap roi_mat = makeRoiMap(face_roi_rects);
-        roi_.data = std::make_unique<int8_t[]>(roi_length);
-        memcpy(roi_.data.get(), roi_mat.data.get(), roi_length);
-
-        roiSurface_->inputDetections(detections, {input->vInfo->width, input->vInfo->height}, 0);
+        // the map is small, so it is cheaper to rebuild it than to move it
+        roi_ = makeRoiMap(predictRois(frameMs, roi_size));
       }
 
       if(roi_.data)
@@ -164,8 +198,6 @@ void ROIYoloFilter::process()
 
         roiSurface_->visualizeROIMap(input->vInfo->roi, roiSettings_.qp);
       }
-
-      frameCount_++;
     }
 
     sendOutput(std::move(input));
@@ -174,6 +206,193 @@ void ROIYoloFilter::process()
 }
 
 
+void ROIYoloFilter::startDetection()
+{
+  std::lock_guard<std::mutex> lock(detectionMutex_);
+  if (!detecting_)
+  {
+    detecting_ = true;
+    detectionThread_ = std::thread(&ROIYoloFilter::detectionLoop, this);
+  }
+}
+
+
+void ROIYoloFilter::stopDetection()
+{
+  {
+    std::lock_guard<std::mutex> lock(detectionMutex_);
+    detecting_ = false;
+    hasJob_ = false;
+    detectionCV_.notify_all();
+  }
+
+  if (detectionThread_.joinable())
+  {
+    detectionThread_.join();
+  }
+}
+
+
+void ROIYoloFilter::detectionLoop()
+{
+  std::unique_lock<std::mutex> lock(detectionMutex_);
+
+  while (detecting_)
+  {
+    if (!hasJob_)
+    {
+      detectionCV_.wait(lock);
+      continue;
+    }
+
+    DetectionJob job = std::move(job_);
+    hasJob_ = false;
+    lock.unlock();
+
+    int64_t startMs = clockNowMs();
+    std::vector<Detection> detections;
+
+    {
+      std::lock_guard<std::mutex> modelLock(modelMutex_);
+      if (yoloModel_.binding && job.generation == yoloModel_.generation)
+      {
+        detections = yolo_detection(job.size);
+      }
+    }
+
+    float spentMs = (float)(clockNowMs() - startMs);
+
+    lock.lock();
+
+    if (inferenceMs_ == 0.0f)
+    {
+      inferenceMs_ = spentMs;
+    }
+    else
+    {
+      inferenceMs_ = INFERENCE_TIME_SMOOTHING*inferenceMs_ +
+          (1.0f - INFERENCE_TIME_SMOOTHING)*spentMs;
+    }
+
+    // the rate follows the inference time both ways, so the detection
+    // speeds up again when the machine has more room
+    nextDetectionMs_ = startMs + (int64_t)(inferenceMs_*100/cpuBudget_);
+
+    result_ = std::move(detections);
+    resultSize_ = job.size;
+    resultFrameMs_ = job.frameMs;
+    hasResult_ = true;
+    detectionBusy_ = false;
+  }
+}
+
+
+void ROIYoloFilter::offerFrame(const Data* input, int64_t frameMs)
+{
+  std::lock_guard<std::mutex> lock(detectionMutex_);
+
+  if (!detecting_ || detectionBusy_ || clockNowMs() < nextDetectionMs_)
+  {
+    return;
+  }
+
+  if (!yoloModel_.binding)
+  {
+    return;
+  }
+
+  // the detection thread is idle, so it does not read the tensor while it is written
+  prepareInput(input);
+
+  job_.size = {input->vInfo->width, input->vInfo->height};
+  job_.frameMs = frameMs;
+  job_.generation = yoloModel_.generation;
+
+  hasJob_ = true;
+  detectionBusy_ = true;
+  detectionCV_.notify_one();
+}
+
+
+bool ROIYoloFilter::takeDetections(std::vector<Detection>& detections, Size& size,
+                                   int64_t& frameMs)
+{
+  std::lock_guard<std::mutex> lock(detectionMutex_);
+  if (!hasResult_)
+  {
+    return false;
+  }
+
+  detections = std::move(result_);
+  size = resultSize_;
+  frameMs = resultFrameMs_;
+  hasResult_ = false;
+  return true;
+}
+
+
+void ROIYoloFilter::updateTracking(const std::vector<Rect>& boxes, int64_t frameMs)
+{
+  std::vector<TrackedBox> tracked;
+
+  for (const Rect& box : boxes)
+  {
+    TrackedBox current = {box, frameMs, 0.0f, 0.0f};
+
+    float centerX = box.x + box.width/2.0f;
+    float centerY = box.y + box.height/2.0f;
+
+    // the closest previous box is the same face if it has not moved more than its size
+    float maxDistance = (float)std::max(box.width, box.height);
+    float closest = maxDistance*maxDistance;
+    const TrackedBox* previous = nullptr;
+
+    for (const TrackedBox& old : tracked_)
+    {
+      float dx = centerX - (old.bbox.x + old.bbox.width/2.0f);
+      float dy = centerY - (old.bbox.y + old.bbox.height/2.0f);
+
+      if (dx*dx + dy*dy < closest)
+      {
+        closest = dx*dx + dy*dy;
+        previous = &old;
+      }
+    }
+
+    if (previous != nullptr && frameMs > previous->detectedMs)
+    {
+      float elapsed = (float)(frameMs - previous->detectedMs);
+      current.velocityX = (centerX - (previous->bbox.x + previous->bbox.width/2.0f))/elapsed;
+      current.velocityY = (centerY - (previous->bbox.y + previous->bbox.height/2.0f))/elapsed;
+    }
+
+    tracked.push_back(current);
+  }
+
+  tracked_ = std::move(tracked);
+}
+
+
+std::vector<Rect> ROIYoloFilter::predictRois(int64_t frameMs, Size roiSize)
+{
+  std::vector<Rect> rois;
+
+  for (const TrackedBox& box : tracked_)
+  {
+    int64_t elapsed = std::clamp<int64_t>(frameMs - box.detectedMs, 0, MAX_EXTRAPOLATION_MS);
+
+    Rect moved = box.bbox;
+    moved.x += (int)(box.velocityX*elapsed);
+    moved.y += (int)(box.velocityY*elapsed);
+
+    rois.push_back(bbox_to_roi(moved));
+  }
+
+  clip_coords(rois, roiSize);
+  return rois;
+}
+
+
 bool ROIYoloFilter::initYolo(int threads, QString newModelQstr)
 {
 #ifdef _WIN32
@@ -193,6 +412,9 @@ bool ROIYoloFilter::initYolo(int threads, QString newModelQstr)
     }
 #endif
 
+  // waits for an ongoing detection to finish with the old model
+  std::lock_guard<std::mutex> lock(modelMutex_);
+
   if (newModelPath != yoloModelPath_)
   {
     Logger::getLogger()->printNormal(this, "Initializing Yolo model");
@@ -202,7 +424,9 @@ bool ROIYoloFilter::initYolo(int threads, QString newModelQstr)
     {
       if (yoloModel_.session)
       {
-        // Deallocate previous strings before destroying their allocator.
+        // The binding refers to the session and the names to the allocator.
+        yoloModel_.binding.reset();
+        yoloModel_.inputTensor = Ort::Value(nullptr);
         yoloModel_.inputName = std::nullopt;
         yoloModel_.outputName = std::nullopt;
       }
@@ -263,6 +487,37 @@ bool ROIYoloFilter::initYolo(int threads, QString newModelQstr)
       yoloModel_.inputSize = std::max(yoloModel_.inputShape[2], yoloModel_.inputShape[3]);
       yoloModel_.minimum = false;
     }
+    else if (yoloModel_.inputSize <= 0)
+    {
+      yoloModel_.inputSize = DEFAULT_INPUT_SIZE;
+    }
+
+    try
+    {
+      const int64_t size = yoloModel_.inputSize;
+      const size_t SHAPE_LEN = 4;
+      int64_t shape[SHAPE_LEN] = {1, 3, size, size};
+      auto memory = Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault);
+
+      // the padding is only written here and when the frame size changes
+      yoloModel_.input.assign(3*size*size, LETTERBOX_COLOR/255.0f);
+      yoloModel_.inputTensor = Ort::Value::CreateTensor<float>(memory, yoloModel_.input.data(),
+                                                               yoloModel_.input.size(),
+                                                               shape, SHAPE_LEN);
+
+      yoloModel_.binding = std::make_unique<Ort::IoBinding>(*yoloModel_.session);
+      yoloModel_.binding->BindInput(yoloModel_.inputName->get(), yoloModel_.inputTensor);
+      yoloModel_.binding->BindOutput(yoloModel_.outputName->get(), memory);
+    }
+    catch (std::exception &e)
+    {
+      Logger::getLogger()->printError(this, e.what());
+      yoloModel_.binding.reset();
+      return false;
+    }
+
+    ++yoloModel_.generation;
+    letterboxSource_ = {0, 0};
 
     Logger::getLogger()->printNormal(this, "Yolo model initialized");
   }
@@ -273,48 +528,115 @@ bool ROIYoloFilter::initYolo(int threads, QString newModelQstr)
 
 void ROIYoloFilter::close()
 {
+  yoloModel_.binding.reset();
   yoloModel_.allocator.reset();
   yoloModel_.session.reset();
 }
 
 
-void ROIYoloFilter::YUVToFloat(uint8_t* src, float* dst, size_t len)
+void ROIYoloFilter::prepareInput(const Data* input)
 {
-  for(size_t i = 0; i < len; i++)
+  Size original_size{input->vInfo->width, input->vInfo->height};
+
+  if (original_size.width != letterboxSource_.width ||
+      original_size.height != letterboxSource_.height)
+  {
+    updateLetterbox(original_size);
+  }
+
+  const uint8_t* luma = input->data.get();
+  int stride = original_size.width;
+
+  if (input->vInfo->planes[0])
   {
-    dst[i] = float(src[i]) / 255.0f; // divide color space to 0-1
+    luma = input->vInfo->planes[0];
+    stride = input->vInfo->pitches[0];
+  }
+
+  int channel_size = yoloModel_.inputSize*yoloModel_.inputSize;
+  float* output = yoloModel_.input.data() + letterboxTop_*yoloModel_.inputSize + letterboxLeft_;
+  int width = (int)letterboxColumns_.size();
+  int height = (int)letterboxRows_.size();
+
+  // the model expects three channels, so luma is written to each of them
+  if (getHWManager()->isAVX2Enabled())
+  {
+    luma_to_tensor_avx2(luma, stride, letterboxColumns_.data(), letterboxRows_.data(),
+                        width, height, gatherWidth_, output, yoloModel_.inputSize, 3, channel_size);
+  }
+  else if (getHWManager()->isSSE41Enabled())
+  {
+    luma_to_tensor_sse41(luma, stride, letterboxColumns_.data(), letterboxRows_.data(),
+                         width, height, loadWidth_, output, yoloModel_.inputSize, 3, channel_size);
+  }
+  else
+  {
+    luma_to_tensor_c(luma, stride, letterboxColumns_.data(), letterboxRows_.data(),
+                     width, height, output, yoloModel_.inputSize, 3, channel_size);
   }
 }
 
 
-std::vector<Detection> ROIYoloFilter::yolo_detection(const Data* input)
+void ROIYoloFilter::updateLetterbox(Size original_shape)
 {
-  Size original_size{input->vInfo->width, input->vInfo->height};
-  std::vector<float> Y_f(original_size.width*original_size.height);
-  YUVToFloat(input->data.get(), Y_f.data(), original_size.width*original_size.height);
+  int size = yoloModel_.inputSize;
 
-  const uint8_t COLOR = 114;
-  auto Y_input = scaleToLetterbox(Y_f, original_size,{yoloModel_.inputSize, yoloModel_.inputSize}, COLOR, yoloModel_.minimum);
-  size_t channel_size = Y_input.size();
+  // scale to fit the model input and pad the rest, see
+  // https://github.com/ultralytics/yolov3/issues/232
+  double r = std::min((double)size / (double)original_shape.width,
+                      (double)size / (double)original_shape.height);
 
-  Y_input.resize(Y_input.size()*3);
-  std::memcpy(Y_input.data() + channel_size,   Y_input.data(), channel_size);
-  std::memcpy(Y_input.data() + 2*channel_size, Y_input.data(), channel_size);
+  Size new_unpad{std::min(size, int(std::round(original_shape.width * r))),
+                 std::min(size, int(std::round(original_shape.height * r)))};
 
-  const size_t SHAPE_LEN = 4;
-  int64_t shape[SHAPE_LEN] = {1, 3, yoloModel_.inputSize, yoloModel_.inputSize};
-  auto memory = Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault);
+  double ddw = (size - new_unpad.width) / 2.0;
+  double ddh = (size - new_unpad.height) / 2.0;
+  letterboxLeft_ = int(std::round(ddw - 0.1));
+  letterboxTop_ = int(std::round(ddh - 0.1));
 
-  auto input_tensor = Ort::Value::CreateTensor<float>(&*memory, Y_input.data(), Y_input.size(), shape, SHAPE_LEN);
+  letterboxColumns_.resize(new_unpad.width);
+  for (int x = 0; x < new_unpad.width; ++x)
+  {
+    letterboxColumns_[x] = std::min(original_shape.width - 1,
+                                    (int)((int64_t)x*original_shape.width/new_unpad.width));
+  }
 
-  Ort::RunOptions options;
-  const char* input_names[] = {yoloModel_.inputName->get()};
-  char* output_names[]      = {yoloModel_.outputName->get()};
+  letterboxRows_.resize(new_unpad.height);
+  for (int y = 0; y < new_unpad.height; ++y)
+  {
+    letterboxRows_[y] = std::min(original_shape.height - 1,
+                                 (int)((int64_t)y*original_shape.height/new_unpad.height));
+  }
 
-  // run the detection model
-  auto detections = yoloModel_.session->Run(options, input_names, &input_tensor, 1, output_names, 1);
+  // the gathers of the last pixels of a row could read past the plane
+  gatherWidth_ = 0;
+  while (gatherWidth_ < new_unpad.width &&
+         letterboxColumns_[gatherWidth_] + 4 <= original_shape.width)
+  {
+    ++gatherWidth_;
+  }
+
+  loadWidth_ = 0;
+  while (loadWidth_ < new_unpad.width &&
+         letterboxColumns_[loadWidth_] + 16 <= original_shape.width)
+  {
+    ++loadWidth_;
+  }
+
+  // the image area may have shrunk, so the padding is written again
+  std::fill(yoloModel_.input.begin(), yoloModel_.input.end(), LETTERBOX_COLOR/255.0f);
+
+  letterboxSource_ = original_shape;
+}
 
-  auto out_shape = detections[0].GetTensorTypeAndShapeInfo().GetShape();
+
+std::vector<Detection> ROIYoloFilter::yolo_detection(Size original_size)
+{
+  Ort::RunOptions options;
+
+  // run the detection model on the bound input tensor
+  yoloModel_.session->Run(options, *yoloModel_.binding);
+  std::vector<Ort::Value> detections = yoloModel_.binding->GetOutputValues();
 
   // remove overlapping detections
   std::vector<const float*> objects;
@@ -343,73 +665,6 @@ Rect ROIYoloFilter::find_largest_bbox(std::vector<Detection> &detections)
 }
 
 
-std::vector<float> ROIYoloFilter::scaleToLetterbox(const std::vector<float>& img, Size original_shape, Size new_shape, uint8_t color,
-                             bool minimum, bool scaleFill, bool scaleup)
-{
-  //Resize image to a 32 - pixel - multiple rectangle https://github.com/ultralytics/yolov3/issues/232
-  // Scale ratio(new / old)
-  double r = std::min((double)new_shape.width / (double)original_shape.width,
-                      (double)new_shape.height / (double)original_shape.height);
-  if (!scaleup) // only scale down, do not scale up (for better test mAP)
-  {
-    r = std::min(r, 1.0);
-  }
-  // Compute padding
-  Size new_unpad{int(std::round(original_shape.width * r)), int(std::round(original_shape.height * r))};
-  int dw = new_shape.width - new_unpad.width;
-  int dh = new_shape.height - new_unpad.height; // wh padding
-  if (minimum)                                  //minimum rectangle
-  {
-    dw = dw % 64;
-    dh = dh % 64; //wh padding
-  }
-  else if (scaleFill) //stretch
-  {
-    dw = 0;
-    dh = 0;
-    new_unpad = {new_shape.width, new_shape.height};
-  }
-
-  double ddh = (double)dh / 2.0; // divide padding into 2 sides
-  double ddw = (double)dw / 2.0;
-  int top = int(std::round(ddh - 0.1));
-  int left = int(std::round(ddw - 0.1));
-
-#ifdef uvgComm_HAVE_OPENCV
-  int bottom = int(std::round(ddh + 0.1));
-  int right = int(std::round(ddw + 0.1));
-  cv::Mat scaled;
-#else
-  std::vector<float> scaled_img((dw + new_unpad.width)*(dh + new_unpad.height), color/255.0f);
-#endif
-
-  if (original_shape.width != new_unpad.width && original_shape.height != new_unpad.height) // resize
-  {
-#ifdef uvgComm_HAVE_OPENCV
-    cv::Mat input(original_shape.height, original_shape.width, CV_32F, (void*)img.data());
-    cv::resize(input, scaled, {new_unpad.width, new_unpad.height}, 0.0, 0.0, cv::INTER_NEAREST);
-#else
-    double fx = 1/((double)new_unpad.width / (double)original_shape.width);
-    double fy = 1/((double)new_unpad.height / (double)original_shape.height);
-    for(int y = top; y < new_unpad.height+top; y++) {
-      for(int x = left; x < new_unpad.width+left; x++) {
-        int old_x = std::floor(x*fx),
-            old_y = std::floor((y - top)*fy);
-        scaled_img[y*(new_unpad.width + dw)+x] = img[old_y*original_shape.width + old_x];
-      }
-    }
-#endif
-  }
-
-#ifdef uvgComm_HAVE_OPENCV
-  cv::copyMakeBorder(scaled, scaled, top, bottom, left, right, cv::BORDER_CONSTANT, color/255.0f); // add border
-  std::vector<float> scaled_img(new_shape.width*new_shape.height);
-  memcpy((void*)scaled_img.data(), (void*)scaled.datastart, new_shape.width*new_shape.height*scaled.elemSize());
-#endif
-  return scaled_img;
-}
-
-
 std::vector<const float*> ROIYoloFilter::non_max_suppression_obj(
         Ort::Value const &prediction, bool faceDetection,
         double conf_thres, double iou_thres)
@@ -664,7 +919,7 @@ Ort::SessionOptions ROIYoloFilter::get_session_options(bool cuda, int threads)
 RoiMap ROIYoloFilter::makeRoiMap(const std::vector<Rect> &bbs)
 {
   int width = roiSettings_.width;
-  int height = roiSettings_.width;
+  int height = roiSettings_.height;
   int roiQP = roiSettings_.roiQP;
   int backgroundQP = roiSettings_.backgroundQP;
   int qp = roiSettings_.qp;
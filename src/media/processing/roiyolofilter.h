@@ -7,6 +7,10 @@
 #include <onnxruntime/core/session/onnxruntime_cxx_api.h>
 
 #include <array>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
 
 #ifdef uvgComm_HAVE_OPENCV
 #include <opencv2/core.hpp>
@@ -31,6 +35,12 @@ struct RoiSettings {
 
 class VideoInterface;
 
+// Detects faces or objects and marks them as regions of interest for the
+// encoder. The detection runs in its own thread on the newest frame it can
+// take, while frames pass through with the latest ROI map. The boxes are moved
+// along their measured motion between detections and the detection rate
+// follows the time one detection takes, so that it stays within a CPU budget.
+
 class ROIYoloFilter : public Filter {
 public:
   ROIYoloFilter(QString id, StatisticsInterface* stats,
@@ -53,12 +63,30 @@ private:
 
   void close();
 
-  void YUVToFloat(uint8_t* src, float* dst, size_t len);
-  std::vector<Detection> yolo_detection(const Data* input);
+  void startDetection();
+  void stopDetection();
+  void detectionLoop();
+
+  // gives the frame to the detection thread if it is idle and the next detection is due
+  void offerFrame(const Data* input, int64_t frameMs);
+
+  // returns true if a detection has completed since the last call
+  bool takeDetections(std::vector<Detection>& detections, Size& size, int64_t& frameMs);
+
+  // matches the boxes to the previous ones to estimate their motion
+  void updateTracking(const std::vector<Rect>& boxes, int64_t frameMs);
+
+  // the tracked boxes moved to the time of the frame, in ROI map blocks
+  std::vector<Rect> predictRois(int64_t frameMs, Size roiSize);
+
+  // samples the luma of the frame straight into the letterboxed input tensor
+  void prepareInput(const Data* input);
+  void updateLetterbox(Size original_shape);
+
+  // runs the model on the prepared input tensor
+  std::vector<Detection> yolo_detection(Size original_size);
 
   Rect find_largest_bbox(std::vector<Detection> &detections);
-  std::vector<float> scaleToLetterbox(const std::vector<float>& img, Size original_shape, Size new_shape, uint8_t color = 114,
-                               bool minimum = false, bool scaleFill = false, bool scaleup = true);
 
   std::vector<const float*> non_max_suppression_obj(Ort::Value const &prediction, bool faceDetection,
           double conf_thres=0.25,
@@ -74,13 +102,10 @@ private:
   Ort::SessionOptions get_session_options(bool cuda, int threads);
   RoiMap makeRoiMap(const std::vector<Rect> &bbs);
 
-  unsigned int prevInputDiscarded_;
-  unsigned int skipInput_;
-
 #ifdef _WIN32
   std::wstring yoloModelPath_;
 #else
-  std::string modelPath_;
+  std::string yoloModelPath_;
 #endif
 
   struct ModelData
@@ -97,12 +122,24 @@ private:
     std::vector<int64_t> outputShape;
 
     bool minimum = false;
+
+    // The input tensor is allocated once and bound to the session, so a
+    // detection only writes the pixels and runs the model.
+    std::vector<float> input;
+    Ort::Value inputTensor{nullptr};
+    std::unique_ptr<Ort::IoBinding> binding = nullptr;
+
+    // increased when the model changes, so jobs prepared for the old one are dropped
+    uint32_t generation = 0;
   };
 
   Ort::Env onnxEnv_;
 
   ModelData yoloModel_;
 
+  // held while the model is used or replaced
+  std::mutex modelMutex_;
+
   Size minBbSize_;
   bool drawBbox_;
   double minRelativeBbSize_;
@@ -116,10 +153,60 @@ private:
 
   bool useCuda_;
   QAtomicInt roiEnabled_;
-  int frameCount_;
   RoiMap roi_;
   RoiSettings roiSettings_;
 
+  struct DetectionJob
+  {
+    Size size = {0, 0};
+    int64_t frameMs = 0;
+    uint32_t generation = 0;
+  };
+
+  std::mutex detectionMutex_;
+  std::condition_variable detectionCV_;
+  bool detecting_;
+
+  // a job is waiting or being detected, no new frames are copied until it is done
+  bool detectionBusy_;
+  bool hasJob_;
+  DetectionJob job_;
+
+  bool hasResult_;
+  std::vector<Detection> result_;
+  Size resultSize_;
+  int64_t resultFrameMs_;
+
+  std::thread detectionThread_;
+
+  // percent of one core, the time between detections is the inference time divided by this
+  int cpuBudget_;
+  float inferenceMs_;
+  int64_t nextDetectionMs_;
+
+  struct TrackedBox
+  {
+    Rect bbox;
+    int64_t detectedMs;
+
+    // pixels per millisecond
+    float velocityX;
+    float velocityY;
+  };
+
+  // accessed only by the filter thread
+  std::vector<TrackedBox> tracked_;
+  bool tracking_;
+
+  // nearest neighbour sampling of the current frame size into the model input
+  Size letterboxSource_;
+  int letterboxLeft_;
+  int letterboxTop_;
+  std::vector<int32_t> letterboxColumns_;
+  std::vector<int32_t> letterboxRows_;
+  int gatherWidth_;
+  int loadWidth_;
+
   QMutex settingsMutex_;
   VideoInterface* roiSurface_;
 };
@@ -73,12 +73,13 @@ std::unique_ptr<Data> ScaleFilter::scaleFrame(std::unique_ptr<Data> input)
         QImage::Format_RGB32);
 
   QImage scaled = image.scaled(newSize_);
-  if(newSize_.width() * newSize_.height()
+  // the old frame can be reused if it is large enough and nobody else uses it
+  if(input->data.isShared() || newSize_.width() * newSize_.height()
      > input->vInfo->width * input->vInfo->height)
   {
     input->data = std::unique_ptr<uchar[]>(new uchar[scaled.sizeInBytes()]);
   }
-  memcpy(input->data.get(), scaled.bits(), scaled.sizeInBytes());
+  memcpy(input->data.writable(scaled.sizeInBytes()), scaled.bits(), scaled.sizeInBytes());
   input->vInfo->width = newSize_.width();
   input->vInfo->height = newSize_.height();
   input->data_size = scaled.sizeInBytes();
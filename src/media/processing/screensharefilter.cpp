@@ -102,12 +102,13 @@ void ScreenShareFilter::process()
   std::unique_ptr<Data> newImage = initializeData(output_, DS_LOCAL);
   newImage->creationTimestamp = clockNowMs();
   newImage->presentationTimestamp = newImage->creationTimestamp;
-  newImage->data = std::unique_ptr<uchar[]>(new uchar[image.sizeInBytes()]);
+  std::unique_ptr<uchar[]> frame(new uchar[image.sizeInBytes()]);
 
   image = image.mirrored(false, true);
   uchar *bits = image.bits();
 
-  memcpy(newImage->data.get(), bits, image.sizeInBytes());
+  memcpy(frame.get(), bits, image.sizeInBytes());
+  newImage->data = std::move(frame);
   newImage->data_size = image.sizeInBytes();
 
   // kvazaar requires divisable by 8 resolution
@@ -0,0 +1,179 @@
+#include "speakerselector.h"
+
+#include "filter.h"
+
+#include "common.h"
+
+#include <algorithm>
+#include <cmath>
+
+const uint8_t SILENT_LEVEL = 127;
+
+// sources quieter than this are not speaking
+const float MAX_SPEECH_LEVEL = 50.0f;
+
+// the level follows a louder sound at once, but a quieter one by 1/N per update
+const float LEVEL_DECAY_DIVISOR = 16.0f;
+
+// a new speaker must be this many dB louder to replace a selected one
+const float SELECTION_HYSTERESIS_DB = 6.0f;
+
+const int64_t SELECTION_INTERVAL_MS = 20;
+
+// a source whose level has not been updated is treated as silent
+const int64_t STALE_LEVEL_MS = 200;
+
+
+SpeakerSelector::SpeakerSelector(unsigned int speakers):
+  mutex_(),
+  speakers_(speakers),
+  sources_(),
+  ranking_(),
+  lastSelection_(0),
+  selectionChanged_(nullptr)
+{}
+
+
+void SpeakerSelector::setSpeakers(unsigned int speakers)
+{
+  QMutexLocker lock(&mutex_);
+  speakers_ = speakers;
+  lastSelection_ = 0;
+}
+
+
+void SpeakerSelector::measureLevel(std::unique_ptr<Data> frame)
+{
+  const int16_t* pcm = (const int16_t*)frame->data.get();
+  uint32_t samples = frame->data_size/sizeof(int16_t);
+
+  if (pcm == nullptr || samples == 0)
+  {
+    return;
+  }
+
+  updateLevel(frame->ssrc, pcmLevel(pcm, samples), clockNowMs());
+}
+
+
+uint8_t SpeakerSelector::pcmLevel(const int16_t* pcm, uint32_t samples)
+{
+  int64_t energy = 0;
+  for (uint32_t i = 0; i < samples; ++i)
+  {
+    energy += pcm[i]*pcm[i];
+  }
+
+  float rms = std::sqrt(float(energy)/samples)/INT16_MAX;
+  float level = rms > 0.0f ? -20.0f*std::log10(rms) : SILENT_LEVEL;
+
+  return (uint8_t)std::clamp(level, 0.0f, float(SILENT_LEVEL));
+}
+
+
+void SpeakerSelector::setSelectionCallback(std::function<void()> callback)
+{
+  QMutexLocker lock(&mutex_);
+  selectionChanged_ = callback;
+}
+
+
+void SpeakerSelector::updateLevel(uint32_t ssrc, uint8_t level, int64_t nowMs)
+{
+  mutex_.lock();
+
+  auto source = sources_.find(ssrc);
+  if (source == sources_.end())
+  {
+    sources_[ssrc] = {float(level), nowMs, false, false};
+  }
+  else
+  {
+    if (nowMs - source->second.updated > STALE_LEVEL_MS || level < source->second.level)
+    {
+      source->second.level = level;
+    }
+    else
+    {
+      source->second.level += (level - source->second.level)/LEVEL_DECAY_DIVISOR;
+    }
+
+    source->second.updated = nowMs;
+  }
+
+  bool changed = false;
+  if (nowMs - lastSelection_ >= SELECTION_INTERVAL_MS)
+  {
+    changed = select(nowMs);
+  }
+
+  std::function<void()> callback = selectionChanged_;
+  mutex_.unlock();
+
+  // outside the lock, since the callback may ask which sources are selected
+  if (changed && callback)
+  {
+    callback();
+  }
+}
+
+
+bool SpeakerSelector::isSelected(uint32_t ssrc)
+{
+  QMutexLocker lock(&mutex_);
+
+  auto source = sources_.find(ssrc);
+  return source != sources_.end() && source->second.selected;
+}
+
+
+void SpeakerSelector::removeSource(uint32_t ssrc)
+{
+  QMutexLocker lock(&mutex_);
+  sources_.erase(ssrc);
+  lastSelection_ = 0;
+}
+
+
+bool SpeakerSelector::select(int64_t nowMs)
+{
+  lastSelection_ = nowMs;
+
+  ranking_.clear();
+  for (auto& source : sources_)
+  {
+    source.second.wasSelected = source.second.selected;
+    source.second.selected = false;
+
+    if (nowMs - source.second.updated > STALE_LEVEL_MS ||
+        source.second.level > MAX_SPEECH_LEVEL)
+    {
+      continue;
+    }
+
+    // lower is louder
+    float score = source.second.level;
+    if (source.second.wasSelected)
+    {
+      score -= SELECTION_HYSTERESIS_DB;
+    }
+
+    ranking_.push_back({score, source.first});
+  }
+
+  size_t selected = std::min<size_t>(speakers_, ranking_.size());
+  std::partial_sort(ranking_.begin(), ranking_.begin() + selected, ranking_.end());
+
+  for (size_t i = 0; i < selected; ++i)
+  {
+    sources_[ranking_.at(i).second].selected = true;
+  }
+
+  bool changed = false;
+  for (auto& source : sources_)
+  {
+    changed = changed || source.second.selected != source.second.wasSelected;
+  }
+
+  return changed;
+}
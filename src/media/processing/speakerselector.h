@@ -0,0 +1,66 @@
+#pragma once
+
+#include <QMutex>
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <vector>
+
+struct Data;
+
+// Keeps track of the loudest audio sources so that only the active speakers
+// need to be mixed or forwarded. The levels are in -dBov like in RFC 6464,
+// 0 being the loudest and 127 silence. A selected source stays selected a
+// while after it goes quiet so the pauses between words do not switch it off.
+
+class SpeakerSelector
+{
+public:
+  SpeakerSelector(unsigned int speakers);
+
+  void setSpeakers(unsigned int speakers);
+
+  // measures the level of decoded audio, used as an output callback of a decoder
+  void measureLevel(std::unique_ptr<Data> frame);
+
+  // the level of mono PCM in -dBov
+  static uint8_t pcmLevel(const int16_t* pcm, uint32_t samples);
+
+  void updateLevel(uint32_t ssrc, uint8_t level, int64_t nowMs);
+
+  bool isSelected(uint32_t ssrc);
+
+  // called from the thread updating the levels whenever a source is selected
+  // or deselected
+  void setSelectionCallback(std::function<void()> callback);
+
+  void removeSource(uint32_t ssrc);
+
+private:
+
+  // returns whether the selection changed
+  bool select(int64_t nowMs);
+
+  QMutex mutex_;
+
+  unsigned int speakers_;
+
+  struct Source
+  {
+    float level;
+    int64_t updated;
+    bool selected;
+    bool wasSelected;
+  };
+
+  // key is SSRC
+  std::map<uint32_t, Source> sources_;
+
+  // reused between selections, level and SSRC
+  std::vector<std::pair<float, uint32_t>> ranking_;
+
+  int64_t lastSelection_;
+
+  std::function<void()> selectionChanged_;
+};
@@ -236,7 +236,7 @@ std::unique_ptr<uchar[]> SpeexAEC::processInputFrame(std::unique_ptr<uchar[]> in
 }
 
 
-void SpeexAEC::processEchoFrame(uint8_t *echo, uint32_t dataSize)
+void SpeexAEC::processEchoFrame(const uint8_t *echo, uint32_t dataSize)
 {
   if (echoBuffer_)
   {
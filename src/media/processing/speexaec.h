@@ -26,7 +26,7 @@ public:
   std::unique_ptr<uchar[]> processInputFrame(std::unique_ptr<uchar[]> input,
                                              uint32_t dataSize);
 
-  void processEchoFrame(uint8_t *echo,
+  void processEchoFrame(const uint8_t *echo,
                         uint32_t dataSize);
 
 private:
@@ -69,7 +69,7 @@ bool is_sse41_available()
 // 32 bytes is enough for AVX2
 #define SIMD_ALIGNMENT 32
 
-int yuv420_to_rgb_i_avx2_mt(uint8_t* input, uint8_t* output, uint16_t width, uint16_t height, uint8_t threads)
+int yuv420_to_rgb_i_avx2_mt(const uint8_t* input, uint8_t* output, uint16_t width, uint16_t height, uint8_t threads)
 {
  const int mini[8] = { 0,0,0,0,0,0,0,0 };
  const int middle[8] = { 128, 128, 128, 128,128, 128, 128, 128 };
@@ -79,9 +79,9 @@ int yuv420_to_rgb_i_avx2_mt(uint8_t* input, uint8_t* output, uint16_t width, uin
  const __m256i middle_val = _mm256_loadu_si256((__m256i const*)middle);
  const __m256i max_val = _mm256_loadu_si256((__m256i const*)maxi);
 
- uint8_t *in_y_base = &input[0];;
- uint8_t *in_u_base = &input[width*height];;
- uint8_t *in_v_base = &input[width*height + (width*height >> 2)];
+ const uint8_t *in_y_base = &input[0];;
+ const uint8_t *in_u_base = &input[width*height];;
+ const uint8_t *in_v_base = &input[width*height + (width*height >> 2)];
 
  __m128i luma_shufflemask_lo = _mm_set_epi8(-1, -1, -1, 3, -1, -1, -1, 2, -1, -1, -1, 1, -1, -1, -1, 0);
  __m128i luma_shufflemask_hi = _mm_set_epi8(-1, -1, -1, 7, -1, -1, -1, 6, -1, -1, -1, 5, -1, -1, -1, 4);
@@ -96,7 +96,7 @@ int yuv420_to_rgb_i_avx2_mt(uint8_t* input, uint8_t* output, uint16_t width, uin
 
    int8_t row = i%(width*2) >= width ? 1 : 0;
 
-   uint8_t *in_y = in_y_base + i;
+   const uint8_t *in_y = in_y_base + i;
 
    // Load 16 bytes (16 luma pixels)
    __m128i y_a = _mm_loadu_si128((__m128i const*) in_y);
@@ -109,9 +109,9 @@ int yuv420_to_rgb_i_avx2_mt(uint8_t* input, uint8_t* output, uint16_t width, uin
    __m128i u_a, v_a;
 
    int32_t temp = row?width/4:0;
-   uint8_t *in_u = in_u_base + ((i - i%width)/4) + (i%width)/2 - temp;
+   const uint8_t *in_u = in_u_base + ((i - i%width)/4) + (i%width)/2 - temp;
    u_a = _mm_loadl_epi64((__m128i const*) in_u);
-   uint8_t *in_v = in_v_base + ((i - i%width)/4) + (i%width)/2 - temp;
+   const uint8_t *in_v = in_v_base + ((i - i%width)/4) + (i%width)/2 - temp;
    v_a = _mm_loadl_epi64((__m128i const*) in_v);
 
    __m128i chroma_u_lo = _mm_shuffle_epi8(u_a, chroma_shufflemask_lo);
@@ -167,7 +167,7 @@ int yuv420_to_rgb_i_avx2_mt(uint8_t* input, uint8_t* output, uint16_t width, uin
  return 1;
 }
 
-int yuv420_to_rgb_i_avx2(uint8_t* input, uint8_t* output, uint16_t width, uint16_t height)
+int yuv420_to_rgb_i_avx2(const uint8_t* input, uint8_t* output, uint16_t width, uint16_t height)
 {
   const int mini[8] = { 0,0,0,0,0,0,0,0 };
   const int middle[8] = { 128, 128, 128, 128,128, 128, 128, 128 };
@@ -187,9 +187,9 @@ int yuv420_to_rgb_i_avx2(uint8_t* input, uint8_t* output, uint16_t width, uint16
   uint8_t *row_b = (uint8_t*)ALIGNED_POINTER(row_b_temp, SIMD_ALIGNMENT);
 
 
-  uint8_t *in_y = &input[0];
-  uint8_t *in_u = &input[width*height];
-  uint8_t *in_v = &input[width*height + (width*height >> 2)];
+  const uint8_t *in_y = &input[0];
+  const uint8_t *in_u = &input[width*height];
+  const uint8_t *in_v = &input[width*height + (width*height >> 2)];
   uint8_t *out = output;
 
   int8_t row = 0;
@@ -308,7 +308,7 @@ int yuv420_to_rgb_i_avx2(uint8_t* input, uint8_t* output, uint16_t width, uint16
 }
 
 
-int yuv420_to_rgb_i_sse41(uint8_t* input, uint8_t* output, uint16_t width, uint16_t height)
+int yuv420_to_rgb_i_sse41(const uint8_t* input, uint8_t* output, uint16_t width, uint16_t height)
 {
   const int mini[4] = { 0,0,0,0 };
   const int middle[4] = { 128, 128, 128, 128 };
@@ -322,9 +322,9 @@ int yuv420_to_rgb_i_sse41(uint8_t* input, uint8_t* output, uint16_t width, uint1
   uint8_t *row_g = (uint8_t *)malloc(width*4);
   uint8_t *row_b = (uint8_t *)malloc(width*4);
 
-  uint8_t *in_y = &input[0];
-  uint8_t *in_u = &input[width*height];
-  uint8_t *in_v = &input[width*height + (width*height >> 2)];
+  const uint8_t *in_y = &input[0];
+  const uint8_t *in_u = &input[width*height];
+  const uint8_t *in_v = &input[width*height + (width*height >> 2)];
   uint8_t *out = output;
 
   int8_t row = 0;
@@ -420,7 +420,7 @@ int yuv420_to_rgb_i_sse41(uint8_t* input, uint8_t* output, uint16_t width, uint1
 }
 
 
-void yuv420_to_rgb_i_c(uint8_t* input, uint8_t* output, uint16_t width, uint16_t height)
+void yuv420_to_rgb_i_c(const uint8_t* input, uint8_t* output, uint16_t width, uint16_t height)
 {
   // Luma pixels
   for(int i = 0; i < width*height; ++i)
@@ -493,7 +493,7 @@ void yuv420_to_rgb_i_c(uint8_t* input, uint8_t* output, uint16_t width, uint16_t
 }
 
 
-int rgb_to_yuv420_i_sse41_mt(uint8_t* input, uint8_t* output, int width, int height, int threads)
+int rgb_to_yuv420_i_sse41_mt(const uint8_t* input, uint8_t* output, int width, int height, int threads)
 {
   const int r_mul_y[4] = { 76, 76, 76, 76 };
   const int r_mul_u[4] = { -43, -43, -43, -43 };
@@ -543,7 +543,7 @@ int rgb_to_yuv420_i_sse41_mt(uint8_t* input, uint8_t* output, int width, int hei
   #pragma omp parallel for
   for (int32_t i = 0; i < width*height << 2; i += 16) {
 
-    uint8_t *in = input + i;
+    const uint8_t *in = input + i;
 
     // Load 16 bytes (4 pixels)
     const __m128i a = _mm_loadu_si128((__m128i const*) in);
@@ -627,7 +627,7 @@ int rgb_to_yuv420_i_sse41_mt(uint8_t* input, uint8_t* output, int width, int hei
 }
 
 
-int rgb_to_yuv420_i_sse41(uint8_t* input, uint8_t* output, int width, int height)
+int rgb_to_yuv420_i_sse41(const uint8_t* input, uint8_t* output, int width, int height)
 {
   // TODO: Green colorshift in this conversion
 
@@ -660,7 +660,7 @@ int rgb_to_yuv420_i_sse41(uint8_t* input, uint8_t* output, int width, int height
 
   const int chroma_offset[4] = { 255 * 255, 255 * 255, 255 * 255, 255 * 255 };
 
-  uint8_t *in = input;
+  const uint8_t *in = input;
 
   const __m128i min_val = _mm_loadu_si128((__m128i const*)mini);
   const __m128i max_val = _mm_loadu_si128((__m128i const*)maxi);
@@ -762,7 +762,7 @@ int rgb_to_yuv420_i_sse41(uint8_t* input, uint8_t* output, int width, int height
 }
 
 
-void rgb_to_yuv420_i_c(uint8_t* input, uint8_t* output, uint16_t width, uint16_t height)
+void rgb_to_yuv420_i_c(const uint8_t* input, uint8_t* output, uint16_t width, uint16_t height)
 {
   uint32_t rgb_size =  width*height*4;
 
@@ -797,7 +797,7 @@ void rgb_to_yuv420_i_c(uint8_t* input, uint8_t* output, uint16_t width, uint16_t
 }
 
 
-void yuyv_to_yuv420_c(uint8_t* input, uint8_t* output, uint16_t width, uint16_t height)
+void yuyv_to_yuv420_c(const uint8_t* input, uint8_t* output, uint16_t width, uint16_t height)
 {
   uint8_t* lumaY = output;
   uint8_t* chromaU = output + width*height;
@@ -834,7 +834,7 @@ void yuyv_to_yuv420_c(uint8_t* input, uint8_t* output, uint16_t width, uint16_t
 }
 
 
-void yuyv_to_rgb_c(uint8_t* input, uint8_t* output, uint16_t width, uint16_t height)
+void yuyv_to_rgb_c(const uint8_t* input, uint8_t* output, uint16_t width, uint16_t height)
 {
   // Luma values
   for(int i = 0; i < width*height*2; i += 2)
@@ -849,7 +849,7 @@ void yuyv_to_rgb_c(uint8_t* input, uint8_t* output, uint16_t width, uint16_t hei
 }
 
 
-void half_rgb(uint8_t* input, uint8_t* output, uint16_t width, uint16_t height)
+void half_rgb(const uint8_t* input, uint8_t* output, uint16_t width, uint16_t height)
 {
   int old_rgb_row = width*4;
   int new_rgb_row = width*4/2;
@@ -866,7 +866,7 @@ void half_rgb(uint8_t* input, uint8_t* output, uint16_t width, uint16_t height)
   }
 }
 
-void flip_rgb(uint8_t* input, uint8_t* output, uint16_t width, uint16_t height,
+void flip_rgb(const uint8_t* input, uint8_t* output, uint16_t width, uint16_t height,
               bool horizontally, bool vertically)
 {
   if (!horizontally && !vertically)
@@ -921,6 +921,235 @@ void flip_rgb(uint8_t* input, uint8_t* output, uint16_t width, uint16_t height,
 }
 
 
+uint64_t plane_sse_avx2(const uint8_t* a, int a_stride, const uint8_t* b, int b_stride,
+                        int width, int height)
+{
+  uint64_t sse = 0;
+  __m256i total = _mm256_setzero_si256();
+
+  for (int y = 0; y < height; ++y)
+  {
+    const uint8_t* row_a = a + y*a_stride;
+    const uint8_t* row_b = b + y*b_stride;
+
+    // 32-bit lanes cannot overflow within one row of less than 32768 pixels
+    __m256i row_sum = _mm256_setzero_si256();
+
+    int x = 0;
+    for (; x + 16 <= width; x += 16)
+    {
+      __m256i pix_a = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i const*)(row_a + x)));
+      __m256i pix_b = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i const*)(row_b + x)));
+      __m256i diff = _mm256_sub_epi16(pix_a, pix_b);
+
+      row_sum = _mm256_add_epi32(row_sum, _mm256_madd_epi16(diff, diff));
+    }
+
+    total = _mm256_add_epi64(total, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(row_sum)));
+    total = _mm256_add_epi64(total, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(row_sum, 1)));
+
+    for (; x < width; ++x)
+    {
+      int diff = row_a[x] - row_b[x];
+      sse += diff*diff;
+    }
+  }
+
+  uint64_t lanes[4];
+  _mm256_storeu_si256((__m256i*)lanes, total);
+
+  return sse + lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+
+uint64_t plane_sse_sse41(const uint8_t* a, int a_stride, const uint8_t* b, int b_stride,
+                         int width, int height)
+{
+  uint64_t sse = 0;
+  __m128i total = _mm_setzero_si128();
+
+  for (int y = 0; y < height; ++y)
+  {
+    const uint8_t* row_a = a + y*a_stride;
+    const uint8_t* row_b = b + y*b_stride;
+
+    // 32-bit lanes cannot overflow within one row of less than 16384 pixels
+    __m128i row_sum = _mm_setzero_si128();
+
+    int x = 0;
+    for (; x + 8 <= width; x += 8)
+    {
+      __m128i pix_a = _mm_cvtepu8_epi16(_mm_loadl_epi64((__m128i const*)(row_a + x)));
+      __m128i pix_b = _mm_cvtepu8_epi16(_mm_loadl_epi64((__m128i const*)(row_b + x)));
+      __m128i diff = _mm_sub_epi16(pix_a, pix_b);
+
+      row_sum = _mm_add_epi32(row_sum, _mm_madd_epi16(diff, diff));
+    }
+
+    total = _mm_add_epi64(total, _mm_cvtepu32_epi64(row_sum));
+    total = _mm_add_epi64(total, _mm_cvtepu32_epi64(_mm_srli_si128(row_sum, 8)));
+
+    for (; x < width; ++x)
+    {
+      int diff = row_a[x] - row_b[x];
+      sse += diff*diff;
+    }
+  }
+
+  uint64_t lanes[2];
+  _mm_storeu_si128((__m128i*)lanes, total);
+
+  return sse + lanes[0] + lanes[1];
+}
+
+
+uint64_t plane_sse_c(const uint8_t* a, int a_stride, const uint8_t* b, int b_stride,
+                     int width, int height)
+{
+  uint64_t sse = 0;
+
+  for (int y = 0; y < height; ++y)
+  {
+    const uint8_t* row_a = a + y*a_stride;
+    const uint8_t* row_b = b + y*b_stride;
+
+    uint32_t row_sum = 0;
+    for (int x = 0; x < width; ++x)
+    {
+      int diff = row_a[x] - row_b[x];
+      row_sum += diff*diff;
+    }
+
+    sse += row_sum;
+  }
+
+  return sse;
+}
+
+
+const float TENSOR_SCALE = 1.0f/255.0f;
+
+
+void luma_to_tensor_avx2(const uint8_t* plane, int stride,
+                         const int32_t* columns, const int32_t* rows,
+                         int width, int height, int gather_width,
+                         float* output, int output_stride, int channels, int channel_size)
+{
+  const __m256i byte_mask = _mm256_set1_epi32(0xFF);
+  const __m256 scale = _mm256_set1_ps(TENSOR_SCALE);
+
+  for (int y = 0; y < height; ++y)
+  {
+    const uint8_t* row = plane + rows[y]*stride;
+    float* out = output + y*output_stride;
+
+    int x = 0;
+    for (; x + 8 <= gather_width; x += 8)
+    {
+      __m256i index = _mm256_loadu_si256((__m256i const*)(columns + x));
+      __m256i pixels = _mm256_and_si256(_mm256_i32gather_epi32((int const*)row, index, 1), byte_mask);
+      __m256 values = _mm256_mul_ps(_mm256_cvtepi32_ps(pixels), scale);
+
+      for (int c = 0; c < channels; ++c)
+      {
+        _mm256_storeu_ps(out + c*channel_size + x, values);
+      }
+    }
+
+    for (; x < width; ++x)
+    {
+      float value = row[columns[x]]*TENSOR_SCALE;
+
+      for (int c = 0; c < channels; ++c)
+      {
+        out[c*channel_size + x] = value;
+      }
+    }
+  }
+}
+
+
+void luma_to_tensor_sse41(const uint8_t* plane, int stride,
+                          const int32_t* columns, const int32_t* rows,
+                          int width, int height, int load_width,
+                          float* output, int output_stride, int channels, int channel_size)
+{
+  const __m128 scale = _mm_set1_ps(TENSOR_SCALE);
+
+  // the upper bytes of each 32-bit lane are zeroed by the shuffle
+  const __m128i zero_extend = _mm_set1_epi32(0x80808000);
+
+  for (int y = 0; y < height; ++y)
+  {
+    const uint8_t* row = plane + rows[y]*stride;
+    float* out = output + y*output_stride;
+
+    int x = 0;
+    for (; x + 4 <= width; x += 4)
+    {
+      int first = columns[x];
+      __m128i pixels;
+
+      if (x < load_width && columns[x + 3] - first < 16)
+      {
+        // The four pixels are within one load, so they are shuffled to the
+        // lanes. Without scaling this is the same as _mm_cvtepu8_epi32.
+        __m128i offsets = _mm_sub_epi32(_mm_loadu_si128((__m128i const*)(columns + x)),
+                                        _mm_set1_epi32(first));
+        pixels = _mm_shuffle_epi8(_mm_loadu_si128((__m128i const*)(row + first)),
+                                  _mm_or_si128(offsets, zero_extend));
+      }
+      else
+      {
+        // the pixels are too far apart or the load would pass the plane
+        pixels = _mm_setr_epi32(row[first],          row[columns[x + 1]],
+                                row[columns[x + 2]], row[columns[x + 3]]);
+      }
+
+      __m128 values = _mm_mul_ps(_mm_cvtepi32_ps(pixels), scale);
+
+      for (int c = 0; c < channels; ++c)
+      {
+        _mm_storeu_ps(out + c*channel_size + x, values);
+      }
+    }
+
+    for (; x < width; ++x)
+    {
+      float value = row[columns[x]]*TENSOR_SCALE;
+
+      for (int c = 0; c < channels; ++c)
+      {
+        out[c*channel_size + x] = value;
+      }
+    }
+  }
+}
+
+
+void luma_to_tensor_c(const uint8_t* plane, int stride,
+                      const int32_t* columns, const int32_t* rows,
+                      int width, int height,
+                      float* output, int output_stride, int channels, int channel_size)
+{
+  for (int y = 0; y < height; ++y)
+  {
+    const uint8_t* row = plane + rows[y]*stride;
+    float* out = output + y*output_stride;
+
+    for (int x = 0; x < width; ++x)
+    {
+      float value = row[columns[x]]*TENSOR_SCALE;
+
+      for (int c = 0; c < channels; ++c)
+      {
+        out[c*channel_size + x] = value;
+      }
+    }
+  }
+}
+
+
 uint8_t clamp_8bit(int32_t input)
 {
   if(input & ~255)
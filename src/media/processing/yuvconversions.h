@@ -6,23 +6,51 @@
 bool is_avx2_available();
 bool is_sse41_available();
 
-int  yuv420_to_rgb_i_avx2_mt (uint8_t* input, uint8_t* output, uint16_t width, uint16_t height, uint8_t threads);
-int  yuv420_to_rgb_i_avx2    (uint8_t* input, uint8_t* output, uint16_t width, uint16_t height);
-int  yuv420_to_rgb_i_sse41   (uint8_t* input, uint8_t* output, uint16_t width, uint16_t height);
-void yuv420_to_rgb_i_c       (uint8_t* input, uint8_t* output, uint16_t width, uint16_t height);
+int  yuv420_to_rgb_i_avx2_mt (const uint8_t* input, uint8_t* output, uint16_t width, uint16_t height, uint8_t threads);
+int  yuv420_to_rgb_i_avx2    (const uint8_t* input, uint8_t* output, uint16_t width, uint16_t height);
+int  yuv420_to_rgb_i_sse41   (const uint8_t* input, uint8_t* output, uint16_t width, uint16_t height);
+void yuv420_to_rgb_i_c       (const uint8_t* input, uint8_t* output, uint16_t width, uint16_t height);
 
 // TODO: These also flip the input vertically!
-int  rgb_to_yuv420_i_sse41_mt(uint8_t* input, uint8_t* output, int width, int height, int threads);
-int  rgb_to_yuv420_i_sse41   (uint8_t* input, uint8_t* output, int width, int height);
-void rgb_to_yuv420_i_c       (uint8_t* input, uint8_t* output, uint16_t width, uint16_t height);
+int  rgb_to_yuv420_i_sse41_mt(const uint8_t* input, uint8_t* output, int width, int height, int threads);
+int  rgb_to_yuv420_i_sse41   (const uint8_t* input, uint8_t* output, int width, int height);
+void rgb_to_yuv420_i_c       (const uint8_t* input, uint8_t* output, uint16_t width, uint16_t height);
 
-void yuyv_to_yuv420_c        (uint8_t* input, uint8_t* output, uint16_t width, uint16_t height);
+void yuyv_to_yuv420_c        (const uint8_t* input, uint8_t* output, uint16_t width, uint16_t height);
 
-void yuyv_to_rgb_c           (uint8_t* input, uint8_t* output, uint16_t width, uint16_t height);
+void yuyv_to_rgb_c           (const uint8_t* input, uint8_t* output, uint16_t width, uint16_t height);
 
 // reduces the size of RGB frame to half height and half width
-void half_rgb                (uint8_t* input, uint8_t* output, uint16_t width, uint16_t height);
+void half_rgb                (const uint8_t* input, uint8_t* output, uint16_t width, uint16_t height);
 
-void flip_rgb                (uint8_t* input, uint8_t* output, uint16_t width, uint16_t height,
+void flip_rgb                (const uint8_t* input, uint8_t* output, uint16_t width, uint16_t height,
                               bool horizontally, bool vertically);
 
+// sum of squared differences between two 8-bit planes, used for PSNR
+uint64_t plane_sse_avx2      (const uint8_t* a, int a_stride, const uint8_t* b, int b_stride,
+                              int width, int height);
+uint64_t plane_sse_sse41     (const uint8_t* a, int a_stride, const uint8_t* b, int b_stride,
+                              int width, int height);
+uint64_t plane_sse_c         (const uint8_t* a, int a_stride, const uint8_t* b, int b_stride,
+                              int width, int height);
+
+
+// Samples an 8-bit plane with nearest neighbour into planar float channels
+// scaled to [0, 1]. The source of each output pixel is given by the column and
+// row tables and the same values are written to every channel. The gathers of
+// the AVX2 version read 3 bytes past the sampled pixel, so it samples only the
+// first gather_width columns that way. The SSE4.1 version shuffles the pixels
+// out of 16 byte loads, which it does for the first load_width columns. The
+// columns must not decrease.
+void luma_to_tensor_avx2     (const uint8_t* plane, int stride,
+                              const int32_t* columns, const int32_t* rows,
+                              int width, int height, int gather_width,
+                              float* output, int output_stride, int channels, int channel_size);
+void luma_to_tensor_sse41    (const uint8_t* plane, int stride,
+                              const int32_t* columns, const int32_t* rows,
+                              int width, int height, int load_width,
+                              float* output, int output_stride, int channels, int channel_size);
+void luma_to_tensor_c        (const uint8_t* plane, int stride,
+                              const int32_t* columns, const int32_t* rows,
+                              int width, int height,
+                              float* output, int output_stride, int channels, int channel_size);
@@ -9,12 +9,16 @@
 
 #include <QSettings>
 
+#include <libyuv.h>
+
 
 YUVtoRGB32::YUVtoRGB32(QString id, StatisticsInterface *stats,
                        std::shared_ptr<ResourceAllocator> hwResources) :
   Filter(id, "YUVtoRGB32", stats, hwResources, DT_YUV420VIDEO, DT_RGB32VIDEO),
   threadCount_(0)
 {
+  taskCompatible_ = true;
+  stridedInput_ = true;
   updateSettings();
 }
 
@@ -33,26 +37,42 @@ void YUVtoRGB32::process()
   while(input)
   {
     uint32_t finalDataSize = input->vInfo->width*input->vInfo->height*4;
-    std::unique_ptr<uchar[]> rgb32_frame(new uchar[finalDataSize]);
+    DataBuffer rgb32_frame = allocateBuffer(finalDataSize);
+    uint8_t* rgb32 = rgb32_frame.writable(finalDataSize);
 
     // TODO: Select thread count based on input resolution instead of settings.
     // Anything above fullhd should be around 2
-    if (getHWManager()->isAVX2Enabled() && threadCount_ != 1 && input->vInfo->width % 16 == 0)
+    if (input->vInfo->planes[0] != nullptr)
+    {
+      // read straight from the decoder picture, same full range conversion as below
+      libyuv::J420ToARGB(input->vInfo->planes[0], input->vInfo->pitches[0],
+                         input->vInfo->planes[1], input->vInfo->pitches[1],
+                         input->vInfo->planes[2], input->vInfo->pitches[2],
+                         rgb32, input->vInfo->width*4,
+                         input->vInfo->width, input->vInfo->height);
+
+      for (int i = 0; i < 3; ++i)
+      {
+        input->vInfo->planes[i] = nullptr;
+        input->vInfo->pitches[i] = 0;
+      }
+    }
+    else if (getHWManager()->isAVX2Enabled() && threadCount_ != 1 && input->vInfo->width % 16 == 0)
     {
-      yuv420_to_rgb_i_avx2_mt(input->data.get(), rgb32_frame.get(), input->vInfo->width, input->vInfo->height,
+      yuv420_to_rgb_i_avx2_mt(input->data.get(), rgb32, input->vInfo->width, input->vInfo->height,
                      threadCount_);
     }
     else if (getHWManager()->isAVX2Enabled() && input->vInfo->width % 16 == 0)
     {
-      yuv420_to_rgb_i_avx2(input->data.get(), rgb32_frame.get(), input->vInfo->width, input->vInfo->height);
+      yuv420_to_rgb_i_avx2(input->data.get(), rgb32, input->vInfo->width, input->vInfo->height);
     }
     else if (getHWManager()->isSSE41Enabled() && input->vInfo->width % 16 == 0)
     {
-      yuv420_to_rgb_i_sse41(input->data.get(), rgb32_frame.get(), input->vInfo->width, input->vInfo->height);
+      yuv420_to_rgb_i_sse41(input->data.get(), rgb32, input->vInfo->width, input->vInfo->height);
     }
     else
     {
-      yuv420_to_rgb_i_c(input->data.get(), rgb32_frame.get(), input->vInfo->width, input->vInfo->height);
+      yuv420_to_rgb_i_c(input->data.get(), rgb32, input->vInfo->width, input->vInfo->height);
     }
     input->type = DT_RGB32VIDEO;
     input->data = std::move(rgb32_frame);
@@ -3,6 +3,7 @@
 #include "global.h"
 #include "processing/yuvconversions.h"
 
+#include "statisticsinterface.h"
 #include "settingskeys.h"
 #include "logger.h"
 #include "common.h"
@@ -12,8 +13,10 @@
 
 const int DEFAULT_OPUS_BITRATE_BITS = 24000; // 24 kbps
 
+const int BUFFER_POOL_REPORT_INTERVAL_MS = 1000;
 
-ResourceAllocator::ResourceAllocator():
+
+ResourceAllocator::ResourceAllocator(StatisticsInterface *stats):
   avx2_(is_avx2_available()),
   sse41_(is_sse41_available()),
   manualROI_(false),
@@ -30,9 +33,25 @@ ResourceAllocator::ResourceAllocator():
   bitrateMode_(SINGLE_UPLINK_BITRATE),
   isSpeaker_(false),
   uploadBandwidth_(0),
-  hybridPrioritization_(100)
+  hybridPrioritization_(100),
+  stats_(stats),
+  bufferPool_(std::make_shared<BufferPool>()),
+  poolReportTimer_(this)
 {
   updateSettings();
+
+  if (stats_ != nullptr)
+  {
+    connect(&poolReportTimer_, &QTimer::timeout, this, &ResourceAllocator::reportBufferPool);
+    poolReportTimer_.start(BUFFER_POOL_REPORT_INTERVAL_MS);
+  }
+}
+
+
+void ResourceAllocator::reportBufferPool()
+{
+  stats_->bufferPoolStatus(bufferPool_->getHits(), bufferPool_->getMisses(),
+                           bufferPool_->getIdleBytes(), DataBuffer::getCopies());
 }
 
 
@@ -432,3 +451,4 @@ int ResourceAllocator::getStreamBandwidthUsage(DataType type)
 
   return std::max(0, streamTotalBandwidthBps);
 }
+
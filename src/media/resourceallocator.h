@@ -1,8 +1,10 @@
 #pragma once
 
 #include "processing/filter.h"
+#include "processing/bufferpool.h"
 
 #include <QObject>
+#include <QTimer>
 #include <qsize.h>
 
 /* The purpose of this class is the enable filters to easily query the
@@ -29,7 +31,7 @@ class ResourceAllocator : public QObject
 {
   Q_OBJECT
 public:
-  ResourceAllocator();
+  ResourceAllocator(StatisticsInterface* stats = nullptr);
 
   // determines how we limit the maximum bitrate
   void setArchitectureBitrate(ArchitectureBitrate bitrate);
@@ -62,9 +64,19 @@ public:
   uint8_t getRoiQp() const;
   uint8_t getBackgroundQp() const;
 
+  // payload buffers for packets and frames are recycled through this pool
+  std::shared_ptr<BufferPool> getBufferPool() const
+  {
+    return bufferPool_;
+  }
+
 signals:
   void participantsChanged(int otherParticipants);
 
+private slots:
+
+  void reportBufferPool();
+
 private:
 
   void updateGlobalBitrate(int& bitrate,
@@ -111,4 +123,9 @@ private:
 
   uint32_t framerateNumerator_ = 30;
   uint32_t framerateDenominator_ = 1;
+
+  StatisticsInterface* stats_;
+
+  std::shared_ptr<BufferPool> bufferPool_;
+  QTimer poolReportTimer_;
 };
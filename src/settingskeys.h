@@ -69,6 +69,8 @@ const QString videoMVConstraint = "video/mvConstraint";
 const QString videoQPInCU = "video/qpInCU";
 const QString videoVAQ = "video/vaq";
 const QString videoPreset = "video/Preset";
+const QString videoPSNRInterval = "video/psnrInterval";
+const QString videoPSNRAsync = "video/psnrAsync";
 const QString videoCustomParameters = "parameters";
 
 
@@ -140,6 +142,25 @@ const QString sipVisibleParticipants = "sip/visibleParticipants";
 const QString sipTimestampInterval = "sip/timestampInterval";
 const QString sipHybridPriorization = "sip/hybridPriorization";
 
+// run input driven filters on a shared pool of worker threads
+const QString mediaTaskScheduler = "media/taskScheduler";
+
+// process linear filter chains on the thread of the first filter
+const QString mediaFusedSegments = "media/fusedSegments";
+
+// number of threads receiving media in the UDP relay
+const QString mediaRelayWorkers = "media/relayWorkers";
+
+// the SFU mixes the audio of the loudest speakers for each participant
+// instead of forwarding every audio stream
+const QString sfuAudioMixing = "media/sfuAudioMixing";
+const QString sfuMixedSpeakers = "media/sfuMixedSpeakers";
+
+// without mixing, forward only the audio of this many loudest speakers, 0 forwards all.
+// Ranking the speakers costs the SFU one Opus decode per publisher at 8 kHz,
+// without the jitter buffer, FEC and concealment of a decoder for playback.
+const QString sfuForwardedSpeakers = "media/sfuForwardedSpeakers";
+
 const QString sipSIPProtocol = "sip/SIPProtocol";
 const QString sipSIPPort = "sip/SIPPort";
 
@@ -156,4 +177,7 @@ const QString roiKernelType = "roi/KernelType";
 const QString roiMaxThreads = "roi/Threads";
 const QString roiEnabled = "roi/Enabled";
 const QString roiMode = "roi/Mode";
+
+// share of one CPU core the detection may use, in percent
+const QString roiCpuBudget = "roi/CpuBudget";
 }
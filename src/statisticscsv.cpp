@@ -239,6 +239,8 @@ void StatisticsCSV::videoInfo(uint32_t, uint32_t, double, QSize) {}
 void StatisticsCSV::selectedICEPair(uint32_t, std::shared_ptr<ICEPair>) {}
 void StatisticsCSV::addSendPacket(uint32_t) {}
 void StatisticsCSV::addReceivePacket(uint32_t, const QString&, QString, uint32_t) {}
+void StatisticsCSV::addRelayReceive(uint32_t, uint32_t) {}
+
 void StatisticsCSV::addRTCPPacket(uint32_t, const QString&, QString, uint8_t, int32_t, uint32_t, uint32_t) {}
 
 void StatisticsCSV::encodedAudioFrame(uint32_t size, uint32_t encodingTime)
@@ -323,6 +325,8 @@ void StatisticsCSV::packetDropped(uint32_t id)
 
 }
 
+void StatisticsCSV::bufferPoolStatus(uint64_t, uint64_t, uint64_t, uint64_t) {}
+
 // SIP
 // Tracking of sent and received SIP Messages
 void StatisticsCSV::addSentSIPMessage(const QString& headerType, const QString& header,
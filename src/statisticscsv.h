@@ -49,6 +49,7 @@ public:
   // ignored
   virtual void addSendPacket(uint32_t size) override;
   virtual void addReceivePacket(uint32_t sessionID, const QString& cname, QString type, uint32_t size) override;
+  virtual void addRelayReceive(uint32_t packets, uint32_t syscalls) override;
 
 
   // FILTER
@@ -63,6 +64,10 @@ public:
   // Tracking of packets dropped due to buffer overflow
   virtual void packetDropped(uint32_t id) override;
 
+  // ignored
+  virtual void bufferPoolStatus(uint64_t hits, uint64_t misses, uint64_t idleBytes,
+                                uint64_t copies) override;
+
   // SIP
   // Tracking of sent and received SIP Messages
   virtual void addSentSIPMessage(const QString& headerType, const QString& header,
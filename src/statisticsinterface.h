@@ -57,6 +57,10 @@ public:
   // tracking of received packets.
   virtual void addReceivePacket(uint32_t sessionID, const QString& cname, QString type, uint32_t size) = 0;
 
+  // Packets read from the relay sockets and the system calls used to read them.
+  // Reported periodically as the amounts since the previous report.
+  virtual void addRelayReceive(uint32_t packets, uint32_t syscalls) = 0;
+
   // Details of an individual packet that shows how well our data is getting delivered
   virtual void addRTCPPacket(uint32_t sessionID, const QString& cname, QString type,
                              uint8_t  fraction,
@@ -77,6 +81,11 @@ public:
   // Tracking of packets dropped due to buffer overflow
   virtual void packetDropped(uint32_t id) = 0;
 
+  // Reuse of payload buffers. A miss means a new buffer had to be allocated.
+  // Copies is the number of shared payloads that had to be copied before modifying.
+  virtual void bufferPoolStatus(uint64_t hits, uint64_t misses, uint64_t idleBytes,
+                                uint64_t copies) = 0;
+
 
   // SIP
   // Tracking of sent and received SIP Messages
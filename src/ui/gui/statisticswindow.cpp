@@ -48,7 +48,13 @@ StatisticsInterface(),
   transferredData_(0),
   receivePacketCount_(0),
   receivedData_(0),
+  relayPackets_(0),
+  relaySyscalls_(0),
   packetsDropped_(0),
+  poolHits_(0),
+  poolMisses_(0),
+  poolIdleBytes_(0),
+  poolCopies_(0),
   videoEncDelayIndex_(0),
   videoEncDelay_(BUFFERSIZE,nullptr),
   audioEncDelayIndex_(0),
@@ -692,6 +698,14 @@ void StatisticsWindow::
   }
 }
 
+void StatisticsWindow::addRelayReceive(uint32_t packets, uint32_t syscalls)
+{
+  deliveryMutex_.lock();
+  relayPackets_ += packets;
+  relaySyscalls_ += syscalls;
+  deliveryMutex_.unlock();
+}
+
 void StatisticsWindow::addRTCPPacket(uint32_t sessionID,
                                      const QString& cname,
                                      QString type,
@@ -764,6 +778,23 @@ void StatisticsWindow::packetDropped(uint32_t id)
 }
 
 
+void StatisticsWindow::bufferPoolStatus(uint64_t hits, uint64_t misses, uint64_t idleBytes,
+                                        uint64_t copies)
+{
+  filterMutex_.lock();
+  if (poolHits_ != hits || poolMisses_ != misses || poolIdleBytes_ != idleBytes ||
+      poolCopies_ != copies)
+  {
+    poolHits_ = hits;
+    poolMisses_ = misses;
+    poolIdleBytes_ = idleBytes;
+    poolCopies_ = copies;
+    dirtyBuffers_ = true;
+  }
+  filterMutex_.unlock();
+}
+
+
 void StatisticsWindow::paintEvent(QPaintEvent *event)
 {
   Q_UNUSED(event);
@@ -840,6 +871,13 @@ void StatisticsWindow::paintEvent(QPaintEvent *event)
       ui_->packets_received_value->setText( QString::number(receivePacketCount_));
       ui_->data_received_value->setText( QString::number(receivedData_));
 
+      if (relaySyscalls_ > 0)
+      {
+        ui_->relay_receive_value->setText(QString::number(relayPackets_) + " packets, " +
+                                          QString::number((double)relayPackets_/relaySyscalls_, 'f', 2) +
+                                          " per system call");
+      }
+
       // jitter and lost charts
       for(auto& d : sessions_)
       {
@@ -968,10 +1006,20 @@ void StatisticsWindow::paintEvent(QPaintEvent *event)
           ui_->filterTable->item(it.second.tableIndex, 3)->setTextAlignment(Qt::AlignHCenter);
           ui_->filterTable->item(it.second.tableIndex, 4)->setTextAlignment(Qt::AlignHCenter);
         }
+
+        uint64_t poolRequests = poolHits_ + poolMisses_;
+        QString poolStatus = QString::number(poolHits_) + "/" + QString::number(poolRequests);
+        if (poolRequests > 0)
+        {
+          poolStatus += " (" + QString::number(100*poolHits_/poolRequests) + " %), " +
+              QString::number(poolIdleBytes_/1024) + " kB idle";
+        }
+        poolStatus += ", " + QString::number(poolCopies_) + " copied";
         filterMutex_.unlock();
 
         ui_->value_buffers->setText(QString::number(totalBuffers));
         ui_->value_dropped->setText(QString::number(packetsDropped_));
+        ui_->value_pool->setText(poolStatus);
         dirtyBuffers_ = false;
 
       }
@@ -67,6 +67,7 @@ public:
   // delivery
   virtual void addSendPacket(uint32_t size);
   virtual void addReceivePacket(uint32_t sessionID, const QString &cname, QString type, uint32_t size);
+  virtual void addRelayReceive(uint32_t packets, uint32_t syscalls);
   virtual void addRTCPPacket(uint32_t sessionID,
                              const QString& cname,
                              QString type,
@@ -81,6 +82,8 @@ public:
   virtual void updateBufferStatus(uint32_t id, uint16_t buffersize,
                                   uint16_t maxBufferSize);
   virtual void packetDropped(uint32_t id);
+  virtual void bufferPoolStatus(uint64_t hits, uint64_t misses, uint64_t idleBytes,
+                                uint64_t copies);
 
   // sip
   virtual void addSentSIPMessage(const QString& headerType, const QString& header,
@@ -232,8 +235,18 @@ private:
   uint64_t receivePacketCount_;
   uint64_t receivedData_;
 
+  // packets and system calls of relay sockets
+  uint64_t relayPackets_;
+  uint64_t relaySyscalls_;
+
   uint64_t packetsDropped_;
 
+  // payload buffer pool
+  uint64_t poolHits_;
+  uint64_t poolMisses_;
+  uint64_t poolIdleBytes_;
+  uint64_t poolCopies_;
+
   // encoder latencies
   uint32_t videoEncDelayIndex_;
   std::vector<ValueInfo*> videoEncDelay_;
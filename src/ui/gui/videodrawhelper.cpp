@@ -41,7 +41,8 @@ VideoDrawHelper::VideoDrawHelper(uint32_t sessionID, LayoutID layoutID, uint8_t
   fullscreen_(false),
   discardedFrames_(0),
   showLatency_(false),
-  lastLatency_(0)
+  lastLatency_(0),
+  viewSize_(0)
 {
   micIcon_.setAspectRatioMode(Qt::KeepAspectRatio);
 }
@@ -73,6 +74,14 @@ void VideoDrawHelper::initWidget(QWidget* widget)
 }
 
 
+void VideoDrawHelper::updateViewSize(QWidget* widget)
+{
+  QSize size = widget->size()*widget->devicePixelRatio();
+  viewSize_.store(((uint32_t)qBound(0, size.width(), 0xffff) << 16) |
+                  (uint32_t)qBound(0, size.height(), 0xffff), std::memory_order_relaxed);
+}
+
+
 void VideoDrawHelper::setDrawMicOff(bool state)
 {
   drawIcon_ = state;
@@ -138,7 +147,7 @@ bool VideoDrawHelper::readyToDraw()
 }
 
 
-void VideoDrawHelper::inputImage(QWidget* widget, std::unique_ptr<uchar[]> data, QImage &image,
+void VideoDrawHelper::inputImage(QWidget* widget, DataBuffer data, QImage &image,
                                  double framerate, int64_t creationTimestamp, int64_t displayTimestamp)
 {
   // Respect the widget visibility by default to avoid unnecessary drawing.
@@ -14,6 +14,7 @@
 #include <QMutex>
 #include <QSvgRenderer>
 
+#include <atomic>
 #include <deque>
 #include <memory>
 
@@ -48,7 +49,7 @@ public:
 
   bool readyToDraw();
   void inputImage(QWidget* widget,
-                  std::unique_ptr<uchar[]> data,
+                  DataBuffer data,
                   QImage& image,
                   double framerate,
                   int64_t creationTimestamp,
@@ -71,6 +72,16 @@ public:
   // update the rect in case the window or input has changed.
   void updateTargetRect(QWidget* widget);
 
+  // records the size of the widget in device pixels, called when it is resized
+  void updateViewSize(QWidget* widget);
+
+  // can be called from any thread, empty until the widget has been resized
+  QSize getViewSize() const
+  {
+    uint32_t size = viewSize_.load(std::memory_order_relaxed);
+    return QSize(size >> 16, size & 0xffff);
+  }
+
   QRect getTargetRect()
   {
     return imageRect_;
@@ -129,7 +140,7 @@ private:
   struct Frame
   {
     QImage image;
-    std::unique_ptr<uchar[]> data;
+    DataBuffer data;
     int64_t creationTimestamp;
     int64_t displayTimestamp;
   };
@@ -171,6 +182,9 @@ private:
 
   double framerate_ = 30;
 
+  // width in the upper and height in the lower 16 bits
+  std::atomic<uint32_t> viewSize_;
+
   bool showLatency_ = false;
 
   int64_t lastLatency_ = 0;
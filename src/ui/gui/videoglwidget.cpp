@@ -101,6 +101,7 @@ void VideoGLWidget::resizeEvent(QResizeEvent *event)
 {
   QOpenGLWidget::resizeEvent(event); // its important to call this resize function, not the qwidget one.
   helper_.updateTargetRect(this);
+  helper_.updateViewSize(this);
 }
 
 void VideoGLWidget::keyPressEvent(QKeyEvent *event)
@@ -53,6 +53,11 @@ public:
     return QWidget::isVisible();
   }
 
+  virtual QSize viewSize()
+  {
+    return helper_.getViewSize();
+  }
+
   static unsigned int number_;
 
 signals:
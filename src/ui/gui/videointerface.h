@@ -1,6 +1,7 @@
 #pragma once
 
 #include "global.h"
+#include "media/processing/databuffer.h"
 
 #include <QImage>
 
@@ -28,8 +29,8 @@ public:
   // set stats to use with this video view.
   virtual void setStats(StatisticsInterface* stats, QString cname) = 0;
 
-  // Takes ownership of the image data
-  virtual void inputImage(std::unique_ptr<uchar[]> data, QImage &image,
+  // Keeps a reference to the image data until the frame has been drawn
+  virtual void inputImage(DataBuffer data, QImage &image,
                           double framerate, int64_t creationTimestamp, int64_t displayTimestamp) = 0;
 
   virtual void inputDetections(std::vector<Detection> detections, QSize original_size, int64_t timestamp) = 0;
@@ -42,6 +43,10 @@ public:
 
   virtual VideoFormat supportedFormat() = 0;
 
+  // size of the view in pixels so the video does not have to be processed at
+  // a higher resolution than shown. Can be called from any thread.
+  virtual QSize viewSize() = 0;
+
 signals:
   virtual void reattach(LayoutID layoutID) = 0;
   virtual void detach(LayoutID layoutID) = 0;
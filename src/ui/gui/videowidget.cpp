@@ -98,7 +98,7 @@ void VideoWidget::visualizeROIMap(RoiMap& map, int qp)
   helper_.visualizeROIMap(map, qp);
 }
 
-void VideoWidget::inputImage(std::unique_ptr<uchar[]> data,
+void VideoWidget::inputImage(DataBuffer data,
                              QImage &image,
                              double framerate,
                              int64_t creationTimestamp,
@@ -178,6 +178,7 @@ void VideoWidget::resizeEvent(QResizeEvent *event)
 {
   QWidget::resizeEvent(event);
   helper_.updateTargetRect(this);
+  helper_.updateViewSize(this);
 }
 
 
@@ -28,7 +28,7 @@ public:
   virtual void setStats(StatisticsInterface* stats, QString cname);
 
   // Takes ownership of the image data
-  virtual void inputImage(std::unique_ptr<uchar[]> data, QImage &image, double framerate, int64_t creationTimestamp, int64_t displayTimestamp);
+  virtual void inputImage(DataBuffer data, QImage &image, double framerate, int64_t creationTimestamp, int64_t displayTimestamp);
 
   virtual void inputDetections(std::vector<Detection> detections, QSize original_size, int64_t timestamp);
 
@@ -48,6 +48,11 @@ public:
     return QWidget::isVisible();
   }
 
+  virtual QSize viewSize()
+  {
+    return helper_.getViewSize();
+  }
+
   void enableOverlay(int roiQP, int backgroundQP, int brushSize,
                      bool showGrid, bool pixelBased, QSize videoResolution);
   void disableOverlay();
@@ -334,6 +334,7 @@ void VideoYUVWidget::resizeGL(int width, int height)
 void VideoYUVWidget::resizeEvent(QResizeEvent *event)
 {
   QOpenGLWidget::resizeEvent(event); // its important to call this resize function, not the qwidget one.
+  helper_.updateViewSize(this);
 }
 
 
@@ -57,6 +57,11 @@ public:
     return QWidget::isVisible();
   }
 
+  virtual QSize viewSize()
+  {
+    return helper_.getViewSize();
+  }
+
 signals:
   // for reattaching after fullscreenmode
   void reattach(uint32_t sessionID_);
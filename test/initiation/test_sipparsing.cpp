@@ -0,0 +1,215 @@
+#include "../src/initiation/transport/siptransporthelper.h"
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <iostream>
+
+
+static const QString INVITE_LINE = "INVITE sip:bob@biloxi.example.com SIP/2.0";
+
+
+TEST(SIPParsingTest, foldedHeaders) {
+    QString header = INVITE_LINE + "\r\n"
+                     "Subject: I know you're\r\n"
+                     "  there,\r\n"
+                     "\tpick up\r\n"
+                     "Via: SIP/2.0/UDP pc33.atlanta.example.com\r\n"
+                     "\t;branch=z9hG4bK776asdhds\r\n";
+
+    QString firstLine;
+    QList<SIPField> fields;
+
+    ASSERT_TRUE(headerToFields(header, firstLine, fields));
+    EXPECT_EQ(firstLine, INVITE_LINE);
+    ASSERT_EQ(fields.size(), 2);
+
+    // the folding is one space, so the words are separated normally
+    EXPECT_EQ(fields[0].name, "Subject");
+    ASSERT_EQ(fields[0].commaSeparated.size(), 2);
+    EXPECT_EQ(fields[0].commaSeparated[0].words, QStringList({"I", "know", "you're", "there"}));
+    EXPECT_EQ(fields[0].commaSeparated[1].words, QStringList({"pick", "up"}));
+
+    EXPECT_EQ(fields[1].name, "Via");
+    ASSERT_EQ(fields[1].commaSeparated.size(), 1);
+    EXPECT_EQ(fields[1].commaSeparated[0].words,
+              QStringList({"SIP/2.0/UDP", "pc33.atlanta.example.com"}));
+    ASSERT_EQ(fields[1].commaSeparated[0].parameters.size(), 1);
+    EXPECT_EQ(fields[1].commaSeparated[0].parameters[0].name, "branch");
+    EXPECT_EQ(fields[1].commaSeparated[0].parameters[0].value, "z9hG4bK776asdhds");
+}
+
+
+TEST(SIPParsingTest, compactForms) {
+    QString header = INVITE_LINE + "\r\n"
+                     "v: SIP/2.0/UDP pc33.atlanta.example.com;branch=z9hG4bK776asdhds\r\n"
+                     "f: Alice <sip:alice@atlanta.example.com>;tag=1928301774\r\n"
+                     "t: Bob <sip:bob@biloxi.example.com>\r\n"
+                     "i: a84b4c76e66710@pc33.atlanta.example.com\r\n"
+                     "l: 0\r\n";
+
+    QString firstLine;
+    QList<SIPField> fields;
+
+    ASSERT_TRUE(headerToFields(header, firstLine, fields));
+    ASSERT_EQ(fields.size(), 5);
+
+    std::shared_ptr<SIPMessageHeader> message = std::make_shared<SIPMessageHeader>();
+    ASSERT_TRUE(fieldsToMessageHeader(fields, message));
+
+    ASSERT_EQ(message->vias.size(), 1);
+    EXPECT_EQ(message->vias[0].sentBy, "pc33.atlanta.example.com");
+    EXPECT_EQ(message->vias[0].branch, "z9hG4bK776asdhds");
+
+    EXPECT_EQ(message->from.address.realname, "Alice");
+    EXPECT_EQ(message->from.address.uri.userinfo.user, "alice");
+    EXPECT_EQ(message->from.tagParameter, "1928301774");
+
+    EXPECT_EQ(message->to.address.uri.hostport.host, "biloxi.example.com");
+    EXPECT_EQ(message->callID, "a84b4c76e66710@pc33.atlanta.example.com");
+    EXPECT_EQ(message->contentLength, 0u);
+}
+
+
+TEST(SIPParsingTest, emptyValues) {
+    QString header = INVITE_LINE + "\r\n"
+                     "Supported: \r\n"
+                     "Subject:\r\n"
+                     "Call-ID:a84b4c76e66710\r\n"
+                     "Allow :  \r\n";
+
+    QString firstLine;
+    QList<SIPField> fields;
+
+    ASSERT_TRUE(headerToFields(header, firstLine, fields));
+    ASSERT_EQ(fields.size(), 4);
+
+    EXPECT_EQ(fields[0].name, "Supported");
+    EXPECT_TRUE(fields[0].commaSeparated.empty());
+
+    EXPECT_EQ(fields[1].name, "Subject");
+    EXPECT_TRUE(fields[1].commaSeparated.empty());
+
+    // no whitespace is needed after the colon
+    EXPECT_EQ(fields[2].name, "Call-ID");
+    ASSERT_EQ(fields[2].commaSeparated.size(), 1);
+    EXPECT_EQ(fields[2].commaSeparated[0].words, QStringList({"a84b4c76e66710"}));
+
+    // nor is it forbidden before it
+    EXPECT_EQ(fields[3].name, "Allow");
+    EXPECT_TRUE(fields[3].commaSeparated.empty());
+
+    std::shared_ptr<SIPMessageHeader> message = std::make_shared<SIPMessageHeader>();
+    EXPECT_TRUE(fieldsToMessageHeader(fields, message));
+    EXPECT_EQ(message->callID, "a84b4c76e66710");
+}
+
+
+TEST(SIPParsingTest, invalidFieldName) {
+    QString firstLine;
+    QList<SIPField> fields;
+
+    QString noColon = INVITE_LINE + "\r\nCall-ID a84b4c76e66710\r\n";
+    EXPECT_FALSE(headerToFields(noColon, firstLine, fields));
+
+    QString noName = INVITE_LINE + "\r\n: a84b4c76e66710\r\n";
+    EXPECT_FALSE(headerToFields(noName, firstLine, fields));
+
+    QString twoWords = INVITE_LINE + "\r\nCall ID: a84b4c76e66710\r\n";
+    EXPECT_FALSE(headerToFields(twoWords, firstLine, fields));
+}
+
+
+TEST(SIPParsingTest, lineEndings) {
+    QString crlf = INVITE_LINE + "\r\n"
+                   "Call-ID: a84b4c76e66710\r\n"
+                   "Subject: lunch,\r\n"
+                   " tomorrow\r\n"
+                   "Max-Forwards: 70\r\n";
+
+    QString lf = crlf;
+    lf.replace("\r\n", "\n");
+
+    QString crlfFirstLine;
+    QList<SIPField> crlfFields;
+    ASSERT_TRUE(headerToFields(crlf, crlfFirstLine, crlfFields));
+
+    QString lfFirstLine;
+    QList<SIPField> lfFields;
+    ASSERT_TRUE(headerToFields(lf, lfFirstLine, lfFields));
+
+    EXPECT_EQ(crlfFirstLine, INVITE_LINE);
+    EXPECT_EQ(lfFirstLine, INVITE_LINE);
+
+    ASSERT_EQ(crlfFields.size(), 3);
+    ASSERT_EQ(lfFields.size(), crlfFields.size());
+
+    for (int i = 0; i < crlfFields.size(); ++i)
+    {
+        EXPECT_EQ(lfFields[i].name, crlfFields[i].name);
+        ASSERT_EQ(lfFields[i].commaSeparated.size(), crlfFields[i].commaSeparated.size());
+
+        for (int j = 0; j < crlfFields[i].commaSeparated.size(); ++j)
+        {
+            EXPECT_EQ(lfFields[i].commaSeparated[j].words, crlfFields[i].commaSeparated[j].words);
+        }
+    }
+
+    // a lone CR is not a line ending
+    QString cr = INVITE_LINE + "\r\nSubject: a\rb\r\n";
+    QString crFirstLine;
+    QList<SIPField> crFields;
+    ASSERT_TRUE(headerToFields(cr, crFirstLine, crFields));
+    ASSERT_EQ(crFields.size(), 1);
+    EXPECT_EQ(crFields[0].commaSeparated[0].words, QStringList({"a\rb"}));
+}
+
+
+// Not a pass/fail test, prints the parsing speed of typical messages
+TEST(SIPParsingTest, benchmark) {
+    const int MESSAGES = 1000;
+
+    std::vector<QString> headers;
+    for (int i = 0; i < MESSAGES; ++i)
+    {
+        QString number = QString::number(i);
+        headers.push_back(INVITE_LINE + "\r\n"
+                          "Via: SIP/2.0/UDP pc33.atlanta.example.com:5060;branch=z9hG4bK" + number + ";rport\r\n"
+                          "Max-Forwards: 70\r\n"
+                          "To: Bob <sip:bob@biloxi.example.com>\r\n"
+                          "From: Alice <sip:alice@atlanta.example.com>;tag=" + number + "\r\n"
+                          "Call-ID: " + number + "a84b4c76e66710@pc33.atlanta.example.com\r\n"
+                          "CSeq: " + number + " INVITE\r\n"
+                          "Contact: <sip:alice@pc33.atlanta.example.com;transport=udp>\r\n"
+                          "Allow: INVITE, ACK, CANCEL, BYE, OPTIONS\r\n"
+                          "Supported: path,\r\n"
+                          " outbound\r\n"
+                          "User-Agent: uvgComm\r\n"
+                          "Content-Type: application/sdp\r\n"
+                          "Content-Length: 142\r\n");
+    }
+
+    auto start = std::chrono::steady_clock::now();
+
+    int parsed = 0;
+    for (QString& header : headers)
+    {
+        QString firstLine;
+        QList<SIPField> fields;
+        std::shared_ptr<SIPMessageHeader> message = std::make_shared<SIPMessageHeader>();
+
+        if (headerToFields(header, firstLine, fields) && fieldsToMessageHeader(fields, message))
+        {
+            ++parsed;
+        }
+    }
+
+    auto elapsedUs = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count();
+
+    EXPECT_EQ(parsed, MESSAGES);
+
+    std::cout << "Parsed " << MESSAGES << " SIP headers in " << elapsedUs << " us, "
+              << double(elapsedUs)/MESSAGES << " us per header" << std::endl;
+    RecordProperty("MicrosecondsPerHeader", QString::number(double(elapsedUs)/MESSAGES).toStdString());
+}
@@ -0,0 +1,269 @@
+#include "../src/initiation/transaction/sipretransmissions.h"
+
+#include "../src/common.h"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+
+// The test moves the clock in steps instead of waiting for the timer. The
+// transactions are started at the real time, so they may start a few
+// milliseconds after the test thinks.
+class TestRetransmissions : public SIPRetransmissions
+{
+public:
+    TestRetransmissions():
+        start(clockNowMs()),
+        now(start),
+        requests(),
+        responses(),
+        incoming(0)
+    {
+        QObject::connect(this, &SIPMessageProcessor::outgoingRequest,
+                         [this](SIPRequest&, QVariant&)
+        {
+            requests.push_back(now - start);
+        });
+
+        QObject::connect(this, &SIPMessageProcessor::outgoingResponse,
+                         [this](SIPResponse&, QVariant&)
+        {
+            responses.push_back(now - start);
+        });
+
+        QObject::connect(this, &SIPMessageProcessor::incomingRequest,
+                         [this](SIPRequest&, QVariant&, SIPResponseStatus)
+        {
+            ++incoming;
+        });
+    }
+
+    // moves the clock to ms after the start in steps of 10 ms
+    void advance(int64_t ms)
+    {
+        while (now - start < ms)
+        {
+            now += 10;
+            processDeadlines(now);
+        }
+    }
+
+    int64_t start;
+    int64_t now;
+
+    // times of the sent messages since the start
+    std::vector<int64_t> requests;
+    std::vector<int64_t> responses;
+
+    int incoming;
+};
+
+
+static SIPRequest makeRequest(SIPRequestMethod method, QString branch,
+                              QString sentBy = "alice.example.com")
+{
+    ViaField via;
+    via.sipVersion = SIP_VERSION;
+    via.protocol = UDP;
+    via.sentBy = sentBy;
+    via.port = 5060;
+    via.branch = branch;
+
+    SIPRequest request;
+    request.method = method;
+    request.sipVersion = SIP_VERSION;
+    request.message = std::shared_ptr<SIPMessageHeader> (new SIPMessageHeader);
+    request.message->vias.push_back(via);
+    request.message->callID = "call-" + branch;
+    request.message->cSeq = {1, method};
+    return request;
+}
+
+
+static SIPResponse makeResponse(const SIPRequest& request, SIPResponseStatus type)
+{
+    SIPResponse response;
+    response.sipVersion = SIP_VERSION;
+    response.type = type;
+    response.message = std::shared_ptr<SIPMessageHeader> (new SIPMessageHeader(*request.message));
+    return response;
+}
+
+
+static std::vector<int64_t> intervals(const std::vector<int64_t>& times)
+{
+    std::vector<int64_t> result;
+    for (size_t i = 1; i < times.size(); ++i)
+    {
+        result.push_back(times[i] - times[i - 1]);
+    }
+    return result;
+}
+
+
+TEST(SIPRetransmissionsTest, timerE) {
+    TestRetransmissions retransmissions;
+    QVariant content;
+
+    SIPRequest request = makeRequest(SIP_OPTIONS, "z9hG4bKoptions");
+    retransmissions.processOutgoingRequest(request, content);
+    ASSERT_EQ(retransmissions.requests.size(), 1u);
+
+    retransmissions.advance(490);
+    EXPECT_EQ(retransmissions.requests.size(), 1u);
+
+    // the interval doubles from T1 until it reaches T2
+    retransmissions.advance(31600);
+    ASSERT_GE(retransmissions.requests.size(), 2u);
+    EXPECT_NEAR(retransmissions.requests[1], 500, 50);
+    EXPECT_EQ(intervals(retransmissions.requests),
+              std::vector<int64_t>({retransmissions.requests[1], 1000, 2000, 4000,
+                                    4000, 4000, 4000, 4000, 4000, 4000}));
+
+    // timer F ends the transaction
+    EXPECT_TRUE(retransmissions.hasTransactions());
+    retransmissions.advance(32100);
+    EXPECT_FALSE(retransmissions.hasTransactions());
+    EXPECT_EQ(retransmissions.requests.size(), 11u);
+}
+
+
+TEST(SIPRetransmissionsTest, timerA) {
+    TestRetransmissions retransmissions;
+    QVariant content;
+
+    SIPRequest request = makeRequest(SIP_INVITE, "z9hG4bKinvite");
+    retransmissions.processOutgoingRequest(request, content);
+
+    // the interval of INVITE keeps doubling until timer B
+    retransmissions.advance(32100);
+    ASSERT_GE(retransmissions.requests.size(), 2u);
+    EXPECT_EQ(intervals(retransmissions.requests),
+              std::vector<int64_t>({retransmissions.requests[1], 1000, 2000, 4000,
+                                    8000, 16000}));
+    EXPECT_FALSE(retransmissions.hasTransactions());
+}
+
+
+TEST(SIPRetransmissionsTest, provisionalResponse) {
+    TestRetransmissions retransmissions;
+    QVariant content;
+
+    SIPRequest options = makeRequest(SIP_OPTIONS, "z9hG4bKoptions");
+    SIPRequest invite = makeRequest(SIP_INVITE, "z9hG4bKinvite");
+    retransmissions.processOutgoingRequest(options, content);
+    retransmissions.processOutgoingRequest(invite, content);
+
+    // timer E continues at T2 and timer A stops
+    SIPResponse trying = makeResponse(options, SIP_TRYING);
+    SIPResponse ringing = makeResponse(invite, SIP_RINGING);
+    retransmissions.processIncomingResponse(trying, content, false);
+    retransmissions.processIncomingResponse(ringing, content, false);
+
+    retransmissions.advance(8500);
+    ASSERT_EQ(retransmissions.requests.size(), 4u);
+    EXPECT_NEAR(retransmissions.requests[2], 4000, 50);
+    EXPECT_EQ(retransmissions.requests[3] - retransmissions.requests[2], 4000);
+
+    // a final response ends the retransmissions, the INVITE keeps ringing
+    SIPResponse ok = makeResponse(options, SIP_OK);
+    retransmissions.processIncomingResponse(ok, content, false);
+    retransmissions.advance(20000);
+    EXPECT_EQ(retransmissions.requests.size(), 4u);
+    EXPECT_TRUE(retransmissions.hasTransactions());
+}
+
+
+TEST(SIPRetransmissionsTest, timerG) {
+    TestRetransmissions retransmissions;
+    QVariant content;
+
+    SIPRequest invite = makeRequest(SIP_INVITE, "z9hG4bKinvite");
+    retransmissions.processIncomingRequest(invite, content, SIP_UNKNOWN_RESPONSE);
+    EXPECT_EQ(retransmissions.incoming, 1);
+
+    SIPResponse ok = makeResponse(invite, SIP_OK);
+    retransmissions.processOutgoingResponse(ok, content);
+
+    // the interval doubles from T1 until it reaches T2
+    retransmissions.advance(12000);
+    ASSERT_GE(retransmissions.responses.size(), 2u);
+    EXPECT_NEAR(retransmissions.responses[1], 500, 50);
+    EXPECT_EQ(intervals(retransmissions.responses),
+              std::vector<int64_t>({retransmissions.responses[1], 1000, 2000, 4000, 4000}));
+
+    // a repeated INVITE is absorbed and answered with our response
+    retransmissions.processIncomingRequest(invite, content, SIP_UNKNOWN_RESPONSE);
+    EXPECT_EQ(retransmissions.incoming, 1);
+    EXPECT_EQ(retransmissions.responses.size(), 7u);
+
+    // the ACK stops the retransmissions and its repetitions are absorbed
+    SIPRequest ack = makeRequest(SIP_ACK, "z9hG4bKack");
+    ack.message->callID = invite.message->callID;
+    retransmissions.processIncomingRequest(ack, content, SIP_UNKNOWN_RESPONSE);
+    retransmissions.processIncomingRequest(ack, content, SIP_UNKNOWN_RESPONSE);
+    EXPECT_EQ(retransmissions.incoming, 2);
+
+    retransmissions.advance(20000);
+    EXPECT_EQ(retransmissions.responses.size(), 7u);
+    EXPECT_FALSE(retransmissions.hasTransactions());
+}
+
+
+TEST(SIPRetransmissionsTest, timerH) {
+    TestRetransmissions retransmissions;
+    QVariant content;
+
+    SIPRequest invite = makeRequest(SIP_INVITE, "z9hG4bKinvite");
+    retransmissions.processIncomingRequest(invite, content, SIP_UNKNOWN_RESPONSE);
+
+    SIPResponse ok = makeResponse(invite, SIP_OK);
+    retransmissions.processOutgoingResponse(ok, content);
+
+    // without an ACK the response is repeated until the transaction times out
+    retransmissions.advance(32100);
+    EXPECT_EQ(retransmissions.responses.size(), 11u);
+    EXPECT_FALSE(retransmissions.hasTransactions());
+}
+
+
+TEST(SIPRetransmissionsTest, peerLimit) {
+    const int LIMIT = 256;
+
+    TestRetransmissions retransmissions;
+    QVariant content;
+
+    // one more transaction than is tracked for the flooding peer
+    for (int i = 0; i <= LIMIT; ++i)
+    {
+        SIPRequest invite = makeRequest(SIP_INVITE, "z9hG4bK" + QString::number(i),
+                                        "flood.example.com");
+        retransmissions.processIncomingRequest(invite, content, SIP_UNKNOWN_RESPONSE);
+
+        SIPResponse ok = makeResponse(invite, SIP_OK);
+        retransmissions.processOutgoingResponse(ok, content);
+    }
+
+    // other peers are not affected
+    SIPRequest invite = makeRequest(SIP_INVITE, "z9hG4bKother", "bob.example.com");
+    retransmissions.processIncomingRequest(invite, content, SIP_UNKNOWN_RESPONSE);
+
+    SIPResponse ok = makeResponse(invite, SIP_OK);
+    retransmissions.processOutgoingResponse(ok, content);
+
+    // all messages are passed on, tracked or not
+    EXPECT_EQ(retransmissions.incoming, LIMIT + 2);
+    ASSERT_EQ(retransmissions.responses.size(), size_t(LIMIT + 2));
+
+    retransmissions.advance(600);
+    EXPECT_EQ(retransmissions.responses.size(), size_t(2*LIMIT + 3));
+
+    // the ended transactions make room for new ones
+    retransmissions.advance(32100);
+    EXPECT_FALSE(retransmissions.hasTransactions());
+
+    SIPRequest later = makeRequest(SIP_INVITE, "z9hG4bKlater", "flood.example.com");
+    retransmissions.processIncomingRequest(later, content, SIP_UNKNOWN_RESPONSE);
+    EXPECT_TRUE(retransmissions.hasTransactions());
+}
@@ -0,0 +1,230 @@
+#include "../src/media/processing/audiomixer.h"
+#include "../src/media/processing/bufferpool.h"
+#include "../src/media/processing/speakerselector.h"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+
+
+static const uint32_t FRAME_SAMPLES = 960;
+
+
+static std::unique_ptr<Data> makeFrame(int16_t value, uint32_t samples = FRAME_SAMPLES)
+{
+    std::unique_ptr<Data> frame(new Data);
+    frame->type = DT_RAWAUDIO;
+    frame->source = DS_REMOTE;
+
+    std::unique_ptr<uchar[]> pcm(new uchar[samples*sizeof(int16_t)]);
+    int16_t* samplePtr = (int16_t*)pcm.get();
+    for (uint32_t i = 0; i < samples; ++i)
+    {
+        samplePtr[i] = value;
+    }
+
+    frame->data = DataBuffer(std::move(pcm));
+    frame->data_size = samples*sizeof(int16_t);
+    return frame;
+}
+
+
+static std::unique_ptr<Data> makeOutput()
+{
+    std::unique_ptr<Data> output(new Data);
+    output->type = DT_RAWAUDIO;
+    output->source = DS_LOCAL;
+    return output;
+}
+
+
+// mixes one frame of constant value from each source
+static std::unique_ptr<Data> mixFrames(AudioMixer& mixer, std::vector<int16_t> values,
+                                       uint32_t samples = FRAME_SAMPLES)
+{
+    std::unique_ptr<Data> mixed = nullptr;
+    for (size_t i = 0; i < values.size(); ++i)
+    {
+        mixed = mixer.mixAudio(makeFrame(values[i], samples), makeOutput(), (uint32_t)i + 1);
+
+        if (i + 1 < values.size())
+        {
+            EXPECT_FALSE(mixed);
+        }
+    }
+
+    return mixed;
+}
+
+
+static const int16_t* pcm(const std::unique_ptr<Data>& frame)
+{
+    return (const int16_t*)frame->data.get();
+}
+
+
+TEST(AudioMixerTest, singleInputPassesThrough) {
+    AudioMixer mixer(std::make_shared<BufferPool>());
+    mixer.addInput();
+
+    std::unique_ptr<Data> frame = makeFrame(1234);
+    const uchar* payload = frame->data.get();
+
+    std::unique_ptr<Data> mixed = mixer.mixAudio(std::move(frame), makeOutput(), 1);
+    ASSERT_TRUE(mixed);
+    EXPECT_EQ(mixed->data.get(), payload);
+}
+
+
+TEST(AudioMixerTest, quietSumIsExact) {
+    AudioMixer mixer(std::make_shared<BufferPool>());
+    mixer.addInput();
+    mixer.addInput();
+    mixer.addInput();
+
+    // the sum is well below the knee of the compressor, frame size is not a
+    // multiple of the vector width so the scalar tail is used too
+    std::unique_ptr<Data> mixed = mixFrames(mixer, {1000, -300, 250}, 101);
+    ASSERT_TRUE(mixed);
+
+    for (uint32_t i = 0; i < 101; ++i)
+    {
+        EXPECT_EQ(pcm(mixed)[i], 950);
+    }
+}
+
+
+TEST(AudioMixerTest, loudSumIsCompressed) {
+    AudioMixer mixer(std::make_shared<BufferPool>());
+    mixer.addInput();
+    mixer.addInput();
+
+    std::unique_ptr<Data> mixed = mixFrames(mixer, {30000, 30000});
+    ASSERT_TRUE(mixed);
+
+    // with the default -6 dB threshold and 5:1 ratio, the level above the
+    // threshold is divided by five instead of the sum being clipped
+    float inputDB = 20.0f*std::log10(60000.0f/INT16_MAX);
+    float expectedDB = -6.0f + (inputDB + 6.0f)/5.0f;
+
+    for (uint32_t i = 0; i < FRAME_SAMPLES; ++i)
+    {
+        ASSERT_GT(pcm(mixed)[i], 0);
+        EXPECT_NEAR(20.0f*std::log10(float(pcm(mixed)[i])/INT16_MAX), expectedDB, 0.05f);
+    }
+
+    // negative peaks are compressed the same way
+    mixed = mixFrames(mixer, {-30000, -30000});
+    ASSERT_TRUE(mixed);
+    EXPECT_NEAR(20.0f*std::log10(-float(pcm(mixed)[0])/INT16_MAX), expectedDB, 0.05f);
+}
+
+
+TEST(AudioMixerTest, gainRecoversSlowly) {
+    AudioMixer mixer(std::make_shared<BufferPool>());
+    mixer.addInput();
+    mixer.addInput();
+
+    ASSERT_TRUE(mixFrames(mixer, {30000, 30000}));
+
+    // the gain does not jump back up after a loud frame
+    std::unique_ptr<Data> mixed = mixFrames(mixer, {1000, 1000});
+    ASSERT_TRUE(mixed);
+    EXPECT_LT(pcm(mixed)[0], 2000);
+
+    int16_t previous = pcm(mixed)[0];
+    for (uint32_t i = 1; i < FRAME_SAMPLES; ++i)
+    {
+        EXPECT_GE(pcm(mixed)[i], previous);
+        previous = pcm(mixed)[i];
+    }
+
+    for (int frame = 0; frame < 50 && previous != 2000; ++frame)
+    {
+        mixed = mixFrames(mixer, {1000, 1000});
+        ASSERT_TRUE(mixed);
+        EXPECT_GE(pcm(mixed)[0], previous);
+        previous = pcm(mixed)[FRAME_SAMPLES - 1];
+    }
+    EXPECT_EQ(previous, 2000);
+}
+
+
+TEST(AudioMixerTest, neverClips) {
+    AudioMixer mixer(std::make_shared<BufferPool>());
+    for (int i = 0; i < 8; ++i)
+    {
+        mixer.addInput();
+    }
+
+    std::unique_ptr<Data> mixed = mixFrames(mixer, {INT16_MAX, INT16_MAX, INT16_MAX, INT16_MAX,
+                                                    INT16_MAX, INT16_MAX, INT16_MAX, INT16_MAX});
+    ASSERT_TRUE(mixed);
+
+    for (uint32_t i = 0; i < FRAME_SAMPLES; ++i)
+    {
+        EXPECT_GT(pcm(mixed)[i], 0);
+        EXPECT_LT(pcm(mixed)[i], INT16_MAX);
+    }
+}
+
+
+TEST(AudioMixerTest, shorterSourceMixesToBeginning) {
+    AudioMixer mixer(std::make_shared<BufferPool>());
+    mixer.addInput();
+    mixer.addInput();
+
+    // the frame size is taken from the source that completes the mix
+    EXPECT_FALSE(mixer.mixAudio(makeFrame(100, FRAME_SAMPLES/2), makeOutput(), 1));
+    std::unique_ptr<Data> mixed = mixer.mixAudio(makeFrame(200), makeOutput(), 2);
+    ASSERT_TRUE(mixed);
+
+    EXPECT_EQ(pcm(mixed)[0], 300);
+    EXPECT_EQ(pcm(mixed)[FRAME_SAMPLES/2 - 1], 300);
+    EXPECT_EQ(pcm(mixed)[FRAME_SAMPLES/2], 200);
+    EXPECT_EQ(pcm(mixed)[FRAME_SAMPLES - 1], 200);
+}
+
+
+TEST(AudioMixerTest, selectedSpeakersAreSummed) {
+    // the third speaker is the one listening to this mix, so it never sends
+    // here, and the fourth is too quiet to be selected
+    auto selector = std::make_shared<SpeakerSelector>(3);
+    for (uint32_t ssrc = 1; ssrc <= 4; ++ssrc)
+    {
+        selector->updateLevel(ssrc, ssrc == 4 ? 100 : 10, 1000);
+    }
+    selector->updateLevel(1, 10, 1020);
+
+    ASSERT_TRUE(selector->isSelected(1));
+    ASSERT_TRUE(selector->isSelected(2));
+    ASSERT_TRUE(selector->isSelected(3));
+    ASSERT_FALSE(selector->isSelected(4));
+
+    AudioMixer mixer(std::make_shared<BufferPool>());
+    mixer.setSpeakerSelector(selector);
+    mixer.addInput();
+    mixer.addInput();
+    mixer.addInput();
+
+    auto speak = [&mixer](int16_t value, uint32_t ssrc)
+    {
+        std::unique_ptr<Data> frame = makeFrame(value);
+        frame->ssrc = ssrc;
+        return mixer.mixAudio(std::move(frame), makeOutput(), ssrc);
+    };
+
+    // the mixer cannot wait for a source before it has heard from it
+    ASSERT_TRUE(speak(100, 1));
+
+    for (int i = 0; i < 3; ++i)
+    {
+        EXPECT_FALSE(speak(200, 2));
+        EXPECT_FALSE(speak(900, 4));
+
+        std::unique_ptr<Data> mixed = speak(100, 1);
+        ASSERT_TRUE(mixed);
+        EXPECT_EQ(pcm(mixed)[0], 300);
+        EXPECT_EQ(pcm(mixed)[FRAME_SAMPLES - 1], 300);
+    }
+}
@@ -0,0 +1,116 @@
+#include "../src/media/processing/bufferpool.h"
+
+#include "../src/global.h"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+
+
+TEST(BufferPoolTest, recyclesBuffers) {
+    std::shared_ptr<BufferPool> pool = std::make_shared<BufferPool>();
+
+    DataBuffer first = pool->allocate(100);
+    const uchar* payload = first.get();
+    ASSERT_NE(payload, nullptr);
+    EXPECT_EQ(pool->getMisses(), 1u);
+
+    first.reset();
+    EXPECT_EQ(pool->getIdleBytes(), DEFAULT_MTU_BYTES);
+
+    DataBuffer second = pool->allocate(200);
+    EXPECT_EQ(second.get(), payload);
+    EXPECT_EQ(pool->getHits(), 1u);
+    EXPECT_EQ(pool->getIdleBytes(), 0u);
+}
+
+
+TEST(BufferPoolTest, sizeClasses) {
+    std::shared_ptr<BufferPool> pool = std::make_shared<BufferPool>();
+
+    // all packets share the MTU class
+    pool->allocate(1).reset();
+    pool->allocate(DEFAULT_MTU_BYTES).reset();
+    EXPECT_EQ(pool->getHits(), 1u);
+
+    // frames are rounded up to whole pages
+    pool->allocate(5000).reset();
+    EXPECT_EQ(pool->getIdleBytes(), DEFAULT_MTU_BYTES + 8192u);
+
+    pool->allocate(8192).reset();
+    EXPECT_EQ(pool->getHits(), 2u);
+
+    pool->allocate(8193).reset();
+    EXPECT_EQ(pool->getHits(), 2u);
+    EXPECT_EQ(pool->getMisses(), 3u);
+}
+
+
+TEST(BufferPoolTest, idleLimit) {
+    std::shared_ptr<BufferPool> pool = std::make_shared<BufferPool>(16384);
+
+    DataBuffer packet = pool->allocate(100);
+    DataBuffer first = pool->allocate(8192);
+    DataBuffer second = pool->allocate(8192);
+
+    packet.reset();
+    first.reset();
+    EXPECT_EQ(pool->getIdleBytes(), DEFAULT_MTU_BYTES + 8192u);
+
+    // the idle packet of another class makes room for the frame
+    second.reset();
+    EXPECT_EQ(pool->getIdleBytes(), 16384u);
+
+    // a new frame size replaces the idle frames of the previous one
+    DataBuffer larger = pool->allocate(16384);
+    larger.reset();
+    EXPECT_EQ(pool->getIdleBytes(), 16384u);
+
+    uint64_t hits = pool->getHits();
+    pool->allocate(16384).reset();
+    EXPECT_EQ(pool->getHits(), hits + 1);
+
+    // nothing fits next to a class that fills the pool
+    DataBuffer secondPacket = pool->allocate(100);
+    DataBuffer kept = pool->allocate(16384);
+    secondPacket.reset();
+    EXPECT_EQ(pool->getIdleBytes(), DEFAULT_MTU_BYTES);
+    kept.reset();
+    EXPECT_EQ(pool->getIdleBytes(), 16384u);
+
+    pool->clear();
+    EXPECT_EQ(pool->getIdleBytes(), 0u);
+}
+
+
+TEST(BufferPoolTest, writableCopyIsPooled) {
+    std::shared_ptr<BufferPool> pool = std::make_shared<BufferPool>();
+
+    DataBuffer original = pool->allocate(100);
+    memset(original.writable(100), 7, 100);
+
+    DataBuffer copy = original;
+    uchar* written = copy.writable(100);
+    EXPECT_NE(written, original.get());
+    EXPECT_EQ(written[99], 7);
+    EXPECT_EQ(pool->getMisses(), 2u);
+
+    // both return to the pool
+    original.reset();
+    copy.reset();
+    EXPECT_EQ(pool->getIdleBytes(), 2u*DEFAULT_MTU_BYTES);
+}
+
+
+TEST(BufferPoolTest, buffersOutliveThePool) {
+    std::shared_ptr<BufferPool> pool = std::make_shared<BufferPool>();
+    std::weak_ptr<BufferPool> weakPool = pool;
+
+    DataBuffer buffer = pool->allocate(100);
+    pool.reset();
+
+    // the buffer keeps the pool alive until it is returned
+    EXPECT_FALSE(weakPool.expired());
+    buffer.reset();
+    EXPECT_TRUE(weakPool.expired());
+}
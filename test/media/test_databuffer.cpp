@@ -0,0 +1,143 @@
+#include "../src/media/processing/databuffer.h"
+
+#include <gtest/gtest.h>
+
+#include <cstring>
+#include <thread>
+#include <vector>
+
+
+static DataBuffer makeBuffer(uint32_t size, uchar value)
+{
+    std::unique_ptr<uchar[]> data(new uchar[size]);
+    memset(data.get(), value, size);
+    return DataBuffer(std::move(data));
+}
+
+
+TEST(DataBufferTest, copiesShareThePayload) {
+    DataBuffer original = makeBuffer(16, 1);
+    EXPECT_FALSE(original.isShared());
+
+    DataBuffer copy = original;
+    EXPECT_EQ(copy.get(), original.get());
+    EXPECT_TRUE(original.isShared());
+    EXPECT_TRUE(copy.isShared());
+
+    copy.reset();
+    EXPECT_TRUE(copy == nullptr);
+    EXPECT_FALSE(original.isShared());
+}
+
+
+TEST(DataBufferTest, moveDoesNotReference) {
+    DataBuffer original = makeBuffer(16, 1);
+    const uchar* payload = original.get();
+
+    DataBuffer moved = std::move(original);
+    EXPECT_TRUE(original == nullptr);
+    EXPECT_EQ(moved.get(), payload);
+    EXPECT_FALSE(moved.isShared());
+}
+
+
+TEST(DataBufferTest, writableCopiesOnlyShared) {
+    DataBuffer original = makeBuffer(16, 1);
+    const uchar* payload = original.get();
+    uint64_t copies = DataBuffer::getCopies();
+
+    // nobody else sees the payload, so it is modified in place
+    EXPECT_EQ(original.writable(16), payload);
+    EXPECT_EQ(DataBuffer::getCopies(), copies);
+
+    DataBuffer copy = original;
+    uchar* written = copy.writable(16);
+    ASSERT_NE(written, nullptr);
+    EXPECT_NE(written, payload);
+    EXPECT_EQ(DataBuffer::getCopies(), copies + 1);
+
+    // the copy has the same content, but writing it does not change the original
+    EXPECT_EQ(memcmp(written, payload, 16), 0);
+    written[0] = 2;
+    EXPECT_EQ(original.get()[0], 1);
+
+    EXPECT_FALSE(original.isShared());
+    EXPECT_FALSE(copy.isShared());
+}
+
+
+TEST(DataBufferTest, giveBackOnLastReference) {
+    uchar memory[16] = {};
+    int givenBack = 0;
+
+    DataBuffer external(memory, [&givenBack]() { ++givenBack; });
+    DataBuffer copy = external;
+
+    external.reset();
+    EXPECT_EQ(givenBack, 0);
+
+    copy.reset();
+    EXPECT_EQ(givenBack, 1);
+}
+
+
+TEST(DataBufferTest, release) {
+    DataBuffer unique = makeBuffer(16, 1);
+    const uchar* payload = unique.get();
+
+    // an unshared payload is handed over as it is
+    std::unique_ptr<uchar[]> released = unique.release(16);
+    EXPECT_EQ(released.get(), payload);
+    EXPECT_TRUE(unique == nullptr);
+
+    DataBuffer shared = makeBuffer(16, 3);
+    DataBuffer other = shared;
+    released = shared.release(16);
+    EXPECT_NE(released.get(), other.get());
+    EXPECT_EQ(released[0], 3);
+    EXPECT_FALSE(other.isShared());
+
+    // memory of someone else is always copied and given back
+    uchar memory[16] = {};
+    memory[0] = 4;
+    int givenBack = 0;
+    DataBuffer external(memory, [&givenBack]() { ++givenBack; });
+
+    released = external.release(16);
+    EXPECT_NE(released.get(), memory);
+    EXPECT_EQ(released[0], 4);
+    EXPECT_EQ(givenBack, 1);
+}
+
+
+TEST(DataBufferTest, referencesFromManyThreads) {
+    uchar memory[16] = {};
+    std::atomic<int> givenBack(0);
+
+    DataBuffer original(memory, [&givenBack]() { ++givenBack; });
+
+    // every output of a filter holds its own reference in its own thread
+    std::vector<std::thread> threads;
+    for (int i = 0; i < 4; ++i)
+    {
+        threads.emplace_back([original]()
+        {
+            for (int j = 0; j < 10000; ++j)
+            {
+                DataBuffer copy = original;
+                EXPECT_EQ(copy.get(), original.get());
+            }
+        });
+    }
+
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+
+    EXPECT_EQ(givenBack.load(), 0);
+    EXPECT_FALSE(original.isShared());
+
+    original.reset();
+    EXPECT_EQ(givenBack.load(), 1);
+}
@@ -0,0 +1,259 @@
+#include "../src/media/processing/filter.h"
+#include "../src/media/resourceallocator.h"
+#include "../src/statisticsinterface.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+
+// the filters report their buffers, but the tests do not look at it
+class NullStatistics : public StatisticsInterface
+{
+public:
+    void addSession(uint32_t) {}
+    void removeSession(uint32_t) {}
+    void addParticipant(uint32_t, const QString&) {}
+    void removeParticipant(uint32_t, const QString&) {}
+    void audioInfo(uint32_t, uint32_t, uint32_t, uint16_t) {}
+    void videoInfo(uint32_t, uint32_t, double, QSize) {}
+    void selectedICEPair(uint32_t, std::shared_ptr<ICEPair>) {}
+    void encodedAudioFrame(uint32_t, uint32_t) {}
+    void encodedVideoFrame(uint32_t, uint32_t, uint32_t, QSize, float, float, float,
+                           int64_t, int64_t) {}
+    void decodedAudioFrame(QString, int64_t, uint32_t, uint32_t) {}
+    void decodedVideoFrame(QString, int64_t, uint32_t, uint32_t, QSize, int64_t) {}
+    void audioLatency(uint32_t, QString, int64_t, int64_t) {}
+    void videoLatency(uint32_t, QString, int64_t, int64_t) {}
+    void addSendPacket(uint32_t) {}
+    void addReceivePacket(uint32_t, const QString&, QString, uint32_t) {}
+    void addRelayReceive(uint32_t, uint32_t) {}
+    void addRTCPPacket(uint32_t, const QString&, QString, uint8_t, int32_t, uint32_t,
+                       uint32_t) {}
+    uint32_t addFilter(QString, QString, uint64_t) { return 0; }
+    void removeFilter(uint32_t) {}
+    void updateBufferStatus(uint32_t, uint16_t, uint16_t) {}
+    void packetDropped(uint32_t) {}
+    void bufferPoolStatus(uint64_t, uint64_t, uint64_t, uint64_t) {}
+    void addSentSIPMessage(const QString&, const QString&, const QString&, const QString&) {}
+    void addReceivedSIPMessage(const QString&, const QString&, const QString&,
+                               const QString&) {}
+};
+
+
+// The filter is never started, so the test reads its input in place of the
+// filter thread.
+class InputFilter : public Filter
+{
+public:
+    InputFilter(StatisticsInterface* stats, int bufferSize, bool lockFree):
+        Filter("", "Input test", stats, std::make_shared<ResourceAllocator>(),
+               DT_RAWAUDIO, DT_RAWAUDIO)
+    {
+        maxBufferSize_ = bufferSize;
+        lockFreeInput_ = lockFree;
+    }
+
+    void send(uint32_t number)
+    {
+        std::unique_ptr<Data> sample = initializeData(DT_RAWAUDIO, DS_LOCAL);
+        sample->aInfo = std::make_unique<AudioInfo>();
+        sample->data = allocateBuffer(4);
+        sample->data_size = 4;
+        sample->rtpTimestamp = number;
+
+        sendOutput(std::move(sample));
+    }
+
+    // returns the number of the oldest sample or -1 if there is none
+    int64_t take()
+    {
+        std::unique_ptr<Data> sample = getInput();
+        return sample ? sample->rtpTimestamp : -1;
+    }
+
+    unsigned int discarded() const
+    {
+        return inputDiscarded_;
+    }
+
+protected:
+    void process() {}
+};
+
+
+TEST(FilterInputTest, singleProducerOrder) {
+    NullStatistics stats;
+    auto producer = std::make_shared<InputFilter>(&stats, 10, true);
+    auto consumer = std::make_shared<InputFilter>(&stats, 64, true);
+    producer->addOutConnection(consumer);
+
+    for (uint32_t i = 0; i < 50; ++i)
+    {
+        producer->send(i);
+    }
+
+    for (int64_t i = 0; i < 50; ++i)
+    {
+        EXPECT_EQ(consumer->take(), i);
+    }
+    EXPECT_EQ(consumer->take(), -1);
+    EXPECT_EQ(consumer->discarded(), 0u);
+}
+
+
+TEST(FilterInputTest, ringDropsLikeBuffer) {
+    NullStatistics stats;
+    auto producer = std::make_shared<InputFilter>(&stats, 10, true);
+    auto ring = std::make_shared<InputFilter>(&stats, 10, true);
+    auto locked = std::make_shared<InputFilter>(&stats, 10, false);
+    producer->addOutConnection(ring);
+    producer->addOutConnection(locked);
+
+    for (uint32_t i = 0; i < 15; ++i)
+    {
+        producer->send(i);
+    }
+
+    // the oldest samples are discarded whether it happens on put or on take
+    for (int64_t i = 6; i < 15; ++i)
+    {
+        EXPECT_EQ(ring->take(), i);
+        EXPECT_EQ(locked->take(), i);
+    }
+    EXPECT_EQ(ring->take(), -1);
+    EXPECT_EQ(locked->take(), -1);
+
+    EXPECT_EQ(ring->discarded(), 6u);
+    EXPECT_EQ(locked->discarded(), 6u);
+}
+
+
+TEST(FilterInputTest, stalledConsumerIsBounded) {
+    NullStatistics stats;
+    auto producer = std::make_shared<InputFilter>(&stats, 10, true);
+    auto consumer = std::make_shared<InputFilter>(&stats, 10, true);
+    producer->addOutConnection(consumer);
+
+    // the ring keeps at most the buffer size rounded up to a power of two
+    for (uint32_t i = 0; i < 100; ++i)
+    {
+        producer->send(i);
+    }
+    EXPECT_EQ(consumer->discarded(), 84u);
+
+    // and the oldest of those are discarded down to the buffer size when read
+    for (int64_t i = 7; i < 16; ++i)
+    {
+        EXPECT_EQ(consumer->take(), i);
+    }
+    EXPECT_EQ(consumer->take(), -1);
+    EXPECT_EQ(consumer->discarded(), 91u);
+}
+
+
+TEST(FilterInputTest, secondProducerKeepsOrder) {
+    NullStatistics stats;
+    auto first = std::make_shared<InputFilter>(&stats, 10, true);
+    auto second = std::make_shared<InputFilter>(&stats, 10, true);
+    auto consumer = std::make_shared<InputFilter>(&stats, 64, true);
+
+    first->addOutConnection(consumer);
+    for (uint32_t i = 0; i < 5; ++i)
+    {
+        first->send(i);
+    }
+
+    // the rest goes through the locked buffer, behind what is in the ring
+    second->addOutConnection(consumer);
+    for (uint32_t i = 5; i < 8; ++i)
+    {
+        first->send(i);
+    }
+    second->send(8);
+    second->send(9);
+
+    EXPECT_EQ(consumer->take(), 0);
+
+    // the ring is not used again after the other producer leaves
+    second->removeOutConnection(consumer);
+    first->send(10);
+
+    for (int64_t i = 1; i <= 10; ++i)
+    {
+        EXPECT_EQ(consumer->take(), i);
+    }
+    EXPECT_EQ(consumer->take(), -1);
+}
+
+
+TEST(FilterInputTest, emptyBuffer) {
+    NullStatistics stats;
+    auto producer = std::make_shared<InputFilter>(&stats, 10, true);
+    auto consumer = std::make_shared<InputFilter>(&stats, 64, true);
+    producer->addOutConnection(consumer);
+
+    for (uint32_t i = 0; i < 5; ++i)
+    {
+        producer->send(i);
+    }
+
+    consumer->emptyBuffer();
+    producer->send(5);
+    producer->send(6);
+
+    EXPECT_EQ(consumer->take(), 5);
+    EXPECT_EQ(consumer->take(), 6);
+    EXPECT_EQ(consumer->take(), -1);
+}
+
+
+TEST(FilterInputTest, concurrentProducer) {
+    const uint32_t SAMPLES = 100000;
+
+    NullStatistics stats;
+    auto producer = std::make_shared<InputFilter>(&stats, 10, true);
+    auto consumer = std::make_shared<InputFilter>(&stats, 1024, true);
+    producer->addOutConnection(consumer);
+
+    std::atomic<bool> sent(false);
+    std::thread sender([&]()
+    {
+        for (uint32_t i = 0; i < SAMPLES; ++i)
+        {
+            producer->send(i);
+        }
+        sent = true;
+    });
+
+    // samples may be discarded if we fall behind, but never reordered
+    int64_t previous = -1;
+    uint32_t received = 0;
+    bool ordered = true;
+    while (true)
+    {
+        bool finished = sent;
+        int64_t number = consumer->take();
+
+        if (number == -1)
+        {
+            if (finished)
+            {
+                break;
+            }
+            std::this_thread::yield();
+            continue;
+        }
+
+        ordered = ordered && number > previous;
+        previous = number;
+        ++received;
+    }
+
+    sender.join();
+
+    EXPECT_TRUE(ordered);
+    EXPECT_EQ(received + consumer->discarded(), SAMPLES);
+}
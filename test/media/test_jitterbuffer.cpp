@@ -0,0 +1,227 @@
+#include "../src/media/processing/jitterbuffer.h"
+
+#include <gtest/gtest.h>
+
+
+// 20 ms Opus frames
+static const uint32_t CLOCK_RATE = 48000;
+static const uint32_t FRAME_TICKS = 960;
+static const int64_t FRAME_MS = 20;
+
+
+static std::unique_ptr<Data> makePacket(uint16_t sequence, uint32_t timestamp)
+{
+    std::unique_ptr<Data> packet(new Data);
+    packet->type = DT_OPUSAUDIO;
+    packet->source = DS_REMOTE;
+    packet->rtpSequence = sequence;
+    packet->rtpTimestamp = timestamp;
+
+    std::unique_ptr<uchar[]> payload(new uchar[4]());
+    packet->data = DataBuffer(std::move(payload));
+    packet->data_size = 4;
+    return packet;
+}
+
+
+// inserts the packets of a stream as if they were sent every frame and
+// arrived without delay
+static void insertFrames(JitterBuffer& buffer, uint32_t firstTimestamp,
+                         std::vector<uint16_t> sequences)
+{
+    for (uint16_t sequence : sequences)
+    {
+        uint32_t timestamp = firstTimestamp + sequence*FRAME_TICKS;
+        EXPECT_TRUE(buffer.insert(makePacket(sequence, timestamp), FRAME_TICKS,
+                                  sequence*FRAME_MS));
+    }
+}
+
+
+TEST(JitterBufferTest, startsAfterTargetDelay) {
+    JitterBuffer buffer(CLOCK_RATE, FRAME_TICKS);
+    EXPECT_EQ(buffer.targetDelayMs(), FRAME_MS);
+
+    EXPECT_TRUE(buffer.insert(makePacket(0, 0), FRAME_TICKS, 1000));
+    EXPECT_EQ(buffer.bufferedMs(), FRAME_MS);
+
+    EXPECT_EQ(buffer.pop(1000 + FRAME_MS - 1).type, JitterBuffer::PLAYOUT_NONE);
+    EXPECT_FALSE(buffer.isActive());
+
+    JitterBuffer::Playout playout = buffer.pop(1000 + FRAME_MS);
+    EXPECT_EQ(playout.type, JitterBuffer::PLAYOUT_NORMAL);
+    EXPECT_EQ(playout.durationTicks, FRAME_TICKS);
+    ASSERT_TRUE(playout.packet);
+    EXPECT_EQ(playout.packet->rtpSequence, 0);
+    EXPECT_TRUE(buffer.isActive());
+}
+
+
+TEST(JitterBufferTest, reordering) {
+    JitterBuffer buffer(CLOCK_RATE, FRAME_TICKS);
+
+    // starts just before the timestamp wraps around
+    uint32_t first = 0xFFFFFFFF - FRAME_TICKS;
+    insertFrames(buffer, first, {0, 3, 1, 4, 2});
+
+    for (uint16_t sequence = 0; sequence < 5; ++sequence)
+    {
+        JitterBuffer::Playout playout = buffer.pop(1000);
+        ASSERT_EQ(playout.type, JitterBuffer::PLAYOUT_NORMAL);
+        EXPECT_EQ(playout.packet->rtpSequence, sequence);
+        EXPECT_EQ(playout.packet->rtpTimestamp, (uint32_t)(first + sequence*FRAME_TICKS));
+    }
+
+    EXPECT_EQ(buffer.getLost(), 0u);
+    EXPECT_EQ(buffer.getRecovered(), 0u);
+}
+
+
+TEST(JitterBufferTest, duplicateAndLate) {
+    JitterBuffer buffer(CLOCK_RATE, FRAME_TICKS);
+    insertFrames(buffer, 0, {0, 1, 2});
+
+    EXPECT_FALSE(buffer.insert(makePacket(1, FRAME_TICKS), FRAME_TICKS, 40));
+
+    EXPECT_EQ(buffer.pop(1000).packet->rtpSequence, 0);
+    EXPECT_EQ(buffer.pop(1000).packet->rtpSequence, 1);
+
+    // already played
+    EXPECT_FALSE(buffer.insert(makePacket(0, 0), FRAME_TICKS, 60));
+    EXPECT_EQ(buffer.getLate(), 1u);
+
+    EXPECT_EQ(buffer.pop(1000).packet->rtpSequence, 2);
+}
+
+
+TEST(JitterBufferTest, forwardErrorCorrection) {
+    JitterBuffer buffer(CLOCK_RATE, FRAME_TICKS);
+    insertFrames(buffer, 0, {0, 2});
+
+    EXPECT_EQ(buffer.pop(1000).type, JitterBuffer::PLAYOUT_NORMAL);
+
+    // the lost packet is decoded from the FEC of the one after it
+    JitterBuffer::Playout fec = buffer.pop(1000);
+    ASSERT_EQ(fec.type, JitterBuffer::PLAYOUT_FEC);
+    ASSERT_TRUE(fec.packet);
+    EXPECT_EQ(fec.packet->rtpSequence, 1);
+    EXPECT_EQ(fec.packet->rtpTimestamp, FRAME_TICKS);
+    EXPECT_EQ(fec.durationTicks, FRAME_TICKS);
+
+    JitterBuffer::Playout next = buffer.pop(1000);
+    ASSERT_EQ(next.type, JitterBuffer::PLAYOUT_NORMAL);
+    EXPECT_EQ(next.packet->rtpSequence, 2);
+
+    // the FEC refers to the payload of the following packet instead of copying it
+    EXPECT_EQ(fec.packet->data.get(), next.packet->data.get());
+
+    EXPECT_EQ(buffer.getLost(), 1u);
+    EXPECT_EQ(buffer.getRecovered(), 1u);
+}
+
+
+TEST(JitterBufferTest, concealment) {
+    JitterBuffer buffer(CLOCK_RATE, FRAME_TICKS);
+    insertFrames(buffer, 0, {0, 3});
+
+    EXPECT_EQ(buffer.pop(1000).type, JitterBuffer::PLAYOUT_NORMAL);
+
+    // only the latter of two lost packets has its FEC available
+    JitterBuffer::Playout conceal = buffer.pop(1000);
+    EXPECT_EQ(conceal.type, JitterBuffer::PLAYOUT_CONCEAL);
+    EXPECT_FALSE(conceal.packet);
+    EXPECT_EQ(conceal.durationTicks, FRAME_TICKS);
+
+    JitterBuffer::Playout fec = buffer.pop(1000);
+    ASSERT_EQ(fec.type, JitterBuffer::PLAYOUT_FEC);
+    EXPECT_EQ(fec.packet->rtpSequence, 2);
+
+    EXPECT_EQ(buffer.pop(1000).type, JitterBuffer::PLAYOUT_NORMAL);
+
+    EXPECT_EQ(buffer.getLost(), 2u);
+    EXPECT_EQ(buffer.getRecovered(), 1u);
+}
+
+
+TEST(JitterBufferTest, fecNeedsConsecutiveSequence) {
+    JitterBuffer buffer(CLOCK_RATE, FRAME_TICKS);
+
+    // the sender skipped a sequence number, so the packet after the gap does
+    // not carry the FEC of the missing frame
+    EXPECT_TRUE(buffer.insert(makePacket(0, 0), FRAME_TICKS, 0));
+    EXPECT_TRUE(buffer.insert(makePacket(5, 2*FRAME_TICKS), FRAME_TICKS, 2*FRAME_MS));
+
+    EXPECT_EQ(buffer.pop(1000).type, JitterBuffer::PLAYOUT_NORMAL);
+    EXPECT_EQ(buffer.pop(1000).type, JitterBuffer::PLAYOUT_CONCEAL);
+    EXPECT_EQ(buffer.pop(1000).type, JitterBuffer::PLAYOUT_NORMAL);
+    EXPECT_EQ(buffer.getRecovered(), 0u);
+}
+
+
+TEST(JitterBufferTest, pauseEndsPlayout) {
+    JitterBuffer buffer(CLOCK_RATE, FRAME_TICKS);
+    insertFrames(buffer, 0, {0});
+
+    EXPECT_EQ(buffer.pop(1000).type, JitterBuffer::PLAYOUT_NORMAL);
+
+    // an empty buffer is concealed for a while, but it is not loss
+    for (int i = 0; i < 10; ++i)
+    {
+        EXPECT_EQ(buffer.pop(1000).type, JitterBuffer::PLAYOUT_CONCEAL);
+    }
+    EXPECT_EQ(buffer.pop(1000).type, JitterBuffer::PLAYOUT_NONE);
+    EXPECT_FALSE(buffer.isActive());
+    EXPECT_EQ(buffer.getLost(), 0u);
+
+    // the next talk spurt waits for the target delay again
+    EXPECT_TRUE(buffer.insert(makePacket(100, 100*FRAME_TICKS), FRAME_TICKS, 5000));
+    EXPECT_EQ(buffer.pop(5000).type, JitterBuffer::PLAYOUT_NONE);
+
+    JitterBuffer::Playout playout = buffer.pop(5000 + buffer.targetDelayMs());
+    ASSERT_EQ(playout.type, JitterBuffer::PLAYOUT_NORMAL);
+    EXPECT_EQ(playout.packet->rtpSequence, 100);
+}
+
+
+TEST(JitterBufferTest, targetDelayFollowsJitter) {
+    JitterBuffer buffer(CLOCK_RATE, FRAME_TICKS);
+
+    uint16_t sequence = 0;
+    for (; sequence < 100; ++sequence)
+    {
+        buffer.insert(makePacket(sequence, sequence*FRAME_TICKS), FRAME_TICKS,
+                      sequence*FRAME_MS);
+        buffer.pop(sequence*FRAME_MS + 1000);
+    }
+    EXPECT_EQ(buffer.targetDelayMs(), FRAME_MS);
+
+    // every other packet is 60 ms late
+    for (; sequence < 200; ++sequence)
+    {
+        buffer.insert(makePacket(sequence, sequence*FRAME_TICKS), FRAME_TICKS,
+                      sequence*FRAME_MS + (sequence % 2)*60);
+        buffer.pop(sequence*FRAME_MS + 1000);
+    }
+    EXPECT_EQ(buffer.targetDelayMs(), 60 + FRAME_MS);
+
+    // the delay shrinks slowly once the network is good again
+    int previous = buffer.targetDelayMs();
+    for (; sequence < 400; ++sequence)
+    {
+        buffer.insert(makePacket(sequence, sequence*FRAME_TICKS), FRAME_TICKS,
+                      sequence*FRAME_MS);
+        buffer.pop(sequence*FRAME_MS + 1000);
+
+        EXPECT_LE(buffer.targetDelayMs(), previous);
+        previous = buffer.targetDelayMs();
+    }
+    EXPECT_EQ(buffer.targetDelayMs(), FRAME_MS);
+
+    // and never grows beyond the limit
+    for (; sequence < 500; ++sequence)
+    {
+        buffer.insert(makePacket(sequence, sequence*FRAME_TICKS), FRAME_TICKS,
+                      sequence*FRAME_MS + (sequence % 2)*1000);
+    }
+    EXPECT_EQ(buffer.targetDelayMs(), 300);
+}